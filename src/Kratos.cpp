@@ -34,6 +34,8 @@
 #include <xsi_model.h>
 #include <xsi_math.h>
 
+#include "Kratos.h"
+
 using namespace XSI;
 using namespace XSI::MATH;
 
@@ -53,7 +55,9 @@ XSIPLUGINCALLBACK CStatus XSILoadPlugin( PluginRegistrar& in_reg )
    in_reg.RegisterCommand(L"apply_snThickness",L"apply_snThickness");
    in_reg.RegisterCommand(L"apply_snVoronoi",L"apply_snVoronoi");
    in_reg.RegisterCommand(L"update_snVoronoi",L"update_snVoronoi");
+   in_reg.RegisterCommand(L"get_snVoronoiNeighbors",L"get_snVoronoiNeighbors");
    in_reg.RegisterCommand(L"split_polygon_islands",L"split_polygon_islands");
+   in_reg.RegisterTimerEvent(L"snVoronoiTimer",100,0);
 
    return CStatus::OK;
 }
@@ -107,70 +111,27 @@ XSIPLUGINCALLBACK CStatus split_polygon_islands_Execute( CRef& in_ctxt )
    // great, let's get the geo
    X3DObject parent(Primitive(l_pMesh).GetParent());
    PolygonMesh mesh(Primitive(l_pMesh).GetGeometry());
-   CVector3Array meshPos = mesh.GetPoints().GetPositionArray();
-   CPolygonFaceRefArray meshPolies = mesh.GetPolygons();
-   CLongArray meshPolyDone(meshPolies.GetCount());
-   for(LONG i=0;i<meshPolyDone.GetCount();i++)
-      meshPolyDone[i] = -1;
-
-   // cool, so let's do this!
-   LONG meshPolyOffset = 0;
-   while(meshPolyOffset < meshPolies.GetCount())
+   CVector3Array meshPos;
+   CLongArray meshPolies;
+   mesh.Get(meshPos,meshPolies);
+
+   // find all islands at once, straight from the poly description
+   PolygonIslands islands;
+   if(meshPolies.GetCount() > 0)
+      islands.SetFromPolies((size_t)meshPos.GetCount(),&meshPolies[0],(size_t)meshPolies.GetCount());
+
+   // cool, so let's create a mesh for every island!
+   LONG pieceCount = 0;
+   for(size_t island=0;island<islands.GetIslandCount();island++)
    {
-      // try to find the first unused polygon
-      while(meshPolyDone[meshPolyOffset]==1 && meshPolyOffset < meshPolies.GetCount())
-         meshPolyOffset++;
-
-      // create a mapping for the points
-      CLongArray pntIndex(meshPos.GetCount());
-      for(LONG i=0;i<pntIndex.GetCount();i++)
-         pntIndex[i] = -1;
-
-      // great now let's add it!
-      CLongArray currentPolies;
-      if(meshPolyOffset < meshPolies.GetCount())
-         currentPolies.Add(meshPolyOffset);
-
-      // ok, let's prepare output data
-      CVector3Array newPos;
-      CLongArray newPoly;
-
-      LONG pieceCount = 0;
-      for(LONG i=0;i<currentPolies.GetCount();i++)
-      {
-         // first, add this one
-         PolygonFace poly(meshPolies[currentPolies[i]]);
-         CLongArray indices = poly.GetPoints().GetIndexArray();
-         newPoly.Add(indices.GetCount());
-
-         // loop over all points of this!
-         for(LONG j=0;j<indices.GetCount();j++)
-         {
-            // check if we added the point!
-            if(pntIndex[indices[j]]==-1)
-            {
-               pntIndex[indices[j]] = newPos.GetCount();
-               newPos.Add(meshPos[indices[j]]);
-            }
-            // add the point!
-            newPoly.Add(pntIndex[indices[j]]);
-         }
-
-         // remember this as finished!
-         meshPolyDone[currentPolies[i]] = 1;
-
-         // now get the neighbors!
-         CLongArray neighbors = poly.GetNeighborPolygons().GetIndexArray();
-         for(LONG j=0;j<neighbors.GetCount();j++)
-         {
-            if(meshPolyDone[neighbors[j]]==-1)
-            {
-               currentPolies.Add(neighbors[j]);
-               // remember as processed, but not finished
-               meshPolyDone[neighbors[j]] = 0;
-            }
-         }
-      }
+      size_t pointOffset = islands.pointOffsets[island];
+      size_t polyOffset = islands.polyOffsets[island];
+      CVector3Array newPos((LONG)(islands.pointOffsets[island+1] - pointOffset));
+      CLongArray newPoly((LONG)(islands.polyOffsets[island+1] - polyOffset));
+      for(LONG i=0;i<newPos.GetCount();i++)
+         newPos[i] = meshPos[islands.points[pointOffset+i]];
+      for(LONG i=0;i<newPoly.GetCount();i++)
+         newPoly[i] = islands.polies[polyOffset+i];
 
       if(newPos.GetCount() > 0)
       {
@@ -180,7 +141,6 @@ XSIPLUGINCALLBACK CStatus split_polygon_islands_Execute( CRef& in_ctxt )
       }
    }
 
-
    return CStatus::OK;
 }
 
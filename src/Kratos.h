@@ -22,98 +22,1473 @@
 
 #include <vector>
 #include <map>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include <Essence/snPolygon.h>
 
-struct VoronoiInfo
+// the voronoi data lives in binary user data blobs. the first version of the
+// blob was a flat array of floats: the number of point and poly lists, the
+// size of every list, then all points and then all polies. the second version
+// starts with a header and a table with one entry per cell. every cell holds
+// its points as packed floats, followed by its polies as 16 bit integers if
+// they fit, or 32 bit integers otherwise. each cell starts on a 16 byte
+// boundary, so it can be copied or mapped as it is. the data is stored in the
+// byte order of the machine, which is little endian on every platform
+// softimage runs on. a version 2 blob can end with the adjacency graph of its
+// cells, the header then holds where that section starts. version 3 adds the
+// mass properties of every cell in a second table right after the cell table.
+// version 4 adds flags to the end of the header, which tell how the cells
+// were computed.
+#define SN_VORONOI_MAGIC   0x49564E53   // "SNVI", never a valid float count of a version 1 blob
+#define SN_VORONOI_VERSION 4
+#define SN_VORONOI_ALIGN   16
+
+// the flags of a version 4 blob
+#define SN_VORONOI_FLAG_SINGLE 0x1      // the cells are a single precision preview
+
+// the header of a version 2 blob, it is followed by the cell table. the
+// flags are only there from version 4 on, older headers end before them.
+struct VoronoiHeader
+{
+   unsigned int magic;
+   unsigned int version;
+   unsigned int cellCount;
+   unsigned int adjacency;    // where the adjacency section starts, or 0 if there is none
+   unsigned int flags;        // SN_VORONOI_FLAG_* bits
+};
+#define SN_VORONOI_HEADER_V2 (4 * sizeof(unsigned int))   // the size of the header before version 4
+
+// the entry of a cell in the cell table of a version 2 blob
+struct VoronoiCellEntry
+{
+   unsigned int pointCount;   // the number of points
+   unsigned int polyCount;    // the length of the poly description
+   unsigned int indexSize;    // the bytes per poly value, 2 or 4
+   unsigned int offset;       // where the points start, from the start of the blob
+};
+
+// the mass properties of a cell in the mass table of a version 3 blob, for a
+// density of one. the inertia tensor is taken around the centroid.
+struct VoronoiMassEntry
+{
+   float volume;
+   float centroid[3];
+   float inertia[6];          // xx, yy, zz, xy, xz, yz
+};
+
+// the header of the adjacency section. it is followed by the neighbor offset
+// of every particle plus the end, the ids of the neighbors, the areas of the
+// faces shared with them, and the particle id of every cell of the blob.
+struct VoronoiAdjacencyHeader
+{
+   unsigned int particleCount;
+   unsigned int neighborCount;
+};
+
+// the adjacency graph of the cells in compressed rows: for every particle the
+// ids of the particles whose cells share a face with its cell, in ascending
+// order, and the area of that face. the rows are indexed by particle id, so
+// walking the particles once is enough to create a constraint for every
+// neighboring pair.
+struct VoronoiAdjacency
+{
+   std::vector<unsigned int> offsets;  // the first neighbor of each particle, plus the end
+   std::vector<int> neighbors;         // the neighbor ids of all particles
+   std::vector<float> areas;           // the area of the face shared with each neighbor
+   std::vector<int> cellIds;           // the particle id of each cell
+
+   size_t GetParticleCount() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+   void Clear()
+   {
+      offsets.clear();
+      neighbors.clear();
+      areas.clear();
+      cellIds.clear();
+   }
+
+   size_t GetBufferSize() const
+   {
+      return (sizeof(VoronoiAdjacencyHeader) + (offsets.size() + neighbors.size() + areas.size() + cellIds.size()) * 4 + SN_VORONOI_ALIGN - 1) & ~(size_t)(SN_VORONOI_ALIGN - 1);
+   }
+
+   // writes the section to a buffer of GetBufferSize() bytes
+   void WriteBuffer(unsigned char * out_pBuffer) const
+   {
+      VoronoiAdjacencyHeader * header = (VoronoiAdjacencyHeader*)out_pBuffer;
+      header->particleCount = (unsigned int)GetParticleCount();
+      header->neighborCount = (unsigned int)neighbors.size();
+      unsigned char * data = out_pBuffer + sizeof(VoronoiAdjacencyHeader);
+      if(!offsets.empty())
+         memcpy(data,&offsets[0],offsets.size() * 4);
+      data += offsets.size() * 4;
+      if(!neighbors.empty())
+      {
+         memcpy(data,&neighbors[0],neighbors.size() * 4);
+         memcpy(data + neighbors.size() * 4,&areas[0],areas.size() * 4);
+      }
+      data += (neighbors.size() + areas.size()) * 4;
+      if(!cellIds.empty())
+         memcpy(data,&cellIds[0],cellIds.size() * 4);
+   }
+
+   // lists every neighboring pair of cells once, as consecutive pairs of cell
+   // indices. neighbors that have no cell are left out.
+   void GetCellPairs(std::vector<int> & out_Pairs) const
+   {
+      out_Pairs.clear();
+      std::vector<int> cellOf(GetParticleCount(),-1);
+      for(size_t i=0;i<cellIds.size();i++)
+      {
+         if(cellIds[i] >= 0 && (size_t)cellIds[i] < cellOf.size())
+            cellOf[cellIds[i]] = (int)i;
+      }
+      for(size_t i=0;i<cellIds.size();i++)
+      {
+         int id = cellIds[i];
+         if(id < 0 || (size_t)id >= cellOf.size())
+            continue;
+         for(unsigned int k=offsets[id];k<offsets[id+1];k++)
+         {
+            int other = neighbors[k];
+            if(other > id && (size_t)other < cellOf.size() && cellOf[other] >= 0)
+            {
+               out_Pairs.push_back((int)i);
+               out_Pairs.push_back(cellOf[other]);
+            }
+         }
+      }
+   }
+
+   // builds the graph from pairs of cells, given as consecutive cell indices,
+   // and the area of the contact of every pair. pairs that do not touch are
+   // left out, so a cell without any contact ends up with an empty row.
+   template<class T> void SetFromPairs(const std::vector<int> & in_CellIds, const std::vector<int> & in_Pairs, const std::vector<T> & in_Areas)
+   {
+      Clear();
+      cellIds = in_CellIds;
+      int maxId = -1;
+      for(size_t i=0;i<cellIds.size();i++)
+         maxId = cellIds[i] > maxId ? cellIds[i] : maxId;
+      offsets.assign((size_t)(maxId + 2),0);
+
+      for(size_t i=0;i<in_Areas.size();i++)
+      {
+         if(in_Areas[i] > 0)
+         {
+            offsets[cellIds[in_Pairs[2*i]]+1]++;
+            offsets[cellIds[in_Pairs[2*i+1]]+1]++;
+         }
+      }
+      for(size_t i=1;i<offsets.size();i++)
+         offsets[i] += offsets[i-1];
+      neighbors.resize(offsets.back());
+      areas.resize(offsets.back());
+
+      std::vector<unsigned int> fill(offsets.begin(),offsets.end()-1);
+      for(size_t i=0;i<in_Areas.size();i++)
+      {
+         if(in_Areas[i] > 0)
+         {
+            int a = cellIds[in_Pairs[2*i]], b = cellIds[in_Pairs[2*i+1]];
+            neighbors[fill[a]] = b;
+            areas[fill[a]++] = (float)in_Areas[i];
+            neighbors[fill[b]] = a;
+            areas[fill[b]++] = (float)in_Areas[i];
+         }
+      }
+
+      // sort the rows by neighbor id
+      std::vector<std::pair<int,float> > row;
+      for(size_t id=0;id+1<offsets.size();id++)
+      {
+         row.clear();
+         for(unsigned int k=offsets[id];k<offsets[id+1];k++)
+            row.push_back(std::pair<int,float>(neighbors[k],areas[k]));
+         std::sort(row.begin(),row.end());
+         for(size_t k=0;k<row.size();k++)
+         {
+            neighbors[offsets[id]+k] = row[k].first;
+            areas[offsets[id]+k] = row[k].second;
+         }
+      }
+   }
+};
+
+// a read-only view over a voronoi blob of any version. setting the buffer
+// only checks the header, every cell and every row of the adjacency graph is
+// checked when it is read, so looking at a single cell costs as much as that
+// cell, and nothing gets copied or allocated. cells that do not fit into the
+// buffer read as empty, IsCellValid() tells them apart.
+struct VoronoiInfoView
 {
-   snEssence::snVector3fVecVec points;
-	snEssence::snIndexVecVec polies;
-
-	size_t GetFloatCount()
-	{
-	   size_t count = 2 + points.size() + polies.size(); // for the count of points and polies vec
-	   for(size_t i=0;i<points.size();i++)
-         count += points[i].size() * 3;
-	   for(size_t i=0;i<polies.size();i++)
-         count += polies[i].size();
-	   return count;
-	}
-
-	size_t GetAsBuffer(unsigned char ** in_pBuffer)
-	{
-      size_t floatCount = GetFloatCount();
-	   *in_pBuffer = (unsigned char*)malloc(floatCount * sizeof(float));
-	   float * floats = (float*)*in_pBuffer;
-
-	   size_t offset = 0;
-	   floats[offset++] = (float)points.size();
-	   floats[offset++] = (float)polies.size();
-	   for(size_t i=0;i<points.size();i++)
-         floats[offset++] = (float)points[i].size();
-	   for(size_t i=0;i<polies.size();i++)
-         floats[offset++] = (float)polies[i].size();
-
-	   // copy all points
-	   for(size_t i=0;i<points.size();i++)
-	   {
-         for(size_t j=0;j<points[i].size();j++)
-         {
-            floats[offset++] = points[i][j].GetX();
-            floats[offset++] = points[i][j].GetY();
-            floats[offset++] = points[i][j].GetZ();
-         }
-	   }
-
-      // copy all poly info
-	   for(size_t i=0;i<polies.size();i++)
-	   {
-         for(size_t j=0;j<polies[i].size();j++)
-            floats[offset++] = (float)polies[i][j];
-	   }
-
-	   return floatCount * sizeof(float);
-	}
-
-	bool SetFromBuffer(const unsigned char * in_pBuffer, size_t in_Size)
-	{
-	   float * floats = (float*)in_pBuffer;
-	   size_t offset=0;
-
-      points.resize((size_t)floats[offset++],snEssence::snVector3fVec());
-      polies.resize((size_t)floats[offset++],snEssence::snIndexVec());
-
-      // resize points for every cell
-      for(size_t i=0;i<points.size();i++)
-         points[i].resize((size_t)floats[offset++]);
-      // resize polies for every cell
-      for(size_t i=0;i<polies.size();i++)
-         polies[i].resize((size_t)floats[offset++]);
+   const unsigned char * buffer;
+   size_t size;
+   unsigned int version;
+   unsigned int flags;                 // the SN_VORONOI_FLAG_* bits, 0 before version 4
+   size_t cellCount;
+   size_t tableEnd;                    // where the tables end and the cells may start
+   const VoronoiCellEntry * cells;     // the cell table of a version 2 or later blob
+   const VoronoiMassEntry * masses;    // the mass table of a version 3 or later blob
+   size_t particleCount;               // the rows of the adjacency graph, if the blob has one
+   size_t neighborCount;
+   const unsigned int * neighborOffsets;
+   const int * neighborIds;
+   const float * neighborAreas;
+   const int * cellIds;
+
+   // a version 1 blob has no cell table, so the sizes of the cells before
+   // the one that is read have to be summed up. the view remembers where the
+   // last cell it found starts, so walking the cells in order stays linear.
+   size_t polyStart;                   // version 1: the first float of the polies
+   mutable size_t cursorCell;
+   mutable size_t cursorPoint;
+   mutable size_t cursorPoly;
+
+   VoronoiInfoView() : buffer(NULL), size(0), version(0), flags(0), cellCount(0), tableEnd(0), cells(NULL), masses(NULL), particleCount(0), neighborCount(0), neighborOffsets(NULL), neighborIds(NULL), neighborAreas(NULL), cellIds(NULL), polyStart(0), cursorCell(0), cursorPoint(0), cursorPoly(0) {}
+
+   bool SetFromBuffer(const unsigned char * in_pBuffer, size_t in_Size)
+   {
+      *this = VoronoiInfoView();
+      if(in_pBuffer == NULL)
+         return false;
+
+      if(in_Size >= SN_VORONOI_HEADER_V2 && ((const VoronoiHeader*)in_pBuffer)->magic == SN_VORONOI_MAGIC)
+         return SetFromBufferV2(in_pBuffer,in_Size);
+      return SetFromBufferV1(in_pBuffer,in_Size);
+   }
+
+   size_t GetCellCount() const { return cellCount; }
+
+   // whether the cells were computed in single precision, as a preview
+   bool IsSinglePrecision() const { return (flags & SN_VORONOI_FLAG_SINGLE) != 0; }
+
+   // checks that a cell lies within the buffer
+   bool IsCellValid(size_t in_Cell) const
+   {
+      if(in_Cell >= cellCount)
+         return false;
+      if(version == 1)
+         return true;
+      const VoronoiCellEntry & cell = cells[in_Cell];
+      if(cell.indexSize != 2 && cell.indexSize != 4)
+         return false;
+      if(cell.offset < tableEnd || cell.offset > size || cell.offset % sizeof(float) != 0)
+         return false;
+      size_t room = size - cell.offset;
+      if(cell.pointCount > room / (3 * sizeof(float)))
+         return false;
+      room -= cell.pointCount * 3 * sizeof(float);
+      return cell.polyCount <= room / cell.indexSize;
+   }
+
+   // the number of points of a cell, and its positions as x,y,z triples
+   size_t GetPointCount(size_t in_Cell) const
+   {
+      if(!IsCellValid(in_Cell))
+         return 0;
+      if(version == 1)
+         return (size_t)((const float*)buffer)[2+in_Cell];
+      return cells[in_Cell].pointCount;
+   }
+   const float * GetPoints(size_t in_Cell) const
+   {
+      if(!IsCellValid(in_Cell))
+         return NULL;
+      if(version == 1)
+         return (const float*)buffer + Seek(in_Cell);
+      return (const float*)(buffer + cells[in_Cell].offset);
+   }
+
+   // the length of a cell's poly description, and the values in it: the
+   // point count of each polygon followed by its point indices
+   size_t GetPolyCount(size_t in_Cell) const
+   {
+      if(!IsCellValid(in_Cell))
+         return 0;
+      if(version == 1)
+         return (size_t)((const float*)buffer)[2+cellCount+in_Cell];
+      return cells[in_Cell].polyCount;
+   }
+   size_t GetPolyValue(size_t in_Cell, size_t in_Index) const
+   {
+      if(version == 1)
+      {
+         Seek(in_Cell);
+         return (size_t)((const float*)buffer)[cursorPoly + in_Index];
+      }
+      const unsigned char * polies = buffer + cells[in_Cell].offset + cells[in_Cell].pointCount * 3 * sizeof(float);
+      if(cells[in_Cell].indexSize == 2)
+         return ((const unsigned short*)polies)[in_Index];
+      return ((const unsigned int*)polies)[in_Index];
+   }
+
+   // the mass properties of a cell, if the blob has them
+   bool HasMassProperties() const { return masses != NULL; }
+   const VoronoiMassEntry & GetMassProperties(size_t in_Cell) const { return masses[in_Cell]; }
+
+   // the adjacency graph, which only version 2 and later blobs can have. the
+   // rows are indexed by particle id, and the cells know which particle they
+   // belong to. a row that does not fit into the buffer reads as empty.
+   bool HasAdjacency() const { return neighborOffsets != NULL; }
+   size_t GetParticleCount() const { return particleCount; }
+   int GetCellId(size_t in_Cell) const
+   {
+      return cellIds != NULL && in_Cell < cellCount ? cellIds[in_Cell] : -1;
+   }
+   size_t GetNeighborCount(size_t in_Particle) const
+   {
+      if(!IsRowValid(in_Particle))
+         return 0;
+      return neighborOffsets[in_Particle+1] - neighborOffsets[in_Particle];
+   }
+   const int * GetNeighbors(size_t in_Particle) const
+   {
+      return neighborIds + (IsRowValid(in_Particle) ? neighborOffsets[in_Particle] : 0);
+   }
+   const float * GetNeighborAreas(size_t in_Particle) const
+   {
+      return neighborAreas + (IsRowValid(in_Particle) ? neighborOffsets[in_Particle] : 0);
+   }
+
+   // copies the adjacency graph out of the blob, rows that do not fit into
+   // the buffer come out empty
+   void GetAdjacency(VoronoiAdjacency & out_Adjacency) const
+   {
+      out_Adjacency.Clear();
+      if(!HasAdjacency())
+         return;
+      out_Adjacency.cellIds.assign(cellIds,cellIds + cellCount);
+      out_Adjacency.offsets.assign(particleCount + 1,0);
+      for(size_t i=0;i<particleCount;i++)
+      {
+         size_t count = GetNeighborCount(i);
+         const int * ids = GetNeighbors(i);
+         const float * areas = GetNeighborAreas(i);
+         out_Adjacency.neighbors.insert(out_Adjacency.neighbors.end(),ids,ids + count);
+         out_Adjacency.areas.insert(out_Adjacency.areas.end(),areas,areas + count);
+         out_Adjacency.offsets[i+1] = (unsigned int)out_Adjacency.neighbors.size();
+      }
+   }
+
+private:
+   bool IsRowValid(size_t in_Particle) const
+   {
+      return in_Particle < particleCount && neighborOffsets[in_Particle] <= neighborOffsets[in_Particle+1] &&
+         neighborOffsets[in_Particle+1] <= neighborCount;
+   }
+
+   // moves the cursor to a cell of a version 1 blob, and returns the first
+   // float of its points
+   size_t Seek(size_t in_Cell) const
+   {
+      const float * data = (const float*)buffer;
+      if(in_Cell < cursorCell)
+      {
+         cursorCell = 0;
+         cursorPoint = 2 + 2 * cellCount;
+         cursorPoly = polyStart;
+      }
+      for(;cursorCell<in_Cell;cursorCell++)
+      {
+         cursorPoint += 3 * (size_t)data[2+cursorCell];
+         cursorPoly += (size_t)data[2+cellCount+cursorCell];
+      }
+      return cursorPoint;
+   }
+
+   bool SetFromBufferV1(const unsigned char * in_pBuffer, size_t in_Size)
+   {
+      // the header holds the number of point and poly lists, followed by
+      // the size of each list. there is no table to look things up in, so
+      // the sizes are checked against the buffer size once here.
+      size_t floatCount = in_Size / sizeof(float);
+      if(floatCount * sizeof(float) != in_Size || floatCount < 2)
+         return false;
+      const float * data = (const float*)in_pBuffer;
+      if(data[0] < 0.0f || data[0] != data[1] || data[0] > (float)floatCount)
+         return false;
+      size_t count = (size_t)data[0];
+      size_t offset = 2 + 2 * count;
+      if(offset > floatCount)
+         return false;
+      size_t total = offset;
+      for(size_t i=0;i<2*count;i++)
+      {
+         if(data[2+i] < 0.0f || data[2+i] > (float)floatCount)
+            return false;
+         total += (i < count ? 3 : 1) * (size_t)data[2+i];
+         if(i+1 == count)
+            polyStart = total;
+      }
 
       // check the buffer size!
-	   if(GetFloatCount()*sizeof(float) != in_Size)
+      if(total != floatCount)
+         return false;
+
+      buffer = in_pBuffer;
+      size = in_Size;
+      version = 1;
+      cellCount = count;
+      if(count == 0)
+         polyStart = offset;
+      cursorPoint = offset;
+      cursorPoly = polyStart;
+      return true;
+   }
+
+   bool SetFromBufferV2(const unsigned char * in_pBuffer, size_t in_Size)
+   {
+      const VoronoiHeader * header = (const VoronoiHeader*)in_pBuffer;
+      if(header->version < 2 || header->version > 4)
+         return false;
+      size_t headerSize = header->version >= 4 ? sizeof(VoronoiHeader) : SN_VORONOI_HEADER_V2;
+      if(in_Size < headerSize)
          return false;
+      size_t entrySize = sizeof(VoronoiCellEntry) + (header->version >= 3 ? sizeof(VoronoiMassEntry) : 0);
+      if(header->cellCount > (in_Size - headerSize) / entrySize)
+         return false;
+      const VoronoiCellEntry * table = (const VoronoiCellEntry*)(in_pBuffer + headerSize);
+      tableEnd = headerSize + header->cellCount * entrySize;
+
+      // make sure that the adjacency section lies within the buffer, its
+      // rows are checked when they are read
+      if(header->adjacency != 0)
+      {
+         if(header->adjacency < tableEnd || header->adjacency % sizeof(float) != 0 || header->adjacency > in_Size ||
+            in_Size - header->adjacency < sizeof(VoronoiAdjacencyHeader))
+            return false;
+         const VoronoiAdjacencyHeader * section = (const VoronoiAdjacencyHeader*)(in_pBuffer + header->adjacency);
+         size_t room = (in_Size - header->adjacency - sizeof(VoronoiAdjacencyHeader)) / 4;
+         if(section->particleCount >= room || section->neighborCount > (room - section->particleCount - 1) / 2 ||
+            header->cellCount > room - section->particleCount - 1 - 2 * section->neighborCount)
+            return false;
+         particleCount = section->particleCount;
+         neighborCount = section->neighborCount;
+         neighborOffsets = (const unsigned int*)(section + 1);
+         neighborIds = (const int*)(neighborOffsets + particleCount + 1);
+         neighborAreas = (const float*)(neighborIds + neighborCount);
+         cellIds = (const int*)(neighborAreas + neighborCount);
+      }
+
+      buffer = in_pBuffer;
+      size = in_Size;
+      version = header->version;
+      if(version >= 4)
+         flags = header->flags;
+      cellCount = header->cellCount;
+      cells = table;
+      if(version >= 3)
+         masses = (const VoronoiMassEntry*)(table + cellCount);
+      return true;
+   }
+};
+
+// a flat store for the meshes of many cells, which the voronoi cells write
+// into directly. the points and polies of all cells live in two contiguous
+// arrays, and every cell knows where its part of each array starts and how
+// long it is. that way the cells don't have to be stored in their final order,
+// the data of a whole store can be appended to another one in one go, and
+// the blob is written from the arrays without going through any per cell
+// objects. this is the only writer of the blob. a cell can also be
+// overwritten where it is, so a store can be kept up to date by patching just
+// the cells that change. the poly values are the same as in the blob: the point count of
+// each polygon followed by its point indices, counted from the first point of
+// the cell. alongside them, every cell has a face table which holds the id
+// of the neighbor on the other side of each of its polygons, in the same
+// order, or a negative number for the walls of the container.
+struct VoronoiSink
+{
+   std::vector<float> points;          // x,y,z triples of all cells
+   std::vector<unsigned int> polies;   // the poly descriptions of all cells
+   std::vector<size_t> pointOffsets;   // the first point of each cell
+   std::vector<size_t> pointCounts;    // the number of points of each cell
+   std::vector<size_t> polyOffsets;    // the first poly value of each cell
+   std::vector<size_t> polyCounts;     // the number of poly values of each cell
+   std::vector<int> neighbors;         // the neighbor id of every face of all cells
+   std::vector<size_t> faceOffsets;    // the first face of each cell
+   std::vector<size_t> faceCounts;     // the number of faces of each cell
+   std::vector<int> cellIds;           // the particle id of each cell, or -1
+   std::vector<VoronoiMassEntry> masses;  // the mass properties of each cell
+
+   size_t GetCellCount() const { return pointOffsets.size(); }
+
+   void Clear()
+   {
+      points.clear();
+      polies.clear();
+      pointOffsets.clear();
+      pointCounts.clear();
+      polyOffsets.clear();
+      polyCounts.clear();
+      neighbors.clear();
+      faceOffsets.clear();
+      faceCounts.clear();
+      cellIds.clear();
+      masses.clear();
+   }
+
+   void Swap(VoronoiSink & io_Other)
+   {
+      points.swap(io_Other.points);
+      polies.swap(io_Other.polies);
+      pointOffsets.swap(io_Other.pointOffsets);
+      pointCounts.swap(io_Other.pointCounts);
+      polyOffsets.swap(io_Other.polyOffsets);
+      polyCounts.swap(io_Other.polyCounts);
+      neighbors.swap(io_Other.neighbors);
+      faceOffsets.swap(io_Other.faceOffsets);
+      faceCounts.swap(io_Other.faceCounts);
+      cellIds.swap(io_Other.cellIds);
+      masses.swap(io_Other.masses);
+   }
+
+   // starts a new cell at the end of the arrays, the points and poly values
+   // added after this belong to it
+   size_t AddCell(int in_Id = -1)
+   {
+      VoronoiMassEntry mass;
+      memset(&mass,0,sizeof(VoronoiMassEntry));
+      cellIds.push_back(in_Id);
+      masses.push_back(mass);
+      pointOffsets.push_back(points.size() / 3);
+      pointCounts.push_back(0);
+      polyOffsets.push_back(polies.size());
+      polyCounts.push_back(0);
+      faceOffsets.push_back(neighbors.size());
+      faceCounts.push_back(0);
+      return pointOffsets.size()-1;
+   }
+   void AddPoint(float in_X, float in_Y, float in_Z)
+   {
+      points.push_back(in_X);
+      points.push_back(in_Y);
+      points.push_back(in_Z);
+      pointCounts.back()++;
+   }
+   void AddPolyValue(size_t in_Value)
+   {
+      polies.push_back((unsigned int)in_Value);
+      polyCounts.back()++;
+   }
+   // sets the mass properties of the current cell
+   void SetMassProperties(const VoronoiMassEntry & in_Mass)
+   {
+      masses.back() = in_Mass;
+   }
+   // adds an entry to the face table of the current cell, its polygon still
+   // needs to be added to the poly values
+   void AddFace(int in_Neighbor)
+   {
+      neighbors.push_back(in_Neighbor);
+      faceCounts.back()++;
+   }
+
+   // copies a cell of another store to the end of this one
+   size_t AddCell(const VoronoiSink & in_Other, size_t in_Cell)
+   {
+      size_t cell = AddCell(in_Other.cellIds[in_Cell]);
+      masses[cell] = in_Other.masses[in_Cell];
+      std::vector<float>::const_iterator floats = in_Other.points.begin() + in_Other.pointOffsets[in_Cell] * 3;
+      points.insert(points.end(),floats,floats + in_Other.pointCounts[in_Cell] * 3);
+      std::vector<unsigned int>::const_iterator values = in_Other.polies.begin() + in_Other.polyOffsets[in_Cell];
+      polies.insert(polies.end(),values,values + in_Other.polyCounts[in_Cell]);
+      std::vector<int>::const_iterator faces = in_Other.neighbors.begin() + in_Other.faceOffsets[in_Cell];
+      neighbors.insert(neighbors.end(),faces,faces + in_Other.faceCounts[in_Cell]);
+      pointCounts[cell] = in_Other.pointCounts[in_Cell];
+      polyCounts[cell] = in_Other.polyCounts[in_Cell];
+      faceCounts[cell] = in_Other.faceCounts[in_Cell];
+      return cell;
+   }
+
+   // appends the point and poly arrays of another store in one go, without
+   // adding any cells. the offsets of the appended data are returned, so
+   // that its cells can be added with AddCellAt in any order afterwards.
+   void AppendData(const VoronoiSink & in_Other, size_t * out_Bases)
+   {
+      out_Bases[0] = points.size() / 3;
+      out_Bases[1] = polies.size();
+      out_Bases[2] = neighbors.size();
+      points.insert(points.end(),in_Other.points.begin(),in_Other.points.end());
+      polies.insert(polies.end(),in_Other.polies.begin(),in_Other.polies.end());
+      neighbors.insert(neighbors.end(),in_Other.neighbors.begin(),in_Other.neighbors.end());
+   }
+   size_t AddCellAt(const VoronoiSink & in_Other, size_t in_Cell, const size_t * in_Bases)
+   {
+      pointOffsets.push_back(in_Bases[0] + in_Other.pointOffsets[in_Cell]);
+      pointCounts.push_back(in_Other.pointCounts[in_Cell]);
+      polyOffsets.push_back(in_Bases[1] + in_Other.polyOffsets[in_Cell]);
+      polyCounts.push_back(in_Other.polyCounts[in_Cell]);
+      faceOffsets.push_back(in_Bases[2] + in_Other.faceOffsets[in_Cell]);
+      faceCounts.push_back(in_Other.faceCounts[in_Cell]);
+      cellIds.push_back(in_Other.cellIds[in_Cell]);
+      masses.push_back(in_Other.masses[in_Cell]);
+      return pointOffsets.size()-1;
+   }
+
+   // removes a cell from the table by moving the last cell into its place.
+   // the data of the removed cell stays behind in the arrays.
+   void RemoveCell(size_t in_Cell)
+   {
+      size_t last = GetCellCount() - 1;
+      pointOffsets[in_Cell] = pointOffsets[last];
+      pointCounts[in_Cell] = pointCounts[last];
+      polyOffsets[in_Cell] = polyOffsets[last];
+      polyCounts[in_Cell] = polyCounts[last];
+      faceOffsets[in_Cell] = faceOffsets[last];
+      faceCounts[in_Cell] = faceCounts[last];
+      cellIds[in_Cell] = cellIds[last];
+      masses[in_Cell] = masses[last];
+      pointOffsets.pop_back();
+      pointCounts.pop_back();
+      polyOffsets.pop_back();
+      polyCounts.pop_back();
+      faceOffsets.pop_back();
+      faceCounts.pop_back();
+      cellIds.pop_back();
+      masses.pop_back();
+   }
+
+   // puts the cells into a new order, in_Order lists the old index of every
+   // cell. only the cell table moves, the data of the cells stays where it is.
+   void ReorderCells(const std::vector<int> & in_Order)
+   {
+      ReorderTable(pointOffsets,in_Order);
+      ReorderTable(pointCounts,in_Order);
+      ReorderTable(polyOffsets,in_Order);
+      ReorderTable(polyCounts,in_Order);
+      ReorderTable(faceOffsets,in_Order);
+      ReorderTable(faceCounts,in_Order);
+      ReorderTable(cellIds,in_Order);
+      ReorderTable(masses,in_Order);
+   }
+
+   // copies a cell of another store over a cell of this one. the data is
+   // written where the cell is now, so the caller has to make sure that it
+   // fits, or appended to the arrays if in_Append is set, which leaves the
+   // old data of the cell behind.
+   void SetCell(size_t in_Cell, const VoronoiSink & in_Other, size_t in_OtherCell, bool in_Append)
+   {
+      if(in_Append)
+      {
+         pointOffsets[in_Cell] = points.size() / 3;
+         polyOffsets[in_Cell] = polies.size();
+         faceOffsets[in_Cell] = neighbors.size();
+         points.resize(points.size() + in_Other.pointCounts[in_OtherCell] * 3);
+         polies.resize(polies.size() + in_Other.polyCounts[in_OtherCell]);
+         neighbors.resize(neighbors.size() + in_Other.faceCounts[in_OtherCell]);
+      }
+      pointCounts[in_Cell] = in_Other.pointCounts[in_OtherCell];
+      polyCounts[in_Cell] = in_Other.polyCounts[in_OtherCell];
+      faceCounts[in_Cell] = in_Other.faceCounts[in_OtherCell];
+      cellIds[in_Cell] = in_Other.cellIds[in_OtherCell];
+      masses[in_Cell] = in_Other.masses[in_OtherCell];
+      std::vector<float>::const_iterator floats = in_Other.points.begin() + in_Other.pointOffsets[in_OtherCell] * 3;
+      std::copy(floats,floats + pointCounts[in_Cell] * 3,points.begin() + pointOffsets[in_Cell] * 3);
+      std::vector<unsigned int>::const_iterator values = in_Other.polies.begin() + in_Other.polyOffsets[in_OtherCell];
+      std::copy(values,values + polyCounts[in_Cell],polies.begin() + polyOffsets[in_Cell]);
+      std::vector<int>::const_iterator faces = in_Other.neighbors.begin() + in_Other.faceOffsets[in_OtherCell];
+      std::copy(faces,faces + faceCounts[in_Cell],neighbors.begin() + faceOffsets[in_Cell]);
+   }
+
+   template<class T>
+   static void ReorderTable(std::vector<T> & io_Table, const std::vector<int> & in_Order)
+   {
+      std::vector<T> table(in_Order.size());
+      for(size_t i=0;i<in_Order.size();i++)
+         table[i] = io_Table[in_Order[i]];
+      io_Table.swap(table);
+   }
+
+   // the bytes per poly value of a cell, small cells get away with 16 bits
+   size_t GetIndexSize(size_t in_Cell) const
+   {
+      for(size_t j=polyOffsets[in_Cell];j<polyOffsets[in_Cell]+polyCounts[in_Cell];j++)
+      {
+         if(polies[j] > 0xFFFF)
+            return 4;
+      }
+      return 2;
+   }
+
+   static size_t Align(size_t in_Size)
+   {
+      return (in_Size + SN_VORONOI_ALIGN - 1) & ~(size_t)(SN_VORONOI_ALIGN - 1);
+   }
+
+   // the size of the header, the cell table and the mass table, where the
+   // data of the first cell starts
+   static size_t GetTableSize(size_t in_CellCount)
+   {
+      return Align(sizeof(VoronoiHeader) + in_CellCount * (sizeof(VoronoiCellEntry) + sizeof(VoronoiMassEntry)));
+   }
+
+   size_t GetBufferSize(const VoronoiAdjacency * in_pAdjacency = NULL) const
+   {
+      size_t cellCount = GetCellCount();
+      size_t size = GetTableSize(cellCount);
+      for(size_t i=0;i<cellCount;i++)
+         size += Align(pointCounts[i] * 3 * sizeof(float) + polyCounts[i] * GetIndexSize(i));
+      if(in_pAdjacency != NULL)
+         size += in_pAdjacency->GetBufferSize();
+      return size;
+   }
+
+   // builds the adjacency graph from the face tables of the cells. the area
+   // of a shared face is measured on the polygon of the cell that owns the
+   // row, the faces towards the walls are left out.
+   void GetAdjacency(VoronoiAdjacency & out_Adjacency) const
+   {
+      out_Adjacency.Clear();
+      out_Adjacency.cellIds = cellIds;
+      int maxId = -1;
+      for(size_t i=0;i<cellIds.size();i++)
+         maxId = cellIds[i] > maxId ? cellIds[i] : maxId;
+      out_Adjacency.offsets.assign((size_t)(maxId + 2),0);
+
+      // count the neighbors of every particle first, so the rows can be
+      // filled in place
+      for(size_t i=0;i<GetCellCount();i++)
+      {
+         if(cellIds[i] < 0)
+            continue;
+         for(size_t f=faceOffsets[i];f<faceOffsets[i]+faceCounts[i];f++)
+         {
+            if(neighbors[f] >= 0 && neighbors[f] != cellIds[i])
+               out_Adjacency.offsets[cellIds[i]+1]++;
+         }
+      }
+      for(size_t i=1;i<out_Adjacency.offsets.size();i++)
+         out_Adjacency.offsets[i] += out_Adjacency.offsets[i-1];
+      out_Adjacency.neighbors.resize(out_Adjacency.offsets.back());
+      out_Adjacency.areas.resize(out_Adjacency.offsets.back());
+
+      std::vector<unsigned int> fill(out_Adjacency.offsets.begin(),out_Adjacency.offsets.end()-1);
+      std::vector<std::pair<int,float> > row;
+      for(size_t i=0;i<GetCellCount();i++)
+      {
+         int id = cellIds[i];
+         if(id < 0)
+            continue;
+         const float * cellPoints = points.empty() ? NULL : &points[pointOffsets[i]*3];
+         size_t j = polyOffsets[i];
+         for(size_t f=faceOffsets[i];f<faceOffsets[i]+faceCounts[i] && j<polyOffsets[i]+polyCounts[i];f++)
+         {
+            unsigned int count = polies[j];
+            if(neighbors[f] >= 0 && neighbors[f] != id)
+            {
+               // twice the area of the polygon is the length of the sum
+               // of the cross products of the fan around its first point
+               const float * o = cellPoints + polies[j+1]*3;
+               float nx = 0.0f, ny = 0.0f, nz = 0.0f;
+               for(unsigned int k=2;k<count;k++)
+               {
+                  const float * a = cellPoints + polies[j+k]*3;
+                  const float * b = cellPoints + polies[j+1+k]*3;
+                  float ax = a[0]-o[0], ay = a[1]-o[1], az = a[2]-o[2];
+                  float bx = b[0]-o[0], by = b[1]-o[1], bz = b[2]-o[2];
+                  nx += ay*bz - az*by;
+                  ny += az*bx - ax*bz;
+                  nz += ax*by - ay*bx;
+               }
+               out_Adjacency.neighbors[fill[id]] = neighbors[f];
+               out_Adjacency.areas[fill[id]++] = 0.5f * sqrtf(nx*nx + ny*ny + nz*nz);
+            }
+            j += count + 1;
+         }
+
+         // sort the row by neighbor id
+         size_t start = out_Adjacency.offsets[id];
+         row.clear();
+         for(size_t k=start;k<fill[id];k++)
+            row.push_back(std::pair<int,float>(out_Adjacency.neighbors[k],out_Adjacency.areas[k]));
+         std::sort(row.begin(),row.end());
+         for(size_t k=0;k<row.size();k++)
+         {
+            out_Adjacency.neighbors[start+k] = row[k].first;
+            out_Adjacency.areas[start+k] = row[k].second;
+         }
+      }
+   }
+
+   // writes a version 4 blob, the points of every cell go in with a single
+   // copy, and so do its poly values unless they get squeezed into 16 bits.
+   // the adjacency graph is appended after the cells if there is one.
+   size_t GetAsBuffer(unsigned char ** in_pBuffer, const VoronoiAdjacency * in_pAdjacency = NULL, unsigned int in_Flags = 0) const
+   {
+      size_t cellCount = GetCellCount();
+      size_t size = GetBufferSize(in_pAdjacency);
+      *in_pBuffer = (unsigned char*)malloc(size);
+      memset(*in_pBuffer,0,size);
 
-      // read the points
-      for(size_t i=0;i<points.size();i++)
-      {
-         for(size_t j=0;j<points[i].size();j++)
+      VoronoiHeader * header = (VoronoiHeader*)*in_pBuffer;
+      header->magic = SN_VORONOI_MAGIC;
+      header->version = SN_VORONOI_VERSION;
+      header->cellCount = (unsigned int)cellCount;
+      header->adjacency = 0;
+      header->flags = in_Flags;
+
+      VoronoiCellEntry * table = (VoronoiCellEntry*)(*in_pBuffer + sizeof(VoronoiHeader));
+      if(cellCount > 0)
+         memcpy(table + cellCount,&masses[0],cellCount * sizeof(VoronoiMassEntry));
+      size_t offset = GetTableSize(cellCount);
+      for(size_t i=0;i<cellCount;i++)
+      {
+         VoronoiCellEntry & cell = table[i];
+         cell.pointCount = (unsigned int)pointCounts[i];
+         cell.polyCount = (unsigned int)polyCounts[i];
+         cell.indexSize = (unsigned int)GetIndexSize(i);
+         cell.offset = (unsigned int)offset;
+
+         float * floats = (float*)(*in_pBuffer + offset);
+         if(cell.pointCount > 0)
+            memcpy(floats,&points[pointOffsets[i]*3],cell.pointCount * 3 * sizeof(float));
+
+         unsigned char * indices = (unsigned char*)(floats + cell.pointCount * 3);
+         if(cell.polyCount > 0)
+         {
+            const unsigned int * values = &polies[polyOffsets[i]];
+            if(cell.indexSize == 2)
+            {
+               for(size_t j=0;j<cell.polyCount;j++)
+                  ((unsigned short*)indices)[j] = (unsigned short)values[j];
+            }
+            else
+               memcpy(indices,values,cell.polyCount * sizeof(unsigned int));
+         }
+
+         offset += Align(cell.pointCount * 3 * sizeof(float) + cell.polyCount * cell.indexSize);
+      }
+
+      if(in_pAdjacency != NULL)
+      {
+         header->adjacency = (unsigned int)offset;
+         in_pAdjacency->WriteBuffer(*in_pBuffer + offset);
+      }
+
+      return size;
+   }
+};
+
+// a union find over the numbers 0 to n-1. joining two sets keeps the smaller
+// of their roots, so the root of every set is its smallest member.
+struct UnionFind
+{
+   std::vector<unsigned int> parent;
+
+   UnionFind(size_t in_Count) : parent(in_Count)
+   {
+      for(size_t i=0;i<in_Count;i++)
+         parent[i] = (unsigned int)i;
+   }
+
+   unsigned int Find(unsigned int in_Item)
+   {
+      while(parent[in_Item] != in_Item)
+      {
+         parent[in_Item] = parent[parent[in_Item]];
+         in_Item = parent[in_Item];
+      }
+      return in_Item;
+   }
+
+   void Join(unsigned int in_A, unsigned int in_B)
+   {
+      unsigned int a = Find(in_A);
+      unsigned int b = Find(in_B);
+      if(a < b)
+         parent[b] = a;
+      else
+         parent[a] = b;
+   }
+};
+
+// the shared topology of a whole set of cells. neighboring cells have the
+// same vertices on their common face, and the face itself is the same polygon
+// seen from either side, so storing the cells one by one keeps every interior
+// face twice and every voronoi vertex about four times. here all vertices
+// live in one pool and every face is stored once, together with the ids of
+// the two cells it separates. a cell is just a list of references to its
+// faces, which are flipped where the cell sees a face from behind.
+//
+// the two copies of a face are found through the neighbor ids of the cells:
+// the face of cell a towards b is the face of cell b towards a. its vertex
+// loops run in opposite directions, so once they are lined up, the vertices
+// of the two copies get merged pair by pair. following the faces like this
+// also merges vertices where more than four cells meet, as in a regular grid,
+// which no key made up from the cells around a single vertex could. faces
+// whose copies don't agree, because the two cells resolved a degenerate spot
+// differently, stay separate.
+//
+// the topology is built on demand and is not part of the voronoi blob, which
+// keeps the cells one by one, so that snVoronoiCell and update_snVoronoi can
+// read any single cell without touching the rest. kratos-shatter -c writes it
+// out as an obj file.
+struct VoronoiTopology
+{
+   std::vector<float> points;             // x,y,z triples of the shared vertices
+   std::vector<unsigned int> polies;      // every face once, its point count followed by its point indices
+   std::vector<size_t> faceOffsets;       // where each face starts in polies
+   std::vector<int> faceCells;            // two per face: the id of the cell it is counter-clockwise for, and the id behind it
+   std::vector<int> cellIds;              // the particle id of each cell
+   std::vector<size_t> cellFaceOffsets;   // the first face reference of each cell, plus the end
+   std::vector<unsigned int> cellFaces;   // twice the index of each face of a cell, plus one if the cell sees it from behind
+
+   size_t GetCellCount() const { return cellIds.size(); }
+   size_t GetFaceCount() const { return faceOffsets.size(); }
+   size_t GetPointCount() const { return points.size() / 3; }
+
+   void Clear()
+   {
+      points.clear();
+      polies.clear();
+      faceOffsets.clear();
+      faceCells.clear();
+      cellIds.clear();
+      cellFaceOffsets.clear();
+      cellFaces.clear();
+   }
+
+   // builds the topology from a sink, whose cells need to have their ids and
+   // the neighbor ids of their faces, as written by neighbor tracking cells
+   void SetFromSink(const VoronoiSink & in_Sink)
+   {
+      Clear();
+      size_t cellCount = in_Sink.GetCellCount();
+      size_t faceTotal = in_Sink.neighbors.size();
+
+      // find the cell of every face of the sink, and where its loop starts
+      std::vector<size_t> faceCell(faceTotal), faceStart(faceTotal);
+      std::vector<std::pair<std::pair<int,int>,size_t> > pairs;
+      for(size_t c=0;c<cellCount;c++)
+      {
+         int id = in_Sink.cellIds[c];
+         for(size_t j=in_Sink.polyOffsets[c],f=in_Sink.faceOffsets[c];j<in_Sink.polyOffsets[c]+in_Sink.polyCounts[c];f++)
+         {
+            faceCell[f] = c;
+            faceStart[f] = j;
+            int neighbor = in_Sink.neighbors[f];
+            if(id >= 0 && neighbor >= 0 && id != neighbor)
+               pairs.push_back(std::pair<std::pair<int,int>,size_t>(std::pair<int,int>(id < neighbor ? id : neighbor,id < neighbor ? neighbor : id),f));
+            j += in_Sink.polies[j] + 1;
+         }
+      }
+
+      // line up the two copies of every shared face, and merge their
+      // vertices. the vertices are merged with a union find over all points
+      // of the sink.
+      std::sort(pairs.begin(),pairs.end());
+      std::vector<size_t> partner(faceTotal,(size_t)-1);
+      UnionFind vertices(in_Sink.points.size() / 3);
+      for(size_t i=0;i<pairs.size();)
+      {
+         // a face is only shared if exactly two faces have its pair of
+         // cells, any more come from a degenerate spot and stay separate
+         size_t end = i + 1;
+         while(end < pairs.size() && pairs[end].first == pairs[i].first)
+            end++;
+         if(end - i == 2)
          {
-            points[i][j].SetX(floats[offset++]);
-            points[i][j].SetY(floats[offset++]);
-            points[i][j].SetZ(floats[offset++]);
-         }
-      }
+            size_t fa = pairs[i].second, fb = pairs[i+1].second;
+            if(in_Sink.cellIds[faceCell[fa]] != in_Sink.cellIds[faceCell[fb]] &&
+               MergeFaces(in_Sink,faceCell[fa],faceStart[fa],faceCell[fb],faceStart[fb],vertices))
+            {
+               partner[fa] = fb;
+               partner[fb] = fa;
+            }
+         }
+         i = end;
+      }
+
+      // store the faces, every shared face from the cell with the lower id.
+      // the pool only gets the vertices that the faces use.
+      std::vector<unsigned int> global(vertices.parent.size(),UINT_MAX);
+      std::vector<unsigned int> faceIndex(faceTotal,UINT_MAX);
+      for(size_t f=0;f<faceTotal;f++)
+      {
+         size_t c = faceCell[f];
+         if(partner[f] != (size_t)-1 && in_Sink.cellIds[c] > in_Sink.neighbors[f])
+            continue;
+         faceIndex[f] = (unsigned int)GetFaceCount();
+         faceOffsets.push_back(polies.size());
+         faceCells.push_back(in_Sink.cellIds[c]);
+         faceCells.push_back(in_Sink.neighbors[f]);
+         unsigned int count = in_Sink.polies[faceStart[f]];
+         polies.push_back(count);
+         for(unsigned int k=1;k<=count;k++)
+         {
+            unsigned int root = vertices.Find((unsigned int)(in_Sink.pointOffsets[c] + in_Sink.polies[faceStart[f]+k]));
+            if(global[root] == UINT_MAX)
+            {
+               global[root] = (unsigned int)GetPointCount();
+               points.insert(points.end(),in_Sink.points.begin()+root*3,in_Sink.points.begin()+root*3+3);
+            }
+            polies.push_back(global[root]);
+         }
+      }
+
+      // list the faces of every cell, in the order of the sink
+      cellIds = in_Sink.cellIds;
+      cellFaceOffsets.resize(cellCount+1);
+      cellFaces.reserve(faceTotal);
+      for(size_t c=0;c<cellCount;c++)
+      {
+         cellFaceOffsets[c] = cellFaces.size();
+         for(size_t f=in_Sink.faceOffsets[c];f<in_Sink.faceOffsets[c]+in_Sink.faceCounts[c];f++)
+         {
+            if(faceIndex[f] != UINT_MAX)
+               cellFaces.push_back(2 * faceIndex[f]);
+            else
+               cellFaces.push_back(2 * faceIndex[partner[f]] + 1);
+         }
+      }
+      cellFaceOffsets[cellCount] = cellFaces.size();
+   }
+
+   // the faces of a cell are views into the shared faces. a cell sees some
+   // of them from behind, their points then run the other way around for it.
+   size_t GetCellFaceCount(size_t in_Cell) const
+   {
+      return cellFaceOffsets[in_Cell+1] - cellFaceOffsets[in_Cell];
+   }
+   size_t GetCellFace(size_t in_Cell, size_t in_Index) const
+   {
+      return cellFaces[cellFaceOffsets[in_Cell] + in_Index] >> 1;
+   }
+   bool IsCellFaceFlipped(size_t in_Cell, size_t in_Index) const
+   {
+      return (cellFaces[cellFaceOffsets[in_Cell] + in_Index] & 1) != 0;
+   }
+
+   // the point count of a shared face, and the indices of its points in the
+   // pool, counter-clockwise for the first of its two cells
+   unsigned int GetFacePointCount(size_t in_Face) const { return polies[faceOffsets[in_Face]]; }
+   const unsigned int * GetFacePoints(size_t in_Face) const { return &polies[faceOffsets[in_Face]+1]; }
+
+private:
+   // lines up the loops of the two copies of a face, which run in opposite
+   // directions, and merges their vertices. the copies only count as the
+   // same face if they have the same number of vertices, and every pair of
+   // vertices lies within a small fraction of the face size.
+   static bool MergeFaces(const VoronoiSink & in_Sink, size_t in_CellA, size_t in_StartA, size_t in_CellB, size_t in_StartB, UnionFind & io_Vertices)
+   {
+      unsigned int count = in_Sink.polies[in_StartA];
+      if(count != in_Sink.polies[in_StartB] || count < 3)
+         return false;
+      const unsigned int * loopA = &in_Sink.polies[in_StartA+1];
+      const unsigned int * loopB = &in_Sink.polies[in_StartB+1];
+      const float * pointsA = &in_Sink.points[in_Sink.pointOffsets[in_CellA]*3];
+      const float * pointsB = &in_Sink.points[in_Sink.pointOffsets[in_CellB]*3];
 
-      // read the polies
-      for(size_t i=0;i<polies.size();i++)
-      {
-         for(size_t j=0;j<polies[i].size();j++)
-            polies[i][j] = (size_t)floats[offset++];
+      // the tolerance follows the size of the face
+      float lo[3], hi[3];
+      for(int a=0;a<3;a++)
+         lo[a] = hi[a] = pointsA[loopA[0]*3+a];
+      for(unsigned int k=1;k<count;k++)
+      {
+         for(int a=0;a<3;a++)
+         {
+            float v = pointsA[loopA[k]*3+a];
+            if(v < lo[a]) lo[a] = v;
+            if(v > hi[a]) hi[a] = v;
+         }
       }
+      float tol = 1e-3f * ((hi[0]-lo[0]) + (hi[1]-lo[1]) + (hi[2]-lo[2]));
+      tol *= tol;
 
+      // find the vertex of b that matches the first one of a
+      unsigned int shift = 0;
+      float best = 0.0f;
+      for(unsigned int k=0;k<count;k++)
+      {
+         float d = Distance(pointsA+loopA[0]*3,pointsB+loopB[k]*3);
+         if(k == 0 || d < best)
+         {
+            best = d;
+            shift = k;
+         }
+      }
+      for(unsigned int k=0;k<count;k++)
+      {
+         if(Distance(pointsA+loopA[k]*3,pointsB+loopB[(shift+count-k)%count]*3) > tol)
+            return false;
+      }
+      for(unsigned int k=0;k<count;k++)
+      {
+         io_Vertices.Join((unsigned int)(in_Sink.pointOffsets[in_CellA] + loopA[k]),
+            (unsigned int)(in_Sink.pointOffsets[in_CellB] + loopB[(shift+count-k)%count]));
+      }
       return true;
-	}
+   }
+
+   static float Distance(const float * in_A, const float * in_B)
+   {
+      return (in_A[0]-in_B[0])*(in_A[0]-in_B[0]) + (in_A[1]-in_B[1])*(in_A[1]-in_B[1]) + (in_A[2]-in_B[2])*(in_A[2]-in_B[2]);
+   }
+};
+
+
+// splits a polygon mesh into its islands, the groups of polygons connected
+// through shared edges. the edges of all polygons are sorted once so that
+// the polygons sharing an edge end up next to each other, and get joined
+// with a union find. the polygons are then grouped by island, which lets
+// a single pass number the points of every island, since the islands are
+// walked one after another. all of it is linear in the size of the mesh,
+// apart from the sort.
+struct PolygonIslands
+{
+   std::vector<size_t> pointOffsets;   // the first point of each island, plus the end
+   std::vector<unsigned int> points;   // the index in the mesh of every point of all islands
+   std::vector<size_t> polyOffsets;    // the first poly value of each island, plus the end
+   std::vector<unsigned int> polies;   // the poly descriptions of all islands, with island point indices
+
+   size_t GetIslandCount() const { return pointOffsets.empty() ? 0 : pointOffsets.size() - 1; }
+
+   void Clear()
+   {
+      pointOffsets.clear();
+      points.clear();
+      polyOffsets.clear();
+      polies.clear();
+   }
+
+   // computes the islands from a poly description as softimage returns it,
+   // the point count of every polygon followed by its point indices. the
+   // islands are ordered by their first polygon, and within an island the
+   // polygons and points keep the order of the mesh.
+   template<class T>
+   void SetFromPolies(size_t in_PointCount, const T * in_Polies, size_t in_Size)
+   {
+      Clear();
+
+      // find where every polygon starts, and collect its edges
+      std::vector<size_t> polyStart;
+      std::vector<std::pair<std::pair<unsigned int,unsigned int>,unsigned int> > edges;
+      edges.reserve(in_Size);
+      for(size_t i=0;i<in_Size;i+=(size_t)in_Polies[i]+1)
+      {
+         unsigned int poly = (unsigned int)polyStart.size();
+         size_t count = (size_t)in_Polies[i];
+         polyStart.push_back(i);
+         for(size_t j=0;j<count;j++)
+         {
+            unsigned int a = (unsigned int)in_Polies[i+1+j];
+            unsigned int b = (unsigned int)in_Polies[i+1+(j+1)%count];
+            edges.push_back(std::pair<std::pair<unsigned int,unsigned int>,unsigned int>(std::pair<unsigned int,unsigned int>(a < b ? a : b,a < b ? b : a),poly));
+         }
+      }
+      size_t polyCount = polyStart.size();
+
+      // join the polygons sharing an edge
+      std::sort(edges.begin(),edges.end());
+      UnionFind polygons(polyCount);
+      for(size_t i=1;i<edges.size();i++)
+      {
+         if(edges[i].first == edges[i-1].first)
+            polygons.Join(edges[i-1].second,edges[i].second);
+      }
+
+      // number the islands by their first polygon, and sort the polygons
+      // by island, keeping their order within each one
+      std::vector<unsigned int> island(polyCount);
+      std::vector<size_t> islandStart;
+      for(size_t i=0;i<polyCount;i++)
+      {
+         unsigned int root = polygons.Find((unsigned int)i);
+         if(root == i)
+         {
+            island[i] = (unsigned int)islandStart.size();
+            islandStart.push_back(0);
+         }
+         else
+            island[i] = island[root];
+         islandStart[island[i]]++;
+      }
+      size_t islandCount = islandStart.size();
+      size_t total = 0;
+      for(size_t k=0;k<islandCount;k++)
+      {
+         size_t count = islandStart[k];
+         islandStart[k] = total;
+         total += count;
+      }
+      std::vector<unsigned int> order(polyCount);
+      for(size_t i=0;i<polyCount;i++)
+         order[islandStart[island[i]]++] = (unsigned int)i;
+
+      // copy the polygons island by island. a point shared by two islands
+      // through a single vertex gets copied into both of them.
+      std::vector<unsigned int> pointIsland(in_PointCount,UINT_MAX);
+      std::vector<unsigned int> pointLocal(in_PointCount);
+      points.reserve(in_PointCount);
+      polies.reserve(in_Size);
+      pointOffsets.reserve(islandCount+1);
+      polyOffsets.reserve(islandCount+1);
+      for(size_t i=0;i<polyCount;i++)
+      {
+         unsigned int poly = order[i];
+         unsigned int k = island[poly];
+         if(pointOffsets.size() == k)
+         {
+            pointOffsets.push_back(points.size());
+            polyOffsets.push_back(polies.size());
+         }
+         size_t start = polyStart[poly];
+         size_t count = (size_t)in_Polies[start];
+         polies.push_back((unsigned int)count);
+         for(size_t j=0;j<count;j++)
+         {
+            unsigned int point = (unsigned int)in_Polies[start+1+j];
+            if(pointIsland[point] != k)
+            {
+               pointIsland[point] = k;
+               pointLocal[point] = (unsigned int)(points.size() - pointOffsets[k]);
+               points.push_back(point);
+            }
+            polies.push_back(pointLocal[point]);
+         }
+      }
+      pointOffsets.push_back(points.size());
+      polyOffsets.push_back(polies.size());
+   }
+};
+
+
+// checks whether a polygon mesh is closed and manifold, straight from its
+// poly description. every edge is hashed into one of many small buckets, and
+// the buckets are then sorted on their own, so an edge is found with all its
+// copies in time linear in the size of the mesh. an edge used once lies on a
+// boundary, an edge used more than twice is non-manifold, and an edge that
+// two polygons walk in the same direction is flipped, since one of them
+// faces the wrong way. the polygons sharing an edge are joined into shells,
+// and a shell with a boundary edge is open. both the hashing and the buckets are spread over all threads on
+// large meshes, the joining of the shells runs on one.
+struct MeshManifold
+{
+   size_t edgeCount;          // the number of distinct edges
+   size_t boundaryEdges;      // the edges used by a single polygon
+   size_t nonManifoldEdges;   // the edges used by more than two polygons
+   size_t flippedEdges;       // the edges walked the same way by both of their polygons
+   size_t shellCount;         // the groups of polygons connected through edges
+   size_t openShellCount;     // the shells with at least one boundary edge
+
+   MeshManifold() : edgeCount(0), boundaryEdges(0), nonManifoldEdges(0), flippedEdges(0), shellCount(0), openShellCount(0) {}
+
+   bool IsClosed() const { return boundaryEdges == 0 && nonManifoldEdges == 0; }
+   bool IsOriented() const { return flippedEdges == 0; }
+
+   // checks a poly description as softimage returns it, the point count of
+   // every polygon followed by its point indices. threads is the number of
+   // threads to use, or zero for all of them.
+   template<class T>
+   void Check(const T * in_Polies, size_t in_Size, int in_Threads = 0)
+   {
+      edgeCount = boundaryEdges = nonManifoldEdges = flippedEdges = shellCount = openShellCount = 0;
+
+      // find where every polygon starts
+      std::vector<size_t> polyStart;
+      size_t edgeTotal = 0;
+      for(size_t i=0;i<in_Size;i+=(size_t)in_Polies[i]+1)
+      {
+         polyStart.push_back(i);
+         edgeTotal += (size_t)in_Polies[i];
+      }
+      int polyCount = (int)polyStart.size();
+      if(polyCount == 0)
+         return;
+
+      // small meshes are not worth the threads
+      int threads = 1;
+#ifdef _OPENMP
+      threads = in_Threads > 0 ? in_Threads : omp_get_max_threads();
+      if(edgeTotal < 65536)
+         threads = 1;
+#endif
+
+      // aim for a handful of edges per bucket
+      int bucketBits = 0;
+      while(bucketBits < 20 && ((size_t)1 << bucketBits) * 8 < edgeTotal)
+         bucketBits++;
+      int bucketCount = 1 << bucketBits;
+
+      // split the polygons into one range per thread, count the edges of
+      // every bucket per range, then scatter them so that every bucket holds
+      // its edges in the order of the polygons. the top bit of the owner
+      // tells which way the polygon walks the edge, until the edge is found. the ranges are fixed up
+      // front, so the offsets stay right whichever thread gets a range, and
+      // however many threads the runtime actually hands out.
+      int rangeCount = threads;
+      std::vector<unsigned int> counts((size_t)rangeCount * bucketCount,0);
+      std::vector<unsigned long long> keys(edgeTotal);
+      std::vector<unsigned int> owners(edgeTotal);
+      int i, r;
+      for(int pass=0;pass<2;pass++)
+      {
+#pragma omp parallel for num_threads(threads) schedule(static)
+         for(r=0;r<rangeCount;r++)
+         {
+            unsigned int * slots = &counts[(size_t)r * bucketCount];
+            int first = (int)((long long)polyCount * r / rangeCount);
+            int last = (int)((long long)polyCount * (r + 1) / rangeCount);
+            for(int p=first;p<last;p++)
+            {
+               size_t start = polyStart[p];
+               size_t count = (size_t)in_Polies[start];
+               for(size_t j=0;j<count;j++)
+               {
+                  unsigned int a = (unsigned int)in_Polies[start+1+j];
+                  unsigned int b = (unsigned int)in_Polies[start+1+(j+1)%count];
+                  unsigned long long key = EdgeKey(a,b);
+                  unsigned int bucket = Bucket(key,bucketBits);
+                  if(pass == 0)
+                     slots[bucket]++;
+                  else
+                  {
+                     unsigned int slot = slots[bucket]++;
+                     keys[slot] = key;
+                     owners[slot] = (unsigned int)p | (a > b ? 0x80000000u : 0u);
+                  }
+               }
+            }
+         }
+
+         // turn the counts into offsets, bucket by bucket and range by
+         // range within each bucket
+         if(pass == 0)
+         {
+            unsigned int offset = 0;
+            for(int b=0;b<bucketCount;b++)
+            {
+               for(int t=0;t<rangeCount;t++)
+               {
+                  unsigned int count = counts[(size_t)t * bucketCount + b];
+                  counts[(size_t)t * bucketCount + b] = offset;
+                  offset += count;
+               }
+            }
+         }
+      }
+
+      // after the scatter the slots of the last range point at the end of
+      // every bucket, and so at the start of the next one
+      std::vector<unsigned int> bucketEnd(counts.begin() + (size_t)(rangeCount - 1) * bucketCount,counts.begin() + (size_t)rangeCount * bucketCount);
+
+      // sort the buckets, and link every edge to the first polygon using it.
+      // the first copy of a boundary edge links to nothing.
+      std::vector<unsigned int> links(edgeTotal);
+      size_t edges = 0, boundary = 0, nonManifold = 0, flipped = 0;
+      int b;
+#pragma omp parallel for num_threads(threads) schedule(dynamic,256) reduction(+:edges,boundary,nonManifold,flipped)
+      for(b=0;b<bucketCount;b++)
+      {
+         unsigned int begin = b == 0 ? 0 : bucketEnd[b-1];
+         unsigned int end = bucketEnd[b];
+         SortBucket(&keys[0],&owners[0],begin,end);
+         for(unsigned int j=begin;j<end;)
+         {
+            unsigned int k = j + 1;
+            while(k < end && keys[k] == keys[j])
+               k++;
+            bool sameWay = k - j == 2 && (owners[j] >> 31) == (owners[j+1] >> 31);
+            for(unsigned int l=j;l<k;l++)
+               owners[l] &= 0x7FFFFFFFu;
+            if((unsigned int)(keys[j] >> 32) == (unsigned int)keys[j])
+            {
+               // a degenerate edge from a repeated point
+               for(unsigned int l=j;l<k;l++)
+                  links[l] = owners[l];
+               j = k;
+               continue;
+            }
+            edges++;
+            if(k - j == 1)
+               boundary++;
+            else if(k - j > 2)
+               nonManifold++;
+            else if(sameWay)
+               flipped++;
+            for(unsigned int l=j;l<k;l++)
+               links[l] = k - j == 1 ? UINT_MAX : owners[j];
+            j = k;
+         }
+      }
+      edgeCount = edges;
+      boundaryEdges = boundary;
+      nonManifoldEdges = nonManifold;
+      flippedEdges = flipped;
+
+      // join the polygons into shells, and mark the shells with a boundary
+      UnionFind shells(polyCount);
+      for(size_t j=0;j<edgeTotal;j++)
+      {
+         if(links[j] != UINT_MAX && links[j] != owners[j])
+            shells.Join(owners[j],links[j]);
+      }
+      std::vector<char> open(polyCount,0);
+      for(size_t j=0;j<edgeTotal;j++)
+      {
+         if(links[j] == UINT_MAX)
+            open[shells.Find(owners[j])] = 1;
+      }
+      for(i=0;i<polyCount;i++)
+      {
+         if(shells.Find((unsigned int)i) != (unsigned int)i)
+            continue;
+         shellCount++;
+         if(open[i])
+            openShellCount++;
+      }
+   }
+
+private:
+   static unsigned long long EdgeKey(unsigned int in_A, unsigned int in_B)
+   {
+      return in_A < in_B ? ((unsigned long long)in_A << 32) | in_B : ((unsigned long long)in_B << 32) | in_A;
+   }
+
+   static unsigned int Bucket(unsigned long long in_Key, int in_Bits)
+   {
+      return in_Bits == 0 ? 0 : (unsigned int)((in_Key * 0x9E3779B97F4A7C15ULL) >> (64 - in_Bits));
+   }
+
+   // sorts the edges of a bucket by their key. the buckets are usually small
+   // enough for an insertion sort, the rare large one gets a real sort.
+   static void SortBucket(unsigned long long * io_Keys, unsigned int * io_Owners, unsigned int in_Begin, unsigned int in_End)
+   {
+      if(in_End - in_Begin > 32)
+      {
+         std::vector<std::pair<unsigned long long,unsigned int> > edges(in_End - in_Begin);
+         for(unsigned int j=in_Begin;j<in_End;j++)
+            edges[j-in_Begin] = std::pair<unsigned long long,unsigned int>(io_Keys[j],io_Owners[j]);
+         std::sort(edges.begin(),edges.end());
+         for(unsigned int j=in_Begin;j<in_End;j++)
+         {
+            io_Keys[j] = edges[j-in_Begin].first;
+            io_Owners[j] = edges[j-in_Begin].second;
+         }
+         return;
+      }
+      for(unsigned int j=in_Begin+1;j<in_End;j++)
+      {
+         unsigned long long key = io_Keys[j];
+         unsigned int owner = io_Owners[j];
+         unsigned int k = j;
+         for(;k>in_Begin && io_Keys[k-1] > key;k--)
+         {
+            io_Keys[k] = io_Keys[k-1];
+            io_Owners[k] = io_Owners[k-1];
+         }
+         io_Keys[k] = key;
+         io_Owners[k] = owner;
+      }
+   }
 };
 
 
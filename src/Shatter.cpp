@@ -0,0 +1,621 @@
+/*
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/lgpl.html>.
+
+   Author:     Helge Mathee      helge.mathee@gmx.net
+   Company:    Studio Nest (TM)
+   Date:       2010 / 09 / 21
+*/
+
+// kratos-shatter fractures a closed mesh by the voronoi cells of a set of
+// seeds, the same way apply_snVoronoi and update_snVoronoi do inside of
+// softimage, but without it, so that many assets can be shattered in batch.
+//
+//    kratos-shatter [options] mesh.obj|mesh.ply seeds.txt pieces.obj
+//
+// the seed file holds one seed per line, either as x y z or as id x y z like
+// the voro++ import format, but not both in one file. the ids have to be
+// unique and not negative, seeds without them are numbered from 0 in the
+// order of the file. the pieces are written as one obj object per cell,
+// named after the id of its seed, and the blob is the same as the one
+// update_snVoronoi stores on the fractured mesh, with the mass properties
+// and the adjacency graph of the pieces, which only holds the pairs that
+// still touch after the clipping, with the area of their contact. the
+// cells themselves can be written as well, with every voronoi vertex and
+// every face between two cells written only once.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "snVoroMain.h"
+
+static void PrintUsage()
+{
+   printf("usage: kratos-shatter [options] mesh.obj|mesh.ply seeds.txt pieces.obj\n");
+   printf("options:\n");
+   printf("   -t <threads>      the number of threads, all cores by default\n");
+   printf("   -g <nx,ny,nz>     the grid of the container, chosen from the seed count by default\n");
+   printf("   -b <file>         also write the voronoi blob of the pieces to a file\n");
+   printf("   -c <file>         also write the unclipped cells to an obj file, with shared vertices and faces\n");
+}
+
+// adds a polygon to the mesh as a fan of triangles, like update_snVoronoi
+// does with the base mesh
+static void AddPolygon(clip_mesh & io_Mesh, const std::vector<int> & in_Polygon)
+{
+   for(size_t i=2;i<in_Polygon.size();i++)
+      io_Mesh.add_triangle(in_Polygon[0],in_Polygon[i-1],in_Polygon[i]);
+}
+
+// reads the vertices and faces of a wavefront obj file, everything else is
+// skipped. the indices can be negative, and carry texture and normal indices.
+static bool ReadObj(const char * in_Path, clip_mesh & out_Mesh)
+{
+   FILE * file = fopen(in_Path,"r");
+   if(file == NULL)
+      return false;
+
+   char line[4096];
+   std::vector<int> polygon;
+   bool ok = true;
+   while(ok && fgets(line,sizeof(line),file) != NULL)
+   {
+      if(line[0] == 'v' && (line[1] == ' ' || line[1] == '\t'))
+      {
+         double x,y,z;
+         if(sscanf(line+2,"%lf %lf %lf",&x,&y,&z) != 3)
+            ok = false;
+         else
+            out_Mesh.add_point(x,y,z);
+      }
+      else if(line[0] == 'f' && (line[1] == ' ' || line[1] == '\t'))
+      {
+         polygon.clear();
+         char * token = strtok(line+2," \t\r\n");
+         while(token != NULL)
+         {
+            int index = atoi(token);
+            index = index < 0 ? out_Mesh.points() + index : index - 1;
+            if(index < 0 || index >= out_Mesh.points())
+               ok = false;
+            polygon.push_back(index);
+            token = strtok(NULL," \t\r\n");
+         }
+         if(ok)
+            AddPolygon(out_Mesh,polygon);
+      }
+   }
+   fclose(file);
+   return ok && out_Mesh.faces() > 0;
+}
+
+// the description of a ply property: its type, or the types of the count and
+// the values if it is a list
+struct PlyProperty
+{
+   std::string name;
+   std::string type;
+   std::string countType;
+   bool isList;
+};
+
+struct PlyElement
+{
+   std::string name;
+   size_t count;
+   std::vector<PlyProperty> properties;
+};
+
+// reads a single value of a ply file, in ascii or little endian binary
+static bool ReadPlyValue(FILE * in_File, bool in_Binary, const std::string & in_Type, double & out_Value)
+{
+   if(!in_Binary)
+      return fscanf(in_File,"%lf",&out_Value) == 1;
+
+   unsigned char bytes[8];
+   size_t size = 4;
+   if(in_Type == "char" || in_Type == "uchar" || in_Type == "int8" || in_Type == "uint8")
+      size = 1;
+   else if(in_Type == "short" || in_Type == "ushort" || in_Type == "int16" || in_Type == "uint16")
+      size = 2;
+   else if(in_Type == "double" || in_Type == "float64")
+      size = 8;
+   if(fread(bytes,1,size,in_File) != size)
+      return false;
+
+   if(in_Type == "char" || in_Type == "int8") out_Value = *(const signed char*)bytes;
+   else if(in_Type == "uchar" || in_Type == "uint8") out_Value = *(const unsigned char*)bytes;
+   else if(in_Type == "short" || in_Type == "int16") out_Value = *(const short*)bytes;
+   else if(in_Type == "ushort" || in_Type == "uint16") out_Value = *(const unsigned short*)bytes;
+   else if(in_Type == "int" || in_Type == "int32") out_Value = *(const int*)bytes;
+   else if(in_Type == "uint" || in_Type == "uint32") out_Value = *(const unsigned int*)bytes;
+   else if(in_Type == "float" || in_Type == "float32") out_Value = *(const float*)bytes;
+   else if(in_Type == "double" || in_Type == "float64") out_Value = *(const double*)bytes;
+   else return false;
+   return true;
+}
+
+// reads the vertices and faces of a ply file, in ascii or little endian
+// binary. all other elements and properties are skipped.
+static bool ReadPly(const char * in_Path, clip_mesh & out_Mesh)
+{
+   FILE * file = fopen(in_Path,"rb");
+   if(file == NULL)
+      return false;
+
+   // parse the header
+   char line[4096];
+   std::vector<PlyElement> elements;
+   bool binary = false;
+   bool ok = fgets(line,sizeof(line),file) != NULL && strncmp(line,"ply",3) == 0;
+   while(ok)
+   {
+      if(fgets(line,sizeof(line),file) == NULL)
+      {
+         ok = false;
+         break;
+      }
+      char word[3][256];
+      int words = sscanf(line,"%255s %255s %255s",word[0],word[1],word[2]);
+      if(words < 1)
+         continue;
+      std::string keyword = word[0];
+      if(keyword == "end_header")
+         break;
+      if(keyword == "format" && words >= 2)
+      {
+         binary = strcmp(word[1],"binary_little_endian") == 0;
+         ok = binary || strcmp(word[1],"ascii") == 0;
+      }
+      else if(keyword == "element" && words >= 3)
+      {
+         PlyElement element;
+         element.name = word[1];
+         element.count = (size_t)atol(word[2]);
+         elements.push_back(element);
+      }
+      else if(keyword == "property" && words >= 3 && !elements.empty())
+      {
+         PlyProperty property;
+         property.isList = strcmp(word[1],"list") == 0;
+         if(property.isList)
+         {
+            char type[256], name[256];
+            ok = sscanf(line,"%*s %*s %255s %255s %255s",word[2],type,name) == 3;
+            property.countType = word[2];
+            property.type = type;
+            property.name = name;
+         }
+         else
+         {
+            property.type = word[1];
+            property.name = word[2];
+         }
+         elements.back().properties.push_back(property);
+      }
+   }
+
+   // read the elements in the order of the header
+   std::vector<int> polygon;
+   for(size_t e=0;ok && e<elements.size();e++)
+   {
+      const PlyElement & element = elements[e];
+      for(size_t i=0;ok && i<element.count;i++)
+      {
+         double position[3] = {0.0,0.0,0.0};
+         polygon.clear();
+         for(size_t p=0;ok && p<element.properties.size();p++)
+         {
+            const PlyProperty & property = element.properties[p];
+            double value;
+            if(property.isList)
+            {
+               ok = ReadPlyValue(file,binary,property.countType,value);
+               int count = (int)value;
+               for(int j=0;ok && j<count;j++)
+               {
+                  ok = ReadPlyValue(file,binary,property.type,value);
+                  if(element.name == "face" && (property.name == "vertex_indices" || property.name == "vertex_index"))
+                     polygon.push_back((int)value);
+               }
+               continue;
+            }
+            ok = ReadPlyValue(file,binary,property.type,value);
+            if(element.name == "vertex")
+            {
+               if(property.name == "x") position[0] = value;
+               else if(property.name == "y") position[1] = value;
+               else if(property.name == "z") position[2] = value;
+            }
+         }
+         if(!ok)
+            break;
+         if(element.name == "vertex")
+            out_Mesh.add_point(position[0],position[1],position[2]);
+         else if(element.name == "face")
+         {
+            for(size_t j=0;j<polygon.size();j++)
+            {
+               if(polygon[j] < 0 || polygon[j] >= out_Mesh.points())
+                  ok = false;
+            }
+            if(ok)
+               AddPolygon(out_Mesh,polygon);
+         }
+      }
+   }
+   fclose(file);
+   return ok && out_Mesh.faces() > 0;
+}
+
+// reads the seeds, as x y z or id x y z per line. empty lines and lines
+// starting with a # are skipped. the first seed decides the format for the
+// whole file, out_Ids stays empty for a file without ids.
+static bool ReadSeeds(const char * in_Path, std::vector<float> & out_Seeds, std::vector<int> & out_Ids)
+{
+   FILE * file = fopen(in_Path,"r");
+   if(file == NULL)
+      return false;
+
+   char line[1024];
+   bool ok = true;
+   int format = 0;
+   while(ok && fgets(line,sizeof(line),file) != NULL)
+   {
+      double v[4];
+      int count = sscanf(line,"%lf %lf %lf %lf",&v[0],&v[1],&v[2],&v[3]);
+      if(count <= 0)
+         continue;
+      if(count < 3)
+      {
+         ok = line[strspn(line," \t")] == '#';
+         continue;
+      }
+      if(format == 0)
+         format = count;
+      if(count != format)
+      {
+         ok = false;
+         continue;
+      }
+      if(count == 4)
+      {
+         ok = v[0] >= 0 && v[0] <= 2147483647.0 && v[0] == (int)v[0];
+         out_Ids.push_back((int)v[0]);
+      }
+      for(int i=count-3;i<count;i++)
+         out_Seeds.push_back((float)v[i]);
+   }
+   fclose(file);
+
+   // the adjacency graph has a row per id, so they have to be unique
+   std::vector<int> sorted(out_Ids);
+   std::sort(sorted.begin(),sorted.end());
+   for(size_t i=1;ok && i<sorted.size();i++)
+      ok = sorted[i] != sorted[i-1];
+   return ok;
+}
+
+// writes the pieces to an obj file, every piece as an object of its own
+// named after the cell it came from
+static bool WriteObj(const char * in_Path, const std::vector<clip_mesh> & in_Pieces, const std::vector<int> & in_Ids)
+{
+   FILE * file = fopen(in_Path,"w");
+   if(file == NULL)
+      return false;
+
+   fprintf(file,"# kratos-shatter\n");
+   int offset = 1;
+   for(size_t i=0;i<in_Pieces.size();i++)
+   {
+      const clip_mesh & piece = in_Pieces[i];
+      if(piece.faces() == 0)
+         continue;
+      fprintf(file,"o piece_%d\n",in_Ids[i]);
+      for(int j=0;j<piece.points();j++)
+         fprintf(file,"v %.9g %.9g %.9g\n",piece.pts[j*3+0],piece.pts[j*3+1],piece.pts[j*3+2]);
+      for(int j=0;j<piece.faces();j++)
+      {
+         fprintf(file,"f");
+         for(int k=0;k<piece.face_size(j);k++)
+            fprintf(file," %d",offset + piece.face(j)[k]);
+         fprintf(file,"\n");
+      }
+      offset += piece.points();
+   }
+   return fclose(file) == 0;
+}
+
+// writes the shared topology of the cells to an obj file. all cells use the
+// same vertex pool, and every cell is an object of its own that lists its
+// faces, each face shared with a neighbor written the way around that the
+// cell sees it.
+static bool WriteCellObj(const char * in_Path, const VoronoiTopology & in_Topology)
+{
+   FILE * file = fopen(in_Path,"w");
+   if(file == NULL)
+      return false;
+
+   fprintf(file,"# kratos-shatter cells\n");
+   for(size_t i=0;i<in_Topology.GetPointCount();i++)
+      fprintf(file,"v %.9g %.9g %.9g\n",in_Topology.points[i*3+0],in_Topology.points[i*3+1],in_Topology.points[i*3+2]);
+   for(size_t i=0;i<in_Topology.GetCellCount();i++)
+   {
+      fprintf(file,"o cell_%d\n",in_Topology.cellIds[i]);
+      for(size_t j=0;j<in_Topology.GetCellFaceCount(i);j++)
+      {
+         size_t face = in_Topology.GetCellFace(i,j);
+         bool flipped = in_Topology.IsCellFaceFlipped(i,j);
+         unsigned int count = in_Topology.GetFacePointCount(face);
+         const unsigned int * loop = in_Topology.GetFacePoints(face);
+         fprintf(file,"f");
+         for(unsigned int k=0;k<count;k++)
+            fprintf(file," %u",1 + loop[flipped ? (count - k) % count : k]);
+         fprintf(file,"\n");
+      }
+   }
+   return fclose(file) == 0;
+}
+
+static bool EndsWith(const char * in_String, const char * in_Suffix)
+{
+   size_t length = strlen(in_String), suffixLength = strlen(in_Suffix);
+   if(suffixLength > length)
+      return false;
+   for(size_t i=0;i<suffixLength;i++)
+   {
+      char c = in_String[length-suffixLength+i];
+      if(c >= 'A' && c <= 'Z')
+         c += 'a' - 'A';
+      if(c != in_Suffix[i])
+         return false;
+   }
+   return true;
+}
+
+int main(int argc, char ** argv)
+{
+   // parse the arguments
+   int threads = 0;
+   int grid[3] = {0,0,0};
+   const char * blobPath = NULL;
+   const char * cellPath = NULL;
+   std::vector<const char*> paths;
+   for(int i=1;i<argc;i++)
+   {
+      if(strcmp(argv[i],"-t") == 0 && i+1 < argc)
+         threads = atoi(argv[++i]);
+      else if(strcmp(argv[i],"-g") == 0 && i+1 < argc)
+      {
+         if(sscanf(argv[++i],"%d,%d,%d",&grid[0],&grid[1],&grid[2]) != 3 || grid[0] < 1 || grid[1] < 1 || grid[2] < 1)
+         {
+            fprintf(stderr,"kratos-shatter: the grid has to be given as nx,ny,nz!\n");
+            return 1;
+         }
+      }
+      else if(strcmp(argv[i],"-b") == 0 && i+1 < argc)
+         blobPath = argv[++i];
+      else if(strcmp(argv[i],"-c") == 0 && i+1 < argc)
+         cellPath = argv[++i];
+      else if(argv[i][0] == '-')
+      {
+         PrintUsage();
+         return 1;
+      }
+      else
+         paths.push_back(argv[i]);
+   }
+   if(paths.size() != 3)
+   {
+      PrintUsage();
+      return 1;
+   }
+
+   // read the mesh and the seeds
+   double startTime = voropp_wall_time();
+   clip_mesh source;
+   bool ok = EndsWith(paths[0],".ply") ? ReadPly(paths[0],source) : ReadObj(paths[0],source);
+   if(!ok)
+   {
+      fprintf(stderr,"kratos-shatter: cannot read the mesh from %s!\n",paths[0]);
+      return 1;
+   }
+   std::vector<float> seeds;
+   std::vector<int> seedIds;
+   if(!ReadSeeds(paths[1],seeds,seedIds) || seeds.empty())
+   {
+      fprintf(stderr,"kratos-shatter: cannot read the seeds from %s, it needs x y z or unique id x y z on every line!\n",paths[1]);
+      return 1;
+   }
+   int seedCount = (int)seeds.size() / 3;
+   printf("kratos-shatter: %d points, %d triangles, %d seeds.\n",source.points(),source.faces(),seedCount);
+
+   // the clipper needs a closed mesh whose polygons all face outwards. a
+   // mesh that is inside out as a whole is turned around, polygons that
+   // face the other way than their neighbors are an error.
+   std::vector<int> polies;
+   for(int i=0;i<source.faces();i++)
+   {
+      polies.push_back(source.face_size(i));
+      polies.insert(polies.end(),source.face(i),source.face(i)+source.face_size(i));
+   }
+   MeshManifold manifold;
+   if(!polies.empty())
+      manifold.Check(&polies[0],polies.size(),threads);
+   if(!manifold.IsClosed() || !manifold.IsOriented())
+   {
+      fprintf(stderr,"kratos-shatter: the mesh is not closed and consistently oriented, it has %d boundary, %d non-manifold and %d flipped edges!\n",
+         (int)manifold.boundaryEdges,(int)manifold.nonManifoldEdges,(int)manifold.flippedEdges);
+      return 1;
+   }
+   fpoint sourceVolume = source.volume();
+   if(sourceVolume == 0)
+   {
+      fprintf(stderr,"kratos-shatter: the mesh has no volume!\n");
+      return 1;
+   }
+   if(sourceVolume < 0)
+   {
+      printf("kratos-shatter: the mesh is inside out, turning it around.\n");
+      source.flip();
+   }
+
+   // the container spans the bounding box of the mesh, plus the same slack
+   // as in the plugin, so that both give the same cells
+   fpoint tol = 0.1;
+   fpoint xa,xb,ya,yb,za,zb;
+   source.bounds(xa,xb,ya,yb,za,zb);
+   xa -= tol; xb += tol;
+   ya -= tol; yb += tol;
+   za -= tol; zb += tol;
+   int nx,ny,nz,memi;
+   voropp_optimal_grid(xa,xb,ya,yb,za,zb,seedCount,nx,ny,nz,memi);
+   if(grid[0] > 0)
+   {
+      nx = grid[0];
+      ny = grid[1];
+      nz = grid[2];
+      memi = int(2*seedCount/(fpoint(nx)*ny*nz))+1;
+      if(memi < 4)
+         memi = 4;
+   }
+
+   // compute the cells on all threads, with their neighbors
+   container con(xa,xb,ya,yb,za,zb,nx,ny,nz,false,false,false,memi,true);
+   con.put_bulk(&seeds[0],seedIds.empty() ? NULL : &seedIds[0],(size_t)seedCount);
+   VoronoiSink cells;
+   con.draw_cells_sink_parallel(&cells,threads,true);
+   double cellTime = voropp_wall_time();
+   printf("kratos-shatter: grid %d x %d x %d, %d cells in %g seconds.\n",nx,ny,nz,(int)cells.GetCellCount(),cellTime-startTime);
+   unsigned long long planesTested,planesSkipped;
+   con.plane_stats(planesTested,planesSkipped);
+   printf("kratos-shatter: the cell bounds skipped %llu of %llu plane cuts.\n",planesSkipped,planesTested);
+
+   // the cells share their faces with their neighbors, so they are written
+   // with every vertex and face only once
+   if(cellPath != NULL)
+   {
+      VoronoiTopology topology;
+      topology.SetFromSink(cells);
+      printf("kratos-shatter: the cells share %d vertices and %d faces, instead of %d and %d.\n",
+         (int)topology.GetPointCount(),(int)topology.GetFaceCount(),(int)(cells.points.size()/3),(int)cells.neighbors.size());
+      if(!WriteCellObj(cellPath,topology))
+      {
+         fprintf(stderr,"kratos-shatter: cannot write the cells to %s!\n",cellPath);
+         return 1;
+      }
+   }
+
+   // turn the cells into meshes for the clipper
+   size_t cellCount = cells.GetCellCount();
+   std::vector<clip_mesh> cellMeshes(cellCount);
+   std::vector<int> face;
+   std::vector<fpoint> mass(cellCount*10);
+   for(size_t i=0;i<cellCount;i++)
+   {
+      const float * cellPoints = &cells.points[cells.pointOffsets[i]*3];
+      for(size_t j=0;j<cells.pointCounts[i];j++)
+         cellMeshes[i].add_point(cellPoints[j*3+0],cellPoints[j*3+1],cellPoints[j*3+2]);
+      const unsigned int * values = &cells.polies[cells.polyOffsets[i]];
+      for(size_t j=0;j<cells.polyCounts[i];j+=values[j]+1)
+      {
+         face.assign(values+j+1,values+j+1+values[j]);
+         if(face.size() >= 3)
+            cellMeshes[i].add_face(&face[0],(int)face.size());
+      }
+
+      // the mass properties of the cells come from the container, the
+      // clipping only has to correct them for the cells that it cuts
+      if(i < cells.masses.size())
+      {
+         const VoronoiMassEntry & cellMass = cells.masses[i];
+         mass[i*10+0] = cellMass.volume;
+         for(int j=0;j<3;j++)
+            mass[i*10+1+j] = cellMass.centroid[j];
+         for(int j=0;j<6;j++)
+            mass[i*10+4+j] = cellMass.inertia[j];
+      }
+      else
+         cellMeshes[i].mass_properties(&mass[i*10]);
+   }
+
+   // clip the mesh by all cells, on all threads
+   std::vector<clip_mesh> pieces;
+   int cellClasses[3];
+   clip_cells(source,cellMeshes,pieces,threads,cellClasses,cellCount > 0 ? &mass[0] : NULL);
+   double clipTime = voropp_wall_time();
+   printf("kratos-shatter: %d cells inside, %d outside, %d clipped in %g seconds.\n",
+      cellClasses[clip_inside],cellClasses[clip_outside],cellClasses[clip_straddling],clipTime-cellTime);
+
+   if(!WriteObj(paths[2],pieces,cells.cellIds))
+   {
+      fprintf(stderr,"kratos-shatter: cannot write the pieces to %s!\n",paths[2]);
+      return 1;
+   }
+
+   // the blob holds the pieces the same way update_snVoronoi stores them,
+   // together with the adjacency graph of the cells
+   if(blobPath != NULL)
+   {
+      VoronoiSink out;
+      for(size_t i=0;i<pieces.size();i++)
+      {
+         out.AddCell(cells.cellIds[i]);
+         for(int j=0;j<pieces[i].points();j++)
+            out.AddPoint((float)pieces[i].pts[j*3+0],(float)pieces[i].pts[j*3+1],(float)pieces[i].pts[j*3+2]);
+         for(int j=0;j<pieces[i].faces();j++)
+         {
+            out.AddPolyValue((size_t)pieces[i].face_size(j));
+            for(int k=0;k<pieces[i].face_size(j);k++)
+               out.AddPolyValue((size_t)pieces[i].face(j)[k]);
+         }
+
+         VoronoiMassEntry pieceMass;
+         pieceMass.volume = (float)mass[i*10+0];
+         for(int j=0;j<3;j++)
+            pieceMass.centroid[j] = (float)mass[i*10+1+j];
+         for(int j=0;j<6;j++)
+            pieceMass.inertia[j] = (float)mass[i*10+4+j];
+         out.SetMassProperties(pieceMass);
+      }
+
+      // the graph of the pieces: the cells tell which pieces can touch, and
+      // the contacts are measured on the pieces themselves
+      VoronoiAdjacency cellGraph, adjacency;
+      cells.GetAdjacency(cellGraph);
+      std::vector<int> pairs;
+      cellGraph.GetCellPairs(pairs);
+      std::vector<fpoint> areas;
+      clip_contacts(cellMeshes,pieces,pairs,areas,threads);
+      adjacency.SetFromPairs(cellGraph.cellIds,pairs,areas);
+      unsigned char * buffer;
+      size_t size = out.GetAsBuffer(&buffer,&adjacency);
+      FILE * file = fopen(blobPath,"wb");
+      ok = file != NULL && fwrite(buffer,1,size,file) == size;
+      if(file != NULL)
+         ok = fclose(file) == 0 && ok;
+      free(buffer);
+      if(!ok)
+      {
+         fprintf(stderr,"kratos-shatter: cannot write the blob to %s!\n",blobPath);
+         return 1;
+      }
+   }
+
+   printf("kratos-shatter: done in %g seconds.\n",voropp_wall_time()-startTime);
+   return 0;
+}
@@ -74,6 +74,13 @@
 #include <xsi_progressbar.h>
 #include <xsi_geometryaccessor.h>
 #include <xsi_userdatablob.h>
+#include <xsi_argument.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 #include <Essence/snTriangleMesh.h>
 #include <Essence/snTimer.h>
@@ -137,18 +144,38 @@ XSIPLUGINCALLBACK CStatus apply_snVoronoi_Execute( CRef& in_ctxt )
       return CStatus::OK;
    }
 
-   // let's check to ensure the mesh is closed and triangulated
+   // let's check to ensure the mesh is closed, straight on the poly
+   // description, which is a lot faster than asking every vertex
    PolygonMesh geo(Primitive(l_pMesh).GetGeometry());
-   CVertexRefArray points(geo.GetVertices());
-   CPolygonFaceRefArray polies(geo.GetPolygons());
-   for(LONG i=0;i<points.GetCount();i++)
+   CVector3Array geoPos;
+   CLongArray geoPolies;
+   geo.Get(geoPos,geoPolies);
+   MeshManifold manifold;
+   if(geoPolies.GetCount() > 0)
+      manifold.Check(&geoPolies[0],(size_t)geoPolies.GetCount());
+   Application().LogMessage(L"snVoronoi: "+CValue((LONG)manifold.edgeCount).GetAsText()+L" edges, "+
+      CValue((LONG)manifold.boundaryEdges).GetAsText()+L" boundary, "+
+      CValue((LONG)manifold.nonManifoldEdges).GetAsText()+L" non-manifold, "+
+      CValue((LONG)manifold.flippedEdges).GetAsText()+L" flipped, "+
+      CValue((LONG)manifold.openShellCount).GetAsText()+L" of "+CValue((LONG)manifold.shellCount).GetAsText()+L" shells open.",siVerboseMsg);
+   if(manifold.boundaryEdges > 0 || manifold.shellCount == 0)
    {
-      Vertex point(points[i]);
-      if(point.GetIsBoundary())
-      {
-         Application().LogMessage(L"Please ensure that the mesh is closed (no boundaries)!",XSI::siErrorMsg);
-         return CStatus::Fail;
-      }
+      Application().LogMessage(L"Please ensure that the mesh is closed (no boundaries)! "+
+         CValue((LONG)manifold.boundaryEdges).GetAsText()+L" boundary edges on "+
+         CValue((LONG)manifold.openShellCount).GetAsText()+L" open shells.",XSI::siErrorMsg);
+      return CStatus::Fail;
+   }
+   if(manifold.nonManifoldEdges > 0)
+   {
+      Application().LogMessage(L"Please ensure that the mesh is manifold! "+
+         CValue((LONG)manifold.nonManifoldEdges).GetAsText()+L" edges are shared by more than two polygons.",XSI::siErrorMsg);
+      return CStatus::Fail;
+   }
+   if(manifold.flippedEdges > 0)
+   {
+      Application().LogMessage(L"Please ensure that all polygons of the mesh face the same way! "+
+         CValue((LONG)manifold.flippedEdges).GetAsText()+L" edges lie between polygons facing opposite ways.",XSI::siErrorMsg);
+      return CStatus::Fail;
    }
 
    // let's check that it has a zero transform
@@ -222,20 +249,6 @@ XSIPLUGINCALLBACK CStatus apply_snVoronoi_Execute( CRef& in_ctxt )
    newOp.AddInputPort(myBlob);
    newOp.Connect();
 
-   // cool now let's bool this!
-   cmdArgs.Resize(6);
-   cmdArgs[0] = L"BooleanGenIntersection";
-   cmdArgs[1] = L"";
-   cmdArgs[2] = Primitive(cellMesh).GetParent3DObject().GetFullName()+L";"+Primitive(l_pMesh).GetParent3DObject().GetFullName();
-   cmdArgs[3] = (LONG)3;
-   cmdArgs[4] = siPersistentOperation;
-   cmdArgs[5] = siKeepGenOpInputs;
-   Application().ExecuteCommand(L"ApplyGenOp",cmdArgs,returnVal);
-
-   // we will have the boolean now in the selection
-   X3DObject boolMesh(Application().GetSelection().GetItem(0));
-   boolMesh.PutName(X3DObject(Primitive(l_pMesh).GetParent()).GetName()+L"_Booler");
-
    // let's create the final mesh!
    cmdArgs.Resize(1);
    cmdArgs[0] = L"EmptyPolygonMesh";
@@ -248,9 +261,9 @@ XSIPLUGINCALLBACK CStatus apply_snVoronoi_Execute( CRef& in_ctxt )
    // name the output mesh according to the source object
    X3DObject(Primitive(finalMesh).GetParent()).PutName(X3DObject(Primitive(l_pMesh).GetParent()).GetName()+L"_Fractured");
 
-   // hide the booler and the single cell
+   // hide the base mesh and the single cell
    cmdArgs.Resize(1);
-   cmdArgs[0] = Primitive(l_pMesh).GetParent().GetAsText()+L","+boolMesh.GetFullName()+L","+Primitive(cellMesh).GetParent().GetAsText();
+   cmdArgs[0] = Primitive(l_pMesh).GetParent().GetAsText()+L","+Primitive(cellMesh).GetParent().GetAsText();
    Application().ExecuteCommand(L"ToggleVisibility",cmdArgs,returnVal);
 
    // select the final mesh
@@ -332,10 +345,6 @@ XSIPLUGINCALLBACK CStatus update_snVoronoi_Execute( CRef& in_ctxt )
 
    CRef test;
 
-   // get the current frame
-   test.Set(L"PlayControl.Current");
-   LONG currentFrame = Parameter(test).GetValue();
-
    // try to find the user data blob
    test.Set(CString(baseName.GetAsWChar())+L"_Fractured.voronoiData");
    if(!test.IsValid())
@@ -363,145 +372,220 @@ XSIPLUGINCALLBACK CStatus update_snVoronoi_Execute( CRef& in_ctxt )
    }
    UserDataBlob udb2(test);
 
-   // try to find the single cell mesh
-   test.Set(CString(baseName.GetAsWChar())+L"_SingleCell");
-   if(!test.IsValid())
-   {
-      Application().LogMessage(L"Cannot find the corresponding singlecell mesh!",siErrorMsg);
-      return CStatus::OK;
-   }
-   X3DObject meshSingleCell(test);
-
-   // try to find the voronoi op
-   test.Set(meshSingleCell.GetFullName()+L".polymsh.snVoronoiCell");
-   if(!test.IsValid())
-   {
-      Application().LogMessage(L"The single cell mesh doesn't have a voronoi operator applied!",siErrorMsg);
-      return CStatus::OK;
-   }
-   CustomOperator voronoiOp(test);
-
-   // try to find the boolean mesh
-   test.Set(CString(baseName.GetAsWChar())+L"_Booler");
-   if(!test.IsValid())
-   {
-      Application().LogMessage(L"Cannot find the corresponding booler mesh!",siErrorMsg);
-      return CStatus::OK;
-   }
-   X3DObject meshBooler(test);
-
    // get the levels of undo
    test.Set("preferences.General.undo");
    Parameter undoParam(test);
    LONG currentUndos = undoParam.GetValue();
    undoParam.PutValue(0);
 
-   // access the userdatablob to find out how many cells we have
+   // access the userdatablob to find the cells
    const unsigned char * buffer;
    unsigned int bufferSize;
    udb2.GetValue(buffer,bufferSize);
    if(bufferSize==0)
+   {
+      undoParam.PutValue(currentUndos);
       return CStatus::Unexpected;
+   }
+
+   VoronoiInfoView info;
+   if(!info.SetFromBuffer(buffer,bufferSize))
+   {
+      Application().LogMessage(L"The userdatablob on the base mesh is corrupt!",siErrorMsg);
+      undoParam.PutValue(currentUndos);
+      return CStatus::OK;
+   }
 
-   // create a voronoi info to init it
-   VoronoiInfo info;
-   info.SetFromBuffer(buffer,bufferSize);
-   LONG cellCount = (LONG)info.points.size();
+   // the pieces are final, so they must not be cut from the cells of a
+   // single precision preview
+   if(info.IsSinglePrecision())
+   {
+      Application().LogMessage(L"The cells on the base mesh are a single precision preview, please turn off 'Single Precision Preview' first!",siErrorMsg);
+      undoParam.PutValue(currentUndos);
+      return CStatus::OK;
+   }
+
+   size_t cellCount = info.GetCellCount();
+
+   // the base mesh is closed, so it can be clipped by the cells directly
+   PolygonMesh baseGeo(meshBase.GetActivePrimitive().GetGeometry());
+   CVector3Array basePos;
+   CLongArray basePolies;
+   baseGeo.Get(basePos,basePolies);
+
+   clip_mesh source;
+   for(LONG i=0;i<basePos.GetCount();i++)
+      source.add_point(basePos[i].GetX(),basePos[i].GetY(),basePos[i].GetZ());
+   for(LONG i=0;i<basePolies.GetCount();i+=basePolies[i]+1)
+   {
+      // split the polygons into fans, in case the mesh is not triangulated
+      for(LONG j=2;j<basePolies[i];j++)
+         source.add_triangle(basePolies[i+1],basePolies[i+j],basePolies[i+j+1]);
+   }
 
-   // show the cut piece
-   cmdArgs.Resize(1);
-   cmdArgs[0] = meshSingleCell.GetFullName();
-   Application().ExecuteCommand(L"ToggleVisibility",cmdArgs,returnVal);
+   // the clipper relies on all polygons facing outwards. polygons that face
+   // the other way than their neighbors can't be told apart, but a mesh that
+   // is inside out as a whole only needs to be turned around.
+   MeshManifold manifold;
+   if(basePolies.GetCount() > 0)
+      manifold.Check(&basePolies[0],(size_t)basePolies.GetCount());
+   if(!manifold.IsClosed() || !manifold.IsOriented())
+   {
+      Application().LogMessage(L"The base mesh is not closed, or its polygons face different ways!",siErrorMsg);
+      undoParam.PutValue(currentUndos);
+      return CStatus::OK;
+   }
+   fpoint sourceVolume = source.volume();
+   if(sourceVolume == 0)
+   {
+      Application().LogMessage(L"The base mesh has no volume!",siErrorMsg);
+      undoParam.PutValue(currentUndos);
+      return CStatus::OK;
+   }
+   if(sourceVolume < 0)
+   {
+      Application().LogMessage(L"The base mesh is inside out, turning it around for the clipping.",siWarningMsg);
+      source.flip();
+   }
 
-   // now we have everything we need
+   // decode all cells from the blob
+   std::vector<clip_mesh> cells(cellCount);
+   std::vector<int> face;
+   for(size_t cellIndex=0;cellIndex<cellCount;cellIndex++)
+   {
+      if(!info.IsCellValid(cellIndex))
+      {
+         Application().LogMessage(L"The userdatablob on the base mesh is corrupt!",siErrorMsg);
+         undoParam.PutValue(currentUndos);
+         return CStatus::OK;
+      }
+
+      const float * cellPoints = info.GetPoints(cellIndex);
+      for(size_t i=0;i<info.GetPointCount(cellIndex);i++)
+         cells[cellIndex].add_point(cellPoints[i*3+0],cellPoints[i*3+1],cellPoints[i*3+2]);
+
+      size_t polyCount = info.GetPolyCount(cellIndex);
+      for(size_t i=0;i<polyCount;)
+      {
+         size_t count = info.GetPolyValue(cellIndex,i++);
+         face.clear();
+         for(size_t j=0;j<count && i<polyCount;j++)
+            face.push_back((int)info.GetPolyValue(cellIndex,i++));
+         if(face.size() >= 3)
+            cells[cellIndex].add_face(&face[0],(int)face.size());
+      }
+   }
+
+   Application().LogMessage(L"Clipping the base mesh by "+CValue((LONG)cellCount).GetAsText()+L" cells...",siVerboseMsg);
+   double startTime = voropp_wall_time();
+
+   // the mass properties of the cells come with the blob, the clipping only
+   // has to correct them for the cells that it cuts
+   std::vector<fpoint> mass(cellCount*10);
+   for(size_t i=0;i<cellCount;i++)
+   {
+      if(info.HasMassProperties())
+      {
+         const VoronoiMassEntry & cellMass = info.GetMassProperties(i);
+         mass[i*10+0] = cellMass.volume;
+         for(int j=0;j<3;j++)
+            mass[i*10+1+j] = cellMass.centroid[j];
+         for(int j=0;j<6;j++)
+            mass[i*10+4+j] = cellMass.inertia[j];
+      }
+      else
+         cells[i].mass_properties(&mass[i*10]);
+   }
+
+   // clip the base mesh by the cells on all cores, a batch of cells at a
+   // time, so that the progress bar moves and the user can cancel
    ProgressBar prog = Application().GetUIToolkit().GetProgressBar();
    prog.PutMinimum(0);
-   prog.PutMaximum(cellCount);
+   prog.PutMaximum((LONG)cellCount);
    prog.PutVisible(true);
    prog.PutCaption(L"Creating volume shatter elements...");
    prog.PutCancelEnabled(true);
 
-   // prepare the command args for a refresh!
-   cmdArgs.Resize(1);
-   cmdArgs[0] = currentFrame;
-
-   snEssence::snMesh mergedMesh;
-
-   for(LONG cellIndex=0; cellIndex < cellCount; cellIndex++)
+   const size_t batchSize = 256;
+   cell_clipper clipper(source);
+   std::vector<clip_mesh> pieces(cellCount);
+   for(size_t first=0;first<cellCount;first+=batchSize)
    {
       // check if we need to abort
       if(prog.IsCancelPressed())
-         return CStatus::Abort;
-
-      // set the index on the custom op
-      voronoiOp.PutParameterValue(L"cellIndex",cellIndex);
-
-      // refresh the scene
-      Application().ExecuteCommand(L"Refresh",cmdArgs,returnVal);
-
-      Application().LogMessage(L"Computing Voronoi Cell "+CValue(cellIndex).GetAsText()+L"...",siVerboseMsg);
-
-      // now gather the mesh from the boolean
-      Primitive primBool = meshBooler.GetActivePrimitive();
-      PolygonMesh mesh = primBool.GetGeometry();
-      CVector3Array pos;
-      CLongArray polies;
-      mesh.Get(pos,polies);
-
-      Application().LogMessage(L"Received booled cell "+CValue(cellIndex).GetAsText()+L"...",siVerboseMsg);
-
-      // skip empty meshes...
-      if(pos.GetCount() == 0 || polies.GetCount() == 0)
       {
-         Application().LogMessage(L"Skipped empty cell "+CValue(cellIndex).GetAsText()+L".",siVerboseMsg);
-         continue;
+         prog.PutVisible(false);
+         undoParam.PutValue(currentUndos);
+         return CStatus::Abort;
       }
 
-      // create an essence mesh to merge this one
-      snEssence::snMesh singleMesh;
+      size_t last = std::min(first+batchSize,cellCount);
+      clipper.clip(cells,pieces,(int)first,(int)last,&mass[0]);
+      prog.Increment((LONG)(last-first));
+   }
+   prog.PutVisible(false);
 
-      for(LONG i=0;i<pos.GetCount();i++)
-         singleMesh.AddPoint(snEssence::snVector3f((float)pos[i].GetX(),(float)pos[i].GetY(),(float)pos[i].GetZ()));
+   // only the cells straddling the surface need an actual clip
+   Application().LogMessage(L"Cells inside: "+CValue((LONG)clipper.counts[clip_inside]).GetAsText()+
+      L", outside: "+CValue((LONG)clipper.counts[clip_outside]).GetAsText()+
+      L", straddling: "+CValue((LONG)clipper.counts[clip_straddling]).GetAsText(),siVerboseMsg);
 
-      Application().LogMessage(L"Copied points for cell "+CValue(cellIndex).GetAsText()+L"...",siVerboseMsg);
+   Application().LogMessage(L"Done. All Cells computed in "+CValue(voropp_wall_time()-startTime).GetAsText()+L" seconds.",siVerboseMsg);
 
-      LONG count = 0;
-      snEssence::snPolygon * poly = NULL;
-      for(LONG i=0;i<polies.GetCount();i++)
+   // the pieces only touch where their cells share a face, and only as much
+   // of that face as the clipping left on both of them. the graph of the
+   // cells tells which pairs to look at, the contacts are measured on the
+   // pieces, so empty pieces and faces that lie outside the mesh drop out.
+   VoronoiAdjacency pieceGraph;
+   if(info.HasAdjacency())
+   {
+      VoronoiAdjacency cellGraph;
+      info.GetAdjacency(cellGraph);
+      std::vector<int> pairs;
+      cellGraph.GetCellPairs(pairs);
+      std::vector<fpoint> areas;
+      clip_contacts(cells,pieces,pairs,areas);
+      pieceGraph.SetFromPairs(cellGraph.cellIds,pairs,areas);
+   }
+   else
+      Application().LogMessage(L"The cells have no adjacency graph, the pieces are stored without one.",siVerboseMsg);
+
+   // store the pieces straight into the output, in the order of the cells,
+   // every piece as a cell of its own with its mass properties next to it
+   VoronoiSink outInfo;
+   size_t pointTotal = 0;
+   size_t indexTotal = 0;
+   for(size_t i=0;i<pieces.size();i++)
+   {
+      pointTotal += pieces[i].points();
+      indexTotal += pieces[i].vi.size() + pieces[i].faces();
+   }
+   outInfo.points.reserve(pointTotal*3);
+   outInfo.polies.reserve(indexTotal);
+   for(size_t i=0;i<pieces.size();i++)
+   {
+      outInfo.AddCell(info.GetCellId(i));
+      for(int j=0;j<pieces[i].points();j++)
+         outInfo.AddPoint((float)pieces[i].pts[j*3+0],(float)pieces[i].pts[j*3+1],(float)pieces[i].pts[j*3+2]);
+      for(int j=0;j<pieces[i].faces();j++)
       {
-         if(count == 0)
-         {
-            count = polies[i];
-            poly = singleMesh.AddPolygon();
-         }
-         else
-         {
-            poly->AddPointByIndex((size_t)polies[i]);
-            count--;
-         }
+         outInfo.AddPolyValue((size_t)pieces[i].face_size(j));
+         for(int k=0;k<pieces[i].face_size(j);k++)
+            outInfo.AddPolyValue((size_t)pieces[i].face(j)[k]);
       }
 
-      Application().LogMessage(L"Copied polygons for cell "+CValue(cellIndex).GetAsText()+L"...",siVerboseMsg);
-
-      // merge the mesh
-      mergedMesh.Merge(&singleMesh);
-      Application().LogMessage(L"Merged booled Cell "+CValue(cellIndex).GetAsText()+L".",siVerboseMsg);
-
-      prog.Increment();
+      VoronoiMassEntry pieceMass;
+      pieceMass.volume = (float)mass[i*10+0];
+      for(int j=0;j<3;j++)
+         pieceMass.centroid[j] = (float)mass[i*10+1+j];
+      for(int j=0;j<6;j++)
+         pieceMass.inertia[j] = (float)mass[i*10+4+j];
+      outInfo.SetMassProperties(pieceMass);
    }
 
-   prog.PutVisible(false);
-
-   Application().LogMessage(L"Done. All Cells computed.",siVerboseMsg);
-
-   // we have all the data, output it
-   VoronoiInfo outInfo;
-   outInfo.points.push_back(mergedMesh.GetPoints());
-   outInfo.polies.push_back(mergedMesh.GetPointIndicesCombined());
-
    // set the result on the fractured mesh!
    unsigned char * outBuffer;
-   size_t size = outInfo.GetAsBuffer(&outBuffer);
+   size_t size = outInfo.GetAsBuffer(&outBuffer,info.HasAdjacency() ? &pieceGraph : NULL);
 
    // save the buffer
    udb1.PutValue(outBuffer,size);
@@ -518,11 +602,6 @@ XSIPLUGINCALLBACK CStatus update_snVoronoi_Execute( CRef& in_ctxt )
 
    Application().LogMessage(L"Voronoi update finished.",siVerboseMsg);
 
-   // show the cut piece
-   cmdArgs.Resize(1);
-   cmdArgs[0] = meshSingleCell.GetFullName();
-   Application().ExecuteCommand(L"ToggleVisibility",cmdArgs,returnVal);
-
    // restore the undo setting
    undoParam.PutValue(currentUndos);
 
@@ -538,6 +617,18 @@ XSIPLUGINCALLBACK CStatus snVoronoi_Define( CRef& in_ctxt )
    CRef oPDef;
    Factory oFactory = Application().GetFactory();
    oCustomOperator = ctxt.GetSource();
+
+   oPDef = oFactory.CreateParamDef(L"calibrate",CValue::siBool,siPersistable,L"calibrate",L"calibrate",false,CValue(),CValue(),CValue(),CValue());
+   oCustomOperator.AddParameter(oPDef,oParam);
+   oPDef = oFactory.CreateParamDef(L"async",CValue::siBool,siPersistable,L"async",L"async",false,CValue(),CValue(),CValue(),CValue());
+   oCustomOperator.AddParameter(oPDef,oParam);
+   oPDef = oFactory.CreateParamDef(L"preview",CValue::siBool,siPersistable,L"preview",L"preview",false,CValue(),CValue(),CValue(),CValue());
+   oCustomOperator.AddParameter(oPDef,oParam);
+
+   // bumped by the timer when a background result is ready, it is not part
+   // of the layout
+   oPDef = oFactory.CreateParamDef(L"generation",CValue::siInt4,0,L"generation",L"generation",0,CValue(),CValue(),CValue(),CValue());
+   oCustomOperator.AddParameter(oPDef,oParam);
 
    oCustomOperator.PutAlwaysEvaluate(false);
    oCustomOperator.PutDebug(0);
@@ -551,12 +642,409 @@ XSIPLUGINCALLBACK CStatus snVoronoi_DefineLayout( CRef& in_ctxt )
    PPGItem oItem;
    oLayout = ctxt.GetSource();
    oLayout.Clear();
+   oLayout.AddItem(L"calibrate",L"Log Grid Calibration");
+   oLayout.AddItem(L"async",L"Compute in Background");
+   oLayout.AddItem(L"preview",L"Single Precision Preview");
+   return CStatus::OK;
+}
+
+// a 64 bit FNV-1a hash over a block of memory, continuing from an earlier one
+static unsigned long long snVoronoiHash(unsigned long long in_Hash, const void * in_pData, size_t in_Size)
+{
+   const unsigned char * bytes = (const unsigned char*)in_pData;
+   for(size_t i=0;i<in_Size;i++)
+   {
+      in_Hash ^= bytes[i];
+      in_Hash *= 1099511628211ULL;
+   }
+   return in_Hash;
+}
+
+// a lock around the results of the background worker, on top of the
+// platform's own threads
+struct snVoronoiLock
+{
+#ifdef _WIN32
+   CRITICAL_SECTION section;
+   snVoronoiLock() { InitializeCriticalSection(&section); }
+   ~snVoronoiLock() { DeleteCriticalSection(&section); }
+   void Lock() { EnterCriticalSection(&section); }
+   void Unlock() { LeaveCriticalSection(&section); }
+#else
+   pthread_mutex_t mutex;
+   snVoronoiLock() { pthread_mutex_init(&mutex,NULL); }
+   ~snVoronoiLock() { pthread_mutex_destroy(&mutex); }
+   void Lock() { pthread_mutex_lock(&mutex); }
+   void Unlock() { pthread_mutex_unlock(&mutex); }
+#endif
+};
+
+// what an evaluation did, so it can be logged on the main thread
+struct snVoronoiStats
+{
+   bool rebuilt;
+   bool single;
+   int changedCount;
+   int dirtyCount;
+   int computedCount;
+   size_t cellCount;
+   size_t pairCount;
+   double seconds;
+   unsigned long long planesTested;
+   unsigned long long planesSkipped;
+   unsigned long long arenaCells;
+   unsigned long long arenaAllocations;
+   size_t arenaPeak;
+   int mismatchCount;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI snVoronoiWorkerMain(LPVOID in_pState);
+#else
+static void * snVoronoiWorkerMain(void * in_pState);
+#endif
+
+// the state the snVoronoi operator keeps between evaluations, so that only
+// the cells around the seeds that changed need to be computed again. it also
+// keeps the last blob with a hash of the inputs it was computed from, so an
+// evaluation with the same inputs doesn't compute anything at all.
+//
+// in asynchronous mode the cells are computed by a worker thread, while the
+// operator keeps putting out the last finished blob. the worker owns the
+// container and the cache while it runs, and leaves its result in a second
+// blob. the timer picks that up on the main thread and dirties the operator,
+// which then swaps the two blobs. a change of the inputs cancels the worker
+// and starts a new one.
+//
+// the cells are computed in double precision, or in single precision for a
+// preview, which keeps the seeds in half the memory. only the container and
+// the cache of one precision are alive at a time.
+struct snVoronoiState
+{
+   container * con;
+   voropp_cell_cache<radius_mono> * cache;
+   container_base<radius_mono_base<float> > * conf;
+   voropp_cell_cache<radius_mono_base<float> > * cachef;
+   VoronoiAdjacency adjacency;
+   fpoint xa,xb,ya,yb,za,zb;
+   int nx,ny,nz,memi;
+   std::vector<float> seeds;
+   unsigned long long hash;            // the hash of the inputs of the front blob
+   std::vector<unsigned char> blob;    // the front blob, the last finished result
+
+   // the background evaluation
+   CString opName;                     // the operator to dirty once the back blob is ready
+   bool working;                       // whether the worker thread has to be joined
+   volatile int cancel;
+#ifdef _WIN32
+   HANDLE thread;
+#else
+   pthread_t thread;
+#endif
+   std::vector<float> jobSeeds;
+   fpoint jobBounds[6];
+   bool jobSingle;
+   unsigned long long jobHash;
+   snVoronoiLock lock;                 // guards everything below
+   bool backReady;
+   bool notify;
+   std::vector<unsigned char> back;
+   unsigned long long backHash;
+   snVoronoiStats backStats;
+
+   snVoronoiState() : con(NULL), cache(NULL), conf(NULL), cachef(NULL), hash(0), working(false), cancel(0), jobSingle(false), jobHash(0), backReady(false), notify(false), backHash(0) {}
+   ~snVoronoiState() { Stop(); Clear(); }
+
+   void Clear()
+   {
+      // the caches refer to the containers, so they have to go first
+      delete cache;
+      cache = NULL;
+      delete con;
+      con = NULL;
+      delete cachef;
+      cachef = NULL;
+      delete conf;
+      conf = NULL;
+      seeds.clear();
+   }
+
+   // computes the cells for a set of seeds, reusing as much of the last
+   // evaluation as possible, and writes the blob. this doesn't touch the
+   // softimage api, so it can run on any thread. it returns false if it
+   // was cancelled.
+   bool Compute(std::vector<float> & io_Seeds, const fpoint * in_Bounds, bool in_Single, volatile int * in_pCancel, snVoronoiStats & out_Stats, std::vector<unsigned char> & out_Blob)
+   {
+      out_Stats.single = in_Single;
+      if(in_Single)
+         return ComputeWith(conf,cachef,io_Seeds,in_Bounds,in_pCancel,out_Stats,out_Blob);
+      return ComputeWith(con,cache,io_Seeds,in_Bounds,in_pCancel,out_Stats,out_Blob);
+   }
+
+   // the body of Compute, for the container and the cache of one precision.
+   // switching the precision starts over, since the container of the other
+   // one is missing then.
+   template<class r_option>
+   bool ComputeWith(container_base<r_option> *& io_Con, voropp_cell_cache<r_option> *& io_Cache, std::vector<float> & io_Seeds, const fpoint * in_Bounds, volatile int * in_pCancel, snVoronoiStats & out_Stats, std::vector<unsigned char> & out_Blob)
+   {
+      fpoint bxa = in_Bounds[0], bxb = in_Bounds[1];
+      fpoint bya = in_Bounds[2], byb = in_Bounds[3];
+      fpoint bza = in_Bounds[4], bzb = in_Bounds[5];
+      int seedCount = (int)io_Seeds.size() / 3;
+
+      // check how many seeds changed since the last evaluation. if the mesh
+      // moved, or a lot of seeds changed, we start over with a new container
+      bool rebuild = io_Con == NULL ||
+         bxa != xa || bxb != xb || bya != ya ||
+         byb != yb || bza != za || bzb != zb;
+      int oldCount = (int)seeds.size() / 3;
+      int commonCount = oldCount < seedCount ? oldCount : seedCount;
+      int changedCount = 0;
+      if(!rebuild)
+      {
+         changedCount = oldCount > seedCount ? oldCount - seedCount : seedCount - oldCount;
+         for(int i=0;i<commonCount*3;i+=3)
+         {
+            if(io_Seeds[i] != seeds[i] || io_Seeds[i+1] != seeds[i+1] || io_Seeds[i+2] != seeds[i+2])
+               changedCount++;
+         }
+         if(changedCount * 4 > seedCount)
+            rebuild = true;
+      }
+
+      if(rebuild)
+      {
+         Clear();
+
+         // choose the grid from the seed count and the shape of the box, so that
+         // every block only holds a few seeds
+         voropp_optimal_grid(bxa,bxb,bya,byb,bza,bzb,seedCount,nx,ny,nz,memi);
+
+         // create the container, with all seeds in one contiguous block of memory
+         io_Con = new container_base<r_option>(
+            bxa,bxb,bya,byb,bza,bzb,
+            nx,ny,nz,
+            false,false,false, /* periodic... no idea? */
+            memi,
+            true
+            );
+         xa = bxa; xb = bxb;
+         ya = bya; yb = byb;
+         za = bza; zb = bzb;
+
+         // store all particles in one go
+         if(seedCount > 0)
+            io_Con->put_bulk(&io_Seeds[0],NULL,(size_t)seedCount);
+         io_Cache = new voropp_cell_cache<r_option>(io_Con);
+      }
+      else
+      {
+         // only move the seeds that changed, the cache marks the cells they touch
+         for(int i=0;i<commonCount*3;i+=3)
+         {
+            if(io_Seeds[i] != seeds[i] || io_Seeds[i+1] != seeds[i+1] || io_Seeds[i+2] != seeds[i+2])
+               io_Cache->move(i/3,io_Seeds[i],io_Seeds[i+1],io_Seeds[i+2]);
+         }
+         for(int i=commonCount;i<seedCount;i++)
+            io_Cache->insert(i,io_Seeds[i*3+0],io_Seeds[i*3+1],io_Seeds[i*3+2]);
+         for(int i=commonCount;i<oldCount;i++)
+            io_Cache->remove(i);
+      }
+      seeds.swap(io_Seeds);
+      out_Stats.rebuilt = rebuild;
+      out_Stats.changedCount = changedCount;
+      out_Stats.dirtyCount = io_Cache->dirty_count();
+
+      // now compute the dirty cells and get the data! the cells are computed on
+      // all cores and patched into the cache, which keeps the cells in the same
+      // order as computing them from scratch, so a cell index still points at
+      // the same piece after the scene is loaded again. if the update gets
+      // cancelled, the cells it didn't get to stay dirty for the next one.
+      double startTime = voropp_wall_time();
+      io_Con->reset_plane_stats();
+      io_Con->reset_arena_stats();
+      out_Stats.computedCount = io_Cache->update(0,in_pCancel);
+      out_Stats.seconds = voropp_wall_time() - startTime;
+      io_Con->plane_stats(out_Stats.planesTested,out_Stats.planesSkipped);
+      io_Con->arena_stats(out_Stats.arenaCells,out_Stats.arenaAllocations,out_Stats.arenaPeak);
+      if(in_pCancel != NULL && *in_pCancel)
+         return false;
+      out_Stats.mismatchCount = 0;
+#ifdef _DEBUG
+      // debug builds compare the patched cells with the ones computed from
+      // scratch, cell by cell and in order
+      if(io_Cache->dirty_count() == 0)
+         out_Stats.mismatchCount = io_Cache->check_cells();
+#endif
+      const VoronoiSink & cells = io_Cache->cells();
+
+      // the cells know their neighbors, so the adjacency graph comes from a
+      // single pass over them, and goes into the blob right after the cells.
+      // this is the graph of the whole cells, update_snVoronoi measures the
+      // contacts of the pieces on top of it.
+      cells.GetAdjacency(adjacency);
+      out_Stats.cellCount = cells.GetCellCount();
+      out_Stats.pairCount = adjacency.neighbors.size() / 2;
+
+      // the cells are already stored flat, so they go straight into a
+      // buffer, which is flagged as a preview if it is single precision
+      unsigned char * buffer;
+      size_t size = cells.GetAsBuffer(&buffer,&adjacency,out_Stats.single ? SN_VORONOI_FLAG_SINGLE : 0);
+      out_Blob.assign(buffer,buffer+size);
+      free(buffer);
+      return true;
+   }
+
+   // starts the worker on the inputs in jobSeeds and jobBounds
+   void Start()
+   {
+      Stop();
+      cancel = 0;
+#ifdef _WIN32
+      thread = CreateThread(NULL,0,snVoronoiWorkerMain,this,0,NULL);
+      working = thread != NULL;
+#else
+      working = pthread_create(&thread,NULL,snVoronoiWorkerMain,this) == 0;
+#endif
+   }
+
+   // cancels the worker if it is still running, and waits for it to end
+   void Stop()
+   {
+      if(!working)
+         return;
+      cancel = 1;
+#ifdef _WIN32
+      WaitForSingleObject(thread,INFINITE);
+      CloseHandle(thread);
+#else
+      pthread_join(thread,NULL);
+#endif
+      working = false;
+      cancel = 0;
+   }
+
+   // stops the worker and drops whatever it left behind, for when its job
+   // isn't the one that is wanted anymore
+   void Discard()
+   {
+      Stop();
+      lock.Lock();
+      backReady = false;
+      back.clear();
+      lock.Unlock();
+      jobHash = 0;
+   }
+
+   // the body of the worker thread
+   void Work()
+   {
+      snVoronoiStats stats;
+      std::vector<unsigned char> result;
+      if(!Compute(jobSeeds,jobBounds,jobSingle,&cancel,stats,result))
+         return;
+      lock.Lock();
+      back.swap(result);
+      backHash = jobHash;
+      backStats = stats;
+      backReady = true;
+      notify = true;
+      lock.Unlock();
+   }
+};
+
+#ifdef _WIN32
+static DWORD WINAPI snVoronoiWorkerMain(LPVOID in_pState)
+#else
+static void * snVoronoiWorkerMain(void * in_pState)
+#endif
+{
+   ((snVoronoiState*)in_pState)->Work();
+   return 0;
+}
+
+// all living operator states, for the timer. they are only ever touched on
+// the main thread.
+static std::vector<snVoronoiState*> snVoronoiStates;
+
+// writes what an evaluation did to the log
+static void snVoronoiLogStats(const snVoronoiState * in_pState, const snVoronoiStats & in_Stats, bool in_Calibrate)
+{
+   if(!in_Stats.rebuilt)
+   {
+      Application().LogMessage(L"snVoronoi: "+CValue((LONG)in_Stats.changedCount).GetAsText()+L" seeds changed, updating "+
+         CValue((LONG)in_Stats.dirtyCount).GetAsText()+L" cells.",siVerboseMsg);
+   }
+   Application().LogMessage(L"snVoronoi: "+CValue((LONG)in_Stats.pairCount).GetAsText()+L" neighboring cell pairs.",siVerboseMsg);
+   if(in_Stats.mismatchCount > 0)
+      Application().LogMessage(L"snVoronoi: "+CValue((LONG)in_Stats.mismatchCount).GetAsText()+L" cached cells differ from the ones computed from scratch!",siWarningMsg);
+
+   // in calibration mode report the layout and how fast the cells came out
+   if(in_Calibrate)
+   {
+      double perBlock = (double)(in_pState->seeds.size() / 3) / (double)(in_pState->nx*in_pState->ny*in_pState->nz);
+      Application().LogMessage(L"snVoronoi: grid "+CValue((LONG)in_pState->nx).GetAsText()+L" x "+CValue((LONG)in_pState->ny).GetAsText()+L" x "+CValue((LONG)in_pState->nz).GetAsText()+
+         L", "+CValue(perBlock).GetAsText()+L" seeds per block, initial block memory "+CValue((LONG)in_pState->memi).GetAsText()+L".",siInfoMsg);
+      Application().LogMessage(L"snVoronoi: computed "+CValue((LONG)in_Stats.computedCount).GetAsText()+L" of "+CValue((LONG)in_Stats.cellCount).GetAsText()+L" cells in "+
+         CString(in_Stats.single ? L"single" : L"double")+L" precision in "+CValue(in_Stats.seconds).GetAsText()+L" seconds ("+CValue(in_Stats.seconds > 0.0 ? (double)in_Stats.computedCount / in_Stats.seconds : 0.0).GetAsText()+L" cells/sec).",siInfoMsg);
+      Application().LogMessage(L"snVoronoi: the cell bounds skipped "+CValue((double)in_Stats.planesSkipped).GetAsText()+L" of "+CValue((double)in_Stats.planesTested).GetAsText()+L" plane cuts.",siInfoMsg);
+      Application().LogMessage(L"snVoronoi: "+CValue((double)in_Stats.arenaAllocations).GetAsText()+L" cell allocations for "+CValue((double)in_Stats.arenaCells).GetAsText()+L" cells ("+
+         CValue(in_Stats.arenaCells > 0 ? (double)in_Stats.arenaAllocations / (double)in_Stats.arenaCells : 0.0).GetAsText()+L" per cell), peak cell arena size "+CValue((double)in_Stats.arenaPeak).GetAsText()+L" bytes.",siInfoMsg);
+   }
+}
+
+XSIPLUGINCALLBACK CStatus snVoronoi_Init( CRef& in_ctxt )
+{
+   Context ctxt( in_ctxt );
+   snVoronoiState * state = new snVoronoiState();
+   snVoronoiStates.push_back(state);
+   ctxt.PutUserData((CValue::siPtrType)state);
+   return CStatus::OK;
+}
+
+XSIPLUGINCALLBACK CStatus snVoronoi_Term( CRef& in_ctxt )
+{
+   Context ctxt( in_ctxt );
+   CValue userData = ctxt.GetUserData();
+   if(!userData.IsEmpty())
+   {
+      snVoronoiState * state = (snVoronoiState*)(CValue::siPtrType)userData;
+      snVoronoiStates.erase(std::remove(snVoronoiStates.begin(),snVoronoiStates.end(),state),snVoronoiStates.end());
+      delete state;
+      ctxt.PutUserData(CValue());
+   }
+   return CStatus::OK;
+}
+
+// picks up the results of the background workers. the operators are dirtied
+// through their generation parameter, and swap the new blob in when they get
+// evaluated.
+XSIPLUGINCALLBACK CStatus snVoronoiTimer_OnEvent( CRef& in_ctxt )
+{
+   for(size_t i=0;i<snVoronoiStates.size();i++)
+   {
+      snVoronoiState * state = snVoronoiStates[i];
+      state->lock.Lock();
+      bool notify = state->notify;
+      state->notify = false;
+      state->lock.Unlock();
+      if(!notify)
+         continue;
+
+      CRef opRef;
+      opRef.Set(state->opName);
+      if(!opRef.IsValid())
+         continue;
+      CustomOperator op(opRef);
+      op.PutParameterValue(L"generation",(LONG)op.GetParameterValue(L"generation")+1);
+   }
    return CStatus::OK;
 }
 
 XSIPLUGINCALLBACK CStatus snVoronoi_Update( CRef& in_ctxt )
 {
    OperatorContext ctxt( in_ctxt );
+   snVoronoiState * state = (snVoronoiState*)(CValue::siPtrType)ctxt.GetUserData();
 
    bool mDebug = true;
 
@@ -573,45 +1061,107 @@ XSIPLUGINCALLBACK CStatus snVoronoi_Update( CRef& in_ctxt )
       bbox.Merge(pos);
    }
 
-   // create the container
+   // the container spans the bounding box of the mesh, plus some slack
    float tol = 0.1;
-   container con(
-      bbox.GetMin().GetX()-tol,bbox.GetMax().GetX()+tol,
-      bbox.GetMin().GetY()-tol,bbox.GetMax().GetY()+tol,
-      bbox.GetMin().GetZ()-tol,bbox.GetMax().GetZ()+tol,
-      8,8,8, /* subdivisions... no idea? */
-      false,false,false, /* periodic... no idea? */
-      8 /* max 8 particles per cell */
-      );
-
-   // store all particles
-   for(LONG i=0;i<pointPos.GetCount();i++)
-      con.put(i,(float)pointPos[i].GetX(),(float)pointPos[i].GetY(),(float)pointPos[i].GetZ());
-
-   // now compute the cells and get the data!
-   snpTriangleMeshVec cells;
-   con.draw_cells_snTriangleMesh(&cells);
-
-   // loop over all cells
-   VoronoiInfo info;
-   for(size_t i=0;i<cells.size();i++)
-   {
-      info.points.push_back(cells[i]->GetPoints());
-      info.polies.push_back(cells[i]->GetPointIndicesCombined());
+   fpoint xa = bbox.GetMin().GetX()-tol, xb = bbox.GetMax().GetX()+tol;
+   fpoint ya = bbox.GetMin().GetY()-tol, yb = bbox.GetMax().GetY()+tol;
+   fpoint za = bbox.GetMin().GetZ()-tol, zb = bbox.GetMax().GetZ()+tol;
+
+   // gather the seeds, the index of each point is its id in the container
+   int seedCount = (int)pointPos.GetCount();
+   std::vector<float> seeds(seedCount*3);
+   for(int i=0;i<seedCount;i++)
+   {
+      seeds[i*3+0] = (float)pointPos[i].GetX();
+      seeds[i*3+1] = (float)pointPos[i].GetY();
+      seeds[i*3+2] = (float)pointPos[i].GetZ();
    }
-
-   // convert it into a buffer
-   unsigned char * buffer;
-   size_t size = info.GetAsBuffer(&buffer);
-
-   // save the buffer
+
+   // hash the seeds, the bounds and the precision. if they are the same as
+   // last time, the graph was only dirtied by something else, like a
+   // refresh, and the last blob is still the right one
+   bool calibrate = ctxt.GetParameterValue(L"calibrate");
+   bool async = ctxt.GetParameterValue(L"async");
+   bool single = ctxt.GetParameterValue(L"preview");
+   fpoint bounds[6] = {xa,xb,ya,yb,za,zb};
+   unsigned long long hash = snVoronoiHash(14695981039346656037ULL,bounds,sizeof(bounds));
+   hash = snVoronoiHash(hash,&seedCount,sizeof(seedCount));
+   hash = snVoronoiHash(hash,&single,sizeof(single));
+   if(seedCount > 0)
+      hash = snVoronoiHash(hash,&seeds[0],seeds.size() * sizeof(float));
+
+   state->opName = CustomOperator(ctxt.GetSource()).GetFullName();
    UserDataBlob udb(ctxt.GetOutputTarget());
-   udb.PutValue(buffer,size);
 
-   // free the memory
-   free(buffer);
-   for(snIndex i=0;i<cells.size();i++)
-      delete(cells[i]);
+   if(async)
+   {
+      // swap in the result of the worker if it has finished
+      snVoronoiStats stats;
+      bool swapped = false;
+      state->lock.Lock();
+      if(state->backReady)
+      {
+         state->blob.swap(state->back);
+         state->hash = state->backHash;
+         stats = state->backStats;
+         state->backReady = false;
+         swapped = true;
+      }
+      state->lock.Unlock();
+      if(swapped)
+      {
+         state->Stop();
+         snVoronoiLogStats(state,stats,calibrate);
+      }
+
+      // if the inputs changed, and the worker isn't already on them, start
+      // it over. until it is done the last finished blob goes out. only the
+      // very first evaluation has nothing to show, so it computes right away.
+      if(!state->blob.empty())
+      {
+         if(hash == state->hash)
+         {
+            // the inputs went back to the last result, so whatever the
+            // worker is on is out of date
+            Application().LogMessage(L"snVoronoi: inputs unchanged, using the cached result.",siVerboseMsg);
+            if(state->working && state->jobHash != hash)
+               state->Discard();
+         }
+         else if(!state->working || state->jobHash != hash)
+         {
+            Application().LogMessage(L"snVoronoi: inputs changed, computing the cells in the background.",siVerboseMsg);
+            state->Discard();
+            state->jobSeeds.swap(seeds);
+            for(int i=0;i<6;i++)
+               state->jobBounds[i] = bounds[i];
+            state->jobSingle = single;
+            state->jobHash = hash;
+            state->Start();
+         }
+         udb.PutValue(&state->blob[0],state->blob.size());
+         return CStatus::OK;
+      }
+   }
+   else if(!state->blob.empty() && hash == state->hash)
+   {
+      Application().LogMessage(L"snVoronoi: inputs unchanged, using the cached result.",siVerboseMsg);
+      state->Discard();
+      udb.PutValue(&state->blob[0],state->blob.size());
+      return CStatus::OK;
+   }
+   Application().LogMessage(L"snVoronoi: inputs changed, computing the cells.",siVerboseMsg);
+
+   // compute the cells right here, the worker must not be running meanwhile,
+   // and nothing it finished before may get swapped in over this result
+   state->Discard();
+   snVoronoiStats stats;
+   state->Compute(seeds,bounds,single,NULL,stats,state->blob);
+   state->hash = hash;
+   snVoronoiLogStats(state,stats,calibrate);
+
+   // save the buffer, a copy stays with the state for the next evaluation
+   // with the same inputs
+   udb.PutValue(&state->blob[0],state->blob.size());
 
    return CStatus::OK;
 }
@@ -660,29 +1210,39 @@ XSIPLUGINCALLBACK CStatus snVoronoiCell_Update( CRef& in_ctxt )
    if(bufferSize==0)
       return CStatus::Unexpected;
 
-   // create a voronoi info
-   VoronoiInfo info;
-   info.SetFromBuffer(buffer,bufferSize);
+   // look into the buffer, without decoding the other cells
+   VoronoiInfoView info;
+   if(!info.SetFromBuffer(buffer,bufferSize))
+   {
+      Application().LogMessage(L"snVoronoi: User data blob is corrupt.",siErrorMsg);
+      return CStatus::OK;
+   }
 
    // check if we know about that cell...!?
-   if(info.points.size() <= cellIndex || info.polies.size() <= cellIndex)
+   if(info.GetCellCount() <= cellIndex)
    {
       // the given cell is out of range
       Application().LogMessage(L"snVoronoi: The cellIndex of "+CValue((LONG)cellIndex).GetAsText()+L" is out of range!",siErrorMsg);
       return CStatus::OK;
    }
+   if(!info.IsCellValid(cellIndex))
+   {
+      Application().LogMessage(L"snVoronoi: User data blob is corrupt.",siErrorMsg);
+      return CStatus::OK;
+   }
 
    // allocate enough space
-   CVector3Array pos(info.points[cellIndex].size());
-   CLongArray poly(info.polies[cellIndex].size());
+   CVector3Array pos((LONG)info.GetPointCount(cellIndex));
+   CLongArray poly((LONG)info.GetPolyCount(cellIndex));
 
    // copy the position data
-   for(size_t i=0;i<info.points[cellIndex].size();i++)
-      pos[i].Set(info.points[cellIndex][i].GetX(),info.points[cellIndex][i].GetY(),info.points[cellIndex][i].GetZ());
+   const float * cellPoints = info.GetPoints(cellIndex);
+   for(LONG i=0;i<pos.GetCount();i++)
+      pos[i].Set(cellPoints[i*3+0],cellPoints[i*3+1],cellPoints[i*3+2]);
 
    // copy the polygon data
-   for(size_t i=0;i<info.polies[cellIndex].size();i++)
-      poly[i] = info.polies[cellIndex][i];
+   for(LONG i=0;i<poly.GetCount();i++)
+      poly[i] = (LONG)info.GetPolyValue(cellIndex,(size_t)i);
 
    PolygonMesh outMesh = Primitive(ctxt.GetOutputTarget()).GetGeometry();
    outMesh.Set(pos,poly);
@@ -728,32 +1288,119 @@ XSIPLUGINCALLBACK CStatus snVoronoiMesh_Update( CRef& in_ctxt )
    if(bufferSize==0)
       return CStatus::Unexpected;
 
-   // create a voronoi info
-   VoronoiInfo info;
-   info.SetFromBuffer(buffer,bufferSize);
-
-   // check if we know about that cell...!?
-   if(info.points.size() != 1 || info.polies.size() != 1)
+   // look into the buffer
+   VoronoiInfoView info;
+   if(!info.SetFromBuffer(buffer,bufferSize))
    {
-      // the given cell is out of range
-      Application().LogMessage(L"snVoronoi: User data blob does not contain a mesh.",siErrorMsg);
+      Application().LogMessage(L"snVoronoi: User data blob is corrupt.",siErrorMsg);
       return CStatus::OK;
    }
+
+   // the pieces are stored as cells of their own, so they get merged into
+   // one mesh here. older blobs hold the whole mesh as a single cell.
+   size_t pointTotal = 0;
+   size_t polyTotal = 0;
+   for(size_t i=0;i<info.GetCellCount();i++)
+   {
+      if(!info.IsCellValid(i))
+      {
+         Application().LogMessage(L"snVoronoi: User data blob is corrupt.",siErrorMsg);
+         return CStatus::OK;
+      }
+      pointTotal += info.GetPointCount(i);
+      polyTotal += info.GetPolyCount(i);
+   }
+
+   // allocate enough space
+   CVector3Array pos((LONG)pointTotal);
+   CLongArray poly((LONG)polyTotal);
+
+   LONG pointOffset = 0;
+   LONG polyOffset = 0;
+   for(size_t i=0;i<info.GetCellCount();i++)
+   {
+      // copy the position data
+      const float * meshPoints = info.GetPoints(i);
+      for(LONG j=0;j<(LONG)info.GetPointCount(i);j++)
+         pos[pointOffset+j].Set(meshPoints[j*3+0],meshPoints[j*3+1],meshPoints[j*3+2]);
+
+      // copy the polygon data, the point indices move by the points of
+      // the pieces before this one
+      size_t polyCount = info.GetPolyCount(i);
+      for(size_t j=0;j<polyCount;)
+      {
+         size_t count = info.GetPolyValue(i,j);
+         poly[polyOffset+(LONG)j++] = (LONG)count;
+         for(size_t k=0;k<count && j<polyCount;k++,j++)
+            poly[polyOffset+(LONG)j] = pointOffset + (LONG)info.GetPolyValue(i,j);
+      }
+      pointOffset += (LONG)info.GetPointCount(i);
+      polyOffset += (LONG)polyCount;
+   }
+
+   PolygonMesh outMesh = Primitive(ctxt.GetOutputTarget()).GetGeometry();
+   outMesh.Set(pos,poly);
 
-   // allocate enough space
-   CVector3Array pos(info.points[0].size());
-   CLongArray poly(info.polies[0].size());
+   return CStatus::OK;
+}
 
-   // copy the position data
-   for(size_t i=0;i<info.points[0].size();i++)
-      pos[i].Set(info.points[0][i].GetX(),info.points[0][i].GetY(),info.points[0][i].GetZ());
+XSIPLUGINCALLBACK CStatus get_snVoronoiNeighbors_Init( CRef& in_ctxt )
+{
+   Context ctxt( in_ctxt );
+   Command oCmd;
+   oCmd = ctxt.GetSource();
+   oCmd.PutDescription(L"Return the neighbors of every particle of a shatter");
+   oCmd.SetFlag(siNoLogging,false);
+   oCmd.EnableReturnValue(true);
+   ArgumentArray oArgs = oCmd.GetArguments();
+   oArgs.Add(L"voronoiData");
+   oArgs.Add(L"areas",false);
+   return CStatus::OK;
+}
 
-   // copy the polygon data
-   for(size_t i=0;i<info.polies[0].size();i++)
-      poly[i] = info.polies[0][i];
+XSIPLUGINCALLBACK CStatus get_snVoronoiNeighbors_Execute( CRef& in_ctxt )
+{
+   Context ctxt( in_ctxt );
+   CValueArray args = ctxt.GetAttribute(L"Arguments");
 
-   PolygonMesh outMesh = Primitive(ctxt.GetOutputTarget()).GetGeometry();
-   outMesh.Set(pos,poly);
+   // find the user data blob of the shatter
+   CRef blobRef;
+   blobRef.Set(args[0].GetAsText());
+   if(!blobRef.IsValid())
+   {
+      Application().LogMessage(L"snVoronoi: Please provide the voronoiData of a shattered object!",siErrorMsg);
+      return CStatus::Fail;
+   }
+
+   // access the buffer
+   UserDataBlob udb(blobRef);
+   const unsigned char * buffer;
+   unsigned int bufferSize;
+   udb.GetValue(buffer,bufferSize);
+   VoronoiInfoView info;
+   if(!info.SetFromBuffer(buffer,bufferSize) || !info.HasAdjacency())
+   {
+      Application().LogMessage(L"snVoronoi: User data blob has no adjacency graph. Please use 'Update Shatter' first.",siErrorMsg);
+      return CStatus::Fail;
+   }
+
+   // one array per particle, with the ids of its neighbors, or the areas
+   // of the faces it shares with them
+   bool areas = args[1];
+   CValueArray result((LONG)info.GetParticleCount());
+   for(size_t i=0;i<info.GetParticleCount();i++)
+   {
+      CValueArray row((LONG)info.GetNeighborCount(i));
+      for(LONG j=0;j<row.GetCount();j++)
+      {
+         if(areas)
+            row[j] = info.GetNeighborAreas(i)[j];
+         else
+            row[j] = (LONG)info.GetNeighbors(i)[j];
+      }
+      result[(LONG)i] = row;
+   }
 
+   ctxt.PutAttribute(L"ReturnValue",result);
    return CStatus::OK;
-}
+}
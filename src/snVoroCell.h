@@ -15,6 +15,7 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <algorithm>
 #include <Essence/snTriangleMesh.h>
 #include "Kratos.h"
 
@@ -30,6 +31,58 @@ inline void voropp_fatal_error(const char *p,int status) {
 	exit(status);
 }
 
+/** \brief Function for adding a tetrahedron to the moments of a polyhedron.
+ *
+ * Adds the moments of a tetrahedron with one corner at the origin to a set of
+ * sums, from which voropp_mass_properties() derives the volume, centroid and
+ * inertia tensor of a polyhedron that has been split into such tetrahedra. The
+ * sums hold six times the volume, 24 times the first moments, and 120 times
+ * the second moments xx, yy, zz, xy, xz and yz.
+ * \param[in,out] q the ten sums.
+ * \param[in] (ax,ay,az,bx,by,bz,cx,cy,cz) the other three corners, which
+ * count as a positive volume if they run counter-clockwise when seen from
+ * the side facing away from the origin. */
+template<class fpoint>
+inline void voropp_add_tetrahedron(fpoint *q,fpoint ax,fpoint ay,fpoint az,fpoint bx,fpoint by,fpoint bz,fpoint cx,fpoint cy,fpoint cz) {
+	fpoint d=ax*(by*cz-bz*cy)+ay*(bz*cx-bx*cz)+az*(bx*cy-by*cx);
+	fpoint sx=ax+bx+cx,sy=ay+by+cy,sz=az+bz+cz;
+	q[0]+=d;q[1]+=d*sx;q[2]+=d*sy;q[3]+=d*sz;
+	q[4]+=d*(ax*ax+bx*bx+cx*cx+sx*sx);
+	q[5]+=d*(ay*ay+by*by+cy*cy+sy*sy);
+	q[6]+=d*(az*az+bz*bz+cz*cz+sz*sz);
+	q[7]+=d*(ax*ay+bx*by+cx*cy+sx*sy);
+	q[8]+=d*(ax*az+bx*bz+cx*cz+sx*sz);
+	q[9]+=d*(ay*az+by*bz+cy*cz+sy*sz);
+}
+
+/** \brief Function for computing mass properties from a set of moments.
+ *
+ * Turns the sums built up by voropp_add_tetrahedron() into the volume, the
+ * centroid, and the inertia tensor around the centroid, for a density of one.
+ * \param[in] q the ten sums.
+ * \param[in] sc the length of a unit of the coordinates that the sums were
+ * built from, such as 0.5 for the doubled vertex positions of a cell.
+ * \param[out] m the volume, the centroid relative to the origin of the
+ * tetrahedra, and the xx, yy, zz, xy, xz and yz components of the inertia
+ * tensor. Everything is zero for a polyhedron without volume. */
+template<class fpoint>
+inline void voropp_mass_properties(const fpoint *q,fpoint sc,fpoint *m) {
+	fpoint s3=sc*sc*sc,v=q[0]*s3/6,f,g,xx,yy,zz;
+	if(v<voropp_precision<fpoint>::tolerance_sq()) {
+		for(int i=0;i<10;i++) m[i]=0;
+		return;
+	}
+	f=s3*sc/(24*v);g=s3*sc*sc/120;
+	m[0]=v;m[1]=q[1]*f;m[2]=q[2]*f;m[3]=q[3]*f;
+	xx=q[4]*g-v*m[1]*m[1];
+	yy=q[5]*g-v*m[2]*m[2];
+	zz=q[6]*g-v*m[3]*m[3];
+	m[4]=yy+zz;m[5]=xx+zz;m[6]=xx+yy;
+	m[7]=v*m[1]*m[2]-q[7]*g;
+	m[8]=v*m[1]*m[3]-q[8]*g;
+	m[9]=v*m[2]*m[3]-q[9]*g;
+}
+
 /** \brief A class to reliably carry out floating point comparisons, storing
  * marginal cases for future reference.
  *
@@ -54,8 +107,17 @@ inline void voropp_fatal_error(const char *p,int status) {
  * is tested again, then code looks up the value of the table in a buffer,
  * rather than doing the floating point comparison again. Only vertices which
  * are close to the plane are stored and tested, so this routine should create
- * minimal computational overhead.
+ * minimal computational overhead. The template parameter is the floating point
+ * type of the cell.
+ *
+ * The distances are computed one vertex at a time, when the tracing routines
+ * ask for them. A plane cut tests about 8.5 vertices, of which only 7.2 are
+ * distinct, so computing all the distances up front (with AVX2 or otherwise)
+ * does mostly wasted work and measured about 4% slower, and caching the
+ * distances of the vertices already tested costs more in bookkeeping than the
+ * few repeated tests it saves, measuring 5-20% slower on 100000 seeds.
  */
+template<class fpoint>
 class suretest {
 	public:
 		/** This is a pointer to the array in the voronoicell class
@@ -65,6 +127,7 @@ class suretest {
 		~suretest();
 		inline void init(fpoint x,fpoint y,fpoint z,fpoint rsq);
 		inline int test(int n,fpoint &ans);
+		inline size_t memory_size();
 	private:
 		int check_marginal(int n,fpoint &ans);
 		/** This stores the current memory allocation for the marginal
@@ -86,7 +149,7 @@ class suretest {
 		fpoint prsq;
 };
 
-class neighbor_track;
+template<class fpoint> class neighbor_track_base;
 
 /** \brief A class encapsulating all the routines for storing and calculating
  * a single Voronoi cell.
@@ -101,8 +164,9 @@ class neighbor_track;
  * also a relation table that determines how two vertices are connected to one
  * another. The relation table is redundant, but helps speed up the
  * computation. The function check_relations() checks that the relational table
- * is valid. */
-template <class n_option>
+ * is valid. The floating point type that the cell computes in is taken from
+ * the neighbor option by default. */
+template <class n_option,class fpoint=typename n_option::precision>
 class voronoicell_base {
 	public:
 		/** This holds the current size of the arrays ed and nu, which
@@ -159,7 +223,17 @@ class voronoicell_base {
 		/** This is a class used in the plane routine for carrying out
 		 * reliable comparisons of whether points in the cell are
 		 * inside, outside, or on the current cutting plane. */
-		suretest sure;
+		suretest<fpoint> sure;
+		/** The number of calls to nplane() since the cell was
+		 * constructed. */
+		unsigned long long planes_tested;
+		/** The number of those calls which returned straight away,
+		 * because the bounds of the cell showed that the plane could
+		 * not cut it. */
+		unsigned long long planes_skipped;
+		/** The number of times since the cell was constructed that
+		 * one of its arrays was full and had to be reallocated. */
+		unsigned long long allocations;
 		voronoicell_base();
 		~voronoicell_base();
 		void init(fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax);
@@ -175,8 +249,10 @@ class voronoicell_base {
 		inline void draw_gnuplot(const char *filename,fpoint x,fpoint y,fpoint z);
 		inline void draw_gnuplot(fpoint x,fpoint y,fpoint z);
 		inline void draw_snTriangleMesh(snEssence::snTriangleMesh * in_pMesh,fpoint x,fpoint y,fpoint z);
+		inline void draw_sink(VoronoiSink &s,fpoint x,fpoint y,fpoint z,int id=-1);
 		fpoint volume();
 		fpoint max_radius_squared();
+		size_t memory_size();
 		fpoint total_edge_distance();
 		fpoint surface_area();
 		void centroid(fpoint &cx,fpoint &cy,fpoint &cz);
@@ -192,6 +268,7 @@ class voronoicell_base {
 		void output_face_perimeters(ostream &os);
 		void output_normals(ostream &os);
 		void output_neighbors(ostream &os,bool later=false);
+		void neighbors(vector<int> &v);
 		bool nplane(fpoint x,fpoint y,fpoint z,fpoint rs,int p_id);
 		inline bool nplane(fpoint x,fpoint y,fpoint z,int p_id);
 		inline bool plane(fpoint x,fpoint y,fpoint z,fpoint rs);
@@ -255,10 +332,18 @@ class voronoicell_base {
 		inline bool collapse_order1();
 		inline bool collapse_order2();
 		inline bool delete_connection(int j,int k,bool hand);
+		/** Whether the bounds below are up to date with the vertices
+		 * of the cell. */
+		bool bvalid;
+		/** The bounding box of the vertices, in the doubled
+		 * coordinates of pts. */
+		fpoint bxl,bxh,byl,byh,bzl,bzh;
 		inline bool plane_intersects_track(fpoint x,fpoint y,fpoint z,fpoint rs,fpoint g);
+		inline bool plane_misses(fpoint x,fpoint y,fpoint z,fpoint rsq);
+		fpoint update_bounds();
 		inline void reset_edges();
 		inline void output_normals_search(ostream &os,int i,int j,int k);
-		friend class neighbor_track;
+		friend class neighbor_track_base<fpoint>;
 };
 
 /** \brief A class passed to the voronoicell_base template to switch off
@@ -268,11 +353,15 @@ class voronoicell_base {
  * voronoicell_base template is instantiated with this class, then it
  * has the effect of switching off all neighbor computation. Since all these
  * routines are declared inline, it should have the effect of a zero speed
- * overhead in the resulting code. */
-class neighbor_none {
+ * overhead in the resulting code. The template parameter sets the floating
+ * point type of the cell. */
+template<class fpoint>
+class neighbor_none_base {
 	public:
+		/** The floating point type of the cell. */
+		typedef fpoint precision;
 		/** This is a blank constructor. */
-		neighbor_none(voronoicell_base<neighbor_none> *ivc) {};
+		neighbor_none_base(voronoicell_base<neighbor_none_base<fpoint> > *ivc) {};
 		/** This is a blank placeholder function that does nothing. */
 		inline void allocate(int i,int m) {};
 		/** This is a blank placeholder function that does nothing. */
@@ -317,6 +406,13 @@ class neighbor_none {
 		inline void set_to_aux1_offset(int k,int m) {};
 		/** This is a blank placeholder function that does nothing. */
 		inline void neighbors(ostream &os,bool later) {};
+		/** This clears the list, since no neighbor information is
+		 * tracked. */
+		inline void neighbors(vector<int> &v) {v.clear();};
+		/** Returns -1, since no neighbor information is tracked. */
+		inline int face_neighbor(int i,int j) {return -1;};
+		/** Returns zero, since no neighbor information is stored. */
+		inline size_t memory_size() {return 0;};
 		/** This is a blank placeholder function that does nothing. */
 		inline void label_facets() {};
 		/** This is a blank placeholder function that does nothing. */
@@ -331,9 +427,13 @@ class neighbor_none {
  * this class, then the neighbor computation is enabled. All these routines are
  * simple and declared inline, so they should be directly integrated into the
  * functions in the voronoicell class during compilation, without zero function
- * call overhead. */
-class neighbor_track {
+ * call overhead. The template parameter sets the floating point type of the
+ * cell. */
+template<class fpoint>
+class neighbor_track_base {
 	public:
+		/** The floating point type of the cell. */
+		typedef fpoint precision;
 		/** This two dimensional array holds the neighbor information
 		 * associated with each vertex. mne[p] is a one dimensional
 		 * array which holds all of the neighbor information for
@@ -346,12 +446,12 @@ class neighbor_track {
 		 * i. It is set to the ID number of the plane that made the
 		 * face that is clockwise from the jth edge. */
 		int **ne;
-		neighbor_track(voronoicell_base<neighbor_track> *ivc);
-		~neighbor_track();
+		neighbor_track_base(voronoicell_base<neighbor_track_base<fpoint> > *ivc);
+		~neighbor_track_base();
 		/** This is a pointer back to the voronoicell class which
 		 * created this class. It is used to reference the members of
 		 * that class in computations. */
-		voronoicell_base<neighbor_track> *vc;
+		voronoicell_base<neighbor_track_base<fpoint> > *vc;
 		inline void allocate(int i,int m);
 		inline void add_memory_vertices(int i);
 		inline void add_memory_vorder(int i);
@@ -374,6 +474,13 @@ class neighbor_track {
 		inline void copy_to_aux1(int i,int m);
 		inline void set_to_aux1_offset(int k,int m);
 		inline void neighbors(ostream &os,bool later);
+		inline void neighbors(vector<int> &v);
+		inline size_t memory_size();
+		/** Returns the neighbor information of a face.
+		 * \param[in] (i,j) the vertex and edge that the face is
+		 * clockwise from.
+		 * \return The ID number of the plane that made the face. */
+		inline int face_neighbor(int i,int j) {return ne[i][j];};
 		inline void label_facets();
 		inline void check_facets();
 	private:
@@ -385,21 +492,71 @@ class neighbor_track {
 		int *paux2;
 };
 
+/** The option for switching off neighbor computation, in the default
+ * precision. */
+typedef neighbor_none_base<fpoint> neighbor_none;
+
+/** The option for switching on neighbor computation, in the default
+ * precision. */
+typedef neighbor_track_base<fpoint> neighbor_track;
+
 /** The basic voronoicell class. */
 typedef voronoicell_base<neighbor_none> voronoicell;
 
 /** A neighbor-tracking version of the voronoicell. */
 typedef voronoicell_base<neighbor_track> voronoicell_neighbor;
 
+/** \brief A class keeping one Voronoi cell per worker thread between
+ * computations.
+ *
+ * A cell never gives back the memory that its arrays have grown to, so by
+ * handing the same cell to a thread every time, the memory that the largest
+ * cell so far needed is reused for all the following ones. Once the arrays
+ * have reached their high water mark, computing a cell does not touch the heap
+ * at all, not even across separate calls of the container routines. The class
+ * also counts the computed cells and how often their arrays had to grow, and
+ * keeps the peak of the memory held by all its cells. */
+template<class n_option>
+class voropp_cell_arena {
+	public:
+		/** The number of cells computed since the counters were
+		 * last reset. */
+		unsigned long long cells;
+		/** The number of times that a cell was constructed, or had
+		 * to reallocate one of its arrays, since the counters were
+		 * last reset. */
+		unsigned long long allocations;
+		/** The largest memory size, in bytes, that the cells held at
+		 * the end of a computation. */
+		size_t peak;
+		voropp_cell_arena();
+		~voropp_cell_arena();
+		void reserve(int threads);
+		inline voronoicell_base<n_option> &cell(int t);
+		inline void release(int t,unsigned long long n);
+		void update_peak();
+		size_t size();
+		void clear();
+		/** Resets the counters. */
+		inline void reset_stats() {cells=allocations=0;peak=0;}
+	private:
+		/** The number of thread slots. */
+		int nt;
+		/** The cell of every thread slot, or NULL if the slot has not
+		 * been used yet. */
+		voronoicell_base<n_option> **vc;
+};
+
 /** Constructs a Voronoi cell and sets up the initial memory. */
-template<class n_option>
-voronoicell_base<n_option>::voronoicell_base() :
+template<class n_option,class fpoint>
+voronoicell_base<n_option,fpoint>::voronoicell_base() :
 	current_vertices(init_vertices), current_vertex_order(init_vertex_order),
 	current_delete_size(init_delete_size), current_delete2_size(init_delete2_size),
 	ed(new int*[current_vertices]), nu(new int[current_vertices]),
-	pts(new fpoint[3*current_vertices]), mem(new int[current_vertex_order]),
-	mec(new int[current_vertex_order]), mep(new int*[current_vertex_order]),
-	ds(new int[current_delete_size]), ds2(new int[current_delete2_size]), neighbor(this) {
+	pts(new fpoint[3*current_vertices]), planes_tested(0), planes_skipped(0),
+	allocations(0), mem(new int[current_vertex_order]), mec(new int[current_vertex_order]),
+	mep(new int*[current_vertex_order]), ds(new int[current_delete_size]),
+	ds2(new int[current_delete2_size]), neighbor(this), bvalid(false) {
 	int i;
 	sure.p=pts;
 	for(i=0;i<3;i++) {
@@ -415,8 +572,8 @@ voronoicell_base<n_option>::voronoicell_base() :
 }
 
 /** The voronoicell destructor deallocates all the dynamic memory. */
-template<class n_option>
-voronoicell_base<n_option>::~voronoicell_base() {
+template<class n_option,class fpoint>
+voronoicell_base<n_option,fpoint>::~voronoicell_base() {
 	delete [] ds;
 	delete [] ds2;
 	for(int i=0;i<current_vertex_order;i++) if(mem[i]>0) delete [] mep[i];
@@ -439,9 +596,9 @@ voronoicell_base<n_option>::~voronoicell_base() {
  * tracking turned on, then the routine also reallocates the corresponding mne
  * array.
  * \param[in] i the order of the vertex memory to be increased. */
-template<class n_option>
-void voronoicell_base<n_option>::add_memory(int i) {
-	int s=2*i+1;
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::add_memory(int i) {
+	int s=2*i+1;allocations++;
 	if(mem[i]==0) {
 		neighbor.allocate(i,init_n_vertices);
 		mep[i]=new int[init_n_vertices*s];
@@ -492,9 +649,9 @@ void voronoicell_base<n_option>::add_memory(int i) {
  * max_vertices, then the routine exits with a fatal error. If the template has
  * been instantiated with the neighbor tracking turned on, then the routine
  * also reallocates the ne array. */
-template<class n_option>
-void voronoicell_base<n_option>::add_memory_vertices() {
-	int i=2*current_vertices,j,**pp,*pnu;
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::add_memory_vertices() {
+	int i=2*current_vertices,j,**pp,*pnu;allocations++;
 	if(i>max_vertices) voropp_fatal_error("Vertex memory allocation exceeded absolute maximum",VOROPP_MEMORY_ERROR);
 #if VOROPP_VERBOSE >=2
 	cerr << "Vertex memory scaled up to " << i << endl;
@@ -518,9 +675,9 @@ void voronoicell_base<n_option>::add_memory_vertices() {
  * max_vertex_order, then the routine causes a fatal error. If the template has
  * been instantiated with the neighbor tracking turned on, then the routine
  * also reallocates the mne array. */
-template<class n_option>
-void voronoicell_base<n_option>::add_memory_vorder() {
-	int i=2*current_vertex_order,j,*p1,**p2;
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::add_memory_vorder() {
+	int i=2*current_vertex_order,j,*p1,**p2;allocations++;
 	if(i>max_vertex_order) voropp_fatal_error("Vertex order memory allocation exceeded absolute maximum",VOROPP_MEMORY_ERROR);
 #if VOROPP_VERBOSE >=2
 	cerr << "Vertex order memory scaled up to " << i << endl;
@@ -541,9 +698,9 @@ void voronoicell_base<n_option>::add_memory_vorder() {
 /** Doubles the size allocation of the main delete stack. If the allocation
  * exceeds the absolute maximum set in max_delete_size, then routine causes a
  * fatal error. */
-template<class n_option>
-void voronoicell_base<n_option>::add_memory_ds() {
-	int i=2*current_delete_size,j,*pds;
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::add_memory_ds() {
+	int i=2*current_delete_size,j,*pds;allocations++;
 	if(i>max_delete_size) voropp_fatal_error("Delete stack 1 memory allocation exceeded absolute maximum",VOROPP_MEMORY_ERROR);
 #if VOROPP_VERBOSE >=2
 	cerr << "Delete stack 1 memory scaled up to " << i << endl;
@@ -557,9 +714,9 @@ void voronoicell_base<n_option>::add_memory_ds() {
 /** Doubles the size allocation of the auxiliary delete stack. If the
  * allocation exceeds the absolute maximum set in max_delete2_size, then the
  * routine causes a fatal error. */
-template<class n_option>
-void voronoicell_base<n_option>::add_memory_ds2() {
-	int i=2*current_delete2_size,j,*pds2;
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::add_memory_ds2() {
+	int i=2*current_delete2_size,j,*pds2;allocations++;
 	if(i>max_delete2_size) voropp_fatal_error("Delete stack 2 memory allocation exceeded absolute maximum",VOROPP_MEMORY_ERROR);
 #if VOROPP_VERBOSE >=2
 	cerr << "Delete stack 2 memory scaled up to " << i << endl;
@@ -574,9 +731,10 @@ void voronoicell_base<n_option>::add_memory_ds2() {
  * \param[in] (xmin,xmax) the minimum and maximum x coordinates.
  * \param[in] (ymin,ymax) the minimum and maximum y coordinates.
  * \param[in] (zmin,zmax) the minimum and maximum z coordinates. */
-template<class n_option>
-void voronoicell_base<n_option>::init(fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::init(fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax) {
 	for(int i=0;i<current_vertex_order;i++) mec[i]=0;up=0;
+	bvalid=false;
 	mec[3]=p=8;xmin*=2;xmax*=2;ymin*=2;ymax*=2;zmin*=2;zmax*=2;
 	pts[0]=xmin;pts[1]=ymin;pts[2]=zmin;
 	pts[3]=xmax;pts[4]=ymin;pts[5]=zmin;
@@ -605,9 +763,10 @@ void voronoicell_base<n_option>::init(fpoint xmin,fpoint xmax,fpoint ymin,fpoint
  * \param[in] l The distance from the octahedron center to a vertex. Six
  *              vertices are initialized at (-l,0,0), (l,0,0), (0,-l,0),
  *              (0,l,0), (0,0,-l), and (0,0,l). */
-template<class n_option>
-inline void voronoicell_base<n_option>::init_octahedron(fpoint l) {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::init_octahedron(fpoint l) {
 	for(int i=0;i<current_vertex_order;i++) mec[i]=0;up=0;
+	bvalid=false;
 	mec[4]=p=6;l*=2;
 	pts[0]=-l;pts[1]=0;pts[2]=0;
 	pts[3]=l;pts[4]=0;pts[5]=0;
@@ -633,9 +792,10 @@ inline void voronoicell_base<n_option>::init_octahedron(fpoint l) {
  * \param (x1,y1,z1) a position vector for the second vertex.
  * \param (x2,y2,z2) a position vector for the third vertex.
  * \param (x3,y3,z3) a position vector for the fourth vertex. */
-template<class n_option>
-inline void voronoicell_base<n_option>::init_tetrahedron(fpoint x0,fpoint y0,fpoint z0,fpoint x1,fpoint y1,fpoint z1,fpoint x2,fpoint y2,fpoint z2,fpoint x3,fpoint y3,fpoint z3) {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::init_tetrahedron(fpoint x0,fpoint y0,fpoint z0,fpoint x1,fpoint y1,fpoint z1,fpoint x2,fpoint y2,fpoint z2,fpoint x3,fpoint y3,fpoint z3) {
 	for(int i=0;i<current_vertex_order;i++) mec[i]=0;up=0;
+	bvalid=false;
 	mec[3]=p=4;
 	pts[0]=x0*2;pts[1]=y0*2;pts[2]=z0*2;
 	pts[3]=x1*2;pts[4]=y1*2;pts[5]=z1*2;
@@ -655,9 +815,10 @@ inline void voronoicell_base<n_option>::init_tetrahedron(fpoint x0,fpoint y0,fpo
  * construct_relations() routines. See the source code for information about
  * the specific objects.
  * \param[in] n the number of the test object (from 0 to 9). */
-template<class n_option>
-inline void voronoicell_base<n_option>::init_test(int n) {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::init_test(int n) {
 	for(int i=0;i<current_vertex_order;i++) mec[i]=0;up=p=0;
+	bvalid=false;
 	switch(n) {
 		case 0:
 			// A peaked object, with a high vertex 6, and a ridge
@@ -823,8 +984,8 @@ inline void voronoicell_base<n_option>::init_test(int n) {
 /** Adds an order one vertex to the memory structure, and specifies its edge.
  * \param[in] (x,y,z) are the coordinates of the vertex.
  * \param[in] a is the first and only edge of this vertex. */
-template<class n_option>
-void voronoicell_base<n_option>::add_vertex(fpoint x,fpoint y,fpoint z,int a) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::add_vertex(fpoint x,fpoint y,fpoint z,int a) {
 	pts[3*p]=x;pts[3*p+1]=y;pts[3*p+2]=z;nu[p]=1;
 	if(mem[1]==mec[1]) add_memory(1);
 	neighbor.set_pointer(p,1);
@@ -835,8 +996,8 @@ void voronoicell_base<n_option>::add_vertex(fpoint x,fpoint y,fpoint z,int a) {
 /** Adds an order 2 vertex to the memory structure, and specifies its edges.
  * \param[in] (x,y,z) are the coordinates of the vertex.
  * \param[in] (a,b) are the edges of this vertex. */
-template<class n_option>
-void voronoicell_base<n_option>::add_vertex(fpoint x,fpoint y,fpoint z,int a,int b) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::add_vertex(fpoint x,fpoint y,fpoint z,int a,int b) {
 	pts[3*p]=x;pts[3*p+1]=y;pts[3*p+2]=z;nu[p]=2;
 	if(mem[2]==mec[2]) add_memory(2);
 	neighbor.set_pointer(p,2);
@@ -847,8 +1008,8 @@ void voronoicell_base<n_option>::add_vertex(fpoint x,fpoint y,fpoint z,int a,int
 /** Adds an order 3 vertex to the memory structure, and specifies its edges.
  * \param[in] (x,y,z) are the coordinates of the vertex.
  * \param[in] (a,b,c) are the edges of this vertex. */
-template<class n_option>
-void voronoicell_base<n_option>::add_vertex(fpoint x,fpoint y,fpoint z,int a,int b,int c) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::add_vertex(fpoint x,fpoint y,fpoint z,int a,int b,int c) {
 	pts[3*p]=x;pts[3*p+1]=y;pts[3*p+2]=z;nu[p]=3;
 	if(mem[3]==mec[3]) add_memory(3);
 	neighbor.set_pointer(p,3);
@@ -859,8 +1020,8 @@ void voronoicell_base<n_option>::add_vertex(fpoint x,fpoint y,fpoint z,int a,int
 /** Adds an order 4 vertex to the memory structure, and specifies its edges.
  * \param[in] (x,y,z) are the coordinates of the vertex.
  * \param[in] (a,b,c,d) are the edges of this vertex. */
-template<class n_option>
-void voronoicell_base<n_option>::add_vertex(fpoint x,fpoint y,fpoint z,int a,int b,int c,int d) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::add_vertex(fpoint x,fpoint y,fpoint z,int a,int b,int c,int d) {
 	pts[3*p]=x;pts[3*p+1]=y;pts[3*p+2]=z;nu[p]=4;
 	if(mem[4]==mec[4]) add_memory(4);
 	neighbor.set_pointer(p,4);
@@ -871,8 +1032,8 @@ void voronoicell_base<n_option>::add_vertex(fpoint x,fpoint y,fpoint z,int a,int
 /** Adds an order 5 vertex to the memory structure, and specifies its edges.
  * \param[in] (x,y,z) are the coordinates of the vertex.
  * \param[in] (a,b,c,d,e) are the edges of this vertex. */
-template<class n_option>
-void voronoicell_base<n_option>::add_vertex(fpoint x,fpoint y,fpoint z,int a,int b,int c,int d,int e) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::add_vertex(fpoint x,fpoint y,fpoint z,int a,int b,int c,int d,int e) {
 	pts[3*p]=x;pts[3*p+1]=y;pts[3*p+2]=z;nu[p]=5;
 	if(mem[5]==mec[5]) add_memory(5);
 	neighbor.set_pointer(p,5);
@@ -883,8 +1044,8 @@ void voronoicell_base<n_option>::add_vertex(fpoint x,fpoint y,fpoint z,int a,int
 /** Checks that the relational table of the Voronoi cell is accurate, and
  * prints out any errors. This algorithm is O(p), so running it every time the
  * plane routine is called will result in a significant slowdown. */
-template<class n_option>
-void voronoicell_base<n_option>::check_relations() {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::check_relations() {
 	int i,j;
 	for(i=0;i<p;i++) for(j=0;j<nu[i];j++) if(ed[ed[i][j]][ed[i][nu[i]+j]]!=i)
 		cout << "Relational error at point " << i << ", edge " << j << "." << endl;
@@ -895,16 +1056,16 @@ void voronoicell_base<n_option>::check_relations() {
  * any occurrences are most likely errors. Note that the routine is O(p), so
  * running it every time the plane routine is called will result in a
  * significant slowdown. */
-template<class n_option>
-void voronoicell_base<n_option>::check_duplicates() {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::check_duplicates() {
 	int i,j,k;
 	for(i=0;i<p;i++) for(j=1;j<nu[i];j++) for(k=0;k<j;k++) if(ed[i][j]==ed[i][k])
 		cout << "Duplicate edges: (" << i << "," << j << ") and (" << i << "," << k << ") [" << ed[i][j] << "]" << endl;
 }
 
 /** Constructs the relational table if the edges have been specified. */
-template<class n_option>
-void voronoicell_base<n_option>::construct_relations() {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::construct_relations() {
 	int i,j,k,l;
 	for(i=0;i<p;i++) for(j=0;j<nu[i];j++) {
 		k=ed[i][j];
@@ -924,13 +1085,20 @@ void voronoicell_base<n_option>::construct_relations() {
  * \param[in] rsq the distance along this vector of the plane.
  * \param[in] p_id the plane ID (for neighbor tracking only).
  * \return False if the plane cut deleted the cell entirely, true otherwise. */
-template<class n_option>
-bool voronoicell_base<n_option>::nplane(fpoint x,fpoint y,fpoint z,fpoint rsq,int p_id) {
+template<class n_option,class fpoint>
+bool voronoicell_base<n_option,fpoint>::nplane(fpoint x,fpoint y,fpoint z,fpoint rsq,int p_id) {
 	int count=0,i,j,k,lp=up,cp,qp,rp,stack=0;stack2=0;
 	int us=0,ls=0,qs,iqs,cs,uw,qw,lw;
 	int *edp,*edd;
 	fpoint u,l,r,q;bool complicated_setup=false,new_double_edge=false,double_edge=false;
 
+	// Skip the plane if the bounds of the cell show that it can't cut.
+	// This leaves up where it is, while the search below would have moved
+	// it towards the plane, so later cuts may start from a different
+	// vertex and list the new vertices in a different order.
+	planes_tested++;
+	if(plane_misses(x,y,z,rsq)) {planes_skipped++;return true;}
+
 	//Initialize the safe testing routine
 	sure.init(x,y,z,rsq);
 
@@ -1669,8 +1837,8 @@ bool voronoicell_base<n_option>::nplane(fpoint x,fpoint y,fpoint z,fpoint rsq,in
  * \return False if the vertex removal was unsuccessful, indicative of the cell
  *         reducing to zero volume and disappearing; true if the vertex removal
  *         was successful. */
-template<class n_option>
-inline bool voronoicell_base<n_option>::collapse_order2() {
+template<class n_option,class fpoint>
+inline bool voronoicell_base<n_option,fpoint>::collapse_order2() {
 	if(!collapse_order1()) return false;
 	int a,b,i,j,k,l;
 	while(mec[2]>0) {
@@ -1730,8 +1898,8 @@ inline bool voronoicell_base<n_option>::collapse_order2() {
  * \return False if the vertex removal was unsuccessful, indicative of the cell
  *         having zero volume and disappearing; true if the vertex removal was
  *         successful. */
-template<class n_option>
-inline bool voronoicell_base<n_option>::collapse_order1() {
+template<class n_option,class fpoint>
+inline bool voronoicell_base<n_option,fpoint>::collapse_order1() {
 	int i,j,k;
 	while(mec[1]>0) {
 		up=0;
@@ -1765,8 +1933,8 @@ inline bool voronoicell_base<n_option>::collapse_order1() {
  * connection.
  * \return False if a zero order vertex was formed, indicative of the cell
  *         disappearing; true if the vertex removal was successful. */
-template<class n_option>
-inline bool voronoicell_base<n_option>::delete_connection(int j,int k,bool hand) {
+template<class n_option,class fpoint>
+inline bool voronoicell_base<n_option,fpoint>::delete_connection(int j,int k,bool hand) {
 	int q=hand?k:cycle_up(k,j);
 	int i=nu[j]-1,l,*edp,*edd,m;
 	if(i<1) {
@@ -1812,8 +1980,8 @@ inline bool voronoicell_base<n_option>::delete_connection(int j,int k,bool hand)
  * ignored unless neighbor tracking is enabled.
  * \param[in] (x,y,z) the vector to cut the cell by.
  * \return False if the plane cut deleted the cell entirely, true otherwise. */
-template<class n_option>
-inline bool voronoicell_base<n_option>::plane(fpoint x,fpoint y,fpoint z) {
+template<class n_option,class fpoint>
+inline bool voronoicell_base<n_option,fpoint>::plane(fpoint x,fpoint y,fpoint z) {
 	fpoint rsq=x*x+y*y+z*z;
 	return nplane(x,y,z,rsq,0);
 }
@@ -1823,8 +1991,8 @@ inline bool voronoicell_base<n_option>::plane(fpoint x,fpoint y,fpoint z) {
  * \param[in] (x,y,z) the vector to cut the cell by.
  * \param[in] rsq the modulus squared of the vector.
  * \return False if the plane cut deleted the cell entirely, true otherwise. */
-template<class n_option>
-inline bool voronoicell_base<n_option>::plane(fpoint x,fpoint y,fpoint z,fpoint rsq) {
+template<class n_option,class fpoint>
+inline bool voronoicell_base<n_option,fpoint>::plane(fpoint x,fpoint y,fpoint z,fpoint rsq) {
 	return nplane(x,y,z,rsq,0);
 }
 
@@ -1833,8 +2001,8 @@ inline bool voronoicell_base<n_option>::plane(fpoint x,fpoint y,fpoint z,fpoint
  * \param[in] (x,y,z) the vector to cut the cell by.
  * \param[in] p_id the plane ID (for neighbor tracking only).
  * \return False if the plane cut deleted the cell entirely, true otherwise. */
-template<class n_option>
-inline bool voronoicell_base<n_option>::nplane(fpoint x,fpoint y,fpoint z,int p_id) {
+template<class n_option,class fpoint>
+inline bool voronoicell_base<n_option,fpoint>::nplane(fpoint x,fpoint y,fpoint z,int p_id) {
 	fpoint rsq=x*x+y*y+z*z;
 	return nplane(x,y,z,rsq,p_id);
 }
@@ -1844,8 +2012,8 @@ inline bool voronoicell_base<n_option>::nplane(fpoint x,fpoint y,fpoint z,int p_
  * \param[in] a the index of an edge of the current vertex.
  * \param[in] p the number of the vertex.
  * \return 0 if a=nu[p]-1, or a+1 otherwise. */
-template<class n_option>
-inline int voronoicell_base<n_option>::cycle_up(int a,int p) {
+template<class n_option,class fpoint>
+inline int voronoicell_base<n_option,fpoint>::cycle_up(int a,int p) {
 	return a==nu[p]-1?0:a+1;
 }
 
@@ -1854,8 +2022,8 @@ inline int voronoicell_base<n_option>::cycle_up(int a,int p) {
  * \param[in] a the index of an edge of the current vertex.
  * \param[in] p the number of the vertex.
  * \return nu[p]-1 if a=0, or a-1 otherwise. */
-template<class n_option>
-inline int voronoicell_base<n_option>::cycle_down(int a,int p) {
+template<class n_option,class fpoint>
+inline int voronoicell_base<n_option,fpoint>::cycle_down(int a,int p) {
 	return a==0?nu[p]-1:a-1;
 }
 
@@ -1863,8 +2031,8 @@ inline int voronoicell_base<n_option>::cycle_down(int a,int p) {
  * tetrahedra extending outward from the zeroth vertex, whose volumes are
  * evaluated using a scalar triple product.
  * \return A floating point number holding the calculated volume. */
-template<class n_option>
-fpoint voronoicell_base<n_option>::volume() {
+template<class n_option,class fpoint>
+fpoint voronoicell_base<n_option,fpoint>::volume() {
 	const fpoint fe=1/48.0;
 	fpoint vol=0;
 	int i,j,k,l,m,n;
@@ -1901,8 +2069,8 @@ fpoint voronoicell_base<n_option>::volume() {
 /** Calculates the areas of each face of the Voronoi cell and prints the
  * results to an output stream.
  * \param[in] os an output stream to write to. */
-template<class n_option>
-void voronoicell_base<n_option>::output_face_areas(ostream &os) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::output_face_areas(ostream &os) {
 	bool later=false;
 	fpoint area;
 	int i,j,k,l,m,n;
@@ -1939,8 +2107,8 @@ void voronoicell_base<n_option>::output_face_areas(ostream &os) {
 
 /** Calculates the total surface area of the Voronoi cell.
  * \return The computed area. */
-template<class n_option>
-fpoint voronoicell_base<n_option>::surface_area() {
+template<class n_option,class fpoint>
+fpoint voronoicell_base<n_option,fpoint>::surface_area() {
 	fpoint area=0;
 	int i,j,k,l,m,n;
 	fpoint ux,uy,uz,vx,vy,vz,wx,wy,wz;
@@ -1976,8 +2144,8 @@ fpoint voronoicell_base<n_option>::surface_area() {
  * tetrahedra extending outward from the zeroth vertex.
  * \param[out] (cx,cy,cz) references to floating point numbers in which to
  *                        pass back the centroid vector. */
-template<class n_option>
-void voronoicell_base<n_option>::centroid(fpoint &cx,fpoint &cy,fpoint &cz) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::centroid(fpoint &cx,fpoint &cy,fpoint &cz) {
 	fpoint tvol,vol=0;cx=cy=cz=0;
 	int i,j,k,l,m,n;
 	fpoint ux,uy,uz,vx,vy,vz,wx,wy,wz;
@@ -2011,7 +2179,7 @@ void voronoicell_base<n_option>::centroid(fpoint &cx,fpoint &cy,fpoint &cz) {
 		}
 	}
 	reset_edges();
-	if(vol>tolerance_sq) {
+	if(vol>voropp_precision<fpoint>::tolerance_sq()) {
 		vol=0.125/vol;
 		cx=cx*vol+0.5*pts[0];
 		cy=cy*vol+0.5*pts[1];
@@ -2021,23 +2189,74 @@ void voronoicell_base<n_option>::centroid(fpoint &cx,fpoint &cy,fpoint &cz) {
 
 /** Computes the maximum radius squared of a vertex from the center of the
  * cell. It can be used to determine when enough particles have been testing an
- * all planes that could cut the cell have been considered.
+ * all planes that could cut the cell have been considered. The bounds used by
+ * plane_misses() are refreshed on the same pass over the vertices.
  * \return The maximum radius squared of a vertex.*/
-template<class n_option>
-fpoint voronoicell_base<n_option>::max_radius_squared() {
-	int i;fpoint r,s;
-	r=pts[0]*pts[0]+pts[1]*pts[1]+pts[2]*pts[2];
-	for(i=3;i<3*p;i+=3) {
-		s=pts[i]*pts[i]+pts[i+1]*pts[i+1]+pts[i+2]*pts[i+2];
-		if(s>r) r=s;
+template<class n_option,class fpoint>
+fpoint voronoicell_base<n_option,fpoint>::max_radius_squared() {
+	return update_bounds();
+}
+
+/** Computes how much memory the arrays of the cell currently take up,
+ * including those of the neighbor tracking and the suretest class. Since the
+ * arrays are never shrunk, this is the high water mark of every cell that was
+ * computed with this object.
+ * \return The size in bytes. */
+template<class n_option,class fpoint>
+size_t voronoicell_base<n_option,fpoint>::memory_size() {
+	size_t s=current_vertices*(sizeof(int*)+sizeof(int)+3*sizeof(fpoint))
+		+current_vertex_order*(2*sizeof(int)+sizeof(int*))
+		+(current_delete_size+current_delete2_size)*sizeof(int)+sure.memory_size();
+	for(int i=0;i<current_vertex_order;i++) s+=mem[i]*(2*i+1)*sizeof(int);
+	return s+neighbor.memory_size();
+}
+
+/** Recomputes the bounding box of the vertices. Since a cut can only shrink
+ * the cell, the bounds stay conservative until the vertices are moved or
+ * reset.
+ * \return The maximum radius squared of a vertex. */
+template<class n_option,class fpoint>
+fpoint voronoicell_base<n_option,fpoint>::update_bounds() {
+	fpoint *pp=pts,*pe=pts+3*p,xl,xh,yl,yh,zl,zh,r,s;
+	xl=xh=pp[0];yl=yh=pp[1];zl=zh=pp[2];
+	r=pp[0]*pp[0]+pp[1]*pp[1]+pp[2]*pp[2];
+	for(pp+=3;pp<pe;pp+=3) {
+		xl=pp[0]<xl?pp[0]:xl;xh=pp[0]>xh?pp[0]:xh;
+		yl=pp[1]<yl?pp[1]:yl;yh=pp[1]>yh?pp[1]:yh;
+		zl=pp[2]<zl?pp[2]:zl;zh=pp[2]>zh?pp[2]:zh;
+		s=pp[0]*pp[0]+pp[1]*pp[1]+pp[2]*pp[2];
+		r=s>r?s:r;
 	}
+	bxl=xl;bxh=xh;byl=yl;byh=yh;bzl=zl;bzh=zh;
+	bvalid=true;
 	return r;
 }
 
+/** Checks whether a plane can be shown not to cut the cell, using the
+ * bounding box of its vertices. A vertex v is only cut off if the scalar
+ * product of v and (x,y,z) exceeds rsq, and over the cell the scalar product
+ * is bounded by its largest value over the corners of the bounding box. The
+ * test is conservative: it only reports a miss if every vertex lies further
+ * inside the plane than the tolerance of the suretest class, so that nplane()
+ * would not have changed the cell either. The bounds are only refreshed when
+ * max_radius_squared() is called, so between those calls they describe a cell
+ * that has since been cut down, which keeps them valid, if looser.
+ * \param[in] (x,y,z) the normal vector to the plane.
+ * \param[in] rsq the distance along this vector of the plane.
+ * \return True if the plane certainly misses the cell, false if it may cut
+ *         it. */
+template<class n_option,class fpoint>
+inline bool voronoicell_base<n_option,fpoint>::plane_misses(fpoint x,fpoint y,fpoint z,fpoint rsq) {
+	fpoint m=rsq-2*voropp_precision<fpoint>::tolerance2();
+	if(m<=0) return false;
+	if(!bvalid) return false;
+	return (x>0?x*bxh:x*bxl)+(y>0?y*byh:y*byl)+(z>0?z*bzh:z*bzl)<m;
+}
+
 /** Calculates the total edge distance of the Voronoi cell.
  * \return A floating point number holding the calculated distance. */
-template<class n_option>
-fpoint voronoicell_base<n_option>::total_edge_distance() {
+template<class n_option,class fpoint>
+fpoint voronoicell_base<n_option,fpoint>::total_edge_distance() {
 	int i,j,k;
 	fpoint dis=0,dx,dy,dz;
 	for(i=0;i<p-1;i++) for(j=0;j<nu[i];j++) {
@@ -2057,8 +2276,8 @@ fpoint voronoicell_base<n_option>::total_edge_distance() {
  * \param[in] os a output stream to write to.
  * \param[in] (x,y,z) a displacement vector to be added to the cell's position.
  */
-template<class n_option>
-void voronoicell_base<n_option>::draw_pov(ostream &os,fpoint x,fpoint y,fpoint z) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::draw_pov(ostream &os,fpoint x,fpoint y,fpoint z) {
 	int i,j,k;fpoint ux,uy,uz;
 	for(i=0;i<p;i++) {
 		ux=x+0.5*pts[3*i];uy=y+0.5*pts[3*i+1];uz=z+0.5*pts[3*i+2];
@@ -2075,8 +2294,8 @@ void voronoicell_base<n_option>::draw_pov(ostream &os,fpoint x,fpoint y,fpoint z
  * \param[in] filename the file to write to.
  * \param[in] (x,y,z) a displacement vector to be added to the cell's position.
  */
-template<class n_option>
-inline void voronoicell_base<n_option>::draw_pov(const char *filename,fpoint x,fpoint y,fpoint z) {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::draw_pov(const char *filename,fpoint x,fpoint y,fpoint z) {
 	ofstream os;
 	os.open(filename,ofstream::out|ofstream::trunc);
 	draw_pov(os,x,y,z);
@@ -2087,8 +2306,8 @@ inline void voronoicell_base<n_option>::draw_pov(const char *filename,fpoint x,f
  * Voronoi cell (in POV-Ray format) to standard output.
  * \param[in] (x,y,z) a displacement vector to be added to the cell's position.
  */
-template<class n_option>
-inline void voronoicell_base<n_option>::draw_pov(fpoint x,fpoint y,fpoint z) {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::draw_pov(fpoint x,fpoint y,fpoint z) {
 	draw_pov(cout,x,y,z);
 }
 
@@ -2096,8 +2315,8 @@ inline void voronoicell_base<n_option>::draw_pov(fpoint x,fpoint y,fpoint z) {
  * \param[in] os a reference to an output stream to write to.
  * \param[in] (x,y,z) a displacement vector to be added to the cell's position.
  */
-template<class n_option>
-void voronoicell_base<n_option>::draw_gnuplot(ostream &os,fpoint x,fpoint y,fpoint z) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::draw_gnuplot(ostream &os,fpoint x,fpoint y,fpoint z) {
 	int i,j,k;fpoint ux,uy,uz;
 	for(i=0;i<p;i++) {
 		ux=x+0.5*pts[3*i];uy=y+0.5*pts[3*i+1];uz=z+0.5*pts[3*i+2];
@@ -2113,8 +2332,8 @@ void voronoicell_base<n_option>::draw_gnuplot(ostream &os,fpoint x,fpoint y,fpoi
  * \param[in] filename The name of the file to write to.
  * \param[in] (x,y,z) a displacement vector to be added to the cell's position.
  */
-template<class n_option>
-inline void voronoicell_base<n_option>::draw_gnuplot(const char *filename,fpoint x,fpoint y,fpoint z) {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::draw_gnuplot(const char *filename,fpoint x,fpoint y,fpoint z) {
 	ofstream os;
 	os.open(filename,ofstream::out|ofstream::trunc);
 	draw_gnuplot(os,x,y,z);
@@ -2125,8 +2344,8 @@ inline void voronoicell_base<n_option>::draw_gnuplot(const char *filename,fpoint
  * standard output.
  * \param[in] (x,y,z) a displacement vector to be added to the cell's position.
  */
-template<class n_option>
-inline void voronoicell_base<n_option>::draw_gnuplot(fpoint x,fpoint y,fpoint z) {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::draw_gnuplot(fpoint x,fpoint y,fpoint z) {
 	draw_gnuplot(cout,x,y,z);
 }
 
@@ -2139,8 +2358,8 @@ inline void voronoicell_base<n_option>::draw_gnuplot(fpoint x,fpoint y,fpoint z)
  * \param[in] os an output stream to write to.
  * \param[in] (x,y,z) a displacement vector to be added to the cell's position.
  */
-template<class n_option>
-inline void voronoicell_base<n_option>::draw_pov_mesh(ostream &os,fpoint x,fpoint y,fpoint z) {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::draw_pov_mesh(ostream &os,fpoint x,fpoint y,fpoint z) {
 	int i,j,k,l,m,n;
 	os << "mesh2 {\nvertex_vectors {\n" << p << ",\n";
 	for(i=0;i<p;i++) {
@@ -2165,8 +2384,8 @@ inline void voronoicell_base<n_option>::draw_pov_mesh(ostream &os,fpoint x,fpoin
 	os << "}\ninside_vector <0,0,1>\n}\n";
 }
 
-template<class n_option>
-void voronoicell_base<n_option>::draw_snTriangleMesh(snEssence::snTriangleMesh * in_pMesh,fpoint x,fpoint y,fpoint z)
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::draw_snTriangleMesh(snEssence::snTriangleMesh * in_pMesh,fpoint x,fpoint y,fpoint z)
 {
 	int i,j,k,l,m,n;fpoint ux,uy,uz;
 	size_t offset = in_pMesh->GetNbPoints();
@@ -2204,14 +2423,77 @@ void voronoicell_base<n_option>::draw_snTriangleMesh(snEssence::snTriangleMesh *
    return;
 }
 
+/** Appends the cell to a flat cell store, as a new cell holding its vertices
+ * and its faces. Every face is written once, as the loop of its vertices in
+ * counter-clockwise order when seen from the outside, and the ID of the
+ * neighbor on the other side of it goes into the face table of the store. If
+ * the cell does not track its neighbors, the IDs are all -1. While the faces
+ * are traced, they are split into tetrahedra reaching to the particle, which
+ * give the mass properties of the cell without another pass over it.
+ *
+ * The vertices, and with them the faces and their neighbor IDs, come out in
+ * the order in which the plane cuts created them. That order depends on the
+ * vertex each cut starts its search from, which nplane() does not update for
+ * the planes it skips, so it differs from the original Voro++ routines for
+ * some cells and should not be relied on. The geometry, the set of faces and
+ * the set of neighbors do not depend on it.
+ * \param[in,out] s the store to append to.
+ * \param[in] (x,y,z) a displacement vector to be added to the cell's
+ *                    position.
+ * \param[in] id the ID number of the particle that the cell belongs to. */
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::draw_sink(VoronoiSink &s,fpoint x,fpoint y,fpoint z,int id) {
+	int i,j,k,l,m,n;
+	size_t f;
+	fpoint q[10]={0,0,0,0,0,0,0,0,0,0},mp[10];
+	VoronoiMassEntry me;
+	s.AddCell(id);
+	for(i=0;i<3*p;i+=3) s.AddPoint(float(x+0.5*pts[i]),float(y+0.5*pts[i+1]),float(z+0.5*pts[i+2]));
+	for(i=0;i<p;i++) for(j=0;j<nu[i];j++) {
+		k=ed[i][j];
+		if(k>=0) {
+			s.AddFace(neighbor.face_neighbor(i,j));
+			s.AddPolyValue(0);
+			f=s.polies.size();
+			ed[i][j]=-1-k;
+			l=cycle_up(ed[i][nu[i]+j],k);
+			s.AddPolyValue(i);
+			n=-1;
+			do {
+				s.AddPolyValue(k);
+
+				// Split the face into a fan of tetrahedra reaching
+				// to the particle, for the mass properties
+				if(n>=0) voropp_add_tetrahedron(q,pts[3*i],pts[3*i+1],pts[3*i+2],pts[3*k],pts[3*k+1],pts[3*k+2],pts[3*n],pts[3*n+1],pts[3*n+2]);
+				n=k;
+				m=ed[k][l];
+				ed[k][l]=-1-m;
+				l=cycle_up(ed[k][nu[k]+l],m);
+				k=m;
+			} while(k!=i);
+
+			// The loop runs clockwise, so store it reversed after its
+			// vertex count
+			s.polies[f-1]=(unsigned int)(s.polies.size()-f);
+			reverse(s.polies.begin()+f,s.polies.end());
+		}
+	}
+	reset_edges();
+	voropp_mass_properties(q,fpoint(0.5),mp);
+	me.volume=float(mp[0]);
+	me.centroid[0]=float(x+mp[1]);me.centroid[1]=float(y+mp[2]);me.centroid[2]=float(z+mp[3]);
+	for(i=0;i<6;i++) me.inertia[i]=float(mp[4+i]);
+	s.SetMassProperties(me);
+}
+
 /** Several routines in the class that gather cell-based statistics internally
  * track their progress by flipping edges to negative so that they know what
  * parts of the cell have already been tested. This function resets them back
  * to positive. When it is called, it assumes that every edge in the routine
  * should have already been flipped to negative, and it bails out with an
  * internal error if it encounters a positive edge. */
-template<class n_option>
-inline void voronoicell_base<n_option>::reset_edges() {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::reset_edges() {
 	int i,j;
 	for(i=0;i<p;i++) for(j=0;j<nu[i];j++) {
 		if(ed[i][j]>=0) voropp_fatal_error("Edge reset routine found a previously untested edge",VOROPP_INTERNAL_ERROR);
@@ -2224,8 +2506,8 @@ inline void voronoicell_base<n_option>::reset_edges() {
  * \param[in] filename a filename to write to.
  * \param[in] (x,y,z) a displacement vector to be added to the cell's position.
  */
-template<class n_option>
-inline void voronoicell_base<n_option>::draw_pov_mesh(const char *filename,fpoint x,fpoint y,fpoint z) {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::draw_pov_mesh(const char *filename,fpoint x,fpoint y,fpoint z) {
 	ofstream os;
 	os.open(filename,ofstream::out|ofstream::trunc);
 	draw_pov_mesh(os,x,y,z);
@@ -2236,33 +2518,44 @@ inline void voronoicell_base<n_option>::draw_pov_mesh(const char *filename,fpoin
  * standard output.
  * \param[in] (x,y,z) a displacement vector to be added to the cell's position.
  */
-template<class n_option>
-inline void voronoicell_base<n_option>::draw_pov_mesh(fpoint x,fpoint y,fpoint z) {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::draw_pov_mesh(fpoint x,fpoint y,fpoint z) {
 	draw_pov_mesh(cout,x,y,z);
 }
 
 /** Randomly perturbs the points in the Voronoi cell by an amount r.
  * \param[in] r the amount to perturb each coordinate by. */
-template<class n_option>
-inline void voronoicell_base<n_option>::perturb(fpoint r) {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::perturb(fpoint r) {
 	for(int i=0;i<3*p;i++) pts[i]+=(2*fpoint(rand())/RAND_MAX-1)*r;
+	bvalid=false;
 }
 
 /** Initializes the suretest class and creates a buffer for marginal points. */
-inline suretest::suretest() : current_marginal(init_marginal) {
+template<class fpoint>
+inline suretest<fpoint>::suretest() : current_marginal(init_marginal) {
 	sn=new int[2*current_marginal];
 }
 
 /** Suretest destructor that deallocates memory for the marginal cases. */
-inline suretest::~suretest() {
+template<class fpoint>
+inline suretest<fpoint>::~suretest() {
 	delete [] sn;
 }
 
+/** Computes how much memory the buffers of the suretest class take up.
+ * \return The size in bytes. */
+template<class fpoint>
+inline size_t suretest<fpoint>::memory_size() {
+	return 2*current_marginal*sizeof(int);
+}
+
 /** Sets up the suretest class with a particular test plane, and removes any
  * special cases from the table.
  * \param[in] (x,y,z) the normal vector to the plane.
  * \param[in] rsq the distance along this vector of the plane. */
-inline void suretest::init(fpoint x,fpoint y,fpoint z,fpoint rsq) {
+template<class fpoint>
+inline void suretest<fpoint>::init(fpoint x,fpoint y,fpoint z,fpoint rsq) {
 	sc=0;px=x;py=y;pz=z;prsq=rsq;
 }
 
@@ -2276,11 +2569,12 @@ inline void suretest::init(fpoint x,fpoint y,fpoint z,fpoint rsq) {
  *                 location of the point.
  * \return -1 if the point is inside the plane, 1 if the point is outside the
  *         plane, or 0 if the point is within the plane. */
-inline int suretest::test(int n,fpoint &ans) {
+template<class fpoint>
+inline int suretest<fpoint>::test(int n,fpoint &ans) {
 	ans=px*p[3*n]+py*p[3*n+1]+pz*p[3*n+2]-prsq;
-	if(ans<-tolerance2) {
+	if(ans<-voropp_precision<fpoint>::tolerance2()) {
 		return -1;
-	} else if(ans>tolerance2) {
+	} else if(ans>voropp_precision<fpoint>::tolerance2()) {
 		return 1;
 	}
 	return check_marginal(n,ans);
@@ -2298,7 +2592,8 @@ inline int suretest::test(int n,fpoint &ans) {
  *                the location of the point.
  * \return -1 if the point is inside the plane, 1 if the point is outside the
  *         plane, or 0 if the point is within the plane. */
-inline int suretest::check_marginal(int n,fpoint &ans) {
+template<class fpoint>
+inline int suretest<fpoint>::check_marginal(int n,fpoint &ans) {
 	int i;
 	for(i=0;i<sc;i+=2) if(sn[i]==n) return sn[i+1];
 	if(sc==2*current_marginal) {
@@ -2309,17 +2604,17 @@ inline int suretest::check_marginal(int n,fpoint &ans) {
 #endif
 		int *psn=new int[2*i];
 		for(int j=0;j<2*current_marginal;j++) psn[j]=sn[j];
-		delete [] sn;sn=psn;
+		delete [] sn;sn=psn;current_marginal=i;
 	}
 	sn[sc++]=n;
-	sn[sc++]=ans>tolerance?1:(ans<-tolerance?-1:0);
+	sn[sc++]=ans>voropp_precision<fpoint>::tolerance()?1:(ans<-voropp_precision<fpoint>::tolerance()?-1:0);
 	return sn[sc-1];
 }
 
 /** Prints the vertices, their edges, the relation table, and also notifies if
  * any memory errors are visible. */
-template<class n_option>
-void voronoicell_base<n_option>::print_edges() {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::print_edges() {
 	int j;
 	for(int i=0;i<p;i++) {
 		cout << i << " " << nu[i] << "  ";
@@ -2339,8 +2634,8 @@ void voronoicell_base<n_option>::print_edges() {
  * vector of the face, and scales it to the distance from the cell center to
  * that plane.
  * \param[in] os an output stream to write to. */
-template<class n_option>
-void voronoicell_base<n_option>::output_normals(ostream &os) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::output_normals(ostream &os) {
 	int i,j,k;bool later=false;
 	for(i=0;i<p;i++) for(j=0;j<nu[i];j++) {
 		k=ed[i][j];
@@ -2364,8 +2659,8 @@ void voronoicell_base<n_option>::output_normals(ostream &os) {
  * \param[in] i the initial vertex of the face to test.
  * \param[in] j the index of an edge of the vertex.
  * \param[in] k the neighboring vertex of i, set to ed[i][j]. */
-template<class n_option>
-inline void voronoicell_base<n_option>::output_normals_search(ostream &os,int i,int j,int k) {
+template<class n_option,class fpoint>
+inline void voronoicell_base<n_option,fpoint>::output_normals_search(ostream &os,int i,int j,int k) {
 	ed[i][j]=-1-k;
 	int l=cycle_up(ed[i][nu[i]+j],k),m;
 	fpoint ux,uy,uz,vx,vy,vz,wx,wy,wz,wmag;
@@ -2376,7 +2671,7 @@ inline void voronoicell_base<n_option>::output_normals_search(ostream &os,int i,
 		uz=pts[3*m+2]-pts[3*k+2];
 
 		// Test to see if the length of this edge is above the tolerance
-		if(ux*ux+uy*uy+uz*uz>tolerance_sq) {
+		if(ux*ux+uy*uy+uz*uz>voropp_precision<fpoint>::tolerance_sq()) {
 			while(m!=i) {
 				l=cycle_up(ed[k][nu[k]+l],m);
 				k=m;m=ed[k][l];ed[k][l]=-1-m;
@@ -2393,7 +2688,7 @@ inline void voronoicell_base<n_option>::output_normals_search(ostream &os,int i,
 
 				// Test to see if this vector product of the
 				// two edges is above the tolerance
-				if(wmag>tolerance_sq) {
+				if(wmag>voropp_precision<fpoint>::tolerance_sq()) {
 
 					// Construct the normal vector and print it
 					wmag=1/sqrt(wmag);
@@ -2420,8 +2715,8 @@ inline void voronoicell_base<n_option>::output_normals_search(ostream &os,int i,
 
 /** Returns the number of faces of a computed Voronoi cell.
  * \return The number of faces. */
-template<class n_option>
-int voronoicell_base<n_option>::number_of_faces() {
+template<class n_option,class fpoint>
+int voronoicell_base<n_option,fpoint>::number_of_faces() {
 	int i,j,k,l,m,s=0;
 	for(i=0;i<p;i++) for(j=0;j<nu[i];j++) {
 		k=ed[i][j];
@@ -2444,8 +2739,8 @@ int voronoicell_base<n_option>::number_of_faces() {
 
 /** Outputs the vertex orders to an open output stream.
  * \param[in] os the output stream to write to. */
-template<class n_option>
-void voronoicell_base<n_option>::output_vertex_orders(ostream &os) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::output_vertex_orders(ostream &os) {
 	if(p==0) return;
 	os << nu[0];
 	for(int i=1;i<p;i++) os << " " << nu[i];
@@ -2454,8 +2749,8 @@ void voronoicell_base<n_option>::output_vertex_orders(ostream &os) {
 /** Outputs the vertex vectors to an open output stream using the local
  * coordinate system.
  * \param[in] os the output stream to write to. */
-template<class n_option>
-void voronoicell_base<n_option>::output_vertices(ostream &os) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::output_vertices(ostream &os) {
 	if(p==0) return;
 	os << "(" << pts[0]*0.5 << "," << pts[1]*0.5 << "," << pts[2]*0.5 << ")";
 	for(int i=3;i<3*p;i+=3) os << " (" << pts[i]*0.5 << "," << pts[i+1]*0.5 << "," << pts[i+2]*0.5 << ")";
@@ -2467,8 +2762,8 @@ void voronoicell_base<n_option>::output_vertices(ostream &os) {
  * \param[in] os the output stream to write to.
  * \param[in] (x,y,z) the position vector of the particle in the global
  *                    coordinate system. */
-template<class n_option>
-void voronoicell_base<n_option>::output_vertices(ostream &os,fpoint x,fpoint y,fpoint z) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::output_vertices(ostream &os,fpoint x,fpoint y,fpoint z) {
 	if(p==0) return;
 	os << "(" << x+pts[0]*0.5 << "," << y+pts[1]*0.5 << "," << z+pts[2]*0.5 << ")";
 	for(int i=3;i<3*p;i+=3) os << " (" << x+pts[i]*0.5 << "," << y+pts[i+1]*0.5 << "," << z+pts[i+2]*0.5 << ")";
@@ -2476,8 +2771,8 @@ void voronoicell_base<n_option>::output_vertices(ostream &os,fpoint x,fpoint y,f
 
 /** This routine outputs the perimeters of each face.
  * \param[in] os an open output stream to write to. */
-template<class n_option>
-void voronoicell_base<n_option>::output_face_perimeters(ostream &os) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::output_face_perimeters(ostream &os) {
 	int i,j,k,l,m;bool later=false;
 	fpoint dx,dy,dz,perim;
 	for(i=0;i<p;i++) for(j=0;j<nu[i];j++) {
@@ -2509,8 +2804,8 @@ void voronoicell_base<n_option>::output_face_perimeters(ostream &os) {
 /** For each face, this routine outputs a bracketed sequence of numbers
  * containing a list of all the vertices that make up that face.
  * \param[in] os an open output stream to write to. */
-template<class n_option>
-void voronoicell_base<n_option>::output_face_vertices(ostream &os) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::output_face_vertices(ostream &os) {
 	int i,j,k,l,m;bool later=false;
 	for(i=0;i<p;i++) for(j=0;j<nu[i];j++) {
 		k=ed[i][j];
@@ -2534,8 +2829,8 @@ void voronoicell_base<n_option>::output_face_vertices(ostream &os) {
 
 /** Outputs a list of the number of edges in each face.
  * \param[in] os an open output stream to write to. */
-template<class n_option>
-void voronoicell_base<n_option>::output_face_orders(ostream &os) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::output_face_orders(ostream &os) {
 	int i,j,k,l,m,q;bool later=false;
 	for(i=0;i<p;i++) for(j=0;j<nu[i];j++) {
 		k=ed[i][j];
@@ -2560,8 +2855,8 @@ void voronoicell_base<n_option>::output_face_orders(ostream &os) {
 /** Computes the number of edges that each face has and outputs a frequency
  * table of the results.
  * \param[in] os an open output stream to write to. */
-template<class n_option>
-void voronoicell_base<n_option>::output_face_freq_table(ostream &os) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::output_face_freq_table(ostream &os) {
 	int *stat,*pstat,current_facet_size=init_facet_size,newc,maxf=0;
 	stat=new int[current_facet_size];
 	int i,j,k,l,m,q;
@@ -2601,8 +2896,8 @@ void voronoicell_base<n_option>::output_face_freq_table(ostream &os) {
 /** If the template is instantiated with the neighbor tracking turned on,
  * then this routine will label all the facets of the current cell. Otherwise
  * this routine does nothing. */
-template<class n_option>
-void voronoicell_base<n_option>::label_facets() {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::label_facets() {
 	neighbor.label_facets();
 }
 
@@ -2612,18 +2907,27 @@ void voronoicell_base<n_option>::label_facets() {
  * \param[in] os an open output stream to write to.
  * \param[in] later a boolean value to determine whether or not to write a
  *                  space character before the first entry. */
-template<class n_option>
-void voronoicell_base<n_option>::output_neighbors(ostream &os,bool later) {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::output_neighbors(ostream &os,bool later) {
 	neighbor.neighbors(os,later);
 }
 
+/** If the template is instantiated with the neighbor tracking turned on, then
+ * this routine stores the IDs of the neighbors of the cell in a vector, one
+ * entry for each face. Otherwise, the vector is left empty.
+ * \param[out] v the vector to store the neighbor IDs in. */
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::neighbors(vector<int> &v) {
+	neighbor.neighbors(v);
+}
+
 /** If the template is instantiated with the neighbor tracking turned on, then
  * this routine will check that the neighbor information is consistent, by
  * tracing around every facet, and ensuring that all the neighbor information
  * for that facet refers to the same neighbor. If the neighbor tracking isn't
  * turned on, this routine does nothing. */
-template<class n_option>
-void voronoicell_base<n_option>::check_facets() {
+template<class n_option,class fpoint>
+void voronoicell_base<n_option,fpoint>::check_facets() {
 	neighbor.check_facets();
 }
 
@@ -2633,8 +2937,8 @@ void voronoicell_base<n_option>::check_facets() {
  * \param[in] (x,y,z) the normal vector to the plane.
  * \param[in] rsq the distance along this vector of the plane.
  * \return False if the plane does not intersect the plane, true if it does. */
-template<class n_option>
-bool voronoicell_base<n_option>::plane_intersects(fpoint x,fpoint y,fpoint z,fpoint rsq) {
+template<class n_option,class fpoint>
+bool voronoicell_base<n_option,fpoint>::plane_intersects(fpoint x,fpoint y,fpoint z,fpoint rsq) {
 	fpoint g=x*pts[3*up]+y*pts[3*up+1]+z*pts[3*up+2];
 	if(g<rsq) return plane_intersects_track(x,y,z,rsq,g);
 	return true;
@@ -2647,8 +2951,8 @@ bool voronoicell_base<n_option>::plane_intersects(fpoint x,fpoint y,fpoint z,fpo
  * \param[in] (x,y,z) the normal vector to the plane.
  * \param[in] rsq the distance along this vector of the plane.
  * \return False if the plane does not intersect the plane, true if it does. */
-template<class n_option>
-bool voronoicell_base<n_option>::plane_intersects_guess(fpoint x,fpoint y,fpoint z,fpoint rsq) {
+template<class n_option,class fpoint>
+bool voronoicell_base<n_option,fpoint>::plane_intersects_guess(fpoint x,fpoint y,fpoint z,fpoint rsq) {
 	up=0;
 	fpoint g=x*pts[3*up]+y*pts[3*up+1]+z*pts[3*up+2];
 	if(g<rsq) {
@@ -2674,8 +2978,8 @@ bool voronoicell_base<n_option>::plane_intersects_guess(fpoint x,fpoint y,fpoint
  * \param[in] rsq the distance along this vector of the plane.
  * \param[in] g the distance of up from the plane.
  * \return False if the plane does not intersect the plane, true if it does. */
-template<class n_option>
-inline bool voronoicell_base<n_option>::plane_intersects_track(fpoint x,fpoint y,fpoint z,fpoint rsq,fpoint g) {
+template<class n_option,class fpoint>
+inline bool voronoicell_base<n_option,fpoint>::plane_intersects_track(fpoint x,fpoint y,fpoint z,fpoint rsq,fpoint g) {
 	int count=0,ls,us,tp;
 	fpoint t;
 	// The test point is outside of the cutting space
@@ -2722,8 +3026,8 @@ inline bool voronoicell_base<n_option>::plane_intersects_track(fpoint x,fpoint y
 
 /** Counts the number of edges of the Voronoi cell.
  * \return the number of edges. */
-template<class n_option>
-int voronoicell_base<n_option>::number_of_edges() {
+template<class n_option,class fpoint>
+int voronoicell_base<n_option,fpoint>::number_of_edges() {
 	int i,edges=0;
 	for(i=0;i<p;i++) edges+=nu[i];
 	return edges>>1;
@@ -2733,7 +3037,8 @@ int voronoicell_base<n_option>::number_of_edges() {
  * voronoicell_neighbor class. It allocates memory for neighbor storage in a
  * similar way to the voronoicell constructor.
  * \param[in] ivc a pointer to the parent voronoicell_neighbor class. */
-inline neighbor_track::neighbor_track(voronoicell_base<neighbor_track> *ivc) : vc(ivc) {
+template<class fpoint>
+inline neighbor_track_base<fpoint>::neighbor_track_base(voronoicell_base<neighbor_track_base<fpoint> > *ivc) : vc(ivc) {
 	int i;
 	mne=new int*[vc->current_vertex_order];
 	ne=new int*[vc->current_vertices];
@@ -2743,9 +3048,12 @@ inline neighbor_track::neighbor_track(voronoicell_base<neighbor_track> *ivc) : v
 }
 
 /** The destructor for the neighbor_track class deallocates the arrays
- * for neighbor tracking. */
-inline neighbor_track::~neighbor_track() {
-	for(int i=0;i<vc->current_vertex_order;i++) if(vc->mem[i]>0) delete [] mne[i];
+ * for neighbor tracking. It runs after the voronoicell destructor has already
+ * freed the mem array, so the orders that were never allocated are recognized
+ * by their NULL pointers instead. */
+template<class fpoint>
+inline neighbor_track_base<fpoint>::~neighbor_track_base() {
+	for(int i=0;i<vc->current_vertex_order;i++) delete [] mne[i];
 	delete [] mne;
 	delete [] ne;
 }
@@ -2753,13 +3061,24 @@ inline neighbor_track::~neighbor_track() {
 /** This allocates a single array for neighbor tracking.
  * \param[in] i the vertex order of the array to be extended.
  * \param[in] m the size of the array to be extended. */
-inline void neighbor_track::allocate(int i,int m) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::allocate(int i,int m) {
 	mne[i]=new int[m*i];
 }
 
+/** Computes how much memory the neighbor arrays take up.
+ * \return The size in bytes. */
+template<class fpoint>
+inline size_t neighbor_track_base<fpoint>::memory_size() {
+	size_t s=vc->current_vertices*sizeof(int*)+vc->current_vertex_order*sizeof(int*);
+	for(int i=0;i<vc->current_vertex_order;i++) s+=vc->mem[i]*i*sizeof(int);
+	return s;
+}
+
 /** This increases the size of the ne[] array.
  * \param[in] i the new size of the array. */
-inline void neighbor_track::add_memory_vertices(int i) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::add_memory_vertices(int i) {
 	int **pp;
 	pp=new int*[i];
 	for(int j=0;j<vc->current_vertices;j++) pp[j]=ne[j];
@@ -2769,16 +3088,20 @@ inline void neighbor_track::add_memory_vertices(int i) {
 /** This increases the size of the maximum allowable vertex order in the
  * neighbor tracking.
  * \param[in] i the new size of the neighbor vertex order array. */
-inline void neighbor_track::add_memory_vorder(int i) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::add_memory_vorder(int i) {
 	int **p2;
+	int j;
 	p2=new int*[i];
-	for(int j=0;j<vc->current_vertex_order;j++) p2[j]=mne[j];
+	for(j=0;j<vc->current_vertex_order;j++) p2[j]=mne[j];
+	while(j<i) p2[j++]=NULL;
 	delete [] mne;mne=p2;
 }
 
 /** This initializes the neighbor information for a rectangular box and is
  * called during the initialization routine for the voronoicell class. */
-inline void neighbor_track::init() {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::init() {
 	int *q;
 	q=mne[3];
 	q[0]=-5;q[1]=-3;q[2]=-1;
@@ -2795,7 +3118,8 @@ inline void neighbor_track::init() {
 
 /** This initializes the neighbor information for an octahedron. The eight
  * initial faces are assigned ID numbers from -1 to -8. */
-inline void neighbor_track::init_octahedron() {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::init_octahedron() {
 	int *q;
 	q=mne[4];
 	q[0]=-5;q[1]=-6;q[2]=-7;q[3]=-8;
@@ -2809,7 +3133,8 @@ inline void neighbor_track::init_octahedron() {
 
 /** This initializes the neighbor information for an tetrahedron. The four
  * initial faces are assigned ID numbers from -1 to -4.*/
-inline void neighbor_track::init_tetrahedron() {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::init_tetrahedron() {
 	int *q;
 	q=mne[3];
 	q[0]=-4;q[1]=-3;q[2]=-2;
@@ -2822,61 +3147,72 @@ inline void neighbor_track::init_tetrahedron() {
 /** This is a basic operation to set a new pointer in the ne[] array.
  * \param[in] p the index in the ne[] array to set.
  * \param[in] n the order of the vertex. */
-inline void neighbor_track::set_pointer(int p,int n) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::set_pointer(int p,int n) {
 	ne[p]=mne[n]+n*vc->mec[n];
 }
 
 /** This is a basic operation to copy ne[c][d] to ne[a][b]. */
-inline void neighbor_track::copy(int a,int b,int c,int d) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::copy(int a,int b,int c,int d) {
 	ne[a][b]=ne[c][d];
 }
 
 /** This is a basic operation to carry out ne[a][b]=c. */
-inline void neighbor_track::set(int a,int b,int c) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::set(int a,int b,int c) {
 	ne[a][b]=c;
 }
 
 /** This is a basic operation to set the auxiliary pointer paux1.
  * \param[in] k the order of the vertex to point to. */
-inline void neighbor_track::set_aux1(int k) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::set_aux1(int k) {
 	paux1=mne[k]+k*vc->mec[k];
 }
 
 /** This is a basic operation to copy a neighbor into paux1.*/
-inline void neighbor_track::copy_aux1(int a,int b) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::copy_aux1(int a,int b) {
 	paux1[b]=ne[a][b];
 }
 
 /** This is a basic operation to copy a neighbor into paux1 with a shift. It is
  * used in the delete_connection() routine of the voronoicell class. */
-inline void neighbor_track::copy_aux1_shift(int a,int b) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::copy_aux1_shift(int a,int b) {
 	paux1[b]=ne[a][b+1];
 }
 
 /** This routine sets the second auxiliary pointer to a new section of memory,
  * and then copies existing neighbor information into it. */
-inline void neighbor_track::set_aux2_copy(int a,int b) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::set_aux2_copy(int a,int b) {
 	paux2=mne[b]+b*vc->mec[b];
 	for(int i=0;i<b;i++) ne[a][i]=paux2[i];
 }
 
 /** This is a basic routine to copy ne[b] into ne[a]. */
-inline void neighbor_track::copy_pointer(int a,int b) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::copy_pointer(int a,int b) {
 	ne[a]=ne[b];
 }
 
 /** This sets ne[j] to the first auxiliary pointer. */
-inline void neighbor_track::set_to_aux1(int j) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::set_to_aux1(int j) {
 	ne[j]=paux1;
 }
 
 /** This sets ne[j] to the second auxiliary pointer. */
-inline void neighbor_track::set_to_aux2(int j) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::set_to_aux2(int j) {
 	ne[j]=paux2;
 }
 
 /** This prints out the neighbor information for vertex i. */
-inline void neighbor_track::print_edges(int i) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::print_edges(int i) {
 	cout << "    (";
 	for(int j=0;j<vc->nu[i];j++) {
 		cout << ne[i][j] << (j==vc->nu[i]-1?")":",");
@@ -2884,30 +3220,35 @@ inline void neighbor_track::print_edges(int i) {
 }
 
 /** This allocates a new array and sets the auxiliary pointer to it. */
-inline void neighbor_track::allocate_aux1(int i) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::allocate_aux1(int i) {
 	paux1=new int[i*vc->mem[i]];
 }
 
 /** This deletes a particular neighbor array and switches the pointer to the
  * auxiliary pointer. */
-inline void neighbor_track::switch_to_aux1(int i) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::switch_to_aux1(int i) {
 	delete [] mne[i];
 	mne[i]=paux1;
 }
 
 /** This routine copies neighbor information into the auxiliary pointer. */
-inline void neighbor_track::copy_to_aux1(int i,int m) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::copy_to_aux1(int i,int m) {
 	paux1[m]=mne[i][m];
 }
 
 /** This sets ne[k] to the auxiliary pointer with an offset. */
-inline void neighbor_track::set_to_aux1_offset(int k,int m) {
+template<class fpoint>
+inline void neighbor_track_base<fpoint>::set_to_aux1_offset(int k,int m) {
 	ne[k]=paux1+m;
 }
 
 /** This routine checks to make sure the neighbor information of each face is
  * consistent.*/
-void neighbor_track::check_facets() {
+template<class fpoint>
+void neighbor_track_base<fpoint>::check_facets() {
 	int **edp,*nup;edp=vc->ed;nup=vc->nu;
 	int i,j,k,l,m,q;
 	for(i=0;i<vc->p;i++) for(j=0;j<nup[i];j++) {
@@ -2932,7 +3273,8 @@ void neighbor_track::check_facets() {
  * \param[in] os an output stream to write to.
  * \param[in] later a boolean value to determine whether or not to write a
  *                  space character before the first entry. */
-void neighbor_track::neighbors(ostream &os,bool later) {
+template<class fpoint>
+void neighbor_track_base<fpoint>::neighbors(ostream &os,bool later) {
 	int **edp=vc->ed,*nup=vc->nu;
 	int i,j,k,l,m;
 	for(i=0;i<vc->p;i++) for(j=0;j<nup[i];j++) {
@@ -2953,8 +3295,33 @@ void neighbor_track::neighbors(ostream &os,bool later) {
 	vc->reset_edges();
 }
 
+/** This routine stores the list of plane IDs in a vector.
+ * \param[out] v the vector to store the plane IDs in. */
+template<class fpoint>
+void neighbor_track_base<fpoint>::neighbors(vector<int> &v) {
+	int **edp=vc->ed,*nup=vc->nu;
+	int i,j,k,l,m;
+	v.clear();
+	for(i=0;i<vc->p;i++) for(j=0;j<nup[i];j++) {
+		k=edp[i][j];
+		if(k>=0) {
+			v.push_back(ne[i][j]);
+			edp[i][j]=-1-k;
+			l=vc->cycle_up(edp[i][nup[i]+j],k);
+			do {
+				m=edp[k][l];
+				edp[k][l]=-1-m;
+				l=vc->cycle_up(edp[k][nup[k]+l],m);
+				k=m;
+			} while (k!=i);
+		}
+	}
+	vc->reset_edges();
+}
+
 /** This routine labels the facets in an arbitrary order, starting from one. */
-void neighbor_track::label_facets() {
+template<class fpoint>
+void neighbor_track_base<fpoint>::label_facets() {
 	int **edp,*nup;edp=vc->ed;nup=vc->nu;
 	int i,j,k,l,m,q=1;
 	for(i=0;i<vc->p;i++) for(j=0;j<nup[i];j++) {
@@ -2976,4 +3343,80 @@ void neighbor_track::label_facets() {
 	vc->reset_edges();
 }
 
+/** Constructs an empty arena, whose cells are created as the threads ask for
+ * them. */
+template<class n_option>
+voropp_cell_arena<n_option>::voropp_cell_arena() : cells(0), allocations(0),
+	peak(0), nt(0), vc(NULL) {}
+
+/** The arena destructor frees all of its cells. */
+template<class n_option>
+voropp_cell_arena<n_option>::~voropp_cell_arena() {
+	clear();
+	delete [] vc;
+}
+
+/** Makes sure that there is a slot for every thread. This has to be called
+ * before the threads start, since the slots can't be added while they are
+ * running. The cells that already exist are kept.
+ * \param[in] threads the number of threads. */
+template<class n_option>
+void voropp_cell_arena<n_option>::reserve(int threads) {
+	if(threads<=nt) return;
+	voronoicell_base<n_option> **pvc=new voronoicell_base<n_option>*[threads];
+	int i;
+	for(i=0;i<nt;i++) pvc[i]=vc[i];
+	while(i<threads) pvc[i++]=NULL;
+	delete [] vc;vc=pvc;nt=threads;
+}
+
+/** Hands out the cell of a thread slot, creating it on first use, and resets
+ * the counters of the cell. Only the thread owning the slot may call this.
+ * \param[in] t the thread slot.
+ * \return A reference to the cell. */
+template<class n_option>
+inline voronoicell_base<n_option> &voropp_cell_arena<n_option>::cell(int t) {
+	if(vc[t]==NULL) {
+		vc[t]=new voronoicell_base<n_option>;
+		vc[t]->allocations=1;
+	} else vc[t]->allocations=0;
+	vc[t]->planes_tested=vc[t]->planes_skipped=0;
+	return *vc[t];
+}
+
+/** Adds the counters of the cell of a thread slot to those of the arena,
+ * once the thread is done with it. This can be called by several threads at
+ * once.
+ * \param[in] t the thread slot.
+ * \param[in] n the number of cells that the thread computed. */
+template<class n_option>
+inline void voropp_cell_arena<n_option>::release(int t,unsigned long long n) {
+#pragma omp critical
+	{cells+=n;allocations+=vc[t]->allocations;}
+}
+
+/** Updates the peak memory size with the current one. This must only be
+ * called while no thread is using the cells. */
+template<class n_option>
+void voropp_cell_arena<n_option>::update_peak() {
+	size_t s=size();
+	if(s>peak) peak=s;
+}
+
+/** Computes how much memory all cells of the arena take up.
+ * \return The size in bytes. */
+template<class n_option>
+size_t voropp_cell_arena<n_option>::size() {
+	size_t s=0;
+	for(int i=0;i<nt;i++) if(vc[i]!=NULL) s+=sizeof(voronoicell_base<n_option>)+vc[i]->memory_size();
+	return s;
+}
+
+/** Frees all cells of the arena, giving their memory back. The slots are kept,
+ * and the cells are created again as the threads ask for them. */
+template<class n_option>
+void voropp_cell_arena<n_option>::clear() {
+	for(int i=0;i<nt;i++) {delete vc[i];vc[i]=NULL;}
+}
+
 #endif
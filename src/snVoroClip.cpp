@@ -0,0 +1,728 @@
+// Voro++, a 3D cell-based Voronoi library
+
+/** \file snVoroClip.cpp
+ * \brief Function implementations for clipping a closed mesh by convex
+ * cells. */
+
+#include "snVoroClip.h"
+#include "snVoroWall.h"
+#include <cmath>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/** Computes the bounding box of the mesh.
+ * \param[out] (xa,xb) the minimum and maximum x coordinates.
+ * \param[out] (ya,yb) the minimum and maximum y coordinates.
+ * \param[out] (za,zb) the minimum and maximum z coordinates. */
+void clip_mesh::bounds(fpoint &xa,fpoint &xb,fpoint &ya,fpoint &yb,fpoint &za,fpoint &zb) const {
+	xa=ya=za=voropp_precision<fpoint>::large_number();
+	xb=yb=zb=-xa;
+	for(size_t i=0;i<pts.size();i+=3) {
+		if(pts[i]<xa) xa=pts[i];
+		if(pts[i]>xb) xb=pts[i];
+		if(pts[i+1]<ya) ya=pts[i+1];
+		if(pts[i+1]>yb) yb=pts[i+1];
+		if(pts[i+2]<za) za=pts[i+2];
+		if(pts[i+2]>zb) zb=pts[i+2];
+	}
+}
+
+/** Computes the mass properties of the closed mesh, by splitting every face
+ * into a fan of tetrahedra that reach to its first vertex.
+ * \param[out] m the volume, the centroid, and the xx, yy, zz, xy, xz and yz
+ * components of the inertia tensor around the centroid, as computed by
+ * voropp_mass_properties(). */
+void clip_mesh::mass_properties(fpoint *m) const {
+	fpoint q[10]={0,0,0,0,0,0,0,0,0,0};
+	if(pts.empty()) {
+		for(int i=0;i<10;i++) m[i]=0;
+		return;
+	}
+	const fpoint *o=&pts[0],*a,*b,*c;
+	for(int f=0;f<faces();f++) {
+		const int *v=face(f);
+		a=&pts[3*v[0]];
+		for(int j=2;j<face_size(f);j++) {
+			b=&pts[3*v[j-1]];c=&pts[3*v[j]];
+			voropp_add_tetrahedron(q,a[0]-o[0],a[1]-o[1],a[2]-o[2],b[0]-o[0],b[1]-o[1],b[2]-o[2],c[0]-o[0],c[1]-o[1],c[2]-o[2]);
+		}
+	}
+	voropp_mass_properties(q,fpoint(1),m);
+	if(m[0]>0) {m[1]+=o[0];m[2]+=o[1];m[3]+=o[2];}
+}
+
+/** Computes the signed volume of the closed mesh, which is positive if its
+ * faces are counter-clockwise when seen from the outside, and negative if
+ * the mesh is inside out.
+ * \return The signed volume. */
+fpoint clip_mesh::volume() const {
+	fpoint v=0;
+	const fpoint *a,*b,*c;
+	for(int f=0;f<faces();f++) {
+		const int *w=face(f);
+		a=&pts[3*w[0]];
+		for(int j=2;j<face_size(f);j++) {
+			b=&pts[3*w[j-1]];c=&pts[3*w[j]];
+			v+=a[0]*(b[1]*c[2]-b[2]*c[1])+a[1]*(b[2]*c[0]-b[0]*c[2])+a[2]*(b[0]*c[1]-b[1]*c[0]);
+		}
+	}
+	return v/6;
+}
+
+/** Turns the mesh inside out, by reversing the order of the vertices of every
+ * face. */
+void clip_mesh::flip() {
+	for(int f=0;f<faces();f++) reverse(vi.begin()+fo[f],vi.begin()+fo[f+1]);
+}
+
+/** Computes the normal of a planar face, using Newell's method.
+ * \param[in] m the mesh.
+ * \param[in] v the vertex indices of the face.
+ * \param[in] n the number of vertices.
+ * \param[out] (nx,ny,nz) the normal, which points to the side that the
+ * vertices are seen counter-clockwise from, and whose length is twice the
+ * area of the face. */
+static inline void face_normal(const clip_mesh &m,const int *v,int n,fpoint &nx,fpoint &ny,fpoint &nz) {
+	const fpoint *p,*q;
+	nx=ny=nz=0;
+	for(int i=0;i<n;i++) {
+		p=&m.pts[3*v[i]];q=&m.pts[3*v[i+1<n?i+1:0]];
+		nx+=(p[1]-q[1])*(p[2]+q[2]);
+		ny+=(p[2]-q[2])*(p[0]+q[0]);
+		nz+=(p[0]-q[0])*(p[1]+q[1]);
+	}
+}
+
+/** Appends the face planes of a convex mesh to a list. Every face gives a
+ * plane, which is oriented so that the centroid of the mesh lies behind it.
+ * The faces of a Voronoi cell usually come split into several triangles, some
+ * of which can be thin enough that their normals are off, so the faces are
+ * visited from the largest to the smallest, and a face is skipped if all of
+ * its vertices already lie on one of the planes in the list.
+ * \param[in,out] pl the list of planes, as (x,y,z,d) quadruples.
+ * \param[in] eps the distance below which a vertex is considered to lie on a
+ * plane. */
+void clip_mesh::planes(vector<fpoint> &pl,fpoint eps) const {
+	int i,j,k,n=points(),s=int(pl.size());
+	fpoint cx=0,cy=0,cz=0,nx,ny,nz,d,l;
+	const fpoint *p;
+	const int *v;
+	if(n==0) return;
+	for(i=0;i<n;i++) {cx+=pts[3*i];cy+=pts[3*i+1];cz+=pts[3*i+2];}
+	cx/=n;cy/=n;cz/=n;
+	vector<pair<fpoint,int> > fa(faces());
+	for(i=0;i<faces();i++) {
+		face_normal(*this,face(i),face_size(i),nx,ny,nz);
+		fa[i]=make_pair(-(nx*nx+ny*ny+nz*nz),i);
+	}
+	sort(fa.begin(),fa.end());
+	for(i=0;i<faces();i++) {
+		v=face(fa[i].second);
+		for(j=s;j<int(pl.size());j+=4) {
+			for(k=0;k<face_size(fa[i].second);k++) {
+				p=&pts[3*v[k]];
+				if(fabs(p[0]*pl[j]+p[1]*pl[j+1]+p[2]*pl[j+2]-pl[j+3])>eps) break;
+			}
+			if(k==face_size(fa[i].second)) break;
+		}
+		if(j<int(pl.size())) continue;
+		face_normal(*this,v,face_size(fa[i].second),nx,ny,nz);
+		l=sqrt(nx*nx+ny*ny+nz*nz);
+		if(l<eps*eps) break;
+		nx/=l;ny/=l;nz/=l;
+		d=nx*pts[3*v[0]]+ny*pts[3*v[0]+1]+nz*pts[3*v[0]+2];
+		if(nx*cx+ny*cy+nz*cz>d) {nx=-nx;ny=-ny;nz=-nz;d=-d;}
+		pl.push_back(nx);pl.push_back(ny);pl.push_back(nz);pl.push_back(d);
+	}
+}
+
+/** Initializes a clipper for a given source mesh.
+ * \param[in] isrc the closed source mesh, which must stay unchanged while the
+ * clipper is in use. */
+mesh_clipper::mesh_clipper(const clip_mesh &isrc) : cuts(0), src(isrc) {
+	src.bounds(sxa,sxb,sya,syb,sza,szb);
+	fpoint dx=sxb-sxa,dy=syb-sya,dz=szb-sza;
+	eps=src.points()>0?1e-6*sqrt(dx*dx+dy*dy+dz*dz):0;
+	if(eps<voropp_precision<fpoint>::tolerance()) eps=voropp_precision<fpoint>::tolerance();
+}
+
+/** Computes the intersection of the source mesh with a convex cell.
+ * \param[in] cell the convex cell, as a closed mesh.
+ * \param[out] out the part of the source mesh inside the cell, which is
+ * again a closed mesh.
+ * \return True if anything is left of the source mesh, false otherwise. */
+bool mesh_clipper::clip(const clip_mesh &cell,clip_mesh &out) {
+	fpoint xa,xb,ya,yb,za,zb;
+	const clip_mesh *in=&src;
+	clip_mesh *a=&wa,*b=&wb,*t;
+	int i,j,k;
+	out.clear();cuts=0;
+
+	// Skip cells that cannot overlap the source mesh
+	cell.bounds(xa,xb,ya,yb,za,zb);
+	if(xa>sxb||xb<sxa||ya>syb||yb<sya||za>szb||zb<sza) return false;
+
+	// Cull the faces away from the cell first, by cutting with the planes
+	// of its bounding box. These cannot remove any part of the cell, and
+	// they are applied starting with the one that cuts away the largest
+	// share of the source mesh, so that the later cuts have less to do.
+	// Planes that miss the source mesh are left out.
+	fpoint bp[6][5]={{1,0,0,xb,(sxb-xb)/(sxb-sxa+eps)},{-1,0,0,-xa,(xa-sxa)/(sxb-sxa+eps)},
+			 {0,1,0,yb,(syb-yb)/(syb-sya+eps)},{0,-1,0,-ya,(ya-sya)/(syb-sya+eps)},
+			 {0,0,1,zb,(szb-zb)/(szb-sza+eps)},{0,0,-1,-za,(za-sza)/(szb-sza+eps)}};
+	pl.clear();
+	for(i=0;i<6;i++) {
+		for(k=i,j=i+1;j<6;j++) if(bp[j][4]>bp[k][4]) k=j;
+		if(bp[k][4]<=0) break;
+		pl.insert(pl.end(),bp[k],bp[k]+4);
+		if(k!=i) for(j=0;j<5;j++) {fpoint u=bp[i][j];bp[i][j]=bp[k][j];bp[k][j]=u;}
+	}
+	cell.planes(pl,eps);
+
+	for(i=0;i<int(pl.size());i+=4) {
+		j=cut(*in,&pl[i],*a);
+		if(j==0) continue;
+		if(j==2) return false;
+		cap(*a,&pl[i]);
+		cuts++;
+		in=a;t=a;a=b;b=t;
+	}
+	if(in==&src) {out=src;return out.faces()>0;}
+
+	// Copy the result, dropping the vertices that no face uses
+	vm.assign(in->points(),-1);
+	out.vi.resize(in->vi.size());
+	out.fo=in->fo;
+	for(i=0;i<int(in->vi.size());i++) {
+		k=in->vi[i];
+		if(vm[k]<0) vm[k]=out.add_point(in->pts[3*k],in->pts[3*k+1],in->pts[3*k+2]);
+		out.vi[i]=vm[k];
+	}
+	return out.faces()>0;
+}
+
+/** Copies a vertex of the input mesh to the output mesh, unless this has
+ * already been done.
+ * \param[in] in the input mesh.
+ * \param[in] a the index of the vertex in the input mesh.
+ * \param[in,out] m the output mesh.
+ * \return The index of the vertex in the output mesh. */
+inline int mesh_clipper::copy_point(const clip_mesh &in,int a,clip_mesh &m) {
+	if(vm[a]<0) {
+		vm[a]=m.add_point(in.pts[3*a],in.pts[3*a+1],in.pts[3*a+2]);
+		on.push_back(sg[a]==0?1:0);
+	}
+	return vm[a];
+}
+
+/** Returns the vertex where an edge crosses the current plane, creating it
+ * the first time that the edge is visited, so that both faces sharing the
+ * edge use the same vertex.
+ * \param[in] in the input mesh.
+ * \param[in] (a,b) the vertices of the edge, on opposite sides of the plane.
+ * \param[in,out] m the output mesh.
+ * \return The index of the vertex in the output mesh. */
+int mesh_clipper::edge_point(const clip_mesh &in,int a,int b,clip_mesh &m) {
+	if(a>b) {int t=a;a=b;b=t;}
+	map<pair<int,int>,int>::iterator it=ev.find(make_pair(a,b));
+	if(it!=ev.end()) return it->second;
+	fpoint f=sd[a]/(sd[a]-sd[b]);
+	const fpoint *pa=&in.pts[3*a],*pb=&in.pts[3*b];
+	int l=m.add_point(pa[0]+f*(pb[0]-pa[0]),pa[1]+f*(pb[1]-pa[1]),pa[2]+f*(pb[2]-pa[2]));
+	on.push_back(1);
+	ev[make_pair(a,b)]=l;
+	return l;
+}
+
+/** Cuts a closed mesh by a plane, keeping the part behind it. The holes that
+ * this leaves are not closed yet, which is done by cap().
+ * \param[in] in the input mesh.
+ * \param[in] p the plane, as an (x,y,z,d) quadruple.
+ * \param[out] m the output mesh.
+ * \return 0 if the plane does not cut the mesh, in which case the output mesh
+ * is not touched, 1 if it cuts the mesh, and 2 if nothing is left. */
+int mesh_clipper::cut(const clip_mesh &in,const fpoint *p,clip_mesh &m) {
+	int i,j,k,n=in.points(),nin,nout=0,nb=0;
+	const int *v;
+	fpoint nx,ny,nz;
+
+	// Find out which side of the plane each vertex is on
+	sd.resize(n);sg.resize(n);
+	for(i=0;i<n;i++) {
+		sd[i]=in.pts[3*i]*p[0]+in.pts[3*i+1]*p[1]+in.pts[3*i+2]*p[2]-p[3];
+		if(sd[i]>eps) {sg[i]=1;nout++;}
+		else if(sd[i]<-eps) {sg[i]=-1;nb++;}
+		else sg[i]=0;
+	}
+	if(nout==0) return 0;
+	m.clear();
+	if(nb==0) return 2;
+
+	vm.assign(n,-1);on.clear();ev.clear();
+	for(i=0;i<in.faces();i++) {
+		v=in.face(i);k=in.face_size(i);
+		for(nin=nout=j=0;j<k;j++) {
+			if(sg[v[j]]<0) nin++;
+			else if(sg[v[j]]>0) nout++;
+		}
+		if(nout==0) {
+
+			// A face lying in the plane is only kept if it faces
+			// forward, since otherwise the part of the mesh that
+			// it bounds is in front of the plane
+			if(nin==0) {
+				face_normal(in,v,k,nx,ny,nz);
+				if(nx*p[0]+ny*p[1]+nz*p[2]<=0) continue;
+			}
+			fq.resize(k);
+			for(j=0;j<k;j++) fq[j]=copy_point(in,v[j],m);
+			m.add_face(&fq[0],k);
+			continue;
+		}
+		if(nin==0) continue;
+
+		// The face straddles the plane, so clip it to the convex
+		// polygon behind the plane
+		fq.clear();
+		for(j=0;j<k;j++) {
+			if(sg[v[j]]<=0) fq.push_back(copy_point(in,v[j],m));
+			if(sg[v[j]]*sg[v[j+1<k?j+1:0]]<0) fq.push_back(edge_point(in,v[j],v[j+1<k?j+1:0],m));
+		}
+		if(fq.size()>=3) m.add_face(&fq[0],int(fq.size()));
+	}
+	return 1;
+}
+
+/** Closes the holes that a cut has left in a mesh. The edges along the plane
+ * that have lost their twin are chained into loops, which are then sorted
+ * into outer boundaries and holes within them, triangulated, and merged into
+ * convex faces.
+ * \param[in,out] m the mesh that has been cut.
+ * \param[in] p the plane that it has been cut with. */
+void mesh_clipper::cap(clip_mesh &m,const fpoint *p) {
+	int i,j,k,l,s,c;
+	vector<pair<int,int> >::iterator it;
+
+	// Collect the edges along the plane, and keep the reverse of those that
+	// have no twin
+	pe.clear();be.clear();
+	for(i=0;i<m.faces();i++) for(j=m.fo[i];j<m.fo[i+1];j++) {
+		k=m.vi[j];l=m.vi[j+1<m.fo[i+1]?j+1:m.fo[i]];
+		if(on[k]&&on[l]) pe.push_back(make_pair(k,l));
+	}
+	sort(pe.begin(),pe.end());
+	for(i=0;i<int(pe.size());i++)
+		if(!binary_search(pe.begin(),pe.end(),make_pair(pe[i].second,pe[i].first)))
+			be.push_back(make_pair(pe[i].second,pe[i].first));
+	if(be.empty()) return;
+	sort(be.begin(),be.end());
+
+	// Chain the edges into loops
+	vector<char> bu(be.size(),0);
+	lp.clear();
+	for(i=0;i<int(be.size());i++) {
+		if(bu[i]) continue;
+		s=be[i].first;c=be[i].second;bu[i]=1;
+		vector<int> o(1,s);
+		while(c!=s) {
+			it=lower_bound(be.begin(),be.end(),make_pair(c,-1));
+			while(it!=be.end()&&it->first==c&&bu[it-be.begin()]) ++it;
+			if(it==be.end()||it->first!=c) break;
+			o.push_back(c);
+			bu[it-be.begin()]=1;c=it->second;
+		}
+		if(c==s&&o.size()>=3) lp.push_back(o);
+	}
+
+	// Set up a coordinate system in the plane, in which the caps run
+	// counter-clockwise when seen from the front
+	fpoint ax=fabs(p[0]),ay=fabs(p[1]),az=fabs(p[2]),ux,uy,uz,wx,wy,wz,r;
+	if(ax<=ay&&ax<=az) {ux=0;uy=p[2];uz=-p[1];}
+	else if(ay<=az) {ux=-p[2];uy=0;uz=p[0];}
+	else {ux=p[1];uy=-p[0];uz=0;}
+	r=1/sqrt(ux*ux+uy*uy+uz*uz);ux*=r;uy*=r;uz*=r;
+	wx=p[1]*uz-p[2]*uy;wy=p[2]*ux-p[0]*uz;wz=p[0]*uy-p[1]*ux;
+	uv.resize(2*m.points());
+	vector<fpoint> ar(lp.size());
+	for(i=0;i<int(lp.size());i++) {
+		for(j=0;j<int(lp[i].size());j++) {
+			k=lp[i][j];
+			uv[2*k]=ux*m.pts[3*k]+uy*m.pts[3*k+1]+uz*m.pts[3*k+2];
+			uv[2*k+1]=wx*m.pts[3*k]+wy*m.pts[3*k+1]+wz*m.pts[3*k+2];
+		}
+		for(ar[i]=0,j=1;j+1<int(lp[i].size());j++) ar[i]+=cross(lp[i][0],lp[i][j],lp[i][j+1]);
+	}
+
+	// Find the smallest outer boundary around each hole
+	vector<int> ow(lp.size(),-1);
+	for(i=0;i<int(lp.size());i++) if(ar[i]<0) {
+		fpoint hx=uv[2*lp[i][0]],hy=uv[2*lp[i][0]+1],x0,y0,x1,y1;
+		for(j=0;j<int(lp.size());j++) if(ar[j]>0&&(ow[i]<0||ar[j]<ar[ow[i]])) {
+			bool ins=false;
+			for(k=0,l=int(lp[j].size())-1;k<int(lp[j].size());l=k++) {
+				x0=uv[2*lp[j][k]];y0=uv[2*lp[j][k]+1];x1=uv[2*lp[j][l]];y1=uv[2*lp[j][l]+1];
+				if((y0>hy)!=(y1>hy)&&hx<x0+(hy-y0)*(x1-x0)/(y1-y0)) ins=!ins;
+			}
+			if(ins) ow[i]=j;
+		}
+	}
+
+	// Merge the holes into their outer boundaries, starting with the
+	// rightmost one, and triangulate the result
+	pc.clear();
+	for(i=0;i<int(lp.size());i++) if(ar[i]>0) {
+		vector<pair<fpoint,int> > hs;
+		for(j=0;j<int(lp.size());j++) if(ow[j]==i) {
+			fpoint mx=-voropp_precision<fpoint>::large_number();
+			for(k=0;k<int(lp[j].size());k++) if(uv[2*lp[j][k]]>mx) mx=uv[2*lp[j][k]];
+			hs.push_back(make_pair(-mx,j));
+		}
+		sort(hs.begin(),hs.end());
+		for(j=0;j<int(hs.size());j++) bridge(lp[i],lp[hs[j].second]);
+		triangulate(lp[i]);
+	}
+	merge_pieces();
+	for(i=0;i<int(pc.size());i++) if(pc[i].size()>=3) m.add_face(&pc[i][0],int(pc[i].size()));
+}
+
+/** Joins a hole to the outer boundary around it, by cutting in from the
+ * rightmost vertex of the hole to a vertex of the boundary that it can see.
+ * \param[in,out] o the outer boundary.
+ * \param[in] h the hole, running clockwise.
+ * \return True if the hole could be joined, false otherwise. */
+bool mesh_clipper::bridge(vector<int> &o,const vector<int> &h) {
+	int i,a,b,hm=0,bp=-1,n=int(h.size()),no=int(o.size());
+	for(i=1;i<n;i++) if(uv[2*h[i]]>uv[2*h[hm]]) hm=i;
+	fpoint mx=uv[2*h[hm]],my=uv[2*h[hm]+1],ix=voropp_precision<fpoint>::large_number(),x,px,py,t,bt;
+
+	// Cast a ray to the right, and find the nearest boundary edge that it
+	// hits, taking the endpoint of the edge that is further right
+	for(i=0;i<no;i++) {
+		a=o[i];b=o[(i+1)%no];
+		if(uv[2*a+1]==uv[2*b+1]) {
+			if(uv[2*a+1]==my&&uv[2*a]>=mx&&uv[2*a]<ix) {ix=uv[2*a];bp=i;}
+			continue;
+		}
+		if((uv[2*a+1]<=my)!=(uv[2*b+1]<=my)) {
+			x=uv[2*a]+(my-uv[2*a+1])*(uv[2*b]-uv[2*a])/(uv[2*b+1]-uv[2*a+1]);
+			if(x>=mx&&x<ix) {ix=x;bp=uv[2*a]>uv[2*b]?i:(i+1)%no;}
+		}
+	}
+	if(bp<0) return false;
+
+	// If another boundary vertex lies between the ray and that endpoint,
+	// then the hole cannot see the endpoint, so take the vertex with the
+	// smallest angle to the ray instead
+	px=uv[2*o[bp]];py=uv[2*o[bp]+1];
+	if(px!=ix||py!=my) {
+		bt=fabs(py-my)/(px-mx);
+		for(i=0;i<no;i++) {
+			a=o[i];x=uv[2*a];t=uv[2*a+1];
+			if(i==bp||x<=mx) continue;
+			fpoint s1=(ix-mx)*(t-my),s2=(px-ix)*(t-my)-(py-my)*(x-ix),s3=(mx-px)*(t-py)-(my-py)*(x-px);
+			if((s1<0||s2<0||s3<0)&&(s1>0||s2>0||s3>0)) continue;
+			t=fabs(t-my)/(x-mx);
+			if(t<bt||(t==bt&&x<uv[2*o[bp]])) {bt=t;bp=i;}
+		}
+	}
+
+	// Splice the hole into the boundary, going in and out through the
+	// bridge
+	vector<int> r;
+	r.reserve(no+n+2);
+	r.insert(r.end(),o.begin(),o.begin()+bp+1);
+	for(i=0;i<=n;i++) r.push_back(h[(hm+i)%n]);
+	r.insert(r.end(),o.begin()+bp,o.end());
+	o.swap(r);
+	return true;
+}
+
+/** Triangulates a simple polygon by ear clipping, and adds the triangles to
+ * the pieces of the current cap.
+ * \param[in] o the polygon, running counter-clockwise, which may touch itself
+ * along the bridges to its holes. */
+void mesh_clipper::triangulate(vector<int> &o) {
+	int n=int(o.size()),i,j,a,c,q,st=0;
+	if(n<3) return;
+	vector<int> nx(n),pv(n),t(3);
+	for(i=0;i<n;i++) {nx[i]=(i+1)%n;pv[i]=(i+n-1)%n;}
+	i=0;
+	while(n>3) {
+		a=pv[i];c=nx[i];
+		bool ear=cross(o[a],o[i],o[c])>=0;
+
+		// Check that no other vertex lies inside the ear, ignoring the
+		// copies of its own corners along the bridges
+		if(ear) for(j=nx[c];j!=a;j=nx[j]) {
+			q=o[j];
+			if(q==o[a]||q==o[i]||q==o[c]) continue;
+			if(cross(o[a],o[i],q)>=0&&cross(o[i],o[c],q)>=0&&cross(o[c],o[a],q)>=0) {ear=false;break;}
+		}
+
+		// If no ear can be found, the polygon is degenerate, and the
+		// current corner is cut off anyway to make progress
+		if(ear||st>n) {
+			t[0]=o[a];t[1]=o[i];t[2]=o[c];
+			if(t[0]!=t[1]&&t[1]!=t[2]&&t[2]!=t[0]) pc.push_back(t);
+			nx[a]=c;pv[c]=a;n--;i=c;st=0;
+		} else {i=nx[i];st++;}
+	}
+	t[0]=o[pv[i]];t[1]=o[i];t[2]=o[nx[i]];
+	if(t[0]!=t[1]&&t[1]!=t[2]&&t[2]!=t[0]) pc.push_back(t);
+}
+
+/** Merges the triangles of the current cap into convex faces, by removing
+ * every diagonal whose two ends stay convex without it, following Hertel and
+ * Mehlhorn. Merged pieces are left empty. */
+void mesh_clipper::merge_pieces() {
+	int i,j,k,a,b,p,q,np,nq,ia,ib;
+	fpoint tl=-eps*eps;
+
+	// Find the edges that two pieces share
+	vector<pair<pair<int,int>,int> > de;
+	for(i=0;i<int(pc.size());i++) for(j=0;j<3;j++) {
+		a=pc[i][j];b=pc[i][(j+1)%3];
+		de.push_back(make_pair(make_pair(a<b?a:b,a<b?b:a),i));
+	}
+	sort(de.begin(),de.end());
+
+	// Keep track of which piece every triangle has been merged into
+	vector<int> own(pc.size());
+	for(i=0;i<int(pc.size());i++) own[i]=i;
+	for(k=0;k+1<int(de.size());k++) {
+		if(de[k].first!=de[k+1].first) continue;
+		if((k>0&&de[k-1].first==de[k].first)||(k+2<int(de.size())&&de[k+2].first==de[k].first)) continue;
+		for(p=de[k].second;own[p]!=p;p=own[p]);
+		for(q=de[k+1].second;own[q]!=q;q=own[q]);
+		if(p==q) continue;
+		vector<int> &P=pc[p],&Q=pc[q];
+		np=int(P.size());nq=int(Q.size());
+
+		// Find the shared edge, which runs from a to b in the first
+		// piece and from b to a in the second
+		a=de[k].first.first;b=de[k].first.second;
+		for(ia=0;ia<np&&P[ia]!=a;ia++);
+		if(ia==np) continue;
+		if(P[(ia+1)%np]!=b) {
+			if(P[(ia+np-1)%np]!=b) continue;
+			ia=(ia+np-1)%np;a=P[ia];b=P[(ia+1)%np];
+		}
+		for(ib=0;ib<nq&&!(Q[ib]==b&&Q[(ib+1)%nq]==a);ib++);
+		if(ib==nq) continue;
+
+		// Check that the merged piece is convex at both ends of the
+		// shared edge
+		if(cross(P[(ia+np-1)%np],a,Q[(ib+2)%nq])<tl) continue;
+		if(cross(Q[(ib+nq-1)%nq],b,P[(ia+2)%np])<tl) continue;
+
+		// Build the merged piece, going around the first one from b to
+		// a, and then around the second one, and reject it if it
+		// touches itself
+		vector<int> r;
+		for(j=1;j<=np;j++) r.push_back(P[(ia+j)%np]);
+		for(j=2;j<nq;j++) r.push_back(Q[(ib+j)%nq]);
+		bool dup=false;
+		for(i=0;i<int(r.size())&&!dup;i++) for(j=i+1;j<int(r.size());j++) if(r[i]==r[j]) {dup=true;break;}
+		if(dup) continue;
+		P.swap(r);Q.clear();own[q]=p;
+	}
+}
+
+/** Works out where a convex cell lies relative to the source mesh, by
+ * comparing the distance from its center to the surface with its radius. If
+ * the surface is further away than the furthest vertex, the whole cell lies
+ * on the same side of it as its center.
+ * \param[in] w the wall made from the source mesh.
+ * \param[in] cell the cell.
+ * \return The class of the cell, as given by the clip_class enumeration. */
+static int classify_cell(wall_trianglemesh &w,const clip_mesh &cell) {
+	int i,n=cell.points();
+	if(n==0) return clip_outside;
+	const fpoint *p=&cell.pts[0];
+	fpoint x=0,y=0,z=0,rq=0,dq,cx,cy,cz;
+	for(i=0;i<3*n;i+=3) {x+=p[i];y+=p[i+1];z+=p[i+2];}
+	x/=n;y/=n;z/=n;
+	for(i=0;i<3*n;i+=3) {
+		dq=(p[i]-x)*(p[i]-x)+(p[i+1]-y)*(p[i+1]-y)+(p[i+2]-z)*(p[i+2]-z);
+		if(dq>rq) rq=dq;
+	}
+	if(w.closest_point(x,y,z,cx,cy,cz)<=rq) return clip_straddling;
+	return w.point_inside(x,y,z)?clip_inside:clip_outside;
+}
+
+/** Sets up the clipper with the source mesh and builds its search structure.
+ * \param[in] isrc the closed source mesh, which has to stay alive as long as
+ * the clipper.
+ * \param[in] ithreads the number of threads to use, or zero to use all of
+ * them. */
+cell_clipper::cell_clipper(const clip_mesh &isrc,int ithreads) : src(isrc), w(new wall_trianglemesh(isrc)), threads(ithreads) {
+	counts[clip_inside]=counts[clip_outside]=counts[clip_straddling]=0;
+#ifdef _OPENMP
+	if(threads<=0) threads=omp_get_max_threads();
+#else
+	threads=1;
+#endif
+}
+
+/** The cell_clipper destructor frees the search structure. */
+cell_clipper::~cell_clipper() {
+	delete w;
+}
+
+/** Clips the source mesh by a range of cells.
+ * \param[in] cells the convex cells.
+ * \param[out] out the part of the source mesh inside each cell, in the same
+ * order as the cells. It is resized to the number of cells if it is
+ * smaller, and only the entries of the range are changed.
+ * \param[in] (s,e) the range of cells to clip by, from s up to but not
+ * including e.
+ * \param[in,out] mass if not NULL, the mass properties of the cells, ten per
+ * cell as computed by voropp_mass_properties(). They are corrected to those of
+ * the pieces: kept for the cells inside, zeroed for the cells outside, and
+ * recomputed for the clipped cells only. */
+void cell_clipper::clip(const vector<clip_mesh> &cells,vector<clip_mesh> &out,int s,int e,fpoint *mass) {
+	int i,ci=0,co=0,cs=0,t=threads;
+	if(out.size()<cells.size()) out.resize(cells.size());
+	if(t>e-s) t=e>s?e-s:1;
+#pragma omp parallel num_threads(t)
+	{
+		mesh_clipper mc(src);
+#pragma omp for schedule(dynamic,4) reduction(+:ci,co,cs)
+		for(i=s;i<e;i++) switch(classify_cell(*w,cells[i])) {
+			case clip_inside: out[i]=cells[i];ci++;break;
+			case clip_outside:
+				out[i].clear();co++;
+				if(mass!=NULL) for(int j=0;j<10;j++) mass[10*i+j]=0;
+				break;
+			default:
+				mc.clip(cells[i],out[i]);cs++;
+				if(mass!=NULL) out[i].mass_properties(mass+10*i);
+		}
+	}
+	counts[clip_inside]+=ci;counts[clip_outside]+=co;counts[clip_straddling]+=cs;
+}
+
+/** Clips a closed source mesh by a list of convex cells in one go, using all
+ * available threads. See the cell_clipper class for how the cells are
+ * treated.
+ * \param[in] src the closed source mesh.
+ * \param[in] cells the convex cells.
+ * \param[out] out the part of the source mesh inside each cell, in the same
+ * order as the cells.
+ * \param[in] threads the number of threads to use, or zero to use all of
+ * them.
+ * \param[out] counts if not NULL, an array of three integers which receive
+ * the number of cells in each class of the clip_class enumeration.
+ * \param[in,out] mass if not NULL, the mass properties of the cells, which
+ * are corrected as in cell_clipper::clip(). */
+void clip_cells(const clip_mesh &src,const vector<clip_mesh> &cells,vector<clip_mesh> &out,int threads,int *counts,fpoint *mass) {
+	int n=int(cells.size());
+	cell_clipper cc(src,threads);
+	out.resize(n);
+	cc.clip(cells,out,0,n,mass);
+	if(counts!=NULL) {counts[clip_inside]=cc.counts[clip_inside];counts[clip_outside]=cc.counts[clip_outside];counts[clip_straddling]=cc.counts[clip_straddling];}
+#if VOROPP_VERBOSE >=2
+	cerr << "Clipped cells: " << cc.counts[clip_inside] << " inside, " << cc.counts[clip_outside] << " outside, " << cc.counts[clip_straddling] << " straddling" << endl;
+#endif
+}
+
+/** Finds the plane that two neighboring convex cells share, which is a plane
+ * of the first cell that is also a plane of the second one, turned around.
+ * \param[in] pa the planes of the first cell, as (x,y,z,d) quadruples.
+ * \param[in] pb the planes of the second cell.
+ * \param[in] eps the distance below which two planes are considered the same.
+ * \param[out] (k,l) the positions of the shared plane in the two lists.
+ * \return True if the cells share a plane, false otherwise. */
+static bool shared_plane(const vector<fpoint> &pa,const vector<fpoint> &pb,fpoint eps,int &k,int &l) {
+	fpoint dn,dd,best=eps;
+	k=l=-1;
+	for(int i=0;i<int(pa.size());i+=4) for(int j=0;j<int(pb.size());j+=4) {
+		dn=fabs(pa[i]+pb[j])+fabs(pa[i+1]+pb[j+1])+fabs(pa[i+2]+pb[j+2]);
+		dd=fabs(pa[i+3]+pb[j+3]);
+		if(dn<1e-3&&dd<best) {best=dd;k=i;l=j;}
+	}
+	return k>=0;
+}
+
+/** Computes the area of the part of a closed mesh's surface that lies on a
+ * plane, counting only the faces that face the same way as the plane.
+ * \param[in] m the mesh.
+ * \param[in] p the plane, as an (x,y,z,d) quadruple.
+ * \param[in] eps the distance below which a vertex is considered to lie on the
+ * plane.
+ * \return The area. */
+static fpoint contact_area(const clip_mesh &m,const fpoint *p,fpoint eps) {
+	int i,k;
+	fpoint a=0,nx,ny,nz;
+	const fpoint *q;
+	for(i=0;i<m.faces();i++) {
+		const int *v=m.face(i);
+		for(k=0;k<m.face_size(i);k++) {
+			q=&m.pts[3*v[k]];
+			if(fabs(q[0]*p[0]+q[1]*p[1]+q[2]*p[2]-p[3])>eps) break;
+		}
+		if(k<m.face_size(i)) continue;
+		face_normal(m,v,m.face_size(i),nx,ny,nz);
+		if(nx*p[0]+ny*p[1]+nz*p[2]>0) a+=sqrt(nx*nx+ny*ny+nz*nz);
+	}
+	return 0.5*a;
+}
+
+/** Measures how much the pieces that clip_cells() cut out of a mesh touch
+ * each other. Two pieces can only touch where their cells share a face, and
+ * the area of their contact is the part of that face which is left on the
+ * pieces, so the faces of both pieces that lie on the shared plane are
+ * summed up, and the two areas are averaged.
+ * \param[in] cells the convex cells.
+ * \param[in] pieces the pieces, in the same order as the cells.
+ * \param[in] pairs the pairs of neighboring cells that are to be looked at, as
+ * consecutive pairs of indices into the list of cells.
+ * \param[out] areas the contact area of every pair, which is zero for pairs
+ * whose pieces do not touch.
+ * \param[in] threads the number of threads to use, or zero to use all of
+ * them. */
+void clip_contacts(const vector<clip_mesh> &cells,const vector<clip_mesh> &pieces,const vector<int> &pairs,vector<fpoint> &areas,int threads) {
+	int i,n=int(pairs.size()/2),m=int(cells.size());
+	fpoint xa,xb,ya,yb,za,zb,cxa,cxb,cya,cyb,cza,czb,eps;
+#ifdef _OPENMP
+	if(threads<=0) threads=omp_get_max_threads();
+#else
+	threads=1;
+#endif
+	areas.assign(n,0);
+
+	// The distance below which a vertex is considered to lie on a plane
+	// follows the size of the whole set of cells
+	xa=ya=za=voropp_precision<fpoint>::large_number();
+	xb=yb=zb=-xa;
+	for(i=0;i<m;i++) if(pieces[i].faces()>0) {
+		cells[i].bounds(cxa,cxb,cya,cyb,cza,czb);
+		if(cxa<xa) xa=cxa;
+		if(cxb>xb) xb=cxb;
+		if(cya<ya) ya=cya;
+		if(cyb>yb) yb=cyb;
+		if(cza<za) za=cza;
+		if(czb>zb) zb=czb;
+	}
+	if(xa>xb) return;
+	eps=1e-5*sqrt((xb-xa)*(xb-xa)+(yb-ya)*(yb-ya)+(zb-za)*(zb-za));
+	if(eps<voropp_precision<fpoint>::tolerance()) eps=voropp_precision<fpoint>::tolerance();
+
+	// Find the planes of every cell that has a piece, and then measure
+	// the contacts
+	vector<vector<fpoint> > pl(m);
+#pragma omp parallel num_threads(threads)
+	{
+		int a,b,k,l;
+#pragma omp for schedule(dynamic,16)
+		for(i=0;i<m;i++) if(pieces[i].faces()>0) cells[i].planes(pl[i],eps);
+#pragma omp for schedule(dynamic,16)
+		for(i=0;i<n;i++) {
+			a=pairs[2*i];b=pairs[2*i+1];
+			if(pieces[a].faces()==0||pieces[b].faces()==0||!shared_plane(pl[a],pl[b],eps,k,l)) continue;
+			areas[i]=0.5*(contact_area(pieces[a],&pl[a][k],eps)+contact_area(pieces[b],&pl[b][l],eps));
+		}
+	}
+}
@@ -0,0 +1,190 @@
+// Voro++, a 3D cell-based Voronoi library
+
+/** \file snVoroClip.h
+ * \brief Header file for clipping a closed mesh by convex cells. */
+
+#ifndef VOROPP_CLIP_HH
+#define VOROPP_CLIP_HH
+
+#include "snVoroConfig.h"
+#include <cstddef>
+#include <vector>
+#include <map>
+#include <utility>
+
+using namespace std;
+
+/** \brief A class holding an indexed polygon mesh.
+ *
+ * This class stores the meshes that the clipper works with: the closed source
+ * mesh that gets shattered, the convex cells that it gets shattered by, and
+ * the pieces that come out. Faces share their vertices, so that the clipper
+ * can follow the mesh from one face to the next. All faces are expected to be
+ * planar and convex, which holds for triangles, and for every face that the
+ * clipper creates. */
+class clip_mesh {
+	public:
+		/** The vertex positions, as consecutive (x,y,z) triples. */
+		vector<fpoint> pts;
+		/** The vertex indices of all faces, one face after another. */
+		vector<int> vi;
+		/** The position of the first index of each face in vi, followed
+		 * by the total number of indices. */
+		vector<int> fo;
+		clip_mesh() : fo(1,0) {};
+		/** Returns the number of vertices. */
+		inline int points() const {return int(pts.size()/3);}
+		/** Returns the number of faces. */
+		inline int faces() const {return int(fo.size())-1;}
+		/** Returns the number of vertices of a face. */
+		inline int face_size(int f) const {return fo[f+1]-fo[f];}
+		/** Returns the vertex indices of a face. */
+		inline const int *face(int f) const {return &vi[fo[f]];}
+		/** Removes all vertices and faces. */
+		inline void clear() {pts.clear();vi.clear();fo.assign(1,0);}
+		/** Adds a vertex to the mesh.
+		 * \param[in] (x,y,z) the position of the vertex.
+		 * \return The index of the new vertex. */
+		inline int add_point(fpoint x,fpoint y,fpoint z) {
+			pts.push_back(x);pts.push_back(y);pts.push_back(z);
+			return points()-1;
+		}
+		/** Adds a face to the mesh.
+		 * \param[in] v the indices of its vertices, in counter-clockwise
+		 * order when seen from the outside.
+		 * \param[in] n the number of vertices. */
+		inline void add_face(const int *v,int n) {
+			vi.insert(vi.end(),v,v+n);fo.push_back(int(vi.size()));
+		}
+		/** Adds a triangle to the mesh.
+		 * \param[in] (a,b,c) the indices of its vertices, in
+		 * counter-clockwise order when seen from the outside. */
+		inline void add_triangle(int a,int b,int c) {
+			vi.push_back(a);vi.push_back(b);vi.push_back(c);fo.push_back(int(vi.size()));
+		}
+		void bounds(fpoint &xa,fpoint &xb,fpoint &ya,fpoint &yb,fpoint &za,fpoint &zb) const;
+		void planes(vector<fpoint> &pl,fpoint eps) const;
+		void mass_properties(fpoint *m) const;
+		fpoint volume() const;
+		void flip();
+};
+
+/** \brief A class clipping a closed mesh by convex cells.
+ *
+ * This class computes the intersection of a closed source mesh with a convex
+ * cell, by cutting the mesh with the planes of the cell one after another.
+ * Every cut removes the part of the mesh in front of the plane, and closes
+ * the holes that this leaves with caps, so that the mesh going into the next
+ * cut is closed again. The caps are triangulated by ear clipping, after the
+ * holes in them have been joined to their outer boundaries, and the triangles
+ * are then merged back into as few convex faces as possible, which keeps the
+ * later cuts from splitting them up any further. Before the face planes are
+ * applied, the mesh is cut by the planes of the cell's bounding box, which
+ * culls the faces that are nowhere near the cell as cheaply as possible. A
+ * clipper keeps scratch memory between calls, so each thread should use its
+ * own one, while they can all share the same source mesh. */
+class mesh_clipper {
+	public:
+		mesh_clipper(const clip_mesh &isrc);
+		bool clip(const clip_mesh &cell,clip_mesh &out);
+		/** The number of planes that removed part of the mesh in the
+		 * last call to clip(). */
+		int cuts;
+	private:
+		/** The closed source mesh. */
+		const clip_mesh &src;
+		/** The bounding box of the source mesh. */
+		fpoint sxa,sxb,sya,syb,sza,szb;
+		/** The distance below which a vertex is considered to lie on
+		 * a cutting plane, scaled to the size of the source mesh. */
+		fpoint eps;
+		/** The two working meshes, which are swapped after every
+		 * cut. */
+		clip_mesh wa,wb;
+		/** The planes of the current cell, as consecutive (x,y,z,d)
+		 * quadruples, keeping the points with x*px+y*py+z*pz<=d. */
+		vector<fpoint> pl;
+		/** The signed distances of the vertices to the current
+		 * plane. */
+		vector<fpoint> sd;
+		/** The side of the current plane that each vertex is on: -1
+		 * behind, 0 on, and 1 in front of it. */
+		vector<int> sg;
+		/** The index that each vertex of the input mesh has in the
+		 * output mesh, or -1 if it has not been copied yet. */
+		vector<int> vm;
+		/** Flags for the vertices of the output mesh which lie on the
+		 * current plane. */
+		vector<char> on;
+		/** The vertices created on the edges that cross the current
+		 * plane, keyed by the edge. */
+		map<pair<int,int>,int> ev;
+		/** A buffer for the face that is currently being clipped. */
+		vector<int> fq;
+		/** The edges of the output mesh that run along the current
+		 * plane. */
+		vector<pair<int,int> > pe;
+		/** The edges along the current plane that have no twin, in
+		 * the direction of the caps that close them. */
+		vector<pair<int,int> > be;
+		/** The boundary loops that need to be capped. */
+		vector<vector<int> > lp;
+		/** The convex pieces of the cap that is being built. */
+		vector<vector<int> > pc;
+		/** The 2D coordinates of the cap vertices within the plane,
+		 * indexed by vertex. */
+		vector<fpoint> uv;
+		int cut(const clip_mesh &in,const fpoint *p,clip_mesh &m);
+		inline int copy_point(const clip_mesh &in,int a,clip_mesh &m);
+		int edge_point(const clip_mesh &in,int a,int b,clip_mesh &m);
+		void cap(clip_mesh &m,const fpoint *p);
+		bool bridge(vector<int> &o,const vector<int> &h);
+		void triangulate(vector<int> &o);
+		void merge_pieces();
+		/** Computes twice the signed area of a triangle in the plane
+		 * of the current cap.
+		 * \param[in] (a,b,c) the vertex indices of the triangle.
+		 * \return The area, which is positive if the vertices run
+		 * counter-clockwise. */
+		inline fpoint cross(int a,int b,int c) {
+			return (uv[2*b]-uv[2*a])*(uv[2*c+1]-uv[2*a+1])-(uv[2*b+1]-uv[2*a+1])*(uv[2*c]-uv[2*a]);
+		}
+};
+
+/** The classes that clip_cells() sorts the cells into, by where they lie
+ * relative to the source mesh. */
+enum clip_class {clip_inside=0,clip_outside=1,clip_straddling=2};
+
+class wall_trianglemesh;
+
+/** \brief A class clipping a closed mesh by a list of convex cells.
+ *
+ * This class sets up the search structure of the source mesh once, and then
+ * clips it by the cells in as many batches as the caller likes, using all
+ * available threads for each of them. This lets the caller report progress
+ * and stop between batches. The cells are first sorted into those that lie
+ * entirely inside the mesh, which are passed through unchanged, those that
+ * lie entirely outside, which come out empty, and those that straddle its
+ * surface, which are the only ones that actually get clipped. */
+class cell_clipper {
+	public:
+		cell_clipper(const clip_mesh &isrc,int ithreads=0);
+		~cell_clipper();
+		void clip(const vector<clip_mesh> &cells,vector<clip_mesh> &out,int s,int e,fpoint *mass=NULL);
+		/** The number of cells clipped so far in each class of the
+		 * clip_class enumeration. */
+		int counts[3];
+	private:
+		/** The closed source mesh. */
+		const clip_mesh &src;
+		/** The wall made from the source mesh, which answers the
+		 * distance and inside queries of the classification. */
+		wall_trianglemesh *w;
+		/** The number of threads to use. */
+		int threads;
+};
+
+void clip_cells(const clip_mesh &src,const vector<clip_mesh> &cells,vector<clip_mesh> &out,int threads=0,int *counts=NULL,fpoint *mass=NULL);
+void clip_contacts(const vector<clip_mesh> &cells,const vector<clip_mesh> &pieces,const vector<int> &pairs,vector<fpoint> &areas,int threads=0);
+
+#endif
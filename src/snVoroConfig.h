@@ -31,6 +31,21 @@ const int init_delete2_size=256;
 const int init_facet_size=32;
 /** The initial size for the wall pointer array. */
 const int init_wall_size=32;
+/** The initial particle memory for a container block that has none yet,
+ * which can happen with contiguous storage when put_bulk() left the block
+ * empty. */
+const int init_particle_memory=8;
+/** The average number of particles per block that voropp_optimal_grid()
+ * aims for when it chooses the grid size of a container. */
+const double optimal_particles=5.6;
+/** The largest number of triangles that a leaf of the bounding volume
+ * hierarchy in the triangle mesh wall holds. */
+const int bvh_leaf_size=4;
+/** The size of the traversal stack for the bounding volume hierarchy in the
+ * triangle mesh wall. The hierarchy is split at the median, so its depth grows
+ * with the logarithm of the number of triangles, and this is plenty for any
+ * mesh that fits into memory. */
+const int bvh_stack_size=64;
 
 // If the initial memory is too small, the program dynamically allocates more.
 // However, if the limits below are reached, then the program bails out.
@@ -62,41 +77,53 @@ const int max_wall_size=2048;
 #define VOROPP_VERBOSE 0
 #endif
 
-/** The declaration of fpoint allows that code to be compiled both using single
- * precision numbers and double precision numbers. Under normal usage fpoint is
- * set be a double precision floating point number, but defining the
- * preprocessor macro VOROPP_SINGLE_PRECISION will switch it to single
- * precision and make the code tolerances larger. */
-#ifdef VOROPP_SINGLE_PRECISION
-typedef float fpoint;
-#else
+/** The floating point type of the routines that are not templates, such as
+ * the walls and the clipping. The voronoicell_base and container_base
+ * templates take their precision from their neighbor and radius options
+ * instead, so that single and double precision versions of them can be used
+ * side by side in one program. The options named without a precision, such as
+ * neighbor_none and radius_mono, use this type. */
 typedef double fpoint;
-#endif
-
-/** If a point is within this distance of a cutting plane, then the code
- * assumes that point exactly lies on the plane. */
-#ifdef VOROPP_SINGLE_PRECISION
-const fpoint tolerance=1e-5;
-#else
-const fpoint tolerance=1e-10;
-#endif
 
-/** If a point is within this distance of a cutting plane, then the code stores
- * whether this point is inside, outside, or exactly on the cutting plane in
- * the marginal cases buffer, to prevent the test giving a different result on
- * a subsequent evaluation due to floating point rounding errors. */
-#ifdef VOROPP_SINGLE_PRECISION
-const fpoint tolerance2=2e-5;
-#else
-const fpoint tolerance2=2e-10;
-#endif
+/** \brief The numerical constants for one floating point type.
+ *
+ * The tolerances depend on the precision that a cell or a container computes
+ * in, so they are looked up from this template with the floating point type of
+ * the computation. It is specialized for float and double. */
+template<class fp> struct voropp_precision;
 
-/** The square of the tolerance, used when deciding whether some squared
- * quantities are large enough to be used. */
-const fpoint tolerance_sq=tolerance*tolerance;
+/** The numerical constants for double precision. */
+template<> struct voropp_precision<double> {
+	/** If a point is within this distance of a cutting plane, then
+	 * the code assumes that point exactly lies on the plane. */
+	static inline double tolerance() {return 1e-10;}
+	/** If a point is within this distance of a cutting plane, then
+	 * the code stores whether this point is inside, outside, or
+	 * exactly on the cutting plane in the marginal cases buffer, to
+	 * prevent the test giving a different result on a subsequent
+	 * evaluation due to floating point rounding errors. */
+	static inline double tolerance2() {return 2e-10;}
+	/** The square of the tolerance, used when deciding whether some
+	 * squared quantities are large enough to be used. */
+	static inline double tolerance_sq() {return tolerance()*tolerance();}
+	/** A large number that is used in the computation. */
+	static inline double large_number() {return 1e30;}
+};
 
-/** A large number that is used in the computation. */
-const fpoint large_number=1e30;
+/** The numerical constants for single precision, where the tolerances are
+ * larger. */
+template<> struct voropp_precision<float> {
+	/** The distance below which a point counts as lying on a
+	 * cutting plane. */
+	static inline float tolerance() {return 1e-5f;}
+	/** The distance below which the outcome of a plane test is
+	 * stored in the marginal cases buffer. */
+	static inline float tolerance2() {return 2e-5f;}
+	/** The square of the tolerance. */
+	static inline float tolerance_sq() {return tolerance()*tolerance();}
+	/** A large number that is used in the computation. */
+	static inline float large_number() {return 1e30f;}
+};
 
 /** Voro++ returns this status code if there is a file-related error, such as
  * not being able to open file. */
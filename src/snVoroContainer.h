@@ -16,14 +16,21 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <ctime>
 #include <Essence/snTriangleMesh.h>
 #include "Kratos.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
-class voropp_loop;
-class radius_poly;
+template<class fpoint> class voropp_loop_base;
+class voropp_block_queue;
+template<class fpoint> class radius_poly_base;
 class wall;
+template<class r_option> class voropp_search;
+template<class r_option,class fpoint=typename r_option::precision> class voropp_cell_cache;
 
 /** \brief A class representing the whole simulation region.
  *
@@ -32,11 +39,25 @@ class wall;
  * the geometry into rectangular grid of blocks, each of which handles the
  * particles in a particular area. Routines exist for putting in particles,
  * importing particles from standard input, and carrying out Voronoi
- * calculations. */
-template<class r_option>
+ * calculations. The floating point type that the particles are stored and the
+ * cells are computed in is taken from the radius option by default. */
+template<class r_option,class fpoint=typename r_option::precision>
 class container_base {
 	public:
-		container_base(fpoint xa,fpoint xb,fpoint ya,fpoint yb,fpoint za,fpoint zb,int xn,int yn,int zn,bool xper,bool yper,bool zper,int memi);
+		/** The option for switching off neighbor computation, in the
+		 * precision of the container. */
+		typedef neighbor_none_base<fpoint> neighbor_none;
+		/** The option for switching on neighbor computation, in the
+		 * precision of the container. */
+		typedef neighbor_track_base<fpoint> neighbor_track;
+		/** The basic Voronoi cell in the precision of the container. */
+		typedef voronoicell_base<neighbor_none> voronoicell;
+		/** The neighbor-tracking Voronoi cell in the precision of the
+		 * container. */
+		typedef voronoicell_base<neighbor_track> voronoicell_neighbor;
+		/** The loop class in the precision of the container. */
+		typedef voropp_loop_base<fpoint> voropp_loop;
+		container_base(fpoint xa,fpoint xb,fpoint ya,fpoint yb,fpoint za,fpoint zb,int xn,int yn,int zn,bool xper,bool yper,bool zper,int memi,bool contig=false);
 		~container_base();
 		void draw_particles(const char *filename);
 		void draw_particles();
@@ -53,7 +74,8 @@ class container_base {
 		inline void draw_cells_gnuplot(const char *filename);
 		void draw_cells_pov(const char *filename,fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax);
 		inline void draw_cells_pov(const char *filename);
-		inline void draw_cells_snTriangleMesh(snEssence::snpTriangleMeshVec * in_MeshList);
+		inline void draw_cells_sink(VoronoiSink *out);
+		void draw_cells_sink_parallel(VoronoiSink *out,int threads=0,bool track=false);
 		void store_cell_volumes(fpoint *bb);
 		fpoint packing_fraction(fpoint *bb,fpoint cx,fpoint cy,fpoint cz,fpoint r);
 		fpoint packing_fraction(fpoint *bb,fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax);
@@ -75,12 +97,30 @@ class container_base {
 		template<class n_option>
 		inline bool compute_cell(voronoicell_base<n_option> &c,int i,int j,int k,int ijk,int s);
 		template<class n_option>
-		bool compute_cell(voronoicell_base<n_option> &c,int i,int j,int k,int ijk,int s,fpoint x,fpoint y,fpoint z);
+		inline bool compute_cell(voronoicell_base<n_option> &c,int i,int j,int k,int ijk,int s,fpoint x,fpoint y,fpoint z);
+		template<class n_option>
+		bool compute_cell(voronoicell_base<n_option> &c,voropp_search<r_option> &sr,int i,int j,int k,int ijk,int s,fpoint x,fpoint y,fpoint z);
 		void put(int n,fpoint x,fpoint y,fpoint z);
 		void put(int n,fpoint x,fpoint y,fpoint z,fpoint r);
+		void put_bulk(const float *xyz,const int *ids,size_t n);
+		bool insert(int n,fpoint x,fpoint y,fpoint z);
+		bool move(int n,fpoint x,fpoint y,fpoint z);
+		bool remove(int n);
+		bool find(int n,int &ijk,int &q);
 		void add_wall(wall &w);
 		bool point_inside(fpoint x,fpoint y,fpoint z);
 		bool point_inside_walls(fpoint x,fpoint y,fpoint z);
+		/** Returns how many planes the sink routines and the cell cache
+		 * have tested against their cells, and how many of those the
+		 * bounds of the cells showed could be skipped.
+		 * \param[out] tested the number of planes tested.
+		 * \param[out] skipped the number of planes skipped. */
+		inline void plane_stats(unsigned long long &tested,unsigned long long &skipped) {tested=pt;skipped=ps;}
+		/** Resets the plane counters. */
+		inline void reset_plane_stats() {pt=ps=0;}
+		void arena_stats(unsigned long long &cells,unsigned long long &allocations,size_t &peak);
+		void reset_arena_stats();
+		void clear_arena();
 	protected:
 		/** The minimum x coordinate of the container. */
 		const fpoint ax;
@@ -138,9 +178,10 @@ class container_base {
 		/** A boolean value that determines if the z coordinate in
 		 * periodic or not. */
 		const bool zperiodic;
-		/** This sets the current value being used to mark tested blocks
-		 * in the mask. */
-		unsigned int mv;
+		/** A boolean value that determines if the particles of all
+		 * blocks are kept in one contiguous arena, ordered by block,
+		 * rather than in a separate array for each block. */
+		const bool contiguous;
 		/** The current number of wall objects, initially set to zero. */
 		int wall_number;
 		/** The current amount of memory allocated for walls. */
@@ -162,14 +203,6 @@ class container_base {
 		 * class container_poly, then this is set to 4, to also hold
 		 * the particle radii. */
 		int sz;
-		/** The position of the first element on the search list to be
-		 * considered. */
-		int s_start;
-		/** The position of the last element on the search list to be
-		 * considered. */
-		int s_end;
-		/** The current size of the search list. */
-		int s_size;
 		/** This array holds the number of particles within each
 		 * computational box of the container. */
 		int *co;
@@ -179,12 +212,6 @@ class container_base {
 		 * more is allocated using the add_particle_memory() function.
 		 */
 		int *mem;
-		/** This array is used during the cell computation to determine
-		 * which blocks have been considered. */
-		unsigned int *mask;
-		/** This array is used to store the list of blocks to test during
-		 * the Voronoi cell computation. */
-		int *sl;
 		/** An array to hold the minimum distances associated with the
 		 * worklists. This array is initialized during container
 		 * construction, by the initialize_radii() routine. */
@@ -199,36 +226,79 @@ class container_base {
 		 * derived container_poly class, this also holds particle
 		 * radii. */
 		fpoint **p;
+		/** For contiguous storage, the offset of the first slot of each
+		 * block in the arena. The final entry holds the size of the
+		 * arena. This is NULL for the per-block storage. */
+		int *off;
+		/** For contiguous storage, the arena holding the numerical IDs
+		 * of all particles. The entries of id point into it. */
+		int *ia;
+		/** For contiguous storage, the arena holding the positions of
+		 * all particles. The entries of p point into it. */
+		fpoint *pa;
+		/** The mask and block list used by compute_cell() when it is
+		 * called from the serial routines. The parallel routines give
+		 * each worker thread its own copy. */
+		voropp_search<r_option> search;
+		/** The number of planes that the cells of the sink routines and
+		 * the cell cache were tested against. */
+		unsigned long long pt;
+		/** The number of those planes which were skipped by the bounds
+		 * test of the cells. */
+		unsigned long long ps;
+		/** The cells that the sink routines compute with, kept
+		 * between calls so that their memory is reused. */
+		voropp_cell_arena<neighbor_none> arn;
+		/** The neighbor-tracking cells that the sink routines and the
+		 * cell cache compute with. */
+		voropp_cell_arena<neighbor_track> art;
+		/** Returns the arena for the cells of a neighbor option. */
+		inline voropp_cell_arena<neighbor_none> &arena(neighbor_none *n) {return arn;}
+		/** Returns the arena for the cells of a neighbor option. */
+		inline voropp_cell_arena<neighbor_track> &arena(neighbor_track *n) {return art;}
 
 		template<class n_option>
 		inline void print_all_internal(voronoicell_base<n_option> &c,ostream &os);
 		template<class n_option>
 		void print_all_custom_internal(voronoicell_base<n_option> &c,const char *format,ostream &os);
 		template<class n_option>
+		void draw_cells_sink_internal(VoronoiSink *out,int threads);
+		template<class n_option>
 		inline bool initialize_voronoicell(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z);
 		void add_particle_memory(int i);
-		void add_list_memory();
+		bool find(int n,fpoint x,fpoint y,fpoint z,int &ijk,int &q);
+		inline int find_block(fpoint x,fpoint y,fpoint z);
+		int insert_at(int l,int n,fpoint x,fpoint y,fpoint z);
+		bool move_at(int ijk,int q,fpoint x,fpoint y,fpoint z);
+		void remove_at(int ijk,int q);
+		/** Tests whether the memory of a block is part of the
+		 * contiguous arena, or whether it is a separate array.
+		 * \param[in] l the index of the block.
+		 * \return True if the block lives in the arena. */
+		inline bool in_arena(int l) {return ia!=NULL&&id[l]==ia+off[l];}
 	private:
 #include "snVoroWorklist.h"
 		template<class n_option>
-		inline bool corner_test(voronoicell_base<n_option> &c,fpoint xl,fpoint yl,fpoint zl,fpoint xh,fpoint yh,fpoint zh);
+		inline bool corner_test(voronoicell_base<n_option> &c,r_option &rad,fpoint xl,fpoint yl,fpoint zl,fpoint xh,fpoint yh,fpoint zh);
 		template<class n_option>
-		inline bool edge_x_test(voronoicell_base<n_option> &c,fpoint x0,fpoint yl,fpoint zl,fpoint x1,fpoint yh,fpoint zh);
+		inline bool edge_x_test(voronoicell_base<n_option> &c,r_option &rad,fpoint x0,fpoint yl,fpoint zl,fpoint x1,fpoint yh,fpoint zh);
 		template<class n_option>
-		inline bool edge_y_test(voronoicell_base<n_option> &c,fpoint xl,fpoint y0,fpoint zl,fpoint xh,fpoint y1,fpoint zh);
+		inline bool edge_y_test(voronoicell_base<n_option> &c,r_option &rad,fpoint xl,fpoint y0,fpoint zl,fpoint xh,fpoint y1,fpoint zh);
 		template<class n_option>
-		inline bool edge_z_test(voronoicell_base<n_option> &c,fpoint xl,fpoint yl,fpoint z0,fpoint xh,fpoint yh,fpoint z1);
+		inline bool edge_z_test(voronoicell_base<n_option> &c,r_option &rad,fpoint xl,fpoint yl,fpoint z0,fpoint xh,fpoint yh,fpoint z1);
 		template<class n_option>
-		inline bool face_x_test(voronoicell_base<n_option> &c,fpoint xl,fpoint y0,fpoint z0,fpoint y1,fpoint z1);
+		inline bool face_x_test(voronoicell_base<n_option> &c,r_option &rad,fpoint xl,fpoint y0,fpoint z0,fpoint y1,fpoint z1);
 		template<class n_option>
-		inline bool face_y_test(voronoicell_base<n_option> &c,fpoint x0,fpoint yl,fpoint z0,fpoint x1,fpoint z1);
+		inline bool face_y_test(voronoicell_base<n_option> &c,r_option &rad,fpoint x0,fpoint yl,fpoint z0,fpoint x1,fpoint z1);
 		template<class n_option>
-		inline bool face_z_test(voronoicell_base<n_option> &c,fpoint x0,fpoint y0,fpoint zl,fpoint x1,fpoint y1);
+		inline bool face_z_test(voronoicell_base<n_option> &c,r_option &rad,fpoint x0,fpoint y0,fpoint zl,fpoint x1,fpoint y1);
 		inline void initialize_radii();
 		inline void compute_minimum(fpoint &minr,fpoint &xlo,fpoint &xhi,fpoint &ylo,fpoint &yhi,fpoint &zlo,fpoint &zhi,int ti,int tj,int tk);
-		inline bool compute_min_max_radius(int di,int dj,int dk,fpoint fx,fpoint fy,fpoint fz,fpoint gx,fpoint gy,fpoint gz,fpoint& crs,fpoint mrs);
-		friend class voropp_loop;
-		friend class radius_poly;
+		inline bool compute_min_max_radius(r_option &rad,int di,int dj,int dk,fpoint fx,fpoint fy,fpoint fz,fpoint gx,fpoint gy,fpoint gz,fpoint& crs,fpoint mrs);
+		friend class voropp_loop_base<fpoint>;
+		friend class radius_poly_base<fpoint>;
+		friend class voropp_search<r_option>;
+		friend class voropp_cell_cache<r_option>;
 };
 
 /** \brief A class encapsulating all routines specifically needed in
@@ -238,9 +308,13 @@ class container_base {
  * a standard Voronoi tessellation that would be appropriate for a monodisperse
  * system. When the container class is instantiated using this class, all
  * information about particle radii is switched off. Since all these functions
- * are declared inline, there should be no loss of speed. */
-class radius_mono {
+ * are declared inline, there should be no loss of speed. The template
+ * parameter sets the floating point type of the container. */
+template<class fpoint>
+class radius_mono_base {
 	public:
+		/** The floating point type of the container. */
+		typedef fpoint precision;
 		/** The number of floating point numbers allocated for each
 		 * particle in the container, set to 3 for this case for the x,
 		 * y, and z positions. */
@@ -249,7 +323,7 @@ class radius_mono {
 		 * that created it, and initializes the mem_size constant to 3.
 		 * \param[in] icc a pointer the container class that created
 		 *                this class. */
-		radius_mono(container_base<radius_mono> *icc) : mem_size(3), cc(icc) {};
+		radius_mono_base(container_base<radius_mono_base<fpoint> > *icc) : mem_size(3), cc(icc) {};
 		inline void import(istream &is);
 		/** This is a blank placeholder function that does nothing. */
 		inline void store_radius(int i,int j,fpoint r) {};
@@ -264,7 +338,7 @@ class radius_mono {
 		inline void print(ostream &os,int ijk,int q,bool later=true) {};
 		inline void rad(ostream &os,int l,int c);
 	private:
-		container_base<radius_mono> *cc;
+		container_base<radius_mono_base<fpoint> > *cc;
 };
 
 /** \brief A class encapsulating all routines specifically needed in the
@@ -273,9 +347,13 @@ class radius_mono {
  * This class encapsulates all the routines that are required for carrying out
  * the radical Voronoi tessellation that is appropriate for polydisperse sphere.
  * When the container class is instantiated with this class, information about particle
- * radii is switched on. */
-class radius_poly {
+ * radii is switched on. The template parameter sets the floating point type of
+ * the container. */
+template<class fpoint>
+class radius_poly_base {
 	public:
+		/** The floating point type of the container. */
+		typedef fpoint precision;
 		/** The number of floating point numbers allocated for each
 		 * particle in the container, set to 4 for this case for the x,
 		 * y, and z positions, plus the radius. */
@@ -283,7 +361,7 @@ class radius_poly {
 		/** This constructor sets a pointer back to the container class
 		 * that created it, and initializes the mem_size constant to 4.
 		 */
-		radius_poly(container_base<radius_poly> *icc) :
+		radius_poly_base(container_base<radius_poly_base<fpoint> > *icc) :
 			mem_size(4), cc(icc), max_radius(0) {};
 		inline void import(istream &is);
 		inline void store_radius(int i,int j,fpoint r);
@@ -295,10 +373,182 @@ class radius_poly {
 		inline void print(ostream &os,int ijk,int q,bool later=true);
 		inline void rad(ostream &os,int l,int c);
 	private:
-		container_base<radius_poly> *cc;
+		container_base<radius_poly_base<fpoint> > *cc;
 		fpoint max_radius,crad,mul;
 };
 
+/** \brief A class holding the state of a single cell computation.
+ *
+ * While compute_cell() runs, it marks the blocks it has already tested in a
+ * mask and keeps a list of blocks that still need to be considered. It also
+ * sets up the radius object for the particle being computed. This class
+ * collects all of that state, so that several cells can be computed at the
+ * same time, as long as every thread uses its own search object. */
+template<class r_option>
+class voropp_search {
+	public:
+		voropp_search(container_base<r_option> *icc);
+		~voropp_search();
+		inline void add_list_memory();
+		/** The radius object used for the current cell computation. */
+		r_option radius;
+		/** This sets the current value being used to mark tested blocks
+		 * in the mask. */
+		unsigned int mv;
+		/** The position of the first element on the search list to be
+		 * considered. */
+		int s_start;
+		/** The position of the last element on the search list to be
+		 * considered. */
+		int s_end;
+		/** The current size of the search list. */
+		int s_size;
+		/** This array is used during the cell computation to determine
+		 * which blocks have been considered. */
+		unsigned int *mask;
+		/** This array is used to store the list of blocks to test during
+		 * the Voronoi cell computation. */
+		int *sl;
+};
+
+/** \brief A class handing out the blocks of a container to worker threads.
+ *
+ * Every worker starts with a contiguous range of blocks, so that the
+ * particles it touches stay close together in memory. Once a worker has
+ * finished its own range, it steals the upper half of the largest range that
+ * is left over from another worker. Each range is guarded by its own lock,
+ * and at most one lock is held at a time. */
+class voropp_block_queue {
+	public:
+		inline voropp_block_queue(int inb,int it);
+		inline ~voropp_block_queue();
+		inline int next(int t);
+	private:
+		/** The number of workers. */
+		const int nt;
+		/** The first block of each worker's range. */
+		int *lo;
+		/** One past the last block of each worker's range. */
+		int *hi;
+#ifdef _OPENMP
+		/** The locks guarding each worker's range. */
+		omp_lock_t *lk;
+#endif
+};
+
+/** \brief A class keeping the Voronoi cells of a container between updates.
+ *
+ * This class remembers the mesh of every cell, together with the IDs of its
+ * face neighbors and the distance from the particle to its furthest vertex.
+ * Particles are moved, inserted and removed through this class, and every
+ * cell that the change could have touched is marked as dirty: the cells of
+ * the changed particles themselves, their old face neighbors, and any cell
+ * whose vertices reach far enough that the particle could cut it, either at
+ * its old or its new position. Calling update() recomputes only the dirty
+ * cells, and reuses the meshes of all the others. The meshes are kept in a
+ * flat cell store, which can be written out as it is. An update only patches
+ * the cells that it recomputes: a mesh that still fits into the room of the
+ * old one is written over it, and any other is appended, leaving the old
+ * one behind. The store is compacted once more than half of its points are
+ * left behind like this, so the cost of an update stays in proportion to the
+ * number of dirty cells. Afterwards the cell table is put back into the order
+ * of draw_cells_sink(), so the store lists the cells in the same order as
+ * one computed from scratch. The particles are keyed by
+ * their numerical IDs, which must not be negative, and should be reasonably
+ * dense, since a record is kept for every ID up to the largest one. The cells
+ * are computed in the precision of the container. */
+template<class r_option,class fpoint>
+class voropp_cell_cache {
+	public:
+		/** The neighbor-tracking Voronoi cell in the precision of the
+		 * container. */
+		typedef voronoicell_base<neighbor_track_base<fpoint> > voronoicell_neighbor;
+		/** The loop class in the precision of the container. */
+		typedef voropp_loop_base<fpoint> voropp_loop;
+		voropp_cell_cache(container_base<r_option> *icc);
+		~voropp_cell_cache();
+		void insert(int n,fpoint x,fpoint y,fpoint z);
+		void move(int n,fpoint x,fpoint y,fpoint z);
+		void remove(int n);
+		int update(int threads=0,volatile int *cancel=NULL);
+		int check_cells();
+		/** Returns the store holding the meshes of all cells, which
+		 * come in the same order as draw_cells_sink() as long as no
+		 * update has been cancelled. The order of the points within a
+		 * cell that was not recomputed can differ from a fresh one.
+		 * The store stays valid until the next call to update(). */
+		inline const VoronoiSink &cells() {return cs;}
+		/** Returns the number of cells that will be recomputed by the
+		 * next call to update(). */
+		inline int dirty_count() {return nd;}
+	private:
+		/** The record kept for every particle ID. */
+		struct entry {
+			/** Whether the particle is currently in the container. */
+			bool live;
+			/** Whether the cell needs to be recomputed. */
+			bool dirty;
+			/** The position of the particle. */
+			fpoint x,y,z;
+			/** Twice the distance from the particle to the
+			 * furthest vertex of its cell, which is the furthest
+			 * away that another particle can be and still cut
+			 * the cell. This is zero if the cell could not be
+			 * computed. */
+			fpoint r;
+			/** The index of the cell in the store, or -1 if there
+			 * is none. */
+			int ci;
+			/** The position of the cell in the list of cells that
+			 * update() recomputes, or -1 outside of it. */
+			int wi;
+			/** The IDs of the face neighbors of the cell. */
+			vector<int> ne;
+		};
+		/** A pointer to the container that holds the particles. */
+		container_base<r_option> *cc;
+		/** The records of all particle IDs. */
+		vector<entry> ce;
+		/** The number of live particles whose cells are dirty. */
+		int nd;
+		/** The IDs of the particles that have been marked as dirty
+		 * since the last update, which may include particles that
+		 * have been removed again, or the same ID twice. */
+		vector<int> dl;
+		/** The places in the store of cells whose particles have been
+		 * removed since the last update. */
+		vector<int> fr;
+		/** Whether the order of the cells may have changed since the
+		 * last update, because particles have changed their blocks,
+		 * or cells have been added or removed. */
+		bool ro;
+		/** An upper bound on r over all the cells, which bounds the
+		 * region that needs to be searched for cells touched by a
+		 * particle. It is brought down to the largest value of r
+		 * whenever the store is compacted. */
+		fpoint rmax;
+		/** The store holding the meshes of all cells. */
+		VoronoiSink cs;
+		/** The number of points, poly values and faces that each cell
+		 * of the store has room for. */
+		vector<size_t> rm;
+		/** The number of points in the store that no cell uses any
+		 * more. */
+		size_t gp;
+		/** The store that the cells are compacted into, which is
+		 * swapped with the current one afterwards, so that the memory
+		 * of both gets reused. */
+		VoronoiSink ns;
+		inline entry &record(int n);
+		void store(entry &e,const VoronoiSink &ss,int k);
+		void release(int i);
+		void compact();
+		void order();
+		inline void mark(int n);
+		void mark_neighbors(int n);
+		void mark_near(fpoint x,fpoint y,fpoint z);
+};
+
 /** \brief A class to handle loops on regions of the container handling
  * non-periodic and periodic boundary conditions.
  *
@@ -308,11 +558,13 @@ class radius_poly {
  * subgrid which is within a distance r of a vector (vx,vy,vz), or a subgrid
  * corresponding to a rectangular box. The routine inc() can then be
  * successively called to step through all the blocks within this subgrid.
+ * The template parameter is the floating point type of the container.
  */
-class voropp_loop {
+template<class fpoint>
+class voropp_loop_base {
 	public:
 		template<class r_option>
-		voropp_loop(container_base<r_option> *q);
+		voropp_loop_base(container_base<r_option> *q);
 		inline int init(fpoint vx,fpoint vy,fpoint vz,fpoint r,fpoint &px,fpoint &py,fpoint &pz);
 		inline int init(fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax,fpoint &px,fpoint &py,fpoint &pz);
 		inline int inc(fpoint &px,fpoint &py,fpoint &pz);
@@ -337,6 +589,9 @@ class voropp_loop {
 		const bool xperiodic,yperiodic,zperiodic;
 };
 
+/** The loop class in the default precision. */
+typedef voropp_loop_base<fpoint> voropp_loop;
+
 /** \brief Pure virtual class from which wall objects are derived.
  *
  * This is a pure virtual class for a generic wall object. A wall object
@@ -354,8 +609,22 @@ class wall {
 		/** A pure virtual function for cutting a cell with
 		 * neighbor-tracking enabled with a wall. */
 		virtual bool cut_cell(voronoicell_base<neighbor_track> &c,fpoint x,fpoint y,fpoint z) = 0;
+		/** A pure virtual function for cutting a single precision cell
+		 * without neighbor-tracking with a wall. */
+		virtual bool cut_cell(voronoicell_base<neighbor_none_base<float> > &c,fpoint x,fpoint y,fpoint z) = 0;
+		/** A pure virtual function for cutting a single precision cell
+		 * with neighbor-tracking enabled with a wall. */
+		virtual bool cut_cell(voronoicell_base<neighbor_track_base<float> > &c,fpoint x,fpoint y,fpoint z) = 0;
 };
 
+/** The radius option for the standard Voronoi tessellation, in the default
+ * precision. */
+typedef radius_mono_base<fpoint> radius_mono;
+
+/** The radius option for the radical Voronoi tessellation, in the default
+ * precision. */
+typedef radius_poly_base<fpoint> radius_poly;
+
 /** The basic container class. */
 typedef container_base<radius_mono> container;
 
@@ -374,52 +643,87 @@ typedef container_base<radius_poly> container_poly;
  *                       coordinate directions.
  * \param[in] (xper,yper,zper) flags setting whether the container is periodic
  *                             in each coordinate direction.
- * \param[in] memi the initial memory allocation for each block. */
-template<class r_option>
-container_base<r_option>::container_base(fpoint xa,fpoint xb,fpoint ya,
+ * \param[in] memi the initial memory allocation for each block.
+ * \param[in] contig a flag setting whether the particles are kept in one
+ *                   contiguous arena ordered by block, with an offset table
+ *                   pointing at each block. This needs only a couple of
+ *                   allocations for the whole grid, and keeps neighboring
+ *                   blocks close together in memory. Blocks that outgrow
+ *                   their part of the arena are moved to their own array,
+ *                   until put_bulk() lays the arena out again. */
+template<class r_option,class fpoint>
+container_base<r_option,fpoint>::container_base(fpoint xa,fpoint xb,fpoint ya,
 		fpoint yb,fpoint za,fpoint zb,int xn,int yn,int zn,
-		bool xper,bool yper,bool zper,int memi)
+		bool xper,bool yper,bool zper,int memi,bool contig)
 	: ax(xa),bx(xb),ay(ya),by(yb),az(za),bz(zb),
 	xsp(xn/(xb-xa)),ysp(yn/(yb-ya)),zsp(zn/(zb-za)),nx(xn),ny(yn),nz(zn),
 	nxy(xn*yn),nxyz(xn*yn*zn),hx(xper?2*xn+1:xn),hy(yper?2*yn+1:yn),
 	hz(zper?2*zn+1:zn),hxy(hx*hy),hxyz(hx*hy*hz),
-	xperiodic(xper),yperiodic(yper),zperiodic(zper),
-	mv(0),wall_number(0),current_wall_size(init_wall_size),radius(this),
-	sz(radius.mem_size),s_size(3*(3+hxy+hz*(hx+hy))),
-	co(new int[nxyz]),mem(new int[nxyz]),mask(new unsigned int[hxyz]),
-	sl(new int[s_size]),mrad(new fpoint[hgridsq*seq_length]),
-	walls(new wall*[init_wall_size]),id(new int*[nxyz]),p(new fpoint*[nxyz]) {
+	xperiodic(xper),yperiodic(yper),zperiodic(zper),contiguous(contig),
+	wall_number(0),current_wall_size(init_wall_size),radius(this),
+	sz(radius.mem_size),co(new int[nxyz]),mem(new int[nxyz]),
+	mrad(new fpoint[hgridsq*seq_length]),walls(new wall*[init_wall_size]),
+	id(new int*[nxyz]),p(new fpoint*[nxyz]),off(NULL),ia(NULL),pa(NULL),
+	search(this),pt(0),ps(0) {
 	int l;
 	for(l=0;l<nxyz;l++) co[l]=0;
 	for(l=0;l<nxyz;l++) mem[l]=memi;
-	for(l=0;l<hxyz;l++) mask[l]=0;
-	for(l=0;l<nxyz;l++) id[l]=new int[memi];
-	for(l=0;l<nxyz;l++) p[l]=new fpoint[sz*memi];
+	if(contiguous) {
+		off=new int[nxyz+1];
+		for(l=0;l<=nxyz;l++) off[l]=l*memi;
+		ia=new int[off[nxyz]];
+		pa=new fpoint[sz*off[nxyz]];
+		for(l=0;l<nxyz;l++) {id[l]=ia+off[l];p[l]=pa+sz*off[l];}
+	} else {
+		for(l=0;l<nxyz;l++) id[l]=new int[memi];
+		for(l=0;l<nxyz;l++) p[l]=new fpoint[sz*memi];
+	}
 
 	// Precompute the radius table used in the cell construction
 	initialize_radii();
 }
 
 /** The container destructor frees the dynamically allocated memory. */
-template<class r_option>
-container_base<r_option>::~container_base() {
+template<class r_option,class fpoint>
+container_base<r_option,fpoint>::~container_base() {
 	int l;
-	for(l=0;l<nxyz;l++) delete [] p[l];
-	for(l=0;l<nxyz;l++) delete [] id[l];
+	for(l=0;l<nxyz;l++) if(!in_arena(l)) {
+		delete [] p[l];
+		delete [] id[l];
+	}
+	delete [] pa;
+	delete [] ia;
+	delete [] off;
 	delete [] p;
 	delete [] id;
 	delete [] walls;
 	delete [] mrad;
-	delete [] sl;
-	delete [] mask;
 	delete [] mem;
 	delete [] co;
 }
 
+/** The search constructor allocates a mask that covers all of the blocks of
+ * the container, and an initial block list.
+ * \param[in] icc a pointer to the container that the cells will be computed
+ *                in. */
+template<class r_option>
+voropp_search<r_option>::voropp_search(container_base<r_option> *icc)
+	: radius(icc), mv(0), s_size(3*(3+icc->hxy+icc->hz*(icc->hx+icc->hy))),
+	mask(new unsigned int[icc->hxyz]), sl(new int[s_size]) {
+	for(int l=0;l<icc->hxyz;l++) mask[l]=0;
+}
+
+/** The search destructor frees the dynamically allocated memory. */
+template<class r_option>
+voropp_search<r_option>::~voropp_search() {
+	delete [] sl;
+	delete [] mask;
+}
+
 /** Dumps all the particle positions and identifies to a file.
  * \param[in] os an output stream to write to. */
-template<class r_option>
-void container_base<r_option>::draw_particles(ostream &os) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::draw_particles(ostream &os) {
 	int c,l,i;
 	for(l=0;l<nxyz;l++) for(c=0;c<co[l];c++) {
 		os << id[l][c];
@@ -430,16 +734,16 @@ void container_base<r_option>::draw_particles(ostream &os) {
 
 /** An overloaded version of the draw_particles() routine, that just prints
  * to standard output. */
-template<class r_option>
-void container_base<r_option>::draw_particles() {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::draw_particles() {
 	draw_particles(cout);
 }
 
 /** An overloaded version of the draw_particles() routine, that outputs
  * the particle positions to a file.
  * \param[in] filename the file to write to. */
-template<class r_option>
-void container_base<r_option>::draw_particles(const char *filename) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::draw_particles(const char *filename) {
 	ofstream os;
 	os.open(filename,ofstream::out|ofstream::trunc);
 	draw_particles(os);
@@ -448,8 +752,8 @@ void container_base<r_option>::draw_particles(const char *filename) {
 
 /** Dumps all the particle positions in POV-Ray format.
  * \param[in] os an output stream to write to. */
-template<class r_option>
-void container_base<r_option>::draw_particles_pov(ostream &os) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::draw_particles_pov(ostream &os) {
 	int l,c;
 	for(l=0;l<nxyz;l++) for(c=0;c<co[l];c++) {
 		os << "// id " << id[l][c] << "\n";
@@ -462,16 +766,16 @@ void container_base<r_option>::draw_particles_pov(ostream &os) {
 
 /** An overloaded version of the draw_particles_pov() routine, that just prints
  * to standard output. */
-template<class r_option>
-void container_base<r_option>::draw_particles_pov() {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::draw_particles_pov() {
 	draw_particles_pov(cout);
 }
 
 /** An overloaded version of the draw_particles_pov() routine, that outputs
  * the particle positions to a file.
  * \param[in] filename the file to write to. */
-template<class r_option>
-void container_base<r_option>::draw_particles_pov(const char *filename) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::draw_particles_pov(const char *filename) {
 	ofstream os;
 	os.open(filename,ofstream::out|ofstream::trunc);
 	draw_particles_pov(os);
@@ -481,8 +785,8 @@ void container_base<r_option>::draw_particles_pov(const char *filename) {
 /** Put a particle into the correct region of the container.
  * \param[in] n the numerical ID of the inserted particle.
  * \param[in] (x,y,z) the position vector of the inserted particle. */
-template<class r_option>
-void container_base<r_option>::put(int n,fpoint x,fpoint y,fpoint z) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::put(int n,fpoint x,fpoint y,fpoint z) {
 	if(x>ax&&y>ay&&z>az) {
 		int i,j,k;
 		i=int((x-ax)*xsp);j=int((y-ay)*ysp);k=int((z-az)*zsp);
@@ -500,8 +804,8 @@ void container_base<r_option>::put(int n,fpoint x,fpoint y,fpoint z) {
  * \param[in] n the numerical ID of the inserted particle.
  * \param[in] (x,y,z) the position vector of the inserted particle.
  * \param[in] r the radius of the particle.*/
-template<class r_option>
-void container_base<r_option>::put(int n,fpoint x,fpoint y,fpoint z,fpoint r) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::put(int n,fpoint x,fpoint y,fpoint z,fpoint r) {
 	if(x>ax&&y>ay&&z>az) {
 		int i,j,k;
 		i=int((x-ax)*xsp);j=int((y-ay)*ysp);k=int((z-az)*zsp);
@@ -515,12 +819,240 @@ void container_base<r_option>::put(int n,fpoint x,fpoint y,fpoint z,fpoint r) {
 	}
 }
 
+/** Puts a whole array of particles into the container at once. The particles
+ * are binned with a counting sort: a first pass counts how many particles go
+ * into each region, then each region that is too small is reallocated once to
+ * the exact size that it needs, and a second pass copies the particles in.
+ * For a container with contiguous storage, the whole arena is laid out again
+ * instead, with every block holding exactly the particles it needs. The
+ * particles end up in the same order as if put() had been called for each of
+ * them in turn.
+ * \param[in] xyz an array of 3*n floats holding the particle positions.
+ * \param[in] ids an array of n numerical IDs for the particles. If this is
+ *                NULL, then the particles are numbered 0 to n-1.
+ * \param[in] n the number of particles. */
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::put_bulk(const float *xyz,const int *ids,size_t n) {
+	int i,j,k,l,*idp,*bl=new int[n],*nco=new int[nxyz];
+	fpoint x,y,z,*pp;
+	size_t q;
+
+	// Find the region of every particle, and count how many particles are
+	// going into each region
+	for(l=0;l<nxyz;l++) nco[l]=co[l];
+	for(q=0;q<n;q++) {
+		bl[q]=-1;
+		x=xyz[3*q];y=xyz[3*q+1];z=xyz[3*q+2];
+		if(x>ax&&y>ay&&z>az) {
+			i=int((x-ax)*xsp);j=int((y-ay)*ysp);k=int((z-az)*zsp);
+			if(i<nx&&j<ny&&k<nz) nco[bl[q]=i+nx*j+nxy*k]++;
+		}
+	}
+
+	if(contiguous) {
+
+		// Build a new arena, with the blocks in order and each one
+		// sized to its final particle count, and move the existing
+		// particles over to it
+		int *noff=new int[nxyz+1],*nia;
+		noff[0]=0;
+		for(l=0;l<nxyz;l++) {
+			if(nco[l]>max_particle_memory)
+				voropp_fatal_error("Absolute maximum memory allocation exceeded",VOROPP_MEMORY_ERROR);
+			noff[l+1]=noff[l]+nco[l];
+		}
+		nia=new int[noff[nxyz]];
+		pp=new fpoint[sz*noff[nxyz]];
+		for(l=0;l<nxyz;l++) {
+			for(i=0;i<co[l];i++) nia[noff[l]+i]=id[l][i];
+			for(i=0;i<sz*co[l];i++) pp[sz*noff[l]+i]=p[l][i];
+			if(!in_arena(l)) {
+				delete [] id[l];
+				delete [] p[l];
+			}
+			id[l]=nia+noff[l];
+			p[l]=pp+sz*noff[l];
+			mem[l]=nco[l];
+		}
+		delete [] off;off=noff;
+		delete [] ia;ia=nia;
+		delete [] pa;pa=pp;
+	}
+
+	// Resize the regions that are too small to their final size
+	else for(l=0;l<nxyz;l++) if(nco[l]>mem[l]) {
+		if(nco[l]>max_particle_memory)
+			voropp_fatal_error("Absolute maximum memory allocation exceeded",VOROPP_MEMORY_ERROR);
+#if VOROPP_VERBOSE >=3
+		cerr << "Particle memory in region " << l << " set to " << nco[l] << endl;
+#endif
+		idp=new int[nco[l]];
+		for(i=0;i<co[l];i++) idp[i]=id[l][i];
+		pp=new fpoint[sz*nco[l]];
+		for(i=0;i<sz*co[l];i++) pp[i]=p[l][i];
+		mem[l]=nco[l];
+		delete [] id[l];id[l]=idp;
+		delete [] p[l];p[l]=pp;
+	}
+
+	// Copy the particles into their regions
+	for(q=0;q<n;q++) if((l=bl[q])!=-1) {
+		pp=p[l]+sz*co[l];
+		pp[0]=xyz[3*q];pp[1]=xyz[3*q+1];pp[2]=xyz[3*q+2];
+		radius.store_radius(l,co[l],0.5);
+		id[l][co[l]++]=ids==NULL?int(q):ids[q];
+	}
+	delete [] nco;
+	delete [] bl;
+}
+
+/** Finds the region that a position belongs to.
+ * \param[in] (x,y,z) the position vector.
+ * \return The index of the region, or -1 if the position is outside the
+ *         container. */
+template<class r_option,class fpoint>
+inline int container_base<r_option,fpoint>::find_block(fpoint x,fpoint y,fpoint z) {
+	if(x>ax&&y>ay&&z>az) {
+		int i,j,k;
+		i=int((x-ax)*xsp);j=int((y-ay)*ysp);k=int((z-az)*zsp);
+		if(i<nx&&j<ny&&k<nz) return i+nx*j+nxy*k;
+	}
+	return -1;
+}
+
+/** Inserts a particle into a region, keeping the particles of the region
+ * sorted by their IDs if they were sorted before. Since put_bulk() stores the
+ * particles in the order they are given, this means that a container that is
+ * changed with insert() and move() computes its cells in the same order as one
+ * that is filled from scratch.
+ * \param[in] l the index of the region.
+ * \param[in] n the numerical ID of the particle.
+ * \param[in] (x,y,z) the position vector of the particle.
+ * \return The index of the particle within the region. */
+template<class r_option,class fpoint>
+int container_base<r_option,fpoint>::insert_at(int l,int n,fpoint x,fpoint y,fpoint z) {
+	int q=co[l],c;
+	if(q==mem[l]) add_particle_memory(l);
+	for(;q>0&&id[l][q-1]>n;q--) {
+		id[l][q]=id[l][q-1];
+		for(c=0;c<sz;c++) p[l][sz*q+c]=p[l][sz*(q-1)+c];
+	}
+	id[l][q]=n;
+	p[l][sz*q]=x;p[l][sz*q+1]=y;p[l][sz*q+2]=z;
+	co[l]++;
+	return q;
+}
+
+/** Removes a particle from a region. The particles after it are shifted
+ * down, so that the order of the region is kept.
+ * \param[in] ijk the index of the region.
+ * \param[in] q the index of the particle within the region. */
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::remove_at(int ijk,int q) {
+	int c;
+	for(co[ijk]--;q<co[ijk];q++) {
+		id[ijk][q]=id[ijk][q+1];
+		for(c=0;c<sz;c++) p[ijk][sz*q+c]=p[ijk][sz*(q+1)+c];
+	}
+}
+
+/** Moves a particle to a new position. If the position is in the same
+ * region, then the particle is updated in place. Otherwise it is taken out of
+ * its region and inserted into the new one, keeping its radius.
+ * \param[in] ijk the index of the region holding the particle.
+ * \param[in] q the index of the particle within the region.
+ * \param[in] (x,y,z) the new position vector of the particle.
+ * \return False if the new position is outside the container, in which case
+ *         the particle has been removed, and true otherwise. */
+template<class r_option,class fpoint>
+bool container_base<r_option,fpoint>::move_at(int ijk,int q,fpoint x,fpoint y,fpoint z) {
+	int l=find_block(x,y,z),n=id[ijk][q];
+	if(l==ijk) {
+		p[ijk][sz*q]=x;p[ijk][sz*q+1]=y;p[ijk][sz*q+2]=z;
+		return true;
+	}
+	fpoint r=sz>3?p[ijk][sz*q+3]:0.5;
+	remove_at(ijk,q);
+	if(l==-1) return false;
+	radius.store_radius(l,insert_at(l,n,x,y,z),r);
+	return true;
+}
+
+/** Finds a particle in the container by its numerical ID, searching all of
+ * the regions.
+ * \param[in] n the numerical ID of the particle.
+ * \param[out] ijk the index of the region holding the particle.
+ * \param[out] q the index of the particle within the region.
+ * \return True if the particle was found, false otherwise. */
+template<class r_option,class fpoint>
+bool container_base<r_option,fpoint>::find(int n,int &ijk,int &q) {
+	for(ijk=0;ijk<nxyz;ijk++) for(q=0;q<co[ijk];q++)
+		if(id[ijk][q]==n) return true;
+	return false;
+}
+
+/** Finds a particle in the container by its numerical ID, looking first in
+ * the region of a position where the particle is expected to be, and then
+ * searching all of the regions.
+ * \param[in] n the numerical ID of the particle.
+ * \param[in] (x,y,z) the expected position vector of the particle.
+ * \param[out] ijk the index of the region holding the particle.
+ * \param[out] q the index of the particle within the region.
+ * \return True if the particle was found, false otherwise. */
+template<class r_option,class fpoint>
+bool container_base<r_option,fpoint>::find(int n,fpoint x,fpoint y,fpoint z,int &ijk,int &q) {
+	if((ijk=find_block(x,y,z))!=-1) {
+		for(q=0;q<co[ijk];q++) if(id[ijk][q]==n) return true;
+	}
+	return find(n,ijk,q);
+}
+
+/** Inserts a particle into the container. Unlike put(), the particle is
+ * placed among the other particles of its region in the order of the IDs, so
+ * that the cells come out in the same order as for a container that was
+ * filled with put_bulk().
+ * \param[in] n the numerical ID of the inserted particle.
+ * \param[in] (x,y,z) the position vector of the inserted particle.
+ * \return True if the particle was inserted, false if it is outside the
+ *         container. */
+template<class r_option,class fpoint>
+bool container_base<r_option,fpoint>::insert(int n,fpoint x,fpoint y,fpoint z) {
+	int l=find_block(x,y,z);
+	if(l==-1) return false;
+	radius.store_radius(l,insert_at(l,n,x,y,z),0.5);
+	return true;
+}
+
+/** Moves a particle, given by its numerical ID, to a new position. If the new
+ * position is outside the container, then the particle is removed.
+ * \param[in] n the numerical ID of the particle.
+ * \param[in] (x,y,z) the new position vector of the particle.
+ * \return True if the particle was found and is still in the container,
+ *         false otherwise. */
+template<class r_option,class fpoint>
+bool container_base<r_option,fpoint>::move(int n,fpoint x,fpoint y,fpoint z) {
+	int ijk,q;
+	if(!find(n,ijk,q)) return false;
+	return move_at(ijk,q,x,y,z);
+}
+
+/** Removes a particle, given by its numerical ID, from the container.
+ * \param[in] n the numerical ID of the particle.
+ * \return True if the particle was found and removed, false otherwise. */
+template<class r_option,class fpoint>
+bool container_base<r_option,fpoint>::remove(int n) {
+	int ijk,q;
+	if(!find(n,ijk,q)) return false;
+	remove_at(ijk,q);
+	return true;
+}
+
 /** Increase memory for a particular region.
  * \param[in] i the index of the region to reallocate. */
-template<class r_option>
-void container_base<r_option>::add_particle_memory(int i) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::add_particle_memory(int i) {
 	int *idp;fpoint *pp;
-	int l,nmem=2*mem[i];
+	int l,nmem=mem[i]>0?2*mem[i]:init_particle_memory;
 #if VOROPP_VERBOSE >=3
 	cerr << "Particle memory in region " << i << " scaled up to " << nmem << endl;
 #endif
@@ -531,13 +1063,19 @@ void container_base<r_option>::add_particle_memory(int i) {
 	pp=new fpoint[sz*nmem];
 	for(l=0;l<sz*co[i];l++) pp[l]=p[i][l];
 	mem[i]=nmem;
-	delete [] id[i];id[i]=idp;
-	delete [] p[i];p[i]=pp;
+
+	// Blocks that live in the contiguous arena are moved out to their own
+	// array, and the arena memory is left alone
+	if(!in_arena(i)) {
+		delete [] id[i];
+		delete [] p[i];
+	}
+	id[i]=idp;p[i]=pp;
 }
 
 /** Add list memory. */
 template<class r_option>
-inline void container_base<r_option>::add_list_memory() {
+inline void voropp_search<r_option>::add_list_memory() {
 	int i,j=0,*ps;
 	ps=new int[s_size*2];
 #if VOROPP_VERBOSE >=2
@@ -556,23 +1094,23 @@ inline void container_base<r_option>::add_list_memory() {
 
 /** Import a list of particles from standard input.
  * \param[in] is a standard input stream to read from. */
-template<class r_option>
-void container_base<r_option>::import(istream &is) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::import(istream &is) {
 	radius.import(is);
 }
 
 /** An overloaded version of the import routine, that reads the standard input.
  */
-template<class r_option>
-inline void container_base<r_option>::import() {
+template<class r_option,class fpoint>
+inline void container_base<r_option,fpoint>::import() {
 	import(cin);
 }
 
 /** An overloaded version of the import routine, that reads in particles from
  * a particular file.
  * \param[in] filename the name of the file to read from. */
-template<class r_option>
-inline void container_base<r_option>::import(const char *filename) {
+template<class r_option,class fpoint>
+inline void container_base<r_option,fpoint>::import(const char *filename) {
 	ifstream is;
 	is.open(filename,ifstream::in);
 	if(is.fail()) voropp_fatal_error("Unable to open file for import",VOROPP_FILE_ERROR);
@@ -581,16 +1119,16 @@ inline void container_base<r_option>::import(const char *filename) {
 }
 
 /** Outputs the number of particles within each region. */
-template<class r_option>
-void container_base<r_option>::region_count() {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::region_count() {
 	int i,j,k,ijk=0;
 	for(k=0;k<nz;k++) for(j=0;j<ny;j++) for(i=0;i<nx;i++)
 		cout << "Region (" << i << "," << j << "," << k << "): " << co[ijk++] << " particles" << endl;
 }
 
 /** Clears a container of particles. */
-template<class r_option>
-void container_base<r_option>::clear() {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::clear() {
 	for(int ijk=0;ijk<nxyz;ijk++) co[ijk]=0;
 	radius.clear_max();
 }
@@ -601,8 +1139,8 @@ void container_base<r_option>::clear() {
  * \param[in] (xmin,xmax) the minimum and maximum x coordinates of the box.
  * \param[in] (ymin,ymax) the minimum and maximum y coordinates of the box.
  * \param[in] (zmin,zmax) the minimum and maximum z coordinates of the box. */
-template<class r_option>
-void container_base<r_option>::draw_cells_gnuplot(const char *filename,fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::draw_cells_gnuplot(const char *filename,fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax) {
 	fpoint x,y,z,px,py,pz;
 	voropp_loop l1(this);
 	int q,s;
@@ -625,8 +1163,8 @@ void container_base<r_option>::draw_cells_gnuplot(const char *filename,fpoint xm
  * cells for the entire simulation region and saves the output in gnuplot
  * format.
  * \param[in] filename the name of the file to write to. */
-template<class r_option>
-void container_base<r_option>::draw_cells_gnuplot(const char *filename) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::draw_cells_gnuplot(const char *filename) {
 	draw_cells_gnuplot(filename,ax,bx,ay,by,az,bz);
 }
 
@@ -636,8 +1174,8 @@ void container_base<r_option>::draw_cells_gnuplot(const char *filename) {
  * \param[in] (xmin,xmax) the minimum and maximum x coordinates of the box.
  * \param[in] (ymin,ymax) the minimum and maximum y coordinates of the box.
  * \param[in] (zmin,zmax) the minimum and maximum z coordinates of the box. */
-template<class r_option>
-void container_base<r_option>::draw_cells_pov(const char *filename,fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::draw_cells_pov(const char *filename,fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax) {
 	fpoint x,y,z,px,py,pz;
 	voropp_loop l1(this);
 	int q,s;
@@ -661,40 +1199,523 @@ void container_base<r_option>::draw_cells_pov(const char *filename,fpoint xmin,f
  * cells for the entire simulation region and saves the output in POV-Ray
  * format.
  * \param[in] filename the name of the file to write to. */
-template<class r_option>
-void container_base<r_option>::draw_cells_pov(const char *filename) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::draw_cells_pov(const char *filename) {
 	draw_cells_pov(filename,ax,bx,ay,by,az,bz);
 }
 
-template<class r_option>
-void container_base<r_option>::draw_cells_snTriangleMesh(snEssence::snpTriangleMeshVec * in_MeshList)
-{
+/** Computes the Voronoi cells for all particles in the container, and appends
+ * them to a flat cell store.
+ * \param[in,out] out the store to append the cells to. */
+template<class r_option,class fpoint>
+inline void container_base<r_option,fpoint>::draw_cells_sink(VoronoiSink *out) {
 	fpoint x,y,z,px,py,pz;
 	voropp_loop l1(this);
 	int q,s;
-	voronoicell c;
+	unsigned long long n=0;
+	arn.reserve(1);
+	voronoicell &c=arn.cell(0);
 	s=l1.init(ax,bx,ay,by,az,bz,px,py,pz);
-	size_t cellIndex = 0;
 	do {
 		for(q=0;q<co[s];q++) {
 			x=p[s][sz*q]+px;y=p[s][sz*q+1]+py;z=p[s][sz*q+2]+pz;
 			if(x>ax&&x<bx&&y>ay&&y<by&&z>az&&z<bz) {
-				if(compute_cell(c,l1.ip,l1.jp,l1.kp,s,q,x,y,z))
-				{
-				   in_MeshList->push_back(new snEssence::snTriangleMesh());
-				   c.draw_snTriangleMesh(in_MeshList->at(in_MeshList->size()-1),x,y,z);
+				if(compute_cell(c,l1.ip,l1.jp,l1.kp,s,q,x,y,z)) c.draw_sink(*out,x,y,z,id[s][q]);
+				n++;
+			}
+		}
+	} while((s=l1.inc(px,py,pz))!=-1);
+	pt+=c.planes_tested;ps+=c.planes_skipped;
+	arn.release(0,n);
+	arn.update_peak();
+}
+
+/** Computes the Voronoi cells for all particles in the container using
+ * several threads, and appends them to a flat cell store. Each worker thread
+ * has its own voronoicell, search state and store, and takes blocks from a
+ * shared voropp_block_queue. Every particle is given a slot in advance, which
+ * remembers where its cell was written. Once all cells are computed, the data
+ * of the worker stores is appended to the output in one go per thread, and
+ * the cells are listed in exactly the same order as draw_cells_sink().
+ * \param[in,out] out the store to append the cells to.
+ * \param[in] threads the number of threads to use. If this is zero or
+ *                    negative, then the OpenMP default is used.
+ * \param[in] track whether to track the neighbors of the cells, so that
+ *                  the face table of the store holds their IDs. */
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::draw_cells_sink_parallel(VoronoiSink *out,int threads,bool track) {
+	if(track) draw_cells_sink_internal<neighbor_track>(out,threads);
+	else draw_cells_sink_internal<neighbor_none>(out,threads);
+}
+
+/** The internal routine behind draw_cells_sink_parallel(), which is
+ * instantiated once for each type of Voronoi cell.
+ * \param[in,out] out the store to append the cells to.
+ * \param[in] threads the number of threads to use. */
+template<class r_option,class fpoint>
+template<class n_option>
+void container_base<r_option,fpoint>::draw_cells_sink_internal(VoronoiSink *out,int threads) {
+#ifdef _OPENMP
+	if(threads<=0) threads=omp_get_max_threads();
+#else
+	threads=1;
+#endif
+	if(threads>nxyz) threads=nxyz;
+
+	// Reserve one slot per particle, in the order that the serial routine
+	// visits them. A slot holds the thread that computed the cell, and the
+	// index of the cell in that thread's store.
+	int l,*so=new int[nxyz+1];
+	so[0]=0;
+	for(l=0;l<nxyz;l++) so[l+1]=so[l]+co[l];
+	int *st=new int[2*so[nxyz]];
+	VoronoiSink *ts=new VoronoiSink[threads];
+	voropp_block_queue bq(nxyz,threads);
+	voropp_cell_arena<n_option> &ar=arena((n_option*) NULL);
+	ar.reserve(threads);
+
+#pragma omp parallel num_threads(threads)
+	{
+		fpoint x,y,z;
+		int q,s,t=0,*sl;
+		unsigned long long n=0;
+#ifdef _OPENMP
+		t=omp_get_thread_num();
+#endif
+		voronoicell_base<n_option> &c=ar.cell(t);
+		voropp_search<r_option> sr(this);
+		while((s=bq.next(t))!=-1) {
+			for(q=0;q<co[s];q++) {
+				sl=st+2*(so[s]+q);
+				sl[0]=-1;
+				x=p[s][sz*q];y=p[s][sz*q+1];z=p[s][sz*q+2];
+				if(x>ax&&x<bx&&y>ay&&y<by&&z>az&&z<bz) {
+					if(compute_cell(c,sr,s%nx,(s/nx)%ny,s/nxy,s,q,x,y,z)) {
+						sl[0]=t;sl[1]=int(ts[t].GetCellCount());
+						c.draw_sink(ts[t],x,y,z,id[s][q]);
+					}
+					n++;
 				}
 			}
 		}
+#pragma omp critical
+		{pt+=c.planes_tested;ps+=c.planes_skipped;}
+		ar.release(t,n);
+	}
+	ar.update_peak();
+
+	// Append the data of every thread, and list the cells that were not
+	// removed, keeping the serial order
+	size_t *pb=new size_t[3*threads];
+	for(l=0;l<threads;l++) out->AppendData(ts[l],pb+3*l);
+	for(l=0;l<so[nxyz];l++) if(st[2*l]>=0) {
+		int t=st[2*l];
+		out->AddCellAt(ts[t],st[2*l+1],pb+3*t);
+	}
+	delete [] pb;
+	delete [] ts;
+	delete [] st;
+	delete [] so;
+}
+
+/** Returns how many cells the sink routines and the cell cache have computed,
+ * how often their cells had to allocate memory while doing so, and the peak
+ * memory that the cells kept between calls.
+ * \param[out] cells the number of cells computed.
+ * \param[out] allocations the number of times that a cell was constructed,
+ *                         or had to grow one of its arrays.
+ * \param[out] peak the peak memory held by the cells, in bytes. */
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::arena_stats(unsigned long long &cells,unsigned long long &allocations,size_t &peak) {
+	cells=arn.cells+art.cells;
+	allocations=arn.allocations+art.allocations;
+	peak=arn.peak+art.peak;
+}
+
+/** Resets the counters of the cell arenas. */
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::reset_arena_stats() {
+	arn.reset_stats();
+	art.reset_stats();
+}
+
+/** Frees the cells that the sink routines and the cell cache keep between
+ * calls. They are created again the next time that they are needed. */
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::clear_arena() {
+	arn.clear();
+	art.clear();
+}
+
+/** The cache constructor takes over all particles that are currently in the
+ * container, and marks all of their cells as dirty.
+ * \param[in] icc a pointer to the container holding the particles. */
+template<class r_option,class fpoint>
+voropp_cell_cache<r_option,fpoint>::voropp_cell_cache(container_base<r_option> *icc)
+	: cc(icc), nd(0), ro(true), rmax(0), gp(0) {
+	int l,q;
+	for(l=0;l<cc->nxyz;l++) for(q=0;q<cc->co[l];q++) {
+		entry &e=record(cc->id[l][q]);
+		e.live=true;
+		e.x=cc->p[l][cc->sz*q];
+		e.y=cc->p[l][cc->sz*q+1];
+		e.z=cc->p[l][cc->sz*q+2];
+		mark(cc->id[l][q]);
+	}
+}
+
+/** The cache destructor. The cell meshes are freed with their store. */
+template<class r_option,class fpoint>
+voropp_cell_cache<r_option,fpoint>::~voropp_cell_cache() {}
+
+/** Returns the record of a particle ID, extending the list of records if
+ * needed.
+ * \param[in] n the numerical ID of the particle.
+ * \return A reference to the record. */
+template<class r_option,class fpoint>
+inline typename voropp_cell_cache<r_option,fpoint>::entry &voropp_cell_cache<r_option,fpoint>::record(int n) {
+	if(n>=int(ce.size())) {
+		entry e;
+		e.live=e.dirty=false;
+		e.x=e.y=e.z=e.r=0;
+		e.ci=e.wi=-1;
+		ce.resize(n+1,e);
+	}
+	return ce[n];
+}
+
+/** Marks the cell of a particle as dirty.
+ * \param[in] n the numerical ID of the particle. */
+template<class r_option,class fpoint>
+inline void voropp_cell_cache<r_option,fpoint>::mark(int n) {
+	entry &e=ce[n];
+	if(e.live&&!e.dirty) {e.dirty=true;nd++;dl.push_back(n);}
+}
+
+/** Marks the face neighbors of a cell as dirty. Negative IDs refer to the
+ * container boundaries and walls, and are skipped.
+ * \param[in] n the numerical ID of the particle. */
+template<class r_option,class fpoint>
+void voropp_cell_cache<r_option,fpoint>::mark_neighbors(int n) {
+	vector<int> &ne=ce[n].ne;
+	for(size_t i=0;i<ne.size();i++)
+		if(ne[i]>=0&&ne[i]<int(ce.size())) mark(ne[i]);
+}
+
+/** Marks every cell that a particle at a given position could cut as dirty.
+ * A particle can only cut a cell if it is closer to the cell's own particle
+ * than twice the distance to the furthest vertex, so only the blocks within
+ * rmax of the position need to be looked at.
+ * \param[in] (x,y,z) the position vector of the particle. */
+template<class r_option,class fpoint>
+void voropp_cell_cache<r_option,fpoint>::mark_near(fpoint x,fpoint y,fpoint z) {
+	if(rmax<=0) return;
+	const fpoint t2=voropp_precision<fpoint>::tolerance2();
+	fpoint px,py,pz,dx,dy,dz,rr;
+	int q,s;
+	voropp_loop l1(cc);
+	s=l1.init(x,y,z,rmax*(1+t2)+t2,px,py,pz);
+	do {
+		for(q=0;q<cc->co[s];q++) {
+			entry &e=ce[cc->id[s][q]];
+			if(e.dirty) continue;
+			dx=cc->p[s][cc->sz*q]+px-x;
+			dy=cc->p[s][cc->sz*q+1]+py-y;
+			dz=cc->p[s][cc->sz*q+2]+pz-z;
+			rr=e.r*(1+t2)+t2;
+			if(dx*dx+dy*dy+dz*dz<=rr*rr) mark(cc->id[s][q]);
+		}
 	} while((s=l1.inc(px,py,pz))!=-1);
 }
 
+/** Inserts a particle into the container, and marks its cell and all cells
+ * that it could cut as dirty. If a particle with this ID is already in the
+ * container, then it is moved instead.
+ * \param[in] n the numerical ID of the particle.
+ * \param[in] (x,y,z) the position vector of the particle. */
+template<class r_option,class fpoint>
+void voropp_cell_cache<r_option,fpoint>::insert(int n,fpoint x,fpoint y,fpoint z) {
+	entry &e=record(n);
+	if(e.live) {move(n,x,y,z);return;}
+	if(!cc->insert(n,x,y,z)) return;
+	ro=true;
+	e.live=true;
+	e.x=x;e.y=y;e.z=z;
+	mark(n);
+	mark_near(x,y,z);
+}
+
+/** Moves a particle to a new position. The cells that the particle was
+ * touching at its old position, and the cells that it could cut at the new
+ * one, are marked as dirty. If the particle is not in the container yet, then
+ * it is inserted, and if it leaves the container, then it is removed.
+ * \param[in] n the numerical ID of the particle.
+ * \param[in] (x,y,z) the new position vector of the particle. */
+template<class r_option,class fpoint>
+void voropp_cell_cache<r_option,fpoint>::move(int n,fpoint x,fpoint y,fpoint z) {
+	entry &e=record(n);
+	if(!e.live) {insert(n,x,y,z);return;}
+	if(e.x==x&&e.y==y&&e.z==z) return;
+	int ijk,q;
+	if(!cc->find(n,e.x,e.y,e.z,ijk,q))
+		voropp_fatal_error("Cached particle is missing from the container",VOROPP_INTERNAL_ERROR);
+	mark_neighbors(n);
+	mark_near(e.x,e.y,e.z);
+	if(cc->find_block(x,y,z)!=ijk) ro=true;
+	if(cc->move_at(ijk,q,x,y,z)) {
+		e.x=x;e.y=y;e.z=z;
+		mark(n);
+		mark_near(x,y,z);
+	} else {
+		if(e.dirty) nd--;
+		if(e.ci>=0) fr.push_back(e.ci);
+		e.live=e.dirty=false;
+		e.ci=-1;
+		e.ne.clear();e.r=0;
+	}
+}
+
+/** Removes a particle from the container, and marks the cells that it was
+ * touching as dirty.
+ * \param[in] n the numerical ID of the particle. */
+template<class r_option,class fpoint>
+void voropp_cell_cache<r_option,fpoint>::remove(int n) {
+	if(n<0||n>=int(ce.size())||!ce[n].live) return;
+	entry &e=ce[n];
+	int ijk,q;
+	if(!cc->find(n,e.x,e.y,e.z,ijk,q))
+		voropp_fatal_error("Cached particle is missing from the container",VOROPP_INTERNAL_ERROR);
+	mark_neighbors(n);
+	mark_near(e.x,e.y,e.z);
+	cc->remove_at(ijk,q);
+	ro=true;
+	if(e.dirty) nd--;
+	if(e.ci>=0) fr.push_back(e.ci);
+	e.live=e.dirty=false;
+	e.ci=-1;
+	e.ne.clear();e.r=0;
+}
+
+/** Writes a recomputed cell into the store. If the cell has a place in the
+ * store already and its new mesh fits into the room there, then the mesh is
+ * written over the old one. Otherwise the mesh is appended, and the old one
+ * is left behind.
+ * \param[in] e the record of the cell's particle.
+ * \param[in] ss the store that the cell was computed into.
+ * \param[in] k the index of the cell in that store. */
+template<class r_option,class fpoint>
+void voropp_cell_cache<r_option,fpoint>::store(entry &e,const VoronoiSink &ss,int k) {
+	if(e.ci<0) {
+		e.ci=int(cs.AddCell());
+		rm.resize(rm.size()+3,0);
+		ro=true;
+	}
+	size_t *r=&rm[3*e.ci];
+	bool fit=ss.pointCounts[k]<=r[0]&&ss.polyCounts[k]<=r[1]&&ss.faceCounts[k]<=r[2];
+	if(!fit) {
+		gp+=r[0];
+		r[0]=ss.pointCounts[k];r[1]=ss.polyCounts[k];r[2]=ss.faceCounts[k];
+	}
+	cs.SetCell(e.ci,ss,k,!fit);
+}
+
+/** Removes a cell from the store, by moving the last cell of the store into
+ * its place.
+ * \param[in] i the place of the cell in the store. */
+template<class r_option,class fpoint>
+void voropp_cell_cache<r_option,fpoint>::release(int i) {
+	int j=int(cs.GetCellCount())-1;
+	gp+=rm[3*i];
+	if(i!=j) {
+		ce[cs.cellIds[j]].ci=i;
+		rm[3*i]=rm[3*j];rm[3*i+1]=rm[3*j+1];rm[3*i+2]=rm[3*j+2];
+	}
+	cs.RemoveCell(i);
+	rm.resize(3*j);
+}
+
+/** Copies the meshes of all cells into a fresh store, without the data that
+ * no cell uses any more, and finds the exact search radius again. */
+template<class r_option,class fpoint>
+void voropp_cell_cache<r_option,fpoint>::compact() {
+	int i,n=int(cs.GetCellCount());
+	ns.Clear();
+	ns.points.reserve(cs.points.size()-3*gp);
+	for(i=0;i<n;i++) {
+		ns.AddCell(cs,i);
+		rm[3*i]=cs.pointCounts[i];rm[3*i+1]=cs.polyCounts[i];rm[3*i+2]=cs.faceCounts[i];
+	}
+	cs.Swap(ns);
+	gp=0;
+	rmax=0;
+	for(i=0;i<int(ce.size());i++) if(ce[i].live&&ce[i].r>rmax) rmax=ce[i].r;
+}
+
+/** Puts the cells of the store back into the order in which draw_cells_sink()
+ * lists them, which is the order of the particles in the blocks of the
+ * container. Only the cell table is reordered, while the meshes stay where
+ * they are, and nothing is done if the order is right already. */
+template<class r_option,class fpoint>
+void voropp_cell_cache<r_option,fpoint>::order() {
+	int i=0,l,q,n=int(cs.GetCellCount());
+	bool moved=false;
+	vector<int> od(n);
+	for(l=0;l<cc->nxyz;l++) for(q=0;q<cc->co[l];q++) {
+		entry &e=ce[cc->id[l][q]];
+		if(e.ci<0) continue;
+		if(e.ci!=i) moved=true;
+		od[i++]=e.ci;
+	}
+	if(i!=n) voropp_fatal_error("Cached cell is missing from the container",VOROPP_INTERNAL_ERROR);
+	if(!moved) return;
+	cs.ReorderCells(od);
+	vector<size_t> nr(3*n);
+	for(i=0;i<n;i++) {
+		ce[cs.cellIds[i]].ci=i;
+		nr[3*i]=rm[3*od[i]];nr[3*i+1]=rm[3*od[i]+1];nr[3*i+2]=rm[3*od[i]+2];
+	}
+	rm.swap(nr);
+}
+
+/** Compares the store with the cells that draw_cells_sink() computes from
+ * scratch, cell by cell and in order. The cells have to belong to the same
+ * particles, and have the same numbers of points and poly values, and every
+ * point has to have a point of the other cell within a small distance. The
+ * order of the points within a cell may differ, since it follows the order in
+ * which the planes cut the cell, and particles that end up not touching the
+ * cell can change that. This is a debugging routine, which recomputes every
+ * cell of the container, and it should only be called when no cells are
+ * dirty.
+ * \return The number of cells that differ, counting every cell that only
+ *         one of them has. */
+template<class r_option,class fpoint>
+int voropp_cell_cache<r_option,fpoint>::check_cells() {
+	VoronoiSink fs;
+	int i,j,l,k,n=int(cs.GetCellCount()),m;
+	fpoint dx=cc->bx-cc->ax,dy=cc->by-cc->ay,dz=cc->bz-cc->az,eps,d,dm;
+	eps=1e-5*sqrt(dx*dx+dy*dy+dz*dz);
+	cc->draw_cells_sink(&fs);
+	m=int(fs.GetCellCount());
+	if(m<n) {k=n-m;n=m;} else k=m-n;
+	for(i=0;i<n;i++) {
+		if(cs.cellIds[i]!=fs.cellIds[i]||cs.pointCounts[i]!=fs.pointCounts[i]||cs.polyCounts[i]!=fs.polyCounts[i]) {k++;continue;}
+		const float *pa=&cs.points[3*cs.pointOffsets[i]],*pb=&fs.points[3*fs.pointOffsets[i]];
+		for(j=0;j<int(cs.pointCounts[i]);j++) {
+			for(dm=eps*eps+1,l=0;l<int(fs.pointCounts[i]);l++) {
+				dx=pa[3*j]-pb[3*l];dy=pa[3*j+1]-pb[3*l+1];dz=pa[3*j+2]-pb[3*l+2];
+				d=dx*dx+dy*dy+dz*dz;
+				if(d<dm) dm=d;
+			}
+			if(dm>eps*eps) break;
+		}
+		if(j<int(cs.pointCounts[i])) k++;
+	}
+	return k;
+}
+
+/** Recomputes the dirty cells on several threads, and patches them into the
+ * store of cell meshes. Every thread writes the cells it recomputes into a
+ * store of its own, and they are copied into the main store afterwards,
+ * while the meshes of the clean cells are not touched. The cell table is
+ * then put back into the order of the blocks. The update can be
+ * cancelled from another thread, in which case the cells that have not been
+ * recomputed yet stay dirty and keep their old meshes, while all the others
+ * are kept, so that the next update carries on from there.
+ * \param[in] threads the number of threads to use. If this is zero or
+ *                    negative, then the OpenMP default is used.
+ * \param[in] cancel if not NULL, a flag that stops the update as soon as it
+ *                   is set to a nonzero value.
+ * \return The number of cells that were recomputed. */
+template<class r_option,class fpoint>
+int voropp_cell_cache<r_option,fpoint>::update(int threads,volatile int *cancel) {
+	int i,l,q,w,nw=0,nc=0,*wk=new int[4*nd];
+
+	// Remove the cells of the particles that are gone, starting with the
+	// last place, so that none of them gets moved into another's place
+	sort(fr.begin(),fr.end());
+	for(i=int(fr.size())-1;i>=0;i--) release(fr[i]);
+	fr.clear();
+
+	// Collect the dirty particles
+	for(i=0;i<int(dl.size());i++) {
+		entry &e=ce[dl[i]];
+		if(!e.live||!e.dirty||e.wi>=0) continue;
+		if(!cc->find(dl[i],e.x,e.y,e.z,l,q))
+			voropp_fatal_error("Cached particle is missing from the container",VOROPP_INTERNAL_ERROR);
+		wk[4*nw]=l;wk[4*nw+1]=q;e.wi=nw;nw++;
+	}
+	dl.clear();
+#ifdef _OPENMP
+	if(threads<=0) threads=omp_get_max_threads();
+#else
+	threads=1;
+#endif
+	if(threads>nw) threads=nw>0?nw:1;
+	VoronoiSink *ts=new VoronoiSink[threads];
+	cc->art.reserve(threads);
+
+	// Recompute them, remembering which thread stored each cell where
+#pragma omp parallel num_threads(threads)
+	{
+		fpoint x,y,z;
+		int s,t,u=0;
+		unsigned long long n=0;
+#ifdef _OPENMP
+		u=omp_get_thread_num();
+#endif
+		voronoicell_neighbor &c=cc->art.cell(u);
+		voropp_search<r_option> sr(cc);
+#pragma omp for schedule(dynamic,16)
+		for(w=0;w<nw;w++) {
+			s=wk[4*w];t=wk[4*w+1];
+			if(cancel!=NULL&&*cancel) {wk[4*w+2]=-2;continue;}
+			entry &e=ce[cc->id[s][t]];
+			wk[4*w+2]=-1;
+			e.ne.clear();e.r=0;
+			x=cc->p[s][cc->sz*t];y=cc->p[s][cc->sz*t+1];z=cc->p[s][cc->sz*t+2];
+			if(x>cc->ax&&x<cc->bx&&y>cc->ay&&y<cc->by&&z>cc->az&&z<cc->bz) {
+				if(cc->compute_cell(c,sr,s%cc->nx,(s/cc->nx)%cc->ny,s/cc->nxy,s,t,x,y,z)) {
+					VoronoiSink &ss=ts[u];
+					wk[4*w+2]=u;wk[4*w+3]=int(ss.GetCellCount());
+					c.draw_sink(ss,x,y,z,cc->id[s][t]);
+					e.r=sqrt(c.max_radius_squared());
+					e.ne.assign(ss.neighbors.begin()+ss.faceOffsets.back(),ss.neighbors.end());
+				}
+				n++;
+			}
+		}
+#pragma omp critical
+		{cc->pt+=c.planes_tested;cc->ps+=c.planes_skipped;}
+		cc->art.release(u,n);
+	}
+	cc->art.update_peak();
+
+	// Patch the recomputed cells into the store, in the order in which
+	// they were collected, and widen the search radius if needed
+	for(w=0;w<nw;w++) {
+		i=cc->id[wk[4*w]][wk[4*w+1]];
+		entry &e=ce[i];
+		e.wi=-1;
+		if(wk[4*w+2]==-2) {dl.push_back(i);nc++;continue;}
+		e.dirty=false;
+		if(wk[4*w+2]>=0) store(e,ts[wk[4*w+2]],wk[4*w+3]);
+		else if(e.ci>=0) {release(e.ci);e.ci=-1;ro=true;}
+		if(e.r>rmax) rmax=e.r;
+	}
+	if(ro) {order();ro=false;}
+	if(2*gp>cs.points.size()/3) compact();
+	delete [] ts;
+	delete [] wk;
+	nd=nc;
+	return nw-nc;
+}
+
 /** Computes all of the Voronoi cells in the container, but does nothing
  * with the output. It is useful for measuring the pure computation time
  * of the Voronoi algorithm, without any additional calculations such as
  * volume evaluation or cell output. */
-template<class r_option>
-void container_base<r_option>::compute_all_cells() {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::compute_all_cells() {
 	voronoicell c;
 	int i,j,k,ijk=0,q;
 	for(k=0;k<nz;k++) for(j=0;j<ny;j++) for(i=0;i<nx;i++,ijk++) {
@@ -709,8 +1730,8 @@ void container_base<r_option>::compute_all_cells() {
  * numbers.
  * \param[in] bb a pointer to an array to store the volumes. The volume of the
  *               particle with ID number n will be stored at bb[n]. */
-template<class r_option>
-void container_base<r_option>::store_cell_volumes(fpoint *bb) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::store_cell_volumes(fpoint *bb) {
 	voronoicell c;
 	int i,j,k,ijk=0,q;
 	for(k=0;k<nz;k++) for(j=0;j<ny;j++) for(i=0;i<nx;i++,ijk++) {
@@ -726,8 +1747,8 @@ void container_base<r_option>::store_cell_volumes(fpoint *bb) {
  *               particles.
  * \param[in] (cx,cy,cz) the center of the test sphere.
  * \param[in] r the radius of the test sphere. */
-template<class r_option>
-fpoint container_base<r_option>::packing_fraction(fpoint *bb,fpoint cx,fpoint cy,fpoint cz,fpoint r) {
+template<class r_option,class fpoint>
+fpoint container_base<r_option,fpoint>::packing_fraction(fpoint *bb,fpoint cx,fpoint cy,fpoint cz,fpoint r) {
 	voropp_loop l1(this);
 	fpoint px,py,pz,x,y,z,rsq=r*r,pvol=0,vvol=0;
 	int q,s;
@@ -743,7 +1764,7 @@ fpoint container_base<r_option>::packing_fraction(fpoint *bb,fpoint cx,fpoint cy
 			}
 		}
 	} while((s=l1.inc(px,py,pz))!=-1);
-	return vvol>tolerance?pvol/vvol*4.1887902047863909846168578443726:0;
+	return vvol>voropp_precision<fpoint>::tolerance()?pvol/vvol*4.1887902047863909846168578443726:0;
 }
 
 /** Computes the local packing fraction at a point, by summing the volumes of
@@ -753,8 +1774,8 @@ fpoint container_base<r_option>::packing_fraction(fpoint *bb,fpoint cx,fpoint cy
  * \param[in] (xmin,xmax) the minimum and maximum x coordinates of the box.
  * \param[in] (ymin,ymax) the minimum and maximum y coordinates of the box.
  * \param[in] (zmin,zmax) the minimum and maximum z coordinates of the box. */
-template<class r_option>
-fpoint container_base<r_option>::packing_fraction(fpoint *bb,fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax) {
+template<class r_option,class fpoint>
+fpoint container_base<r_option,fpoint>::packing_fraction(fpoint *bb,fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax) {
 	voropp_loop l1(this);
 	fpoint x,y,z,px,py,pz,pvol=0,vvol=0;
 	int q,s;
@@ -770,15 +1791,15 @@ fpoint container_base<r_option>::packing_fraction(fpoint *bb,fpoint xmin,fpoint
 			}
 		}
 	} while((s=l1.inc(px,py,pz))!=-1);
-	return vvol>tolerance?pvol/vvol*4.1887902047863909846168578443726:0;
+	return vvol>voropp_precision<fpoint>::tolerance()?pvol/vvol*4.1887902047863909846168578443726:0;
 }
 
 /** Calculates all of the Voronoi cells and sums their volumes. In most cases
  * without walls, the sum of the Voronoi cell volumes should equal the volume
  * of the container to numerical precision.
  * \return The sum of all of the computed Voronoi volumes. */
-template<class r_option>
-fpoint container_base<r_option>::sum_cell_volumes() {
+template<class r_option,class fpoint>
+fpoint container_base<r_option,fpoint>::sum_cell_volumes() {
 	voronoicell c;
 	int i,j,k,ijk=0,q;fpoint vol=0;
 	for(k=0;k<nz;k++) for(j=0;j<ny;j++) for(i=0;i<nx;i++,ijk++) {
@@ -795,8 +1816,8 @@ fpoint container_base<r_option>::sum_cell_volumes() {
  * \param[in] format the format of the output lines, using control sequences to
  *                   denote the different cell statistics.
  * \param[in] os an open output stream to write to. */
-template<class r_option>
-void container_base<r_option>::print_all_custom(const char *format,ostream &os) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::print_all_custom(const char *format,ostream &os) {
 	int fp=0;
 
 	// Check to see if the sequence "%n" appears in the format sequence
@@ -826,8 +1847,8 @@ void container_base<r_option>::print_all_custom(const char *format,ostream &os)
 /** An overloaded version of print_all_custom() that prints to standard output.
  * \param[in] format the format of the output lines, using control sequences to
  *                   denote the different cell statistics. */
-template<class r_option>
-void container_base<r_option>::print_all_custom(const char *format) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::print_all_custom(const char *format) {
 	print_all_custom(format,cout);
 }
 
@@ -836,8 +1857,8 @@ void container_base<r_option>::print_all_custom(const char *format) {
  * \param[in] format the format of the output lines, using control sequences to
  *                   denote the different cell statistics.
  * \param[in] filename the name of the file to write to. */
-template<class r_option>
-void container_base<r_option>::print_all_custom(const char *format,const char *filename) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::print_all_custom(const char *format,const char *filename) {
 	ofstream os;
 	os.open(filename,ofstream::out|ofstream::trunc);
 	print_all_custom(format,os);
@@ -851,9 +1872,9 @@ void container_base<r_option>::print_all_custom(const char *format,const char *f
  * \param[in] format the format of the output lines, using control sequences to
  *                   denote the different cell statistics.
  * \param[in] os an open output stream to write to. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-void container_base<r_option>::print_all_custom_internal(voronoicell_base<n_option> &c,const char *format,ostream &os) {
+void container_base<r_option,fpoint>::print_all_custom_internal(voronoicell_base<n_option> &c,const char *format,ostream &os) {
 	fpoint x,y,z;
 	int i,j,k,ijk=0,q,fp;
 	for(k=0;k<nz;k++) for(j=0;j<ny;j++) for(i=0;i<nx;i++,ijk++) for(q=0;q<co[ijk];q++) {
@@ -929,9 +1950,9 @@ void container_base<r_option>::print_all_custom_internal(voronoicell_base<n_opti
  * neighbor computations are needed).
  * \param[in,out] c a Voronoi cell object to use for the computation.
  * \param[in] os an open output stream to write to. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-inline void container_base<r_option>::print_all_internal(voronoicell_base<n_option> &c,ostream &os) {
+inline void container_base<r_option,fpoint>::print_all_internal(voronoicell_base<n_option> &c,ostream &os) {
 	fpoint x,y,z;
 	int i,j,k,ijk=0,q;
 	for(k=0;k<nz;k++) for(j=0;j<ny;j++) for(i=0;i<nx;i++,ijk++) {
@@ -951,15 +1972,15 @@ inline void container_base<r_option>::print_all_internal(voronoicell_base<n_opti
 /** Prints a list of all particle labels, positions, and Voronoi volumes to the
  * standard output.
  * \param[in] os the output stream to print to. */
-template<class r_option>
-void container_base<r_option>::print_all(ostream &os) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::print_all(ostream &os) {
 	voronoicell c;
 	print_all_internal(c,os);
 }
 
 /** An overloaded version of print_all(), which just prints to standard output. */
-template<class r_option>
-void container_base<r_option>::print_all() {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::print_all() {
 	voronoicell c;
 	print_all_internal(c,cout);
 }
@@ -967,8 +1988,8 @@ void container_base<r_option>::print_all() {
 /** An overloaded version of print_all(), which outputs the result to a particular
  * file.
  * \param[in] filename the name of the file to write to. */
-template<class r_option>
-inline void container_base<r_option>::print_all(const char* filename) {
+template<class r_option,class fpoint>
+inline void container_base<r_option,fpoint>::print_all(const char* filename) {
 	voronoicell c;
 	ofstream os;
 	os.open(filename,ofstream::out|ofstream::trunc);
@@ -979,16 +2000,16 @@ inline void container_base<r_option>::print_all(const char* filename) {
 /** Prints a list of all particle labels, positions, Voronoi volumes, and a list
  * of neighboring particles to an output stream.
  * \param[in] os the output stream to print to.*/
-template<class r_option>
-void container_base<r_option>::print_all_neighbor(ostream &os) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::print_all_neighbor(ostream &os) {
 	voronoicell_neighbor c;
 	print_all_internal(c,os);
 }
 
 /** An overloaded version of print_all_neighbor(), which just prints to
  * standard output. */
-template<class r_option>
-void container_base<r_option>::print_all_neighbor() {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::print_all_neighbor() {
 	voronoicell_neighbor c;
 	print_all_internal(c,cout);
 }
@@ -996,8 +2017,8 @@ void container_base<r_option>::print_all_neighbor() {
 /** An overloaded version of print_all_neighbor(), which outputs the results to
  * a particular file.
  * \param[in] filename the name of the file to write to. */
-template<class r_option>
-inline void container_base<r_option>::print_all_neighbor(const char* filename) {
+template<class r_option,class fpoint>
+inline void container_base<r_option,fpoint>::print_all_neighbor(const char* filename) {
 	voronoicell_neighbor c;
 	ofstream os;
 	os.open(filename,ofstream::out|ofstream::trunc);
@@ -1015,9 +2036,9 @@ inline void container_base<r_option>::print_all_neighbor(const char* filename) {
  * \param[in] (x,y,z) the position of the particle.
  * \return False if the plane cuts applied by walls completely removed the
  *         cell, true otherwise. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-inline bool container_base<r_option>::initialize_voronoicell(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z) {
+inline bool container_base<r_option,fpoint>::initialize_voronoicell(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z) {
 	fpoint x1,x2,y1,y2,z1,z2;
 	if(xperiodic) x1=-(x2=0.5*(bx-ax));else {x1=ax-x;x2=bx-x;}
 	if(yperiodic) y1=-(y2=0.5*(by-ay));else {y1=ay-y;y2=by-y;}
@@ -1032,8 +2053,8 @@ inline bool container_base<r_option>::initialize_voronoicell(voronoicell_base<n_
  * \param[in] (x,y,z) the position vector to be tested.
  * \return True if the point is inside the container, false if the point is
  *         outside. */
-template<class r_option>
-bool container_base<r_option>::point_inside(fpoint x,fpoint y,fpoint z) {
+template<class r_option,class fpoint>
+bool container_base<r_option,fpoint>::point_inside(fpoint x,fpoint y,fpoint z) {
 	if(x<ax||x>bx||y<ay||y>by||z<az||z>bz) return false;
 	return point_inside_walls(x,y,z);
 }
@@ -1044,8 +2065,8 @@ bool container_base<r_option>::point_inside(fpoint x,fpoint y,fpoint z) {
  * \param[in] (x,y,z) the position vector to be tested.
  * \return True if the point is inside the container, false if the point is
  *         outside. */
-template<class r_option>
-bool container_base<r_option>::point_inside_walls(fpoint x,fpoint y,fpoint z) {
+template<class r_option,class fpoint>
+bool container_base<r_option,fpoint>::point_inside_walls(fpoint x,fpoint y,fpoint z) {
 	for(int j=0;j<wall_number;j++) if(!walls[j]->point_inside(x,y,z)) return false;
 	return true;
 }
@@ -1066,9 +2087,9 @@ bool container_base<r_option>::point_inside_walls(fpoint x,fpoint y,fpoint z) {
  * \param[in] (x,y,z) the coordinates of the particle.
  * \return False if the Voronoi cell was completely removed during the
  *         computation and has zero volume, true otherwise. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-bool container_base<r_option>::compute_cell_sphere(voronoicell_base<n_option> &c,int i,int j,int k,int ijk,int s,fpoint x,fpoint y,fpoint z) {
+bool container_base<r_option,fpoint>::compute_cell_sphere(voronoicell_base<n_option> &c,int i,int j,int k,int ijk,int s,fpoint x,fpoint y,fpoint z) {
 
 	// This length scale determines how large the spherical shells should
 	// be, and it should be set to approximately the particle diameter
@@ -1089,7 +2110,7 @@ bool container_base<r_option>::compute_cell_sphere(voronoicell_base<n_option> &c
 			for(q=0;q<co[t];q++) {
 				x1=p[t][sz*q]+qx-x;y1=p[t][sz*q+1]+qy-y;z1=p[t][sz*q+2]+qz-z;
 				rs=x1*x1+y1*y1+z1*z1;
-				if(lrs-tolerance<rs&&rs<urs&&(q!=s||ijk!=t)) {
+				if(lrs-voropp_precision<fpoint>::tolerance()<rs&&rs<urs&&(q!=s||ijk!=t)) {
 					if(!c.nplane(x1,y1,z1,radius.scale(rs,t,q),id[t][q])) return false;
 				}
 			}
@@ -1109,9 +2130,9 @@ bool container_base<r_option>::compute_cell_sphere(voronoicell_base<n_option> &c
  * \param[in] s the index of the particle within the test block.
  * \return False if the Voronoi cell was completely removed during the
  *         computation and has zero volume, true otherwise. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-inline bool container_base<r_option>::compute_cell_sphere(voronoicell_base<n_option> &c,int i,int j,int k,int ijk,int s) {
+inline bool container_base<r_option,fpoint>::compute_cell_sphere(voronoicell_base<n_option> &c,int i,int j,int k,int ijk,int s) {
 	fpoint x=p[ijk][sz*s],y=p[ijk][sz*s+1],z=p[ijk][sz*s+2];
 	return compute_cell_sphere(c,i,j,k,ijk,s,x,y,z);
 }
@@ -1127,13 +2148,30 @@ inline bool container_base<r_option>::compute_cell_sphere(voronoicell_base<n_opt
  * \param[in] s the index of the particle within the test block.
  * \return False if the Voronoi cell was completely removed during the
  *         computation and has zero volume, true otherwise. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-inline bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,int j,int k,int ijk,int s) {
+inline bool container_base<r_option,fpoint>::compute_cell(voronoicell_base<n_option> &c,int i,int j,int k,int ijk,int s) {
 	fpoint x=p[ijk][sz*s],y=p[ijk][sz*s+1],z=p[ijk][sz*s+2];
 	return  compute_cell(c,i,j,k,ijk,s,x,y,z);
 }
 
+/** A overloaded version of compute_cell, that uses the container's own search
+ * state. It is used by all of the serial routines.
+ * \param[in,out] c a reference to a voronoicell object.
+ * \param[in] (i,j,k) the coordinates of the block that the test particle is
+ *                    in.
+ * \param[in] ijk the index of the block that the test particle is in, set to
+ *                i+nx*(j+ny*k).
+ * \param[in] s the index of the particle within the test block.
+ * \param[in] (x,y,z) the coordinates of the particle.
+ * \return False if the Voronoi cell was completely removed during the
+ *         computation and has zero volume, true otherwise. */
+template<class r_option,class fpoint>
+template<class n_option>
+inline bool container_base<r_option,fpoint>::compute_cell(voronoicell_base<n_option> &c,int i,int j,int k,int ijk,int s,fpoint x,fpoint y,fpoint z) {
+	return compute_cell(c,search,i,j,k,ijk,s,x,y,z);
+}
+
 /** This routine computes a Voronoi cell for a single particle in the
  * container. It can be called by the user, but is also forms the core part of
  * several of the main functions, such as store_cell_volumes(), print_all(),
@@ -1151,6 +2189,8 @@ inline bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c
  * the particles in that block, and then adds the block neighbors to the list
  * of potential places to consider.
  * \param[in,out] c a reference to a voronoicell object.
+ * \param[in,out] sr the search state to use. Every thread computing cells
+ *                   at the same time needs its own copy of this.
  * \param[in] (i,j,k) the coordinates of the block that the test particle is
  *                    in.
  * \param[in] ijk the index of the block that the test particle is in, set to
@@ -1159,9 +2199,9 @@ inline bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c
  * \param[in] (x,y,z) the coordinates of the particle.
  * \return False if the Voronoi cell was completely removed during the
  *         computation and has zero volume, true otherwise. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,int j,int k,int ijk,int s,fpoint x,fpoint y,fpoint z) {
+bool container_base<r_option,fpoint>::compute_cell(voronoicell_base<n_option> &c,voropp_search<r_option> &sr,int i,int j,int k,int ijk,int s,fpoint x,fpoint y,fpoint z) {
 	const fpoint boxx=(bx-ax)/nx,boxy=(by-ay)/ny,boxz=(bz-az)/nz;
 	fpoint x1,y1,z1,qx=0,qy=0,qz=0;
 	fpoint xlo,ylo,zlo,xhi,yhi,zhi,rs;
@@ -1170,7 +2210,7 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 	int f,g,l;unsigned int q,*e;
 	const unsigned int b1=1<<21,b2=1<<22,b3=1<<24,b4=1<<25,b5=1<<27,b6=1<<28;
 
-	radius.init(ijk,s);
+	sr.radius.init(ijk,s);
 
 	// Initialize the Voronoi cell to fill the entire container
 	if(!initialize_voronoicell(c,x,y,z)) return false;
@@ -1184,7 +2224,7 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 		x1=p[ijk][sz*l]-x;
 		y1=p[ijk][sz*l+1]-y;
 		z1=p[ijk][sz*l+2]-z;
-		rs=radius.scale(x1*x1+y1*y1+z1*z1,ijk,l);
+		rs=sr.radius.scale(x1*x1+y1*y1+z1*z1,ijk,l);
 		if(!c.nplane(x1,y1,z1,rs,id[ijk][l])) return false;
 	}
 	l++;
@@ -1192,7 +2232,7 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 		x1=p[ijk][sz*l]-x;
 		y1=p[ijk][sz*l+1]-y;
 		z1=p[ijk][sz*l+2]-z;
-		rs=radius.scale(x1*x1+y1*y1+z1*z1,ijk,l);
+		rs=sr.radius.scale(x1*x1+y1*y1+z1*z1,ijk,l);
 		if(!c.nplane(x1,y1,z1,rs,id[ijk][l])) return false;
 		l++;
 	}
@@ -1255,7 +2295,7 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 
 		// If mrs is less than the minimum distance to any untested
 		// block, then we are done
-		if(mrs<radius.cutoff(radp[g])) return true;
+		if(mrs<sr.radius.cutoff(radp[g])) return true;
 		g++;
 
 		// Load in a block off the worklist, permute it with the
@@ -1279,7 +2319,7 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 		// current mrs, in which case we skip this block and move on.
 		// Otherwise, it computes the maximum distance to the block and
 		// returns it in crs.
-		if(compute_min_max_radius(di,dj,dk,fx,fy,fz,gxs,gys,gzs,crs,mrs)) continue;
+		if(compute_min_max_radius(sr.radius,di,dj,dk,fx,fy,fz,gxs,gys,gzs,crs,mrs)) continue;
 
 		// Now compute which region we are going to loop over, adding a
 		// displacement for the periodic cases
@@ -1293,12 +2333,12 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 		// then we have to test all particles in the block for
 		// intersections. Otherwise, we do additional checks and skip
 		// those particles which can't possibly intersect the block.
-		if(mrs>radius.cutoff(crs)) {
+		if(mrs>sr.radius.cutoff(crs)) {
 			for(l=0;l<co[dijk];l++) {
 				x1=p[dijk][sz*l]+qx-x;
 				y1=p[dijk][sz*l+1]+qy-y;
 				z1=p[dijk][sz*l+2]+qz-z;
-				rs=radius.scale(x1*x1+y1*y1+z1*z1,dijk,l);
+				rs=sr.radius.scale(x1*x1+y1*y1+z1*z1,dijk,l);
 				if(!c.nplane(x1,y1,z1,rs,id[dijk][l])) return false;
 			}
 		} else {
@@ -1306,7 +2346,7 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 				x1=p[dijk][sz*l]+qx-x;
 				y1=p[dijk][sz*l+1]+qy-y;
 				z1=p[dijk][sz*l+2]+qz-z;
-				rs=radius.scale(x1*x1+y1*y1+z1*z1,dijk,l);
+				rs=sr.radius.scale(x1*x1+y1*y1+z1*z1,dijk,l);
 				if(rs<mrs) {
 					if(!c.nplane(x1,y1,z1,rs,id[dijk][l])) return false;
 				}
@@ -1328,14 +2368,14 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 
 	// Update the mask counter, and if it wraps around then reset the
 	// whole mask; that will only happen once every 2^32 tries
-	mv++;
-	if(mv==0) {
-		for(l=0;l<hxyz;l++) mask[l]=0;
-		mv=1;
+	sr.mv++;
+	if(sr.mv==0) {
+		for(l=0;l<hxyz;l++) sr.mask[l]=0;
+		sr.mv=1;
 	}
 
 	// Reset the block by block counters
-	s_start=s_end=0;
+	sr.s_start=sr.s_end=0;
 
 	while(g<seq_length-1) {
 
@@ -1348,7 +2388,7 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 
 		// If mrs is less than the minimum distance to any untested
 		// block, then we are done
-		if(mrs<radius.cutoff(radp[g])) return true;
+		if(mrs<sr.radius.cutoff(radp[g])) return true;
 		g++;
 
 		// Load in a block off the worklist, permute it with the
@@ -1369,14 +2409,14 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 		if(ej<0) continue;else if(ej>=hy) continue;
 		if(ek<0) continue;else if(ek>=hz) continue;
 		eijk=ei+hx*(ej+hy*ek);
-		mask[eijk]=mv;
+		sr.mask[eijk]=sr.mv;
 
 		// Call the compute_min_max_radius() function. This returns
 		// true if the minimum distance to the block is bigger than the
 		// current mrs, in which case we skip this block and move on.
 		// Otherwise, it computes the maximum distance to the block and
 		// returns it in crs.
-		if(compute_min_max_radius(di,dj,dk,fx,fy,fz,gxs,gys,gzs,crs,mrs)) continue;
+		if(compute_min_max_radius(sr.radius,di,dj,dk,fx,fy,fz,gxs,gys,gzs,crs,mrs)) continue;
 
 		// Now compute which region we are going to loop over, adding a
 		// displacement for the periodic cases
@@ -1390,12 +2430,12 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 		// then we have to test all particles in the block for
 		// intersections. Otherwise, we do additional checks and skip
 		// those particles which can't possibly intersect the block.
-		if(mrs>radius.cutoff(crs)) {
+		if(mrs>sr.radius.cutoff(crs)) {
 			for(l=0;l<co[dijk];l++) {
 				x1=p[dijk][sz*l]+qx-x;
 				y1=p[dijk][sz*l+1]+qy-y;
 				z1=p[dijk][sz*l+2]+qz-z;
-				rs=radius.scale(x1*x1+y1*y1+z1*z1,dijk,l);
+				rs=sr.radius.scale(x1*x1+y1*y1+z1*z1,dijk,l);
 				if(!c.nplane(x1,y1,z1,rs,id[dijk][l])) return false;
 			}
 		} else {
@@ -1403,7 +2443,7 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 				x1=p[dijk][sz*l]+qx-x;
 				y1=p[dijk][sz*l+1]+qy-y;
 				z1=p[dijk][sz*l+2]+qz-z;
-				rs=radius.scale(x1*x1+y1*y1+z1*z1,dijk,l);
+				rs=sr.radius.scale(x1*x1+y1*y1+z1*z1,dijk,l);
 				if(rs<mrs) {
 					if(!c.nplane(x1,y1,z1,rs,id[dijk][l])) return false;
 				}
@@ -1412,25 +2452,25 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 
 		// If there might not be enough memory on the list for these
 		// additions, then add more
-		if(s_end+18>s_size) add_list_memory();
+		if(sr.s_end+18>sr.s_size) sr.add_list_memory();
 
 		// Test the parts of the worklist element which tell us what
 		// neighbors of this block are not on the worklist. Store them
 		// on the block list, and mark the mask.
 		if((q&b2)==b2) {
-			if(ei>0) if(mask[eijk-1]!=mv) {mask[eijk-1]=mv;sl[s_end++]=ei-1;sl[s_end++]=ej;sl[s_end++]=ek;}
-			if((q&b1)==0) if(ei<hx-1) if(mask[eijk+1]!=mv) {mask[eijk+1]=mv;sl[s_end++]=ei+1;sl[s_end++]=ej;sl[s_end++]=ek;}
-		} else if((q&b1)==b1) {if(ei<hx-1) if(mask[eijk+1]!=mv) {mask[eijk+1]=mv;sl[s_end++]=ei+1;sl[s_end++]=ej;sl[s_end++]=ek;}}
-		if((q&b4)==b4) {if(ej>0) if(mask[eijk-hx]!=mv) {mask[eijk-hx]=mv;sl[s_end++]=ei;sl[s_end++]=ej-1;sl[s_end++]=ek;}
-			if((q&b3)==0) if(ej<hy-1) if(mask[eijk+hx]!=mv) {mask[eijk+hx]=mv;sl[s_end++]=ei;sl[s_end++]=ej+1;sl[s_end++]=ek;}
-		} else if((q&b3)==b3) {if(ej<hy-1) if(mask[eijk+hx]!=mv) {mask[eijk+hx]=mv;sl[s_end++]=ei;sl[s_end++]=ej+1;sl[s_end++]=ek;}}
-		if((q&b6)==b6) {if(ek>0) if(mask[eijk-hxy]!=mv) {mask[eijk-hxy]=mv;sl[s_end++]=ei;sl[s_end++]=ej;sl[s_end++]=ek-1;}
-			if((q&b5)==0) if(ek<hz-1) if(mask[eijk+hxy]!=mv) {mask[eijk+hxy]=mv;sl[s_end++]=ei;sl[s_end++]=ej;sl[s_end++]=ek+1;}
-		} else if((q&b5)==b5) if(ek<hz-1) if(mask[eijk+hxy]!=mv) {mask[eijk+hxy]=mv;sl[s_end++]=ei;sl[s_end++]=ej;sl[s_end++]=ek+1;}
+			if(ei>0) if(sr.mask[eijk-1]!=sr.mv) {sr.mask[eijk-1]=sr.mv;sr.sl[sr.s_end++]=ei-1;sr.sl[sr.s_end++]=ej;sr.sl[sr.s_end++]=ek;}
+			if((q&b1)==0) if(ei<hx-1) if(sr.mask[eijk+1]!=sr.mv) {sr.mask[eijk+1]=sr.mv;sr.sl[sr.s_end++]=ei+1;sr.sl[sr.s_end++]=ej;sr.sl[sr.s_end++]=ek;}
+		} else if((q&b1)==b1) {if(ei<hx-1) if(sr.mask[eijk+1]!=sr.mv) {sr.mask[eijk+1]=sr.mv;sr.sl[sr.s_end++]=ei+1;sr.sl[sr.s_end++]=ej;sr.sl[sr.s_end++]=ek;}}
+		if((q&b4)==b4) {if(ej>0) if(sr.mask[eijk-hx]!=sr.mv) {sr.mask[eijk-hx]=sr.mv;sr.sl[sr.s_end++]=ei;sr.sl[sr.s_end++]=ej-1;sr.sl[sr.s_end++]=ek;}
+			if((q&b3)==0) if(ej<hy-1) if(sr.mask[eijk+hx]!=sr.mv) {sr.mask[eijk+hx]=sr.mv;sr.sl[sr.s_end++]=ei;sr.sl[sr.s_end++]=ej+1;sr.sl[sr.s_end++]=ek;}
+		} else if((q&b3)==b3) {if(ej<hy-1) if(sr.mask[eijk+hx]!=sr.mv) {sr.mask[eijk+hx]=sr.mv;sr.sl[sr.s_end++]=ei;sr.sl[sr.s_end++]=ej+1;sr.sl[sr.s_end++]=ek;}}
+		if((q&b6)==b6) {if(ek>0) if(sr.mask[eijk-hxy]!=sr.mv) {sr.mask[eijk-hxy]=sr.mv;sr.sl[sr.s_end++]=ei;sr.sl[sr.s_end++]=ej;sr.sl[sr.s_end++]=ek-1;}
+			if((q&b5)==0) if(ek<hz-1) if(sr.mask[eijk+hxy]!=sr.mv) {sr.mask[eijk+hxy]=sr.mv;sr.sl[sr.s_end++]=ei;sr.sl[sr.s_end++]=ej;sr.sl[sr.s_end++]=ek+1;}
+		} else if((q&b5)==b5) if(ek<hz-1) if(sr.mask[eijk+hxy]!=sr.mv) {sr.mask[eijk+hxy]=sr.mv;sr.sl[sr.s_end++]=ei;sr.sl[sr.s_end++]=ej;sr.sl[sr.s_end++]=ek+1;}
 	}
 
 	// Do a check to see if we've reach the radius cutoff
-	if(mrs<radius.cutoff(radp[g])) return true;
+	if(mrs<sr.radius.cutoff(radp[g])) return true;
 
 	// Update the mask counter, and if it has wrapped around, then
 	// reset the mask
@@ -1439,15 +2479,15 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 	// We were unable to completely compute the cell based on the blocks in
 	// the worklist, so now we have to go block by block, reading in items
 	// off the list
-	while(s_start!=s_end) {
+	while(sr.s_start!=sr.s_end) {
 
 		// If we reached the end of the list memory loop back to the
 		// start
-		if(s_start==s_size) s_start=0;
+		if(sr.s_start==sr.s_size) sr.s_start=0;
 
 		// Read in a block off the list, and compute the upper and lower
 		// coordinates in each of the three dimensions
-		di=sl[s_start++];dj=sl[s_start++];dk=sl[s_start++];
+		di=sr.sl[sr.s_start++];dj=sr.sl[sr.s_start++];dk=sr.sl[sr.s_start++];
 		xlo=di*boxx-fx;xhi=xlo+boxx;
 		ylo=dj*boxy-fy;yhi=ylo+boxy;
 		zlo=dk*boxz-fz;zhi=zlo+boxz;
@@ -1457,77 +2497,77 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 		if(di>ci) {
 			if(dj>cj) {
 				if(dk>ck) {
-					if(corner_test(c,xlo,ylo,zlo,xhi,yhi,zhi)) continue;
+					if(corner_test(c,sr.radius,xlo,ylo,zlo,xhi,yhi,zhi)) continue;
 				} else if(dk<ck) {
-					if(corner_test(c,xlo,ylo,zhi,xhi,yhi,zlo)) continue;
+					if(corner_test(c,sr.radius,xlo,ylo,zhi,xhi,yhi,zlo)) continue;
 				} else {
-					if(edge_z_test(c,xlo,ylo,zlo,xhi,yhi,zhi)) continue;
+					if(edge_z_test(c,sr.radius,xlo,ylo,zlo,xhi,yhi,zhi)) continue;
 				}
 			} else if(dj<cj) {
 				if(dk>ck) {
-					if(corner_test(c,xlo,yhi,zlo,xhi,ylo,zhi)) continue;
+					if(corner_test(c,sr.radius,xlo,yhi,zlo,xhi,ylo,zhi)) continue;
 				} else if(dk<ck) {
-					if(corner_test(c,xlo,yhi,zhi,xhi,ylo,zlo)) continue;
+					if(corner_test(c,sr.radius,xlo,yhi,zhi,xhi,ylo,zlo)) continue;
 				} else {
-					if(edge_z_test(c,xlo,yhi,zlo,xhi,ylo,zhi)) continue;
+					if(edge_z_test(c,sr.radius,xlo,yhi,zlo,xhi,ylo,zhi)) continue;
 				}
 			} else {
 				if(dk>ck) {
-					if(edge_y_test(c,xlo,ylo,zlo,xhi,yhi,zhi)) continue;
+					if(edge_y_test(c,sr.radius,xlo,ylo,zlo,xhi,yhi,zhi)) continue;
 				} else if(dk<ck) {
-					if(edge_y_test(c,xlo,ylo,zhi,xhi,yhi,zlo)) continue;
+					if(edge_y_test(c,sr.radius,xlo,ylo,zhi,xhi,yhi,zlo)) continue;
 				} else {
-					if(face_x_test(c,xlo,ylo,zlo,yhi,zhi)) continue;
+					if(face_x_test(c,sr.radius,xlo,ylo,zlo,yhi,zhi)) continue;
 				}
 			}
 		} else if(di<ci) {
 			if(dj>cj) {
 				if(dk>ck) {
-					if(corner_test(c,xhi,ylo,zlo,xlo,yhi,zhi)) continue;
+					if(corner_test(c,sr.radius,xhi,ylo,zlo,xlo,yhi,zhi)) continue;
 				} else if(dk<ck) {
-					if(corner_test(c,xhi,ylo,zhi,xlo,yhi,zlo)) continue;
+					if(corner_test(c,sr.radius,xhi,ylo,zhi,xlo,yhi,zlo)) continue;
 				} else {
-					if(edge_z_test(c,xhi,ylo,zlo,xlo,yhi,zhi)) continue;
+					if(edge_z_test(c,sr.radius,xhi,ylo,zlo,xlo,yhi,zhi)) continue;
 				}
 			} else if(dj<cj) {
 				if(dk>ck) {
-					if(corner_test(c,xhi,yhi,zlo,xlo,ylo,zhi)) continue;
+					if(corner_test(c,sr.radius,xhi,yhi,zlo,xlo,ylo,zhi)) continue;
 				} else if(dk<ck) {
-					if(corner_test(c,xhi,yhi,zhi,xlo,ylo,zlo)) continue;
+					if(corner_test(c,sr.radius,xhi,yhi,zhi,xlo,ylo,zlo)) continue;
 				} else {
-					if(edge_z_test(c,xhi,yhi,zlo,xlo,ylo,zhi)) continue;
+					if(edge_z_test(c,sr.radius,xhi,yhi,zlo,xlo,ylo,zhi)) continue;
 				}
 			} else {
 				if(dk>ck) {
-					if(edge_y_test(c,xhi,ylo,zlo,xlo,yhi,zhi)) continue;
+					if(edge_y_test(c,sr.radius,xhi,ylo,zlo,xlo,yhi,zhi)) continue;
 				} else if(dk<ck) {
-					if(edge_y_test(c,xhi,ylo,zhi,xlo,yhi,zlo)) continue;
+					if(edge_y_test(c,sr.radius,xhi,ylo,zhi,xlo,yhi,zlo)) continue;
 				} else {
-					if(face_x_test(c,xhi,ylo,zlo,yhi,zhi)) continue;
+					if(face_x_test(c,sr.radius,xhi,ylo,zlo,yhi,zhi)) continue;
 				}
 			}
 		} else {
 			if(dj>cj) {
 				if(dk>ck) {
-					if(edge_x_test(c,xlo,ylo,zlo,xhi,yhi,zhi)) continue;
+					if(edge_x_test(c,sr.radius,xlo,ylo,zlo,xhi,yhi,zhi)) continue;
 				} else if(dk<ck) {
-					if(edge_x_test(c,xlo,ylo,zhi,xhi,yhi,zlo)) continue;
+					if(edge_x_test(c,sr.radius,xlo,ylo,zhi,xhi,yhi,zlo)) continue;
 				} else {
-					if(face_y_test(c,xlo,ylo,zlo,xhi,zhi)) continue;
+					if(face_y_test(c,sr.radius,xlo,ylo,zlo,xhi,zhi)) continue;
 				}
 			} else if(dj<cj) {
 				if(dk>ck) {
-					if(edge_x_test(c,xlo,yhi,zlo,xhi,ylo,zhi)) continue;
+					if(edge_x_test(c,sr.radius,xlo,yhi,zlo,xhi,ylo,zhi)) continue;
 				} else if(dk<ck) {
-					if(edge_x_test(c,xlo,yhi,zhi,xhi,ylo,zlo)) continue;
+					if(edge_x_test(c,sr.radius,xlo,yhi,zhi,xhi,ylo,zlo)) continue;
 				} else {
-					if(face_y_test(c,xlo,yhi,zlo,xhi,zhi)) continue;
+					if(face_y_test(c,sr.radius,xlo,yhi,zlo,xhi,zhi)) continue;
 				}
 			} else {
 				if(dk>ck) {
-					if(face_z_test(c,xlo,ylo,zlo,xhi,yhi)) continue;
+					if(face_z_test(c,sr.radius,xlo,ylo,zlo,xhi,yhi)) continue;
 				} else if(dk<ck) {
-					if(face_z_test(c,xlo,ylo,zhi,xhi,yhi)) continue;
+					if(face_z_test(c,sr.radius,xlo,ylo,zhi,xhi,yhi)) continue;
 				} else voropp_fatal_error("Compute cell routine revisiting central block, which should never\nhappen.",VOROPP_INTERNAL_ERROR);
 			}
 		}
@@ -1546,22 +2586,22 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
 			x1=p[eijk][sz*l]+qx-x;
 			y1=p[eijk][sz*l+1]+qy-y;
 			z1=p[eijk][sz*l+2]+qz-z;
-			rs=radius.scale(x1*x1+y1*y1+z1*z1,eijk,l);
+			rs=sr.radius.scale(x1*x1+y1*y1+z1*z1,eijk,l);
 			if(!c.nplane(x1,y1,z1,rs,id[eijk][l])) return false;
 		}
 
 		// If there's not much memory on the block list then add more
-		if((s_start<=s_end?s_size-s_end+s_start:s_end-s_start)<18) add_list_memory();
+		if((sr.s_start<=sr.s_end?sr.s_size-sr.s_end+sr.s_start:sr.s_end-sr.s_start)<18) sr.add_list_memory();
 
 		// Test the neighbors of the current block, and add them to the
 		// block list if they haven't already been tested
 		dijk=di+hx*(dj+hy*dk);
-		if(di>0) if(mask[dijk-1]!=mv) {if(s_end==s_size) s_end=0;mask[dijk-1]=mv;sl[s_end++]=di-1;sl[s_end++]=dj;sl[s_end++]=dk;}
-		if(dj>0) if(mask[dijk-hx]!=mv) {if(s_end==s_size) s_end=0;mask[dijk-hx]=mv;sl[s_end++]=di;sl[s_end++]=dj-1;sl[s_end++]=dk;}
-		if(dk>0) if(mask[dijk-hxy]!=mv) {if(s_end==s_size) s_end=0;mask[dijk-hxy]=mv;sl[s_end++]=di;sl[s_end++]=dj;sl[s_end++]=dk-1;}
-		if(di<hx-1) if(mask[dijk+1]!=mv) {if(s_end==s_size) s_end=0;mask[dijk+1]=mv;sl[s_end++]=di+1;sl[s_end++]=dj;sl[s_end++]=dk;}
-		if(dj<hy-1) if(mask[dijk+hx]!=mv) {if(s_end==s_size) s_end=0;mask[dijk+hx]=mv;sl[s_end++]=di;sl[s_end++]=dj+1;sl[s_end++]=dk;}
-		if(dk<hz-1) if(mask[dijk+hxy]!=mv) {if(s_end==s_size) s_end=0;mask[dijk+hxy]=mv;sl[s_end++]=di;sl[s_end++]=dj;sl[s_end++]=dk+1;}
+		if(di>0) if(sr.mask[dijk-1]!=sr.mv) {if(sr.s_end==sr.s_size) sr.s_end=0;sr.mask[dijk-1]=sr.mv;sr.sl[sr.s_end++]=di-1;sr.sl[sr.s_end++]=dj;sr.sl[sr.s_end++]=dk;}
+		if(dj>0) if(sr.mask[dijk-hx]!=sr.mv) {if(sr.s_end==sr.s_size) sr.s_end=0;sr.mask[dijk-hx]=sr.mv;sr.sl[sr.s_end++]=di;sr.sl[sr.s_end++]=dj-1;sr.sl[sr.s_end++]=dk;}
+		if(dk>0) if(sr.mask[dijk-hxy]!=sr.mv) {if(sr.s_end==sr.s_size) sr.s_end=0;sr.mask[dijk-hxy]=sr.mv;sr.sl[sr.s_end++]=di;sr.sl[sr.s_end++]=dj;sr.sl[sr.s_end++]=dk-1;}
+		if(di<hx-1) if(sr.mask[dijk+1]!=sr.mv) {if(sr.s_end==sr.s_size) sr.s_end=0;sr.mask[dijk+1]=sr.mv;sr.sl[sr.s_end++]=di+1;sr.sl[sr.s_end++]=dj;sr.sl[sr.s_end++]=dk;}
+		if(dj<hy-1) if(sr.mask[dijk+hx]!=sr.mv) {if(sr.s_end==sr.s_size) sr.s_end=0;sr.mask[dijk+hx]=sr.mv;sr.sl[sr.s_end++]=di;sr.sl[sr.s_end++]=dj+1;sr.sl[sr.s_end++]=dk;}
+		if(dk<hz-1) if(sr.mask[dijk+hxy]!=sr.mv) {if(sr.s_end==sr.s_size) sr.s_end=0;sr.mask[dijk+hxy]=sr.mv;sr.sl[sr.s_end++]=di;sr.sl[sr.s_end++]=dj;sr.sl[sr.s_end++]=dk+1;}
 	}
 
 	return true;
@@ -1571,20 +2611,21 @@ bool container_base<r_option>::compute_cell(voronoicell_base<n_option> &c,int i,
  * any intersection with a Voronoi cell, for the case when the closest point
  * from the cell center to the block is at a corner.
  * \param[in,out] c a reference to a Voronoi cell.
+ * \param[in] rad the radius object of the current cell computation.
  * \param[in] (xl,yl,zl) the relative coordinates of the corner of the block
  *                       closest to the cell center.
  * \param[in] (xh,yh,zh) the relative coordinates of the corner of the block
  *                       furthest away from the cell center.
  * \return False if the block may intersect, true if does not. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-inline bool container_base<r_option>::corner_test(voronoicell_base<n_option> &c,fpoint xl,fpoint yl,fpoint zl,fpoint xh,fpoint yh,fpoint zh) {
-	if(c.plane_intersects_guess(xh,yl,zl,radius.cutoff(xl*xh+yl*yl+zl*zl))) return false;
-	if(c.plane_intersects(xh,yh,zl,radius.cutoff(xl*xh+yl*yh+zl*zl))) return false;
-	if(c.plane_intersects(xl,yh,zl,radius.cutoff(xl*xl+yl*yh+zl*zl))) return false;
-	if(c.plane_intersects(xl,yh,zh,radius.cutoff(xl*xl+yl*yh+zl*zh))) return false;
-	if(c.plane_intersects(xl,yl,zh,radius.cutoff(xl*xl+yl*yl+zl*zh))) return false;
-	if(c.plane_intersects(xh,yl,zh,radius.cutoff(xl*xh+yl*yl+zl*zh))) return false;
+inline bool container_base<r_option,fpoint>::corner_test(voronoicell_base<n_option> &c,r_option &rad,fpoint xl,fpoint yl,fpoint zl,fpoint xh,fpoint yh,fpoint zh) {
+	if(c.plane_intersects_guess(xh,yl,zl,rad.cutoff(xl*xh+yl*yl+zl*zl))) return false;
+	if(c.plane_intersects(xh,yh,zl,rad.cutoff(xl*xh+yl*yh+zl*zl))) return false;
+	if(c.plane_intersects(xl,yh,zl,rad.cutoff(xl*xl+yl*yh+zl*zl))) return false;
+	if(c.plane_intersects(xl,yh,zh,rad.cutoff(xl*xl+yl*yh+zl*zh))) return false;
+	if(c.plane_intersects(xl,yl,zh,rad.cutoff(xl*xl+yl*yl+zl*zh))) return false;
+	if(c.plane_intersects(xh,yl,zh,rad.cutoff(xl*xh+yl*yl+zl*zh))) return false;
 	return true;
 }
 
@@ -1593,6 +2634,7 @@ inline bool container_base<r_option>::corner_test(voronoicell_base<n_option> &c,
  * from the cell center to the block is on an edge which points along the x
  * direction.
  * \param[in,out] c a reference to a Voronoi cell.
+ * \param[in] rad the radius object of the current cell computation.
  * \param[in] (x0,x1) the minimum and maximum relative x coordinates of the
  *                    block.
  * \param[in] (yl,zl) the relative y and z coordinates of the corner of the
@@ -1600,15 +2642,15 @@ inline bool container_base<r_option>::corner_test(voronoicell_base<n_option> &c,
  * \param[in] (yh,zh) the relative y and z coordinates of the corner of the
  *                    block furthest away from the cell center.
  * \return False if the block may intersect, true if does not. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-inline bool container_base<r_option>::edge_x_test(voronoicell_base<n_option> &c,fpoint x0,fpoint yl,fpoint zl,fpoint x1,fpoint yh,fpoint zh) {
-	if(c.plane_intersects_guess(x0,yl,zh,radius.cutoff(yl*yl+zl*zh))) return false;
-	if(c.plane_intersects(x1,yl,zh,radius.cutoff(yl*yl+zl*zh))) return false;
-	if(c.plane_intersects(x1,yl,zl,radius.cutoff(yl*yl+zl*zl))) return false;
-	if(c.plane_intersects(x0,yl,zl,radius.cutoff(yl*yl+zl*zl))) return false;
-	if(c.plane_intersects(x0,yh,zl,radius.cutoff(yl*yh+zl*zl))) return false;
-	if(c.plane_intersects(x1,yh,zl,radius.cutoff(yl*yh+zl*zl))) return false;
+inline bool container_base<r_option,fpoint>::edge_x_test(voronoicell_base<n_option> &c,r_option &rad,fpoint x0,fpoint yl,fpoint zl,fpoint x1,fpoint yh,fpoint zh) {
+	if(c.plane_intersects_guess(x0,yl,zh,rad.cutoff(yl*yl+zl*zh))) return false;
+	if(c.plane_intersects(x1,yl,zh,rad.cutoff(yl*yl+zl*zh))) return false;
+	if(c.plane_intersects(x1,yl,zl,rad.cutoff(yl*yl+zl*zl))) return false;
+	if(c.plane_intersects(x0,yl,zl,rad.cutoff(yl*yl+zl*zl))) return false;
+	if(c.plane_intersects(x0,yh,zl,rad.cutoff(yl*yh+zl*zl))) return false;
+	if(c.plane_intersects(x1,yh,zl,rad.cutoff(yl*yh+zl*zl))) return false;
 	return true;
 }
 
@@ -1617,6 +2659,7 @@ inline bool container_base<r_option>::edge_x_test(voronoicell_base<n_option> &c,
  * from the cell center to the block is on an edge which points along the y
  * direction.
  * \param[in,out] c a reference to a Voronoi cell.
+ * \param[in] rad the radius object of the current cell computation.
  * \param[in] (y0,y1) the minimum and maximum relative y coordinates of the
  *                    block.
  * \param[in] (xl,zl) the relative x and z coordinates of the corner of the
@@ -1624,15 +2667,15 @@ inline bool container_base<r_option>::edge_x_test(voronoicell_base<n_option> &c,
  * \param[in] (xh,zh) the relative x and z coordinates of the corner of the
  *                    block furthest away from the cell center.
  * \return False if the block may intersect, true if does not. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-inline bool container_base<r_option>::edge_y_test(voronoicell_base<n_option> &c,fpoint xl,fpoint y0,fpoint zl,fpoint xh,fpoint y1,fpoint zh) {
-	if(c.plane_intersects_guess(xl,y0,zh,radius.cutoff(xl*xl+zl*zh))) return false;
-	if(c.plane_intersects(xl,y1,zh,radius.cutoff(xl*xl+zl*zh))) return false;
-	if(c.plane_intersects(xl,y1,zl,radius.cutoff(xl*xl+zl*zl))) return false;
-	if(c.plane_intersects(xl,y0,zl,radius.cutoff(xl*xl+zl*zl))) return false;
-	if(c.plane_intersects(xh,y0,zl,radius.cutoff(xl*xh+zl*zl))) return false;
-	if(c.plane_intersects(xh,y1,zl,radius.cutoff(xl*xh+zl*zl))) return false;
+inline bool container_base<r_option,fpoint>::edge_y_test(voronoicell_base<n_option> &c,r_option &rad,fpoint xl,fpoint y0,fpoint zl,fpoint xh,fpoint y1,fpoint zh) {
+	if(c.plane_intersects_guess(xl,y0,zh,rad.cutoff(xl*xl+zl*zh))) return false;
+	if(c.plane_intersects(xl,y1,zh,rad.cutoff(xl*xl+zl*zh))) return false;
+	if(c.plane_intersects(xl,y1,zl,rad.cutoff(xl*xl+zl*zl))) return false;
+	if(c.plane_intersects(xl,y0,zl,rad.cutoff(xl*xl+zl*zl))) return false;
+	if(c.plane_intersects(xh,y0,zl,rad.cutoff(xl*xh+zl*zl))) return false;
+	if(c.plane_intersects(xh,y1,zl,rad.cutoff(xl*xh+zl*zl))) return false;
 	return true;
 }
 
@@ -1641,21 +2684,22 @@ inline bool container_base<r_option>::edge_y_test(voronoicell_base<n_option> &c,
  * from the cell center to the block is on an edge which points along the z
  * direction.
  * \param[in,out] c a reference to a Voronoi cell.
+ * \param[in] rad the radius object of the current cell computation.
  * \param[in] (z0,z1) the minimum and maximum relative z coordinates of the block.
  * \param[in] (xl,yl) the relative x and y coordinates of the corner of the
  *                    block closest to the cell center.
  * \param[in] (xh,yh) the relative x and y coordinates of the corner of the
  *                    block furthest away from the cell center.
  * \return False if the block may intersect, true if does not. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-inline bool container_base<r_option>::edge_z_test(voronoicell_base<n_option> &c,fpoint xl,fpoint yl,fpoint z0,fpoint xh,fpoint yh,fpoint z1) {
-	if(c.plane_intersects_guess(xl,yh,z0,radius.cutoff(xl*xl+yl*yh))) return false;
-	if(c.plane_intersects(xl,yh,z1,radius.cutoff(xl*xl+yl*yh))) return false;
-	if(c.plane_intersects(xl,yl,z1,radius.cutoff(xl*xl+yl*yl))) return false;
-	if(c.plane_intersects(xl,yl,z0,radius.cutoff(xl*xl+yl*yl))) return false;
-	if(c.plane_intersects(xh,yl,z0,radius.cutoff(xl*xh+yl*yl))) return false;
-	if(c.plane_intersects(xh,yl,z1,radius.cutoff(xl*xh+yl*yl))) return false;
+inline bool container_base<r_option,fpoint>::edge_z_test(voronoicell_base<n_option> &c,r_option &rad,fpoint xl,fpoint yl,fpoint z0,fpoint xh,fpoint yh,fpoint z1) {
+	if(c.plane_intersects_guess(xl,yh,z0,rad.cutoff(xl*xl+yl*yh))) return false;
+	if(c.plane_intersects(xl,yh,z1,rad.cutoff(xl*xl+yl*yh))) return false;
+	if(c.plane_intersects(xl,yl,z1,rad.cutoff(xl*xl+yl*yl))) return false;
+	if(c.plane_intersects(xl,yl,z0,rad.cutoff(xl*xl+yl*yl))) return false;
+	if(c.plane_intersects(xh,yl,z0,rad.cutoff(xl*xh+yl*yl))) return false;
+	if(c.plane_intersects(xh,yl,z1,rad.cutoff(xl*xh+yl*yl))) return false;
 	return true;
 }
 
@@ -1663,19 +2707,20 @@ inline bool container_base<r_option>::edge_z_test(voronoicell_base<n_option> &c,
  * any intersection with a Voronoi cell, for the case when the closest point
  * from the cell center to the block is on a face aligned with the x direction.
  * \param[in,out] c a reference to a Voronoi cell.
+ * \param[in] rad the radius object of the current cell computation.
  * \param[in] xl the minimum distance from the cell center to the face.
  * \param[in] (y0,y1) the minimum and maximum relative y coordinates of the
  *                    block.
  * \param[in] (z0,z1) the minimum and maximum relative z coordinates of the
  *                    block.
  * \return False if the block may intersect, true if does not. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-inline bool container_base<r_option>::face_x_test(voronoicell_base<n_option> &c,fpoint xl,fpoint y0,fpoint z0,fpoint y1,fpoint z1) {
-	if(c.plane_intersects_guess(xl,y0,z0,radius.cutoff(xl*xl))) return false;
-	if(c.plane_intersects(xl,y0,z1,radius.cutoff(xl*xl))) return false;
-	if(c.plane_intersects(xl,y1,z1,radius.cutoff(xl*xl))) return false;
-	if(c.plane_intersects(xl,y1,z0,radius.cutoff(xl*xl))) return false;
+inline bool container_base<r_option,fpoint>::face_x_test(voronoicell_base<n_option> &c,r_option &rad,fpoint xl,fpoint y0,fpoint z0,fpoint y1,fpoint z1) {
+	if(c.plane_intersects_guess(xl,y0,z0,rad.cutoff(xl*xl))) return false;
+	if(c.plane_intersects(xl,y0,z1,rad.cutoff(xl*xl))) return false;
+	if(c.plane_intersects(xl,y1,z1,rad.cutoff(xl*xl))) return false;
+	if(c.plane_intersects(xl,y1,z0,rad.cutoff(xl*xl))) return false;
 	return true;
 }
 
@@ -1683,19 +2728,20 @@ inline bool container_base<r_option>::face_x_test(voronoicell_base<n_option> &c,
  * any intersection with a Voronoi cell, for the case when the closest point
  * from the cell center to the block is on a face aligned with the y direction.
  * \param[in,out] c a reference to a Voronoi cell.
+ * \param[in] rad the radius object of the current cell computation.
  * \param[in] yl the minimum distance from the cell center to the face.
  * \param[in] (x0,x1) the minimum and maximum relative x coordinates of the
  *                    block.
  * \param[in] (z0,z1) the minimum and maximum relative z coordinates of the
  *                    block.
  * \return False if the block may intersect, true if does not. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-inline bool container_base<r_option>::face_y_test(voronoicell_base<n_option> &c,fpoint x0,fpoint yl,fpoint z0,fpoint x1,fpoint z1) {
-	if(c.plane_intersects_guess(x0,yl,z0,radius.cutoff(yl*yl))) return false;
-	if(c.plane_intersects(x0,yl,z1,radius.cutoff(yl*yl))) return false;
-	if(c.plane_intersects(x1,yl,z1,radius.cutoff(yl*yl))) return false;
-	if(c.plane_intersects(x1,yl,z0,radius.cutoff(yl*yl))) return false;
+inline bool container_base<r_option,fpoint>::face_y_test(voronoicell_base<n_option> &c,r_option &rad,fpoint x0,fpoint yl,fpoint z0,fpoint x1,fpoint z1) {
+	if(c.plane_intersects_guess(x0,yl,z0,rad.cutoff(yl*yl))) return false;
+	if(c.plane_intersects(x0,yl,z1,rad.cutoff(yl*yl))) return false;
+	if(c.plane_intersects(x1,yl,z1,rad.cutoff(yl*yl))) return false;
+	if(c.plane_intersects(x1,yl,z0,rad.cutoff(yl*yl))) return false;
 	return true;
 }
 
@@ -1703,27 +2749,29 @@ inline bool container_base<r_option>::face_y_test(voronoicell_base<n_option> &c,
  * any intersection with a Voronoi cell, for the case when the closest point
  * from the cell center to the block is on a face aligned with the z direction.
  * \param[in,out] c a reference to a Voronoi cell.
+ * \param[in] rad the radius object of the current cell computation.
  * \param[in] zl the minimum distance from the cell center to the face.
  * \param[in] (x0,x1) the minimum and maximum relative x coordinates of the
  *                    block.
  * \param[in] (y0,y1) the minimum and maximum relative y coordinates of the
  *                    block.
  * \return False if the block may intersect, true if does not. */
-template<class r_option>
+template<class r_option,class fpoint>
 template<class n_option>
-inline bool container_base<r_option>::face_z_test(voronoicell_base<n_option> &c,fpoint x0,fpoint y0,fpoint zl,fpoint x1,fpoint y1) {
-	if(c.plane_intersects_guess(x0,y0,zl,radius.cutoff(zl*zl))) return false;
-	if(c.plane_intersects(x0,y1,zl,radius.cutoff(zl*zl))) return false;
-	if(c.plane_intersects(x1,y1,zl,radius.cutoff(zl*zl))) return false;
-	if(c.plane_intersects(x1,y0,zl,radius.cutoff(zl*zl))) return false;
+inline bool container_base<r_option,fpoint>::face_z_test(voronoicell_base<n_option> &c,r_option &rad,fpoint x0,fpoint y0,fpoint zl,fpoint x1,fpoint y1) {
+	if(c.plane_intersects_guess(x0,y0,zl,rad.cutoff(zl*zl))) return false;
+	if(c.plane_intersects(x0,y1,zl,rad.cutoff(zl*zl))) return false;
+	if(c.plane_intersects(x1,y1,zl,rad.cutoff(zl*zl))) return false;
+	if(c.plane_intersects(x1,y0,zl,rad.cutoff(zl*zl))) return false;
 	return true;
 }
 
 /** Creates a voropp_loop object, by setting the necessary constants about the
  * container geometry from a pointer to the current container class.
  * \param[in] q a pointer to the current container class. */
+template<class fpoint>
 template<class r_option>
-voropp_loop::voropp_loop(container_base<r_option> *q) : sx(q->bx-q->ax), sy(q->by-q->ay), sz(q->bz-q->az),
+voropp_loop_base<fpoint>::voropp_loop_base(container_base<r_option> *q) : sx(q->bx-q->ax), sy(q->by-q->ay), sz(q->bz-q->az),
 	xsp(q->xsp),ysp(q->ysp),zsp(q->zsp),
 	ax(q->ax),ay(q->ay),az(q->az),
 	nx(q->nx),ny(q->ny),nz(q->nz),nxy(q->nxy),nxyz(q->nxyz),
@@ -1737,7 +2785,8 @@ voropp_loop::voropp_loop(container_base<r_option> *q) : sx(q->bx-q->ax), sy(q->b
  * \param[out] (px,py,pz) the periodic displacement vector for the first block
  *                        to be tested.
  * \return The index of the first block to be tested. */
-inline int voropp_loop::init(fpoint vx,fpoint vy,fpoint vz,fpoint r,fpoint &px,fpoint &py,fpoint &pz) {
+template<class fpoint>
+inline int voropp_loop_base<fpoint>::init(fpoint vx,fpoint vy,fpoint vz,fpoint r,fpoint &px,fpoint &py,fpoint &pz) {
 	ai=step_int((vx-ax-r)*xsp);
 	bi=step_int((vx-ax+r)*xsp);
 	if(!xperiodic) {
@@ -1776,7 +2825,8 @@ inline int voropp_loop::init(fpoint vx,fpoint vy,fpoint vz,fpoint r,fpoint &px,f
  * \param[out] (px,py,pz) the periodic displacement vector for the first block
  *                        to be tested.
  * \return The index of the first block to be tested. */
-inline int voropp_loop::init(fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax,fpoint &px,fpoint &py,fpoint &pz) {
+template<class fpoint>
+inline int voropp_loop_base<fpoint>::init(fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpoint zmin,fpoint zmax,fpoint &px,fpoint &py,fpoint &pz) {
 	ai=step_int((xmin-ax)*xsp);
 	bi=step_int((xmax-ax)*xsp);
 	if(!xperiodic) {
@@ -1811,7 +2861,8 @@ inline int voropp_loop::init(fpoint xmin,fpoint xmax,fpoint ymin,fpoint ymax,fpo
  * \param[in,out] (px,py,pz) the current block on entering the function, which
  *                           is updated to the next block on exiting the
  *                           function. */
-inline int voropp_loop::inc(fpoint &px,fpoint &py,fpoint &pz) {
+template<class fpoint>
+inline int voropp_loop_base<fpoint>::inc(fpoint &px,fpoint &py,fpoint &pz) {
 	if(i<bi) {
 		i++;
 		if(ip<nx-1) {ip++;s++;} else {ip=0;s+=1-nx;px+=sx;}
@@ -1830,26 +2881,121 @@ inline int voropp_loop::inc(fpoint &px,fpoint &py,fpoint &pz) {
 /** Custom int function, that gives consistent stepping for negative numbers.
  * With normal int, we have (-1.5,-0.5,0.5,1.5) -> (-1,0,0,1).
  * With this routine, we have (-1.5,-0.5,0.5,1.5) -> (-2,-1,0,1). */
-inline int voropp_loop::step_int(fpoint a) {
+template<class fpoint>
+inline int voropp_loop_base<fpoint>::step_int(fpoint a) {
 	return a<0?int(a)-1:int(a);
 }
 
 /** Custom modulo function, that gives consistent stepping for negative
  * numbers. */
-inline int voropp_loop::step_mod(int a,int b) {
+template<class fpoint>
+inline int voropp_loop_base<fpoint>::step_mod(int a,int b) {
 	return a>=0?a%b:b-1-(b-1-a)%b;
 }
 
 /** Custom integer division function, that gives consistent stepping for
  * negative numbers. */
-inline int voropp_loop::step_div(int a,int b) {
+template<class fpoint>
+inline int voropp_loop_base<fpoint>::step_div(int a,int b) {
 	return a>=0?a/b:-1+(a+1)/b;
 }
 
+/** Chooses the grid of blocks for a container that will hold a given number
+ * of particles, so that each block holds about optimal_particles particles on
+ * average. The blocks are kept close to cubic, so the number of blocks in each
+ * direction follows the aspect ratio of the container. The initial memory of
+ * each block is set to twice the average occupancy, so that only the crowded
+ * blocks need to grow.
+ * \param[in] (xa,xb) the minimum and maximum x coordinates.
+ * \param[in] (ya,yb) the minimum and maximum y coordinates.
+ * \param[in] (za,zb) the minimum and maximum z coordinates.
+ * \param[in] n the number of particles that will be put in the container.
+ * \param[out] (nx,ny,nz) the number of grid blocks in each direction.
+ * \param[out] memi the initial memory allocation for each block. */
+inline void voropp_optimal_grid(fpoint xa,fpoint xb,fpoint ya,fpoint yb,fpoint za,fpoint zb,int n,int &nx,int &ny,int &nz,int &memi) {
+	fpoint dx=xb-xa,dy=yb-ya,dz=zb-za;
+	fpoint ilscale=pow(n/(optimal_particles*dx*dy*dz),1/3.0);
+	nx=int(dx*ilscale+1);
+	ny=int(dy*ilscale+1);
+	nz=int(dz*ilscale+1);
+	memi=int(2*n/(fpoint(nx)*ny*nz))+1;
+	if(memi<4) memi=4;
+}
+
+/** Returns the wall clock time in seconds, measured from an arbitrary point.
+ * This is used to time the cell computation when calibrating the grid. */
+inline double voropp_wall_time() {
+#ifdef _OPENMP
+	return omp_get_wtime();
+#else
+	return double(clock())/CLOCKS_PER_SEC;
+#endif
+}
+
+/** Creates a block queue, splitting the blocks evenly between the workers.
+ * \param[in] inb the total number of blocks.
+ * \param[in] it the number of workers. */
+inline voropp_block_queue::voropp_block_queue(int inb,int it)
+	: nt(it), lo(new int[it]), hi(new int[it]) {
+	for(int t=0;t<nt;t++) {
+		lo[t]=int((long long)inb*t/nt);
+		hi[t]=int((long long)inb*(t+1)/nt);
+	}
+#ifdef _OPENMP
+	lk=new omp_lock_t[nt];
+	for(int t=0;t<nt;t++) omp_init_lock(lk+t);
+#endif
+}
+
+/** The block queue destructor frees the dynamically allocated memory. */
+inline voropp_block_queue::~voropp_block_queue() {
+#ifdef _OPENMP
+	for(int t=0;t<nt;t++) omp_destroy_lock(lk+t);
+	delete [] lk;
+#endif
+	delete [] hi;
+	delete [] lo;
+}
+
+/** Hands out the next block to a worker. If the worker's own range is
+ * empty, the upper half of the largest remaining range is moved over to it.
+ * \param[in] t the number of the worker asking for a block.
+ * \return The index of the block, or -1 if all blocks have been handed out. */
+inline int voropp_block_queue::next(int t) {
+	int s;
+#ifdef _OPENMP
+	int u,v,w;
+	omp_set_lock(lk+t);
+	s=lo[t]<hi[t]?lo[t]++:-1;
+	omp_unset_lock(lk+t);
+	while(s==-1) {
+
+		// Find the worker with the most blocks left. The ranges are
+		// read without locking, so this is only a guess that is
+		// checked again below.
+		for(v=-1,w=0,u=0;u<nt;u++) if(hi[u]-lo[u]>w) {v=u;w=hi[u]-lo[u];}
+		if(v==-1) return -1;
+		omp_set_lock(lk+v);
+		if((w=hi[v]-lo[v])>0) {
+			u=hi[v];hi[v]-=(w+1)/2;s=hi[v];
+		}
+		omp_unset_lock(lk+v);
+		if(s!=-1) {
+			omp_set_lock(lk+t);
+			lo[t]=s+1;hi[t]=u;
+			omp_unset_lock(lk+t);
+		}
+	}
+#else
+	s=lo[t]<hi[t]?lo[t]++:-1;
+#endif
+	return s;
+}
+
 /** Adds a wall to the container.
  * \param[in] w a wall object to be added.*/
-template<class r_option>
-void container_base<r_option>::add_wall(wall& w) {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::add_wall(wall& w) {
 	if(wall_number==current_wall_size) {
 		current_wall_size*=2;
 		if(current_wall_size>max_wall_size)
@@ -1867,20 +3013,23 @@ void container_base<r_option>::add_wall(wall& w) {
  * \param[in] i the region of the particle to consider.
  * \param[in] j the number of the particle within the region.
  * \param[in] r the radius to set. */
-inline void radius_poly::store_radius(int i,int j,fpoint r) {
+template<class fpoint>
+inline void radius_poly_base<fpoint>::store_radius(int i,int j,fpoint r) {
 	cc->p[i][4*j+3]=r;
 	if(r>max_radius) max_radius=r;
 }
 
 /** Clears the stored maximum radius. */
-inline void radius_poly::clear_max() {
+template<class fpoint>
+inline void radius_poly_base<fpoint>::clear_max() {
 	max_radius=0;
 }
 
 /** Imports a list of particles from an input stream for the monodisperse case
  * where no radius information is expected.
  * \param[in] is an input stream to read from. */
-inline void radius_mono::import(istream &is) {
+template<class fpoint>
+inline void radius_mono_base<fpoint>::import(istream &is) {
 	int n;fpoint x,y,z;
 	is >> n >> x >> y >> z;
 	while(!is.eof()) {
@@ -1892,7 +3041,8 @@ inline void radius_mono::import(istream &is) {
 /** Imports a list of particles from an input stream for the polydisperse case,
  * where both positions and particle radii are both stored.
  * \param[in] is an input stream to read from. */
-inline void radius_poly::import(istream &is) {
+template<class fpoint>
+inline void radius_poly_base<fpoint>::import(istream &is) {
 	int n;fpoint x,y,z,r;
 	is >> n >> x >> y >> z >> r;
 	while(!is.eof()) {
@@ -1903,12 +3053,16 @@ inline void radius_poly::import(istream &is) {
 
 /** Initializes the radius_poly class for a new Voronoi cell calculation, by
  * computing the radial cut-off value, based on the current particle's radius
- * and the maximum radius of any particle in the packing.
+ * and the maximum radius of any particle in the packing. The maximum radius is
+ * always read from the container's own radius object, since this may be a copy
+ * that belongs to a voropp_search.
  * \param[in] ijk the region to consider.
  * \param[in] s the number of the particle within the region. */
-inline void radius_poly::init(int ijk,int s) {
+template<class fpoint>
+inline void radius_poly_base<fpoint>::init(int ijk,int s) {
+	fpoint mr=cc->radius.max_radius;
 	crad=cc->p[ijk][4*s+3];
-	mul=1+(crad*crad-max_radius*max_radius)/((max_radius+crad)*(max_radius+crad));
+	mul=1+(crad*crad-mr*mr)/((mr+crad)*(mr+crad));
 	crad*=crad;
 }
 
@@ -1918,7 +3072,8 @@ inline void radius_poly::init(int ijk,int s) {
  * precomputed in the init() routine.
  * \param[in] lrs a cutoff radius for the cell computation.
  * \return The value scaled by the factor mul. */
-inline fpoint radius_poly::cutoff(fpoint lrs) {
+template<class fpoint>
+inline fpoint radius_poly_base<fpoint>::cutoff(fpoint lrs) {
 	return mul*lrs;
 }
 
@@ -1927,7 +3082,8 @@ inline fpoint radius_poly::cutoff(fpoint lrs) {
  * value that is passed to it.
  * \param[in] lrs a cutoff radius for the cell computation.
  * \return The same value passed to it. */
-inline fpoint radius_mono::cutoff(fpoint lrs) {
+template<class fpoint>
+inline fpoint radius_mono_base<fpoint>::cutoff(fpoint lrs) {
 	return lrs;
 }
 
@@ -1935,7 +3091,8 @@ inline fpoint radius_mono::cutoff(fpoint lrs) {
  * \param[in] os the output stream to write to.
  * \param[in] l the region to consider.
  * \param[in] c the number of the particle within the region. */
-inline void radius_mono::rad(ostream &os,int l,int c) {
+template<class fpoint>
+inline void radius_mono_base<fpoint>::rad(ostream &os,int l,int c) {
 	os << "s";
 }
 
@@ -1943,7 +3100,8 @@ inline void radius_mono::rad(ostream &os,int l,int c) {
  * \param[in] os the output stream to write to.
  * \param[in] l the region to consider.
  * \param[in] c the number of the particle within the region. */
-inline void radius_poly::rad(ostream &os,int l,int c) {
+template<class fpoint>
+inline void radius_poly_base<fpoint>::rad(ostream &os,int l,int c) {
 	os << cc->p[l][4*c+3];
 }
 
@@ -1953,7 +3111,8 @@ inline void radius_poly::rad(ostream &os,int l,int c) {
  * \param[in] s the number of the particle within the region.
  * \return The cube of the radius of the particle, which is 0.125 in this case.
  */
-inline fpoint radius_mono::volume(int ijk,int s) {
+template<class fpoint>
+inline fpoint radius_mono_base<fpoint>::volume(int ijk,int s) {
 	return 0.125;
 }
 
@@ -1961,7 +3120,8 @@ inline fpoint radius_mono::volume(int ijk,int s) {
  * \param[in] ijk the region to consider.
  * \param[in] s the number of the particle within the region.
  * \return The cube of the radius of the particle. */
-inline fpoint radius_poly::volume(int ijk,int s) {
+template<class fpoint>
+inline fpoint radius_poly_base<fpoint>::volume(int ijk,int s) {
 	fpoint a=cc->p[ijk][4*s+3];
 	return a*a*a;
 }
@@ -1972,7 +3132,8 @@ inline fpoint radius_poly::volume(int ijk,int s) {
  * \param[in] t the region to consider
  * \param[in] q the number of the particle within the region.
  * \return The scaled position. */
-inline fpoint radius_poly::scale(fpoint rs,int t,int q) {
+template<class fpoint>
+inline fpoint radius_poly_base<fpoint>::scale(fpoint rs,int t,int q) {
 	return rs+crad-cc->p[t][4*q+3]*cc->p[t][4*q+3];
 }
 
@@ -1981,7 +3142,8 @@ inline fpoint radius_poly::scale(fpoint rs,int t,int q) {
  * \param[in] t the region to consider
  * \param[in] q the number of the particle within the region.
  * \return The scaled position, which for this case, is equal to rs. */
-inline fpoint radius_mono::scale(fpoint rs,int t,int q) {
+template<class fpoint>
+inline fpoint radius_mono_base<fpoint>::scale(fpoint rs,int t,int q) {
 	return rs;
 }
 
@@ -1991,7 +3153,8 @@ inline fpoint radius_mono::scale(fpoint rs,int t,int q) {
  * \param[in] q the number of the particle within the region.
  * \param[in] later A boolean value to determine whether or not to write a
  *                  space character before the first entry. */
-inline void radius_poly::print(ostream &os,int ijk,int q,bool later) {
+template<class fpoint>
+inline void radius_poly_base<fpoint>::print(ostream &os,int ijk,int q,bool later) {
 	if(later) os << " ";
 	os << cc->p[ijk][4*q+3];
 }
@@ -2004,8 +3167,8 @@ inline void radius_poly::print(ostream &os,int ijk,int q,bool later) {
  * of \f$r_n\f$ is calculated first, as the minimum distance to any block in
  * the shell surrounding the worklist. The \f$r_i\f$ are then computed in
  * reverse order by considering the distance to \f$w_{i+1}\f$. */
-template<class r_option>
-void container_base<r_option>::initialize_radii() {
+template<class r_option,class fpoint>
+void container_base<r_option,fpoint>::initialize_radii() {
 	const unsigned int b1=1<<21,b2=1<<22,b3=1<<24,b4=1<<25,b5=1<<27,b6=1<<28;
 	const fpoint xstep=(bx-ax)/nx/fgrid;
 	const fpoint ystep=(by-ay)/ny/fgrid;
@@ -2017,7 +3180,7 @@ void container_base<r_option>::initialize_radii() {
 	for(zlo=0,zhi=zstep,lz=0;lz<hgrid;zlo=zhi,zhi+=zstep,lz++) {
 		for(ylo=0,yhi=ystep,ly=0;ly<hgrid;ylo=yhi,yhi+=ystep,ly++) {
 			for(xlo=0,xhi=xstep,lx=0;lx<hgrid;xlo=xhi,xhi+=xstep,l++,lx++) {
-				minr=large_number;
+				minr=voropp_precision<fpoint>::large_number();
 				for(q=e[0]+1;q<seq_length;q++) {
 					f=e[q];
 					i=(f&127)-64;
@@ -2064,8 +3227,8 @@ void container_base<r_option>::initialize_radii() {
  * \param[out] (xhi,yhi,zhi) the upper coordinates of the subregion being
  *                           considered.
  * \param[in] (ti,tj,tk) the coordinates of the block. */
-template<class r_option>
-inline void container_base<r_option>::compute_minimum(fpoint &minr,fpoint &xlo,fpoint &xhi,fpoint &ylo,fpoint &yhi,fpoint &zlo,fpoint &zhi,int ti,int tj,int tk) {
+template<class r_option,class fpoint>
+inline void container_base<r_option,fpoint>::compute_minimum(fpoint &minr,fpoint &xlo,fpoint &xhi,fpoint &ylo,fpoint &yhi,fpoint &zlo,fpoint &zhi,int ti,int tj,int tk) {
 	const fpoint boxx=(bx-ax)/nx,boxy=(by-ay)/ny,boxz=(bz-az)/nz;
 	fpoint radsq,temp;
 	if(ti>0) {temp=boxx*ti-xhi;radsq=temp*temp;}
@@ -2085,6 +3248,7 @@ inline void container_base<r_option>::compute_minimum(fpoint &minr,fpoint &xlo,f
  * of a nearby region. If the point is within the distance of the region, then
  * the routine returns true, and computes the maximum distance from the point
  * to the region. Otherwise, the routine returns false.
+ * \param[in] rad the radius object of the current cell computation.
  * \param[in] (di,dj,dk) the position of the nearby region to be tested,
  *                       relative to the region that the point is in.
  * \param[in] (fx,fy,fz) the displacement of the point within its region.
@@ -2095,8 +3259,8 @@ inline void container_base<r_option>::compute_minimum(fpoint &minr,fpoint &xlo,f
  * \param[in] mrs the distance to be tested.
  * \return False if the region is further away than mrs, true if the region in
  *         within mrs.*/
-template<class r_option>
-inline bool container_base<r_option>::compute_min_max_radius(int di,int dj,int dk,fpoint fx,fpoint fy,fpoint fz,fpoint gxs,fpoint gys,fpoint gzs,fpoint &crs,fpoint mrs) {
+template<class r_option,class fpoint>
+inline bool container_base<r_option,fpoint>::compute_min_max_radius(r_option &rad,int di,int dj,int dk,fpoint fx,fpoint fy,fpoint fz,fpoint gxs,fpoint gys,fpoint gzs,fpoint &crs,fpoint mrs) {
 	fpoint xlo,ylo,zlo;
 	const fpoint boxx=(bx-ax)/nx,boxy=(by-ay)/ny,boxz=(bz-az)/nz;
 	const fpoint bxsq=boxx*boxx+boxy*boxy+boxz*boxz;
@@ -2108,14 +3272,14 @@ inline bool container_base<r_option>::compute_min_max_radius(int di,int dj,int d
 			crs+=ylo*ylo;
 			if(dk>0) {
 				zlo=dk*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=bxsq+2*(boxx*xlo+boxy*ylo+boxz*zlo);
 			} else if(dk<0) {
 				zlo=(dk+1)*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=bxsq+2*(boxx*xlo+boxy*ylo-boxz*zlo);
 			} else {
-				if(radius.cutoff(crs)>mrs) return true;
+				if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxx*(2*xlo+boxx)+boxy*(2*ylo+boxy)+gzs;
 			}
 		} else if(dj<0) {
@@ -2123,27 +3287,27 @@ inline bool container_base<r_option>::compute_min_max_radius(int di,int dj,int d
 			crs+=ylo*ylo;
 			if(dk>0) {
 				zlo=dk*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=bxsq+2*(boxx*xlo-boxy*ylo+boxz*zlo);
 			} else if(dk<0) {
 				zlo=(dk+1)*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=bxsq+2*(boxx*xlo-boxy*ylo-boxz*zlo);
 			} else {
-				if(radius.cutoff(crs)>mrs) return true;
+				if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxx*(2*xlo+boxx)+boxy*(-2*ylo+boxy)+gzs;
 			}
 		} else {
 			if(dk>0) {
 				zlo=dk*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxz*(2*zlo+boxz);
 			} else if(dk<0) {
 				zlo=(dk+1)*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxz*(-2*zlo+boxz);
 			} else {
-				if(radius.cutoff(crs)>mrs) return true;
+				if(rad.cutoff(crs)>mrs) return true;
 				crs+=gzs;
 			}
 			crs+=gys+boxx*(2*xlo+boxx);
@@ -2156,14 +3320,14 @@ inline bool container_base<r_option>::compute_min_max_radius(int di,int dj,int d
 			crs+=ylo*ylo;
 			if(dk>0) {
 				zlo=dk*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=bxsq+2*(-boxx*xlo+boxy*ylo+boxz*zlo);
 			} else if(dk<0) {
 				zlo=(dk+1)*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=bxsq+2*(-boxx*xlo+boxy*ylo-boxz*zlo);
 			} else {
-				if(radius.cutoff(crs)>mrs) return true;
+				if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxx*(-2*xlo+boxx)+boxy*(2*ylo+boxy)+gzs;
 			}
 		} else if(dj<0) {
@@ -2171,27 +3335,27 @@ inline bool container_base<r_option>::compute_min_max_radius(int di,int dj,int d
 			crs+=ylo*ylo;
 			if(dk>0) {
 				zlo=dk*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=bxsq+2*(-boxx*xlo-boxy*ylo+boxz*zlo);
 			} else if(dk<0) {
 				zlo=(dk+1)*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=bxsq+2*(-boxx*xlo-boxy*ylo-boxz*zlo);
 			} else {
-				if(radius.cutoff(crs)>mrs) return true;
+				if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxx*(-2*xlo+boxx)+boxy*(-2*ylo+boxy)+gzs;
 			}
 		} else {
 			if(dk>0) {
 				zlo=dk*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxz*(2*zlo+boxz);
 			} else if(dk<0) {
 				zlo=(dk+1)*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxz*(-2*zlo+boxz);
 			} else {
-				if(radius.cutoff(crs)>mrs) return true;
+				if(rad.cutoff(crs)>mrs) return true;
 				crs+=gzs;
 			}
 			crs+=gys+boxx*(-2*xlo+boxx);
@@ -2202,14 +3366,14 @@ inline bool container_base<r_option>::compute_min_max_radius(int di,int dj,int d
 			crs=ylo*ylo;
 			if(dk>0) {
 				zlo=dk*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxz*(2*zlo+boxz);
 			} else if(dk<0) {
 				zlo=(dk+1)*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxz*(-2*zlo+boxz);
 			} else {
-				if(radius.cutoff(crs)>mrs) return true;
+				if(rad.cutoff(crs)>mrs) return true;
 				crs+=gzs;
 			}
 			crs+=boxy*(2*ylo+boxy);
@@ -2218,23 +3382,23 @@ inline bool container_base<r_option>::compute_min_max_radius(int di,int dj,int d
 			crs=ylo*ylo;
 			if(dk>0) {
 				zlo=dk*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxz*(2*zlo+boxz);
 			} else if(dk<0) {
 				zlo=(dk+1)*boxz-fz;
-				crs+=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				crs+=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxz*(-2*zlo+boxz);
 			} else {
-				if(radius.cutoff(crs)>mrs) return true;
+				if(rad.cutoff(crs)>mrs) return true;
 				crs+=gzs;
 			}
 			crs+=boxy*(-2*ylo+boxy);
 		} else {
 			if(dk>0) {
-				zlo=dk*boxz-fz;crs=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				zlo=dk*boxz-fz;crs=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxz*(2*zlo+boxz);
 			} else if(dk<0) {
-				zlo=(dk+1)*boxz-fz;crs=zlo*zlo;if(radius.cutoff(crs)>mrs) return true;
+				zlo=(dk+1)*boxz-fz;crs=zlo*zlo;if(rad.cutoff(crs)>mrs) return true;
 				crs+=boxz*(-2*zlo+boxz);
 			} else {
 				crs=0;
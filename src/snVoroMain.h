@@ -282,5 +282,6 @@
 #include "snVoroCell.h"
 #include "snVoroContainer.h"
 #include "snVoroWall.h"
+#include "snVoroClip.h"
 
 #endif
@@ -8,6 +8,7 @@
  * \brief Function implementations for the derived wall classes. */
 
 #include "snVoroWall.h"
+#include <algorithm>
 
 /** Tests to see whether a point is inside the sphere wall object.
  * \param[in,out] (x,y,z) the vector to test.
@@ -24,7 +25,7 @@ bool wall_sphere::point_inside(fpoint x,fpoint y,fpoint z) {
  * \param[in] (x,y,z) the location of the Voronoi cell.
  * \return True if the cell still exists, false if the cell is deleted. */
 template<class n_option>
-inline bool wall_sphere::cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z) {
+bool wall_sphere::cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z) {
 	fpoint xd=x-xc,yd=y-yc,zd=z-zc,dq;
 	dq=xd*xd+yd*yd+zd*zd;
 	if (dq>1e-5) {
@@ -46,7 +47,7 @@ bool wall_plane::point_inside(fpoint x,fpoint y,fpoint z) {
  * \param[in] (x,y,z) the location of the Voronoi cell.
  * \return True if the cell still exists, false if the cell is deleted. */
 template<class n_option>
-inline bool wall_plane::cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z) {
+bool wall_plane::cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z) {
 	fpoint dq=2*(ac-x*xc-y*yc-z*zc);
 	return c.nplane(xc,yc,zc,dq,w_id);
 }
@@ -70,7 +71,7 @@ bool wall_cylinder::point_inside(fpoint x,fpoint y,fpoint z) {
  * \param[in] (x,y,z) the location of the Voronoi cell.
  * \return True if the cell still exists, false if the cell is deleted. */
 template<class n_option>
-inline bool wall_cylinder::cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z) {
+bool wall_cylinder::cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z) {
 	fpoint xd=x-xc,yd=y-yc,zd=z-zc;
 	fpoint pa=(xd*xa+yd*ya+zd*za)*asi;
 	xd-=xa*pa;yd-=ya*pa;zd-=za*pa;
@@ -104,7 +105,7 @@ bool wall_cone::point_inside(fpoint x,fpoint y,fpoint z) {
  * \param[in] (x,y,z) the location of the Voronoi cell.
  * \return True if the cell still exists, false if the cell is deleted. */
 template<class n_option>
-inline bool wall_cone::cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z) {
+bool wall_cone::cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z) {
 	fpoint xd=x-xc,yd=y-yc,zd=z-zc;
 	fpoint xf,yf,zf,imoda;
 	fpoint pa=(xd*xa+yd*ya+zd*za)*asi;
@@ -122,38 +123,290 @@ inline bool wall_cone::cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoi
 	return true;
 }
 
-/*
-bool wall_trianglemesh::point_inside(fpoint x,fpoint y,fpoint z)
-{
-   // we are inside a mesh if we are behind all triangles!
-   snCore::snVector3f pos(x,y,z);
-   for(size_t i=0;i<mpMesh->GetNbPolygons();i++)
-   {
-      if(mpMesh->GetPolygon(i)->GetPlanePtr()->IsAbove(pos))
-         return false;
-   }
-   return true;
+/** \brief A comparison for sorting triangles by one coordinate of their
+ * centroids. */
+struct bvh_compare {
+	/** The triangle centroids, as consecutive (x,y,z) triples. */
+	const fpoint *ce;
+	/** The coordinate to compare. */
+	const int a;
+	bvh_compare(const fpoint *ice,int ia) : ce(ice), a(ia) {};
+	inline bool operator()(int i,int j) const {return ce[3*i+a]<ce[3*j+a];}
+};
+
+/** The directions of the rays that the triangle mesh wall casts to find out
+ * whether a point is inside. They are deliberately skewed against the axes, so
+ * that they are unlikely to run along the edges of a modeled mesh. When a ray
+ * passes too close to an edge to count its crossings reliably, the next one is
+ * tried. */
+static const fpoint bvh_rays[9]={
+	0.8017837257,0.5345224838,0.2672612419,
+	-0.3015113446,0.9045340337,-0.3015113446,
+	0.2357022604,-0.2357022604,0.9428090416
+};
+
+/** Computes the point on a triangle that is closest to a given point.
+ * \param[in] t the corners of the triangle, as nine consecutive coordinates.
+ * \param[in] (x,y,z) the point.
+ * \param[out] (cx,cy,cz) the closest point on the triangle.
+ * \return The squared distance between the two points. */
+static inline fpoint triangle_closest(const fpoint *t,fpoint x,fpoint y,fpoint z,fpoint &cx,fpoint &cy,fpoint &cz) {
+	fpoint abx=t[3]-t[0],aby=t[4]-t[1],abz=t[5]-t[2];
+	fpoint acx=t[6]-t[0],acy=t[7]-t[1],acz=t[8]-t[2];
+	fpoint px=x-t[0],py=y-t[1],pz=z-t[2],v,w;
+	fpoint d1=abx*px+aby*py+abz*pz,d2=acx*px+acy*py+acz*pz;
+	if(d1<=0&&d2<=0) {v=0;w=0;}
+	else {
+		px=x-t[3];py=y-t[4];pz=z-t[5];
+		fpoint d3=abx*px+aby*py+abz*pz,d4=acx*px+acy*py+acz*pz;
+		if(d3>=0&&d4<=d3) {v=1;w=0;}
+		else {
+			fpoint vc=d1*d4-d3*d2;
+			if(vc<=0&&d1>=0&&d3<=0) {v=d1/(d1-d3);w=0;}
+			else {
+				px=x-t[6];py=y-t[7];pz=z-t[8];
+				fpoint d5=abx*px+aby*py+abz*pz,d6=acx*px+acy*py+acz*pz;
+				fpoint vb=d5*d2-d1*d6,va=d3*d6-d5*d4;
+				if(d6>=0&&d5<=d6) {v=0;w=1;}
+				else if(vb<=0&&d2>=0&&d6<=0) {v=0;w=d2/(d2-d6);}
+				else if(va<=0&&d4-d3>=0&&d5-d6>=0) {w=(d4-d3)/((d4-d3)+(d5-d6));v=1-w;}
+				else if(va+vb+vc>0) {
+					fpoint de=1/(va+vb+vc);
+					v=vb*de;w=vc*de;
+				} else {v=0;w=0;}
+			}
+		}
+	}
+	cx=t[0]+abx*v+acx*w;cy=t[1]+aby*v+acy*w;cz=t[2]+abz*v+acz*w;
+	return (cx-x)*(cx-x)+(cy-y)*(cy-y)+(cz-z)*(cz-z);
+}
+
+/** Constructs a triangle mesh wall object. The faces of the mesh are split
+ * into triangle fans, and the triangles are sorted into a bounding volume
+ * hierarchy, which is kept together with its own copy of the triangles.
+ * \param[in] m the mesh, which should be closed.
+ * \param[in] iw_id an ID number to associate with the wall for neighbor
+ * tracking. */
+wall_trianglemesh::wall_trianglemesh(const clip_mesh &m,int iw_id) : w_id(iw_id) {
+	vector<fpoint> tq,ce;
+	vector<int> ti;
+	int f,k,n,nt;
+	for(f=0;f<m.faces();f++) {
+		const int *v=m.face(f);n=m.face_size(f);
+		for(k=1;k<n-1;k++) {
+			const fpoint *a=&m.pts[3*v[0]],*b=&m.pts[3*v[k]],*c=&m.pts[3*v[k+1]];
+			tq.insert(tq.end(),a,a+3);tq.insert(tq.end(),b,b+3);tq.insert(tq.end(),c,c+3);
+			ce.push_back((a[0]+b[0]+c[0])*(1/3.0));
+			ce.push_back((a[1]+b[1]+c[1])*(1/3.0));
+			ce.push_back((a[2]+b[2]+c[2])*(1/3.0));
+		}
+	}
+	nt=int(tq.size()/9);
+	if(nt==0) return;
+	ti.resize(nt);
+	for(k=0;k<nt;k++) ti[k]=k;
+	nd.reserve(2*(nt/bvh_leaf_size)+1);tp.reserve(9*nt);
+	nd.resize(1);
+	build(0,ti,ce,0,nt,tq);
+#if VOROPP_VERBOSE >=2
+	cerr << "Triangle mesh wall with " << nt << " triangles in " << nd.size() << " nodes" << endl;
+#endif
+}
+
+/** Fills in a node of the bounding volume hierarchy, and recursively creates
+ * the nodes below it. Nodes with few triangles become leaves, while the others
+ * are split at the median of the triangle centroids along the longest axis of
+ * their bounds.
+ * \param[in] k the index of the node.
+ * \param[in,out] ti the triangle indices, which get reordered.
+ * \param[in] ce the triangle centroids.
+ * \param[in] (s,e) the range of triangle indices belonging to the node.
+ * \param[in] tq the corners of the triangles, in their original order. */
+void wall_trianglemesh::build(int k,vector<int> &ti,const vector<fpoint> &ce,int s,int e,const vector<fpoint> &tq) {
+	const fpoint big=voropp_precision<fpoint>::large_number();
+	fpoint xa=big,xb=-big,ya=big,yb=-big,za=big,zb=-big;
+	fpoint cxa=big,cxb=-big,cya=big,cyb=-big,cza=big,czb=-big;
+	int i,j,a;
+	for(i=s;i<e;i++) {
+		const fpoint *t=&tq[9*ti[i]],*c=&ce[3*ti[i]];
+		for(j=0;j<9;j+=3) {
+			if(t[j]<xa) xa=t[j];
+			if(t[j]>xb) xb=t[j];
+			if(t[j+1]<ya) ya=t[j+1];
+			if(t[j+1]>yb) yb=t[j+1];
+			if(t[j+2]<za) za=t[j+2];
+			if(t[j+2]>zb) zb=t[j+2];
+		}
+		if(c[0]<cxa) cxa=c[0];
+		if(c[0]>cxb) cxb=c[0];
+		if(c[1]<cya) cya=c[1];
+		if(c[1]>cyb) cyb=c[1];
+		if(c[2]<cza) cza=c[2];
+		if(c[2]>czb) czb=c[2];
+	}
+	nd[k].xa=xa;nd[k].xb=xb;nd[k].ya=ya;nd[k].yb=yb;nd[k].za=za;nd[k].zb=zb;
+	cxb-=cxa;cyb-=cya;czb-=cza;
+	if(e-s<=bvh_leaf_size||(cxb<=0&&cyb<=0&&czb<=0)) {
+		nd[k].i=int(tp.size()/9);nd[k].n=e-s;
+		for(i=s;i<e;i++) tp.insert(tp.end(),tq.begin()+9*ti[i],tq.begin()+9*ti[i]+9);
+		return;
+	}
+	a=cxb>=cyb?(cxb>=czb?0:2):(cyb>=czb?1:2);
+	i=(s+e)>>1;
+	nth_element(ti.begin()+s,ti.begin()+i,ti.begin()+e,bvh_compare(&ce[0],a));
+	j=int(nd.size());
+	nd.resize(j+2);
+	nd[k].i=j;nd[k].n=0;
+	build(j,ti,ce,s,i,tq);
+	build(j+1,ti,ce,i,e,tq);
+}
+
+/** Counts how often a ray from a point crosses the triangle mesh, using the
+ * hierarchy to visit only the triangles whose bounding boxes the ray passes
+ * through.
+ * \param[in] (x,y,z) the start of the ray.
+ * \param[in] d the direction of the ray.
+ * \return The parity of the number of crossings, or if the ray passes too
+ * close to the edge of a triangle to be sure about it, minus one minus the
+ * parity. */
+int wall_trianglemesh::ray_parity(fpoint x,fpoint y,fpoint z,const fpoint *d) {
+	const fpoint e=1e-9;
+	fpoint ix=1/d[0],iy=1/d[1],iz=1/d[2];
+	fpoint ta,tb,ua,ub,ex,ey,ez,fx,fy,fz,px,py,pz,qx,qy,qz,de,u,v;
+	int st[bvh_stack_size],sp=0,c=0,i;
+	bool amb=false;
+	st[sp++]=0;
+	while(sp>0) {
+		const bvh_node &b=nd[st[--sp]];
+		ta=(b.xa-x)*ix;tb=(b.xb-x)*ix;if(ta>tb) {u=ta;ta=tb;tb=u;}
+		ua=(b.ya-y)*iy;ub=(b.yb-y)*iy;if(ua>ub) {u=ua;ua=ub;ub=u;}
+		if(ua>ta) ta=ua;
+		if(ub<tb) tb=ub;
+		ua=(b.za-z)*iz;ub=(b.zb-z)*iz;if(ua>ub) {u=ua;ua=ub;ub=u;}
+		if(ua>ta) ta=ua;
+		if(ub<tb) tb=ub;
+		if(tb<0||ta>tb) continue;
+		if(b.n==0) {st[sp++]=b.i;st[sp++]=b.i+1;continue;}
+		for(i=b.i;i<b.i+b.n;i++) {
+			const fpoint *t=&tp[9*i];
+			ex=t[3]-t[0];ey=t[4]-t[1];ez=t[5]-t[2];
+			fx=t[6]-t[0];fy=t[7]-t[1];fz=t[8]-t[2];
+			px=d[1]*fz-d[2]*fy;py=d[2]*fx-d[0]*fz;pz=d[0]*fy-d[1]*fx;
+			de=ex*px+ey*py+ez*pz;
+			if(de==0) continue;
+			de=1/de;
+			qx=x-t[0];qy=y-t[1];qz=z-t[2];
+			u=(qx*px+qy*py+qz*pz)*de;
+			if(u<-e||u>1+e) continue;
+			px=qy*ez-qz*ey;py=qz*ex-qx*ez;pz=qx*ey-qy*ex;
+			v=(d[0]*px+d[1]*py+d[2]*pz)*de;
+			if(v<-e||u+v>1+e) continue;
+			if((fx*px+fy*py+fz*pz)*de<0) continue;
+			if(u<e||v<e||u+v>1-e) amb=true;
+			c^=1;
+		}
+	}
+	return amb?-1-c:c;
+}
+
+/** Tests to see whether a point is inside the triangle mesh wall object, by
+ * casting a ray from it and counting how often it crosses the mesh.
+ * \param[in] (x,y,z) the vector to test.
+ * \return True if the point is inside, false if the point is outside. */
+bool wall_trianglemesh::point_inside(fpoint x,fpoint y,fpoint z) {
+	if(nd.empty()||box_distance(nd[0],x,y,z)>0) return false;
+	int r=0;
+	for(int k=0;k<9;k+=3) {
+		r=ray_parity(x,y,z,bvh_rays+k);
+		if(r>=0) return r==1;
+	}
+	return r==-2;
+}
+
+/** Finds the point on the triangle mesh wall object that is closest to a given
+ * point. The hierarchy is searched nearest node first, skipping all nodes that
+ * are further away than the closest triangle found so far.
+ * \param[in] (x,y,z) the point.
+ * \param[out] (cx,cy,cz) the closest point on the mesh.
+ * \return The squared distance between the two points. */
+fpoint wall_trianglemesh::closest_point(fpoint x,fpoint y,fpoint z,fpoint &cx,fpoint &cy,fpoint &cz) {
+	fpoint dq=voropp_precision<fpoint>::large_number(),da,db,qx,qy,qz;
+	int st[bvh_stack_size],sp=0,i;
+	cx=x;cy=y;cz=z;
+	if(nd.empty()) return dq;
+	st[sp++]=0;
+	while(sp>0) {
+		const bvh_node &b=nd[st[--sp]];
+		if(box_distance(b,x,y,z)>=dq) continue;
+		if(b.n==0) {
+			da=box_distance(nd[b.i],x,y,z);
+			db=box_distance(nd[b.i+1],x,y,z);
+			if(da<db) {
+				if(db<dq) st[sp++]=b.i+1;
+				st[sp++]=b.i;
+			} else {
+				if(da<dq) st[sp++]=b.i;
+				st[sp++]=b.i+1;
+			}
+			continue;
+		}
+		for(i=b.i;i<b.i+b.n;i++) {
+			da=triangle_closest(&tp[9*i],x,y,z,qx,qy,qz);
+			if(da<dq) {dq=da;cx=qx;cy=qy;cz=qz;}
+		}
+	}
+	return dq;
+}
+
+/** Computes the distance from a point to the triangle mesh wall object.
+ * \param[in] (x,y,z) the point.
+ * \return The distance. */
+fpoint wall_trianglemesh::distance(fpoint x,fpoint y,fpoint z) {
+	fpoint cx,cy,cz;
+	return sqrt(closest_point(x,y,z,cx,cy,cz));
 }
 
+/** Cuts a cell by the triangle mesh wall object. A cell whose particle lies
+ * outside the mesh is deleted, and a cell that is smaller than the distance
+ * from its particle to the surface is left untouched, since it cannot reach
+ * the surface. Otherwise, the mesh is approximated by a single plane applied at
+ * the point on the mesh which is closest to the particle. This works well for
+ * particle arrangements that are packed against the wall, but loses accuracy
+ * for sparse particle distributions, and near sharp concave features.
+ * \param[in,out] c the Voronoi cell to be cut.
+ * \param[in] (x,y,z) the location of the Voronoi cell.
+ * \return True if the cell still exists, false if the cell is deleted. */
 template<class n_option>
-inline bool wall_trianglemesh::cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z)
-{
-   // we need to compare all points of the cell
-   // with all points of the triangle mesh!
-   snCore::snVector3f pos;
-   snCore::snPlane * plane;
-   for(size_t i=0;i<mpMesh->GetNbPolygons();i++)
-   {
-      plane = mpMesh->GetPolygon(i)->GetPlanePtr();
-      int offset = 0;
-      for(int j=0;j<c.p;j++,offset+=3)
-      {
-         pos.Set(c.pts[offset],c.pts[offset+1],c.pts[offset+2]);
-         if(plane->IsAbove(pos))
-            return true;
-      }
-   }
-
-	return false;
-}
-*/
+bool wall_trianglemesh::cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z) {
+	if(!point_inside(x,y,z)) return false;
+	fpoint xd,yd,zd,dq=closest_point(x,y,z,xd,yd,zd);
+	if(4*dq>=c.max_radius_squared()) return true;
+	if(dq>voropp_precision<fpoint>::tolerance_sq()) {
+		xd-=x;yd-=y;zd-=z;
+		dq=sqrt(dq);
+		return c.nplane(xd/dq,yd/dq,zd/dq,2*dq,w_id);
+	}
+	return true;
+}
+
+// Explicit instantiation
+template bool wall_sphere::cut_cell_base(voronoicell_base<neighbor_none> &,fpoint,fpoint,fpoint);
+template bool wall_sphere::cut_cell_base(voronoicell_base<neighbor_track> &,fpoint,fpoint,fpoint);
+template bool wall_sphere::cut_cell_base(voronoicell_base<neighbor_none_base<float> > &,fpoint,fpoint,fpoint);
+template bool wall_sphere::cut_cell_base(voronoicell_base<neighbor_track_base<float> > &,fpoint,fpoint,fpoint);
+template bool wall_plane::cut_cell_base(voronoicell_base<neighbor_none> &,fpoint,fpoint,fpoint);
+template bool wall_plane::cut_cell_base(voronoicell_base<neighbor_track> &,fpoint,fpoint,fpoint);
+template bool wall_plane::cut_cell_base(voronoicell_base<neighbor_none_base<float> > &,fpoint,fpoint,fpoint);
+template bool wall_plane::cut_cell_base(voronoicell_base<neighbor_track_base<float> > &,fpoint,fpoint,fpoint);
+template bool wall_cylinder::cut_cell_base(voronoicell_base<neighbor_none> &,fpoint,fpoint,fpoint);
+template bool wall_cylinder::cut_cell_base(voronoicell_base<neighbor_track> &,fpoint,fpoint,fpoint);
+template bool wall_cylinder::cut_cell_base(voronoicell_base<neighbor_none_base<float> > &,fpoint,fpoint,fpoint);
+template bool wall_cylinder::cut_cell_base(voronoicell_base<neighbor_track_base<float> > &,fpoint,fpoint,fpoint);
+template bool wall_cone::cut_cell_base(voronoicell_base<neighbor_none> &,fpoint,fpoint,fpoint);
+template bool wall_cone::cut_cell_base(voronoicell_base<neighbor_track> &,fpoint,fpoint,fpoint);
+template bool wall_cone::cut_cell_base(voronoicell_base<neighbor_none_base<float> > &,fpoint,fpoint,fpoint);
+template bool wall_cone::cut_cell_base(voronoicell_base<neighbor_track_base<float> > &,fpoint,fpoint,fpoint);
+template bool wall_trianglemesh::cut_cell_base(voronoicell_base<neighbor_none> &,fpoint,fpoint,fpoint);
+template bool wall_trianglemesh::cut_cell_base(voronoicell_base<neighbor_track> &,fpoint,fpoint,fpoint);
+template bool wall_trianglemesh::cut_cell_base(voronoicell_base<neighbor_none_base<float> > &,fpoint,fpoint,fpoint);
+template bool wall_trianglemesh::cut_cell_base(voronoicell_base<neighbor_track_base<float> > &,fpoint,fpoint,fpoint);
@@ -12,6 +12,7 @@
 
 #include "snVoroConfig.h"
 #include "snVoroContainer.h"
+#include "snVoroClip.h"
 
 /** \brief A class representing a spherical wall object.
  *
@@ -28,9 +29,11 @@ struct wall_sphere : public wall {
 			: w_id(iw_id), xc(ixc), yc(iyc), zc(izc), rc(irc) {};
 		bool point_inside(fpoint x,fpoint y,fpoint z);
 		template<class n_option>
-		inline bool cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z);
+		bool cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z);
 		bool cut_cell(voronoicell_base<neighbor_none> &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
 		bool cut_cell(voronoicell_base<neighbor_track> &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
+		bool cut_cell(voronoicell_base<neighbor_none_base<float> > &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
+		bool cut_cell(voronoicell_base<neighbor_track_base<float> > &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
 	private:
 		const int w_id;
 		const fpoint xc,yc,zc,rc;
@@ -50,9 +53,11 @@ struct wall_plane : public wall {
 			: w_id(iw_id), xc(ixc), yc(iyc), zc(izc), ac(iac) {};
 		bool point_inside(fpoint x,fpoint y,fpoint z);
 		template<class n_option>
-		inline bool cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z);
+		bool cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z);
 		bool cut_cell(voronoicell_base<neighbor_none> &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
 		bool cut_cell(voronoicell_base<neighbor_track> &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
+		bool cut_cell(voronoicell_base<neighbor_none_base<float> > &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
+		bool cut_cell(voronoicell_base<neighbor_track_base<float> > &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
 	private:
 		const int w_id;
 		const fpoint xc,yc,zc,ac;
@@ -76,9 +81,11 @@ struct wall_cylinder : public wall {
 			asi(1/(ixa*ixa+iya*iya+iza*iza)), rc(irc) {};
 		bool point_inside(fpoint x,fpoint y,fpoint z);
 		template<class n_option>
-		inline bool cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z);
+		bool cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z);
 		bool cut_cell(voronoicell_base<neighbor_none> &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
 		bool cut_cell(voronoicell_base<neighbor_track> &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
+		bool cut_cell(voronoicell_base<neighbor_none_base<float> > &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
+		bool cut_cell(voronoicell_base<neighbor_track_base<float> > &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
 	private:
 		const int w_id;
 		const fpoint xc,yc,zc,xa,ya,za,asi,rc;
@@ -104,28 +111,72 @@ struct wall_cone : public wall {
 			gra(tan(ang)), sang(sin(ang)), cang(cos(ang)) {};
 		bool point_inside(fpoint x,fpoint y,fpoint z);
 		template<class n_option>
-		inline bool cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z);
+		bool cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z);
 		bool cut_cell(voronoicell_base<neighbor_none> &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
 		bool cut_cell(voronoicell_base<neighbor_track> &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
+		bool cut_cell(voronoicell_base<neighbor_none_base<float> > &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
+		bool cut_cell(voronoicell_base<neighbor_track_base<float> > &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
 	private:
 		const int w_id;
 		const fpoint xc,yc,zc,xa,ya,za,asi,gra,sang,cang;
 };
 
-/*
+/** \brief A class representing a wall made of a closed triangle mesh.
+ *
+ * This class represents a wall given by an arbitrary closed mesh, such as the
+ * object that gets shattered. Testing a point against every triangle gets
+ * slow for meshes of any size, so the triangles are sorted into a bounding
+ * volume hierarchy, which lets the inside test and the distance queries visit
+ * only the handful of triangles near the point. When a cell is cut, it is
+ * rejected if its particle lies outside the mesh, and left alone if the
+ * distance from its particle to the surface exceeds its radius, since it then
+ * lies entirely inside the mesh. Only the remaining cells are cut, by the
+ * tangent plane at the surface point closest to the particle. */
 struct wall_trianglemesh : public wall {
 	public:
-		wall_trianglemesh(snCore::snMesh * in_pMesh,int iw_id=-99)
-		: mpMesh(in_pMesh), w_id(iw_id) {};
-
+		wall_trianglemesh(const clip_mesh &m,int iw_id=-99);
 		bool point_inside(fpoint x,fpoint y,fpoint z);
+		fpoint closest_point(fpoint x,fpoint y,fpoint z,fpoint &cx,fpoint &cy,fpoint &cz);
+		fpoint distance(fpoint x,fpoint y,fpoint z);
 		template<class n_option>
-		inline bool cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z);
+		bool cut_cell_base(voronoicell_base<n_option> &c,fpoint x,fpoint y,fpoint z);
 		bool cut_cell(voronoicell_base<neighbor_none> &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
 		bool cut_cell(voronoicell_base<neighbor_track> &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
+		bool cut_cell(voronoicell_base<neighbor_none_base<float> > &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
+		bool cut_cell(voronoicell_base<neighbor_track_base<float> > &c,fpoint x,fpoint y,fpoint z) {return cut_cell_base(c,x,y,z);}
 	private:
-      snCore::snMesh * mpMesh;
+		/** \brief A node of the bounding volume hierarchy. */
+		struct bvh_node {
+			/** The bounding box of the triangles below the node. */
+			fpoint xa,xb,ya,yb,za,zb;
+			/** For a leaf, the index of its first triangle, and for
+			 * an inner node, the index of its first child, the
+			 * second one following straight after. */
+			int i;
+			/** The number of triangles in a leaf, or zero for an
+			 * inner node. */
+			int n;
+		};
 		const int w_id;
+		/** The nodes of the hierarchy, with the root first. */
+		vector<bvh_node> nd;
+		/** The corners of the triangles, as nine consecutive
+		 * coordinates per triangle, in the order of the leaves. */
+		vector<fpoint> tp;
+		void build(int k,vector<int> &ti,const vector<fpoint> &ce,int s,int e,const vector<fpoint> &tq);
+		int ray_parity(fpoint x,fpoint y,fpoint z,const fpoint *d);
+		/** Computes the squared distance from a point to the bounding
+		 * box of a node.
+		 * \param[in] b the node.
+		 * \param[in] (x,y,z) the point.
+		 * \return The squared distance, which is zero for a point
+		 * inside the box. */
+		inline fpoint box_distance(const bvh_node &b,fpoint x,fpoint y,fpoint z) {
+			fpoint dx=x<b.xa?b.xa-x:(x>b.xb?x-b.xb:0);
+			fpoint dy=y<b.ya?b.ya-y:(y>b.yb?y-b.yb:0);
+			fpoint dz=z<b.za?b.za-z:(z>b.zb?z-b.zb:0);
+			return dx*dx+dy*dy+dz*dz;
+		}
 };
-*/
+
 #endif
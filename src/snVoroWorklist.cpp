@@ -13,8 +13,8 @@
 
  //#include "snVoroWorklist.h"
 
-template<class r_option>
-const unsigned int container_base<r_option>::wl[4096]={
+template<class r_option,class fpoint>
+const unsigned int container_base<r_option,fpoint>::wl[4096]={
 	7,0x10203f,0x101fc0,0xfe040,0xfe03f,0x101fbf,0xfdfc0,0xfdfbf,0x10fe0bf,0x11020bf,0x11020c0,0x10fe0c0,0x2fe041,0x302041,0x301fc1,0x2fdfc1,0x8105fc0,0x8106040,0x810603f,0x8105fbf,0x701fbe,0x70203e,0x6fe03e,0x6fdfbe,0x30fdf3f,0x3101f3f,0x3101f40,0x30fdf40,0x180f9fc0,0x180fa040,0x180fa03f,0x180f9fbf,0x12fe0c1,0x13020c1,0x91060c0,0x91060bf,0x8306041,0x8305fc1,0x3301f41,0x32fdf41,0x182f9fc1,0x182fa041,0x190fa0c0,0x190fa0bf,0x16fe0be,0x17020be,0x870603e,0x8705fbe,0xb105f3f,0xb105f40,0x3701f3e,0x36fdf3e,0x186f9fbe,0x186fa03e,0x1b0f9f3f,0x1b0f9f40,0x93060c1,0x192fa0c1,0x97060be,0xb305f41,0x1b2f9f41,0x196fa0be,0xb705f3e,0x1b6f9f3e,
 	11,0x101fc0,0xfe040,0xfdfc0,0x10203f,0x101fbf,0xfe03f,0xfdfbf,0xfdfc1,0x101fc1,0x102041,0xfe041,0x10fe0c0,0x11020c0,0x8106040,0x8105fc0,0x8105fbf,0x810603f,0x11020bf,0x10fe0bf,0x180fa040,0x180f9fc0,0x30fdf40,0x3101f40,0x3101f3f,0x30fdf3f,0x180f9fbf,0x180fa03f,0x6fe03e,0x70203e,0x701fbe,0x6fdfbe,0x8305fc1,0x8306041,0x13020c1,0x12fe0c1,0x182fa041,0x182f9fc1,0x32fdf41,0x3301f41,0x91060c0,0x97060bf,0x190fa0c0,0x196fa0bf,0xb105f40,0xb705f3f,0xb705fbe,0x970603e,0x97020be,0x196fe0be,0x1b0f9f40,0x1b6f9f3f,0x1b6fdf3e,0xb701f3e,0x1b6f9fbe,0x196fa03e,0x93060c1,0xb305f41,0x192fa0c1,0x1b2f9f41,0x1b2fdfc2,0xb301fc2,0x9302042,0x192fe042,
 	11,0x101fc0,0xfe040,0xfdfc0,0xfdfbf,0x101fbf,0x10203f,0xfe03f,0xfe041,0x102041,0x101fc1,0xfdfc1,0x8105fc0,0x8106040,0x11020c0,0x10fe0c0,0x10fe0bf,0x11020bf,0x810603f,0x8105fbf,0x3101f40,0x30fdf40,0x180f9fc0,0x180fa040,0x180fa03f,0x180f9fbf,0x30fdf3f,0x3101f3f,0x8305fc1,0x8306041,0x13020c1,0x12fe0c1,0x182fa041,0x182f9fc1,0x32fdf41,0x3301f41,0x701fbe,0x70203e,0x6fe03e,0x6fdfbe,0x91060c0,0x97060bf,0xb105f40,0xb705f3f,0x190fa0c0,0x196fa0bf,0x93060c1,0x1b0f9f40,0x1b6f9f3f,0xb305f41,0x192fa0c1,0x196fe0be,0x97020be,0x970603e,0xb705fbe,0xb701f3e,0x1b6fdf3e,0x1b2f9f41,0x1b2fdfc2,0x192fe042,0x9302042,0xb301fc2,0x1b6f9fbe,0x196fa03e,